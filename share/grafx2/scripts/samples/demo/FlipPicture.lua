@@ -3,15 +3,13 @@
 w,h=getpicturesize();
 ok,flipx,flipy=inputbox("flip picture","flip x",1,0,1,-1,"flip y",0,0,1,-1);
 if ok==true then
+  -- whole lines are moved at once with the block functions
   if flipx==1 then
-    for y=0,h-1,1 do 
-      for x=0,w/2,1 do 
-        c1=getpicturepixel(x,y);c2=getpicturepixel(w-x-1,y) 
-        putpicturepixel(x,y,c2);putpicturepixel(w-x-1,y,c1) 
-        end;end 
+    for y,row in picturerows(0,0,w,h) do
+      putpicturerect(0,y,w,1,string.reverse(row))
+      end
   else
-    for y=0,h/2,1 do 
-      for x=0,w-1,1 do 
-        c1=getpicturepixel(x,y);c2=getpicturepixel(x,h-y-1) 
-        putpicturepixel(x,y,c2);putpicturepixel(x,h-y-1,c1) 
-        end;end;end;end
+    for y=0,math.floor(h/2)-1,1 do
+      l1=getpicturerect(0,y,w,1);l2=getpicturerect(0,h-y-1,w,1)
+      putpicturerect(0,y,w,1,l2);putpicturerect(0,h-y-1,w,1,l1)
+      end;end;end
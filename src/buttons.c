@@ -701,7 +701,7 @@ void Button_Quit(int btn)
 void Button_Clear(int btn)
 {
   Hide_cursor();
-  Backup();
+  Backup_layers(Main.current_layer); // Cleared without the pixel functions
   if (Stencil_mode && Config.Clear_with_stencil)
     Clear_current_image_with_stencil(Main.backups->Pages->Transparent_color,Stencil);
   else
@@ -716,7 +716,7 @@ void Button_Clear(int btn)
 void Button_Clear_with_backcolor(int btn)
 {
   Hide_cursor();
-  Backup();
+  Backup_layers(Main.current_layer); // Cleared without the pixel functions
   if (Stencil_mode && Config.Clear_with_stencil)
     Clear_current_image_with_stencil(Back_color,Stencil);
   else
@@ -798,6 +798,13 @@ const T_Lookup Lookup_VirtualKeyboard[] = {
   {NULL,-1},
 };
 
+const T_Lookup Lookup_Quantizer[] = {
+  {"Median",0},
+  {"Wu",1},
+  {"K-means",2},
+  {NULL,-1},
+};
+
 typedef struct {
   const char* Label;
   byte Type; // 0: label, 1+: setting (size in bytes)
@@ -993,7 +1000,7 @@ void Button_Settings(int btn)
   {"Auto count colors:",1,&(selected_config.Auto_nb_used),0,1,0,Lookup_YesNo},
   {"Right click colorpick:",1,&(selected_config.Right_click_colorpick),0,1,0,Lookup_YesNo},
   {"Multi shortcuts:",1,&(selected_config.Allow_multi_shortcuts),0,1,0,Lookup_YesNo},
-  {"",0,NULL,0,0,0,NULL},
+  {"Compress undo:",1,&(selected_config.Compress_undo),0,1,0,Lookup_YesNo},
 
   {"      --- File selector  ---",0,NULL,0,0,0,NULL},
   {"Show in fileselector",0,NULL,0,0,0,NULL},
@@ -1011,8 +1018,8 @@ void Button_Settings(int btn)
   {"Screen size in GIF:",1,&(selected_config.Screen_size_in_GIF),0,1,0,Lookup_YesNo},
   {"Clear palette:",1,&(selected_config.Clear_palette),0,1,0,Lookup_YesNo},
   {"MO6/TO8 palette gamma",1,&(selected_config.MOTO_gamma),10,30,2,NULL},
-  {"",0,NULL,0,0,0,NULL},
-  {"",0,NULL,0,0,0,NULL},
+  {"24b quantizer:",1,&(selected_config.Quantizer),0,2,0,Lookup_Quantizer},
+  {"24b dithering:",1,&(selected_config.Dither_24b),0,1,0,Lookup_YesNo},
   {"",0,NULL,0,0,0,NULL},
   {"",0,NULL,0,0,0,NULL},
   {"",0,NULL,0,0,0,NULL},
@@ -1569,6 +1576,7 @@ void Button_Page(int btn)
   memcpy(&temp_doc, &Main, sizeof(T_Document));
   memcpy(&Main, &Spare, sizeof(T_Document));
   memcpy(&Spare, &temp_doc, sizeof(T_Document));
+  Invalidate_best_color_cache();
 
   Pixel_preview=(Main.magnifier_mode)?Pixel_preview_magnifier:Pixel_preview_normal;
 
@@ -0,0 +1,90 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file cmdline.c
+/// Switches of the command line.
+
+#include <string.h>
+#include "cmdline.h"
+
+static const struct {
+    const char *param;
+    int id;
+} cmdparams[] = {
+    {"?", CMDPARAM_HELP},
+    {"h", CMDPARAM_HELP},
+    {"H", CMDPARAM_HELP},
+    {"help", CMDPARAM_HELP},
+    {"mode", CMDPARAM_MODE},
+    {"tall", CMDPARAM_PIXELRATIO_TALL},
+    {"wide", CMDPARAM_PIXELRATIO_WIDE},
+    {"double", CMDPARAM_PIXELRATIO_DOUBLE},
+    {"triple", CMDPARAM_PIXELRATIO_TRIPLE},
+    {"quadruple", CMDPARAM_PIXELRATIO_QUAD},
+    {"tall2", CMDPARAM_PIXELRATIO_TALL2},
+    {"tall3", CMDPARAM_PIXELRATIO_TALL3},
+    {"wide2", CMDPARAM_PIXELRATIO_WIDE2},
+    {"rgb", CMDPARAM_RGB},
+    {"gamma", CMDPARAM_GAMMA},
+    {"skin", CMDPARAM_SKIN},
+    {"size", CMDPARAM_SIZE},
+    {"verbose", CMDPARAM_VERBOSE},
+    {"convert", CMDPARAM_CONVERT},
+    {"format", CMDPARAM_FORMAT},
+    {"jobs", CMDPARAM_JOBS},
+    {"script", CMDPARAM_SCRIPT},
+    {"scriptarg", CMDPARAM_SCRIPTARG},
+};
+
+#define ARRAY_SIZE(x) (int)(sizeof(x) / sizeof(x[0]))
+
+int Find_command_line_switch(const char * s)
+{
+  int i;
+  int prefix_matches = 0;
+  int prefix_match = -1;
+  int param_matches = 0;
+  int param_match = -1;
+  size_t length = strlen(s);
+
+  if (length == 0)
+    return -1;
+  for (i = 0; i < ARRAY_SIZE(cmdparams); i++)
+  {
+    if (!strcmp(s, cmdparams[i].param))
+      return cmdparams[i].id;
+    // "-v" must still mean -verbose, even if "convert" contains a 'v'
+    if (!strncmp(s, cmdparams[i].param, length))
+    {
+      prefix_matches++;
+      prefix_match = cmdparams[i].id;
+    }
+    else if (strstr(cmdparams[i].param, s))
+    {
+      param_matches++;
+      param_match = cmdparams[i].id;
+    }
+  }
+  if (prefix_matches == 1)
+    return prefix_match;
+  if (prefix_matches == 0 && param_matches == 1)
+    return param_match;
+  return -1;
+}
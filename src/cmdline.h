@@ -0,0 +1,64 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file cmdline.h
+/// Switches of the command line.
+
+#ifndef CMDLINE_H_INCLUDED
+#define CMDLINE_H_INCLUDED
+
+/// Identifiers of the command line switches
+enum CMD_PARAMS
+{
+    CMDPARAM_HELP,
+    CMDPARAM_MODE,
+    CMDPARAM_PIXELRATIO_TALL,
+    CMDPARAM_PIXELRATIO_WIDE,
+    CMDPARAM_PIXELRATIO_DOUBLE,
+    CMDPARAM_PIXELRATIO_TRIPLE,
+    CMDPARAM_PIXELRATIO_QUAD,
+    CMDPARAM_PIXELRATIO_TALL2,
+    CMDPARAM_PIXELRATIO_TALL3,
+    CMDPARAM_PIXELRATIO_WIDE2,
+    CMDPARAM_RGB,
+    CMDPARAM_GAMMA,
+    CMDPARAM_SKIN,
+    CMDPARAM_SIZE,
+    CMDPARAM_VERBOSE,
+    CMDPARAM_CONVERT,
+    CMDPARAM_FORMAT,
+    CMDPARAM_JOBS,
+    CMDPARAM_SCRIPT,
+    CMDPARAM_SCRIPTARG,
+};
+
+/**
+ * Find the switch named, or abbreviated, by a command line argument.
+ *
+ * An exact name is always accepted. Otherwise the switches which start
+ * with @p s are looked for, then the switches which contain it: the
+ * abbreviation is accepted if it matches a single one.
+ *
+ * @param s the argument, without its leading "-", "--" or "/"
+ * @return a ::CMD_PARAMS value, or -1 if @p s is unknown or ambiguous
+ */
+int Find_command_line_switch(const char * s);
+
+#endif
@@ -27,6 +27,7 @@
 #include <stdio.h>
 
 #include "colorred.h"
+#include "gfx2thread.h"
 
 /* Octree for mapping RGB to color. A bit slower than a plain conversion table in theory,
 but :
@@ -115,6 +116,16 @@ byte CT_get(CT_Tree* tree, byte r, byte g, byte b)
 	
 	CT_Node* node = &tree->nodes[0];
 	
+	if (tree->grid != NULL) {
+		int shift = 8 - tree->grid_bits;
+		word cell = tree->grid[(((r >> shift) << tree->grid_bits | (g >> shift))
+		                        << tree->grid_bits) | (b >> shift)];
+		if (!(cell & CT_GRID_NODE))
+			return (byte)cell;
+		// The cell spans several leaves, continue from the node containing it
+		node = &tree->nodes[cell & ~CT_GRID_NODE];
+	}
+
 	for(;;) {
 		if(node->children[0] == 0)
 			// return the palette index
@@ -139,7 +150,158 @@ byte CT_get(CT_Tree* tree, byte r, byte g, byte b)
 	}
 }
 
+/**
+ * find the deepest node that contains a whole box, starting from the root
+ *
+ * @return the palette index for a leaf, or CT_GRID_NODE | the node index
+ */
+static word CT_get_box(CT_Tree* tree, byte Rmin, byte Gmin, byte Bmin,
+	byte Rmax, byte Gmax, byte Bmax)
+{
+	word index = 0;
+
+	for(;;) {
+		CT_Node* node = &tree->nodes[index];
+		CT_Node* child0;
+
+		if(node->children[0] == 0)
+			return node->children[1];
+		child0 = &tree->nodes[node->children[0]];
+		if (child0->Rmin <= Rmin && child0->Gmin <= Gmin && child0->Bmin <= Bmin
+			&& child0->Rmax >= Rmax && child0->Gmax >= Gmax && child0->Bmax >= Bmax)
+			// the box is inside child 0
+			index = node->children[0];
+		else if (child0->Rmin > Rmax || child0->Gmin > Gmax || child0->Bmin > Bmax
+			|| child0->Rmax < Rmin || child0->Gmax < Gmin || child0->Bmax < Bmin)
+			// no point of the box is in child 0, CT_get() would take child 1
+			index = node->children[1];
+		else
+			// the box is cut by child 0
+			return CT_GRID_NODE | index;
+	}
+}
+
+int CT_build_grid(CT_Tree* tree, int bits)
+{
+	int size = 1 << bits;
+	int shift = 8 - bits;
+	int r, g, b;
+	word * cell;
+
+	free(tree->grid);
+	tree->grid = NULL;
+	if (bits < 1 || bits > 8 || tree->nodecount == 0)
+		return -1;
+	tree->grid = malloc(sizeof(word) << (3 * bits));
+	if (tree->grid == NULL)
+		return -1;
+	tree->grid_bits = bits;
+
+	cell = tree->grid;
+	for (r = 0; r < size; r++)
+		for (g = 0; g < size; g++)
+			for (b = 0; b < size; b++)
+				*cell++ = CT_get_box(tree,
+					r << shift, g << shift, b << shift,
+					((r + 1) << shift) - 1, ((g + 1) << shift) - 1, ((b + 1) << shift) - 1);
+	return 0;
+}
+
+/// Shared state of the threads of CT_new_nearest()
+typedef struct
+{
+	CT_Tree* tree;
+	const T_Components * palette;
+	int nb_colors;
+	T_GFX2_lock * lock;
+	int next_r;
+} T_CT_nearest_context;
+
+/// Fill the grid cells for one red value
+static void CT_fill_nearest(T_CT_nearest_context * context, int r)
+{
+	int size = 1 << context->tree->grid_bits;
+	int shift = 8 - context->tree->grid_bits;
+	int half = (1 << shift) >> 1;
+	word * cell = context->tree->grid + ((long)r << (2 * context->tree->grid_bits));
+	int g, b, i;
+
+	for (g = 0; g < size; g++)
+		for (b = 0; b < size; b++) {
+			int cr = (r << shift) + half;
+			int cg = (g << shift) + half;
+			int cb = (b << shift) + half;
+			long best_distance = 0x7fffffff;
+			int best = 0;
+
+			for (i = 0; i < context->nb_colors; i++) {
+				int dr = cr - context->palette[i].R;
+				int dg = cg - context->palette[i].G;
+				int db = cb - context->palette[i].B;
+				long distance = (long)dr * dr + (long)dg * dg + (long)db * db;
+				if (distance < best_distance) {
+					best_distance = distance;
+					best = i;
+				}
+			}
+			*cell++ = (word)best;
+		}
+}
+
+static void CT_nearest_worker(void * data)
+{
+	T_CT_nearest_context * context = (T_CT_nearest_context *)data;
+
+	for(;;) {
+		int r;
+
+		GFX2_Lock(context->lock);
+		r = context->next_r++;
+		GFX2_Unlock(context->lock);
+		if (r >= (1 << context->tree->grid_bits))
+			return;
+		CT_fill_nearest(context, r);
+	}
+}
+
+CT_Tree* CT_new_nearest(const T_Components * palette, int nb_colors, int bits)
+{
+	T_CT_nearest_context context;
+	CT_Tree* tree;
+	int r;
+
+	if (bits < 1 || bits > 8 || nb_colors < 1 || nb_colors > 256)
+		return NULL;
+	tree = CT_new();
+	if (tree == NULL)
+		return NULL;
+	tree->grid = malloc(sizeof(word) << (3 * bits));
+	if (tree->grid == NULL) {
+		CT_delete(tree);
+		return NULL;
+	}
+	tree->grid_bits = bits;
+	// A single leaf, so CT_get() is valid even without the grid
+	CT_set(tree, 0, 0, 0, 255, 255, 255, 0);
+
+	context.tree = tree;
+	context.palette = palette;
+	context.nb_colors = nb_colors;
+	context.next_r = 0;
+	context.lock = GFX2_Lock_new();
+	if (context.lock != NULL) {
+		GFX2_Run_threads(GFX2_Thread_count(), CT_nearest_worker, &context);
+		GFX2_Lock_delete(context.lock);
+	} else {
+		for (r = 0; r < (1 << bits); r++)
+			CT_fill_nearest(&context, r);
+	}
+	return tree;
+}
+
 void CT_delete(CT_Tree* tree)
 {
+	if (tree != NULL)
+		free(tree->grid);
 	free(tree);
 }
@@ -65,17 +65,53 @@ typedef struct CT_Node_s
 	word children[2];
 } CT_Node;
 
+/// Default number of bits per component of the lookup grid
+#define CT_GRID_BITS 5
+
+/// Flag of a grid cell which spans several leaves: the rest is a node index
+#define CT_GRID_NODE 0x8000
+
 /**
  * Color Tree
  */
 typedef struct ColorTree_S {
 	short nodecount;
 	CT_Node nodes[511];
+	/// Optional lookup grid, see CT_build_grid()
+	word * grid;
+	byte grid_bits;  ///< Number of bits per component of the grid
 } CT_Tree;
 
 CT_Tree* CT_new();
 void CT_delete(CT_Tree* t);
 byte CT_get(CT_Tree* t,byte r,byte g,byte b);
+
+/**
+ * Bake the finished tree into a lookup grid, used by CT_get().
+ *
+ * The RGB cube is cut in (1 << bits)^3 cells. Cells which are completely
+ * inside a leaf of the tree store its palette index, so CT_get() only
+ * reads the grid. The other cells store the deepest node containing them,
+ * where the tree lookup starts.
+ * The tree must not be modified after the grid is built.
+ * @param t the color tree
+ * @param bits number of bits per component, from 1 to 8. @ref CT_GRID_BITS is a good default
+ * @return 0 for success, -1 if out of memory (the tree can still be used)
+ */
+int CT_build_grid(CT_Tree* t, int bits);
+
+/**
+ * Create a color "tree" which is only a lookup grid, with the nearest
+ * palette color for the center of each cell.
+ *
+ * This is used for palettes which don't come from a box partition of the
+ * RGB cube (like k-means). The precision depends on the size of the grid.
+ * @param palette the palette
+ * @param nb_colors the number of palette entries to use, from index 0
+ * @param bits number of bits per component, from 1 to 8
+ * @return the new tree, NULL if out of memory
+ */
+CT_Tree* CT_new_nearest(const T_Components * palette, int nb_colors, int bits);
 void CT_set(CT_Tree* colorTree, byte Rmin, byte Gmin, byte Bmin,
 	byte Rmax, byte Gmax, byte Bmax, byte index);
 
@@ -0,0 +1,353 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file convert.c
+/// Headless conversion of pictures from the command line.
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__unix__) || defined(__macosx__) || defined(__HAIKU__)
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#define CONVERT_USE_FORK
+#endif
+#if defined(_MSC_VER)
+#define strdup _strdup
+#endif
+
+#include "struct.h"
+#include "global.h"
+#include "gfx2log.h"
+#include "gfx2mem.h"
+#include "gfx2surface.h"
+#include "loadsave.h"
+#include "io.h"
+#include "convert.h"
+#include "factory.h"
+
+/// Lua script to run on each picture, see Convert_set_script()
+static const char * Convert_script = NULL;
+static const char * const * Convert_script_args = NULL;
+static int Nb_convert_script_args = 0;
+
+void Convert_set_script(const char * script, const char * const * args, int nb_args)
+{
+  Convert_script = script;
+  Convert_script_args = args;
+  Nb_convert_script_args = nb_args;
+}
+
+/// Case insensitive comparison of a string with the n first chars of another
+static int Name_matches(const char * name, const char * str, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+  {
+    if (name[i] == '\0' || tolower((unsigned char)name[i]) != tolower((unsigned char)str[i]))
+      return 0;
+  }
+  return name[n] == '\0';
+}
+
+byte Get_savable_format(const char * name)
+{
+  unsigned int i;
+
+  if (name == NULL || *name == '\0')
+    return 0;
+  if (*name == '.')
+    name++;
+  for (i = 0; i < Nb_known_formats(); i++)
+  {
+    const T_Format * format = Get_fileformat(i);
+    const char * label;
+    const char * ext;
+
+    if (format->Identifier <= FORMAT_ALL_FILES || format->Save == NULL)
+      continue;
+    // Labels are right-aligned
+    for (label = format->Label; *label == ' '; label++)
+      ;
+    if (Name_matches(name, label, strlen(label)))
+      return format->Identifier;
+    for (ext = format->Extensions; *ext != '\0'; )
+    {
+      size_t len = strcspn(ext, ";");
+      if (Name_matches(name, ext, len))
+        return format->Identifier;
+      ext += len;
+      if (*ext == ';')
+        ext++;
+    }
+  }
+  return 0;
+}
+
+/// Split a path in a directory and a file name (both to be freed)
+static void Split_path(const char * path, char ** directory, char ** filename)
+{
+  char * separator;
+
+  *directory = strdup(path);
+  separator = Find_last_separator(*directory);
+  if (separator != NULL)
+  {
+    *filename = strdup(separator + 1);
+    if (separator == *directory)
+      separator++;  // keep the root directory
+    *separator = '\0';
+  }
+  else
+  {
+    *filename = *directory;
+    *directory = strdup(".");
+  }
+}
+
+T_GFX2_Surface * Convert_load(const char * source, T_IO_Context * context)
+{
+  char * directory;
+  char * filename;
+
+  Split_path(source, &directory, &filename);
+  Init_context_surface(context, filename, directory);
+  free(filename);
+  free(directory);
+  Load_image(context);
+  if (File_error || context->Surface == NULL)
+  {
+    GFX2_Log(GFX2_ERROR, "%s: cannot load picture\n", source);
+    if (context->Surface != NULL)
+      Free_GFX2_Surface(context->Surface);
+    context->Surface = NULL;
+    return NULL;
+  }
+  return context->Surface;
+}
+
+int Convert_save(T_GFX2_Surface * surface, const T_IO_Context * source_context, const char * destination, byte format)
+{
+  T_IO_Context save_context;
+  char * directory;
+  char * filename;
+
+  Split_path(destination, &directory, &filename);
+  Init_context_surface(&save_context, filename, directory);
+  free(filename);
+  free(directory);
+  save_context.Format = format;
+  save_context.Surface = surface;
+  save_context.Target_address = surface->pixels;
+  save_context.Pitch = surface->w;
+  save_context.Width = surface->w;
+  save_context.Height = surface->h;
+  memcpy(save_context.Palette, surface->palette, sizeof(T_Palette));
+  save_context.Transparent_color = source_context->Transparent_color;
+  save_context.Background_transparent = source_context->Background_transparent;
+  save_context.Ratio = source_context->Ratio;
+  strcpy(save_context.Comment, source_context->Comment);
+  save_context.Color_cycles = source_context->Color_cycles;
+  memcpy(save_context.Cycle_range, source_context->Cycle_range, sizeof(source_context->Cycle_range));
+
+  Save_image(&save_context);
+  save_context.Surface = NULL;
+  Destroy_context(&save_context);
+  if (File_error)
+  {
+    GFX2_Log(GFX2_ERROR, "%s: cannot save picture\n", destination);
+    return 1;
+  }
+  return 0;
+}
+
+int Convert_file(const char * source, const char * destination, byte format)
+{
+  T_IO_Context context;
+  T_GFX2_Surface * surface;
+  int result;
+
+  if (format == 0)
+  {
+    const char * ext = strrchr(destination, '.');
+    format = Get_savable_format(ext);
+    if (format == 0)
+    {
+      GFX2_Log(GFX2_ERROR, "%s: unknown file format\n", destination);
+      return 1;
+    }
+  }
+
+  surface = Convert_load(source, &context);
+  if (surface == NULL)
+  {
+    Destroy_context(&context);
+    return 1;
+  }
+  if (Convert_script != NULL &&
+      Run_script_headless(Convert_script, &surface, context.Transparent_color, Convert_script_args, Nb_convert_script_args) != 0)
+  {
+    GFX2_Log(GFX2_ERROR, "%s: script %s failed\n", source, Convert_script);
+    Free_GFX2_Surface(surface);
+    Destroy_context(&context);
+    return 1;
+  }
+  result = Convert_save(surface, &context, destination, format);
+  Free_GFX2_Surface(surface);
+  Destroy_context(&context);
+  if (result == 0)
+    GFX2_Log(GFX2_INFO, "%s -> %s\n", source, destination);
+  return result;
+}
+
+/// Files of the directory to convert, filled by Add_file_to_convert()
+static char ** Files_to_convert = NULL;
+static int Nb_files_to_convert = 0;
+
+static void Add_file_to_convert(const char * full_name, const char * file_name)
+{
+  char ** new_list;
+
+  if (file_name[0] == '.')
+    return;
+  new_list = realloc(Files_to_convert, (Nb_files_to_convert + 1) * sizeof(char *));
+  if (new_list == NULL)
+    return;
+  Files_to_convert = new_list;
+  Files_to_convert[Nb_files_to_convert++] = strdup(full_name);
+}
+
+/// Convert the files of ::Files_to_convert with index % step == first
+static int Convert_file_list(const char * destination, byte format, int first, int step)
+{
+  const char * default_extension = Get_fileformat(format)->Default_extension;
+  int errors = 0;
+  int i;
+
+  for (i = first; i < Nb_files_to_convert; i += step)
+  {
+    const char * source = Files_to_convert[i];
+    const char * name = Find_last_separator(source);
+    char * filename;
+    char * path;
+    int dot;
+
+    name = (name != NULL) ? name + 1 : source;
+    filename = GFX2_malloc(strlen(name) + strlen(default_extension) + 2);
+    if (filename == NULL)
+    {
+      errors++;
+      continue;
+    }
+    strcpy(filename, name);
+    dot = Position_last_dot(filename);
+    if (dot > 0)
+      filename[dot] = '\0';
+    strcat(filename, ".");
+    strcat(filename, default_extension);
+    path = Filepath_append_to_dir(destination, filename);
+    free(filename);
+    errors += Convert_file(source, path, format);
+    free(path);
+  }
+  return errors;
+}
+
+int Convert_files(const char * source, const char * destination, const char * format_name, int jobs)
+{
+  byte format = 0;
+  int errors = 0;
+  int i;
+
+  if (format_name != NULL)
+  {
+    format = Get_savable_format(format_name);
+    if (format == 0)
+    {
+      GFX2_Log(GFX2_ERROR, "Unknown file format %s\n", format_name);
+      return 1;
+    }
+  }
+  if (!Directory_exists(source))
+    return Convert_file(source, destination, format);
+
+  if (format == 0)
+  {
+    GFX2_Log(GFX2_ERROR, "The target format is required to convert a directory\n");
+    return 1;
+  }
+  if (!Directory_exists(destination) && Directory_create(destination) != 0)
+  {
+    GFX2_Log(GFX2_ERROR, "Cannot create directory %s\n", destination);
+    return 1;
+  }
+  For_each_file(source, Add_file_to_convert);
+  if (jobs > Nb_files_to_convert)
+    jobs = Nb_files_to_convert;
+
+#ifdef CONVERT_USE_FORK
+  if (jobs > 1)
+  {
+    int started = 0;
+
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < jobs; i++)
+    {
+      pid_t pid = fork();
+      if (pid == 0)
+      {
+        errors = Convert_file_list(destination, format, i, jobs);
+        exit(errors > 255 ? 255 : errors);
+      }
+      if (pid < 0)
+      {
+        // convert the remaining part in this process
+        errors += Convert_file_list(destination, format, i, jobs);
+        continue;
+      }
+      started++;
+    }
+    while (started > 0)
+    {
+      int status;
+
+      if (wait(&status) < 0)
+        break;
+      if (!WIFEXITED(status))
+        errors++;
+      else
+        errors += WEXITSTATUS(status);
+      started--;
+    }
+  }
+  else
+#endif
+    errors = Convert_file_list(destination, format, 0, 1);
+
+  for (i = 0; i < Nb_files_to_convert; i++)
+    free(Files_to_convert[i]);
+  free(Files_to_convert);
+  Files_to_convert = NULL;
+  Nb_files_to_convert = 0;
+  return errors;
+}
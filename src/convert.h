@@ -0,0 +1,98 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file convert.h
+/// Headless conversion of pictures from the command line.
+
+#ifndef CONVERT_H_INCLUDED
+#define CONVERT_H_INCLUDED
+
+#include "loadsave.h"
+
+/**
+ * Find a file format which can be saved, by label or file extension.
+ * @param name the label (ie "png") or an extension, case insensitive
+ * @return the format identifier, or 0 if no savable format matches
+ */
+byte Get_savable_format(const char * name);
+
+/**
+ * Load a picture in a new surface.
+ *
+ * @param source path of the picture to load
+ * @param context initialized by this function, it keeps the information
+ *        about the picture (transparent color, comment...). It must be
+ *        released with Destroy_context(), even when loading fails.
+ * @return the picture, NULL if it could not be loaded
+ */
+T_GFX2_Surface * Convert_load(const char * source, T_IO_Context * context);
+
+/**
+ * Save a surface, with the information of a picture loaded by Convert_load().
+ *
+ * @param surface the pixels and palette to save
+ * @param source_context the context of the loaded picture
+ * @param destination path of the file to write
+ * @param format the format to save
+ * @return 0 on success
+ */
+int Convert_save(T_GFX2_Surface * surface, const T_IO_Context * source_context, const char * destination, byte format);
+
+/**
+ * Set a Lua script to run on each picture between loading and saving.
+ *
+ * The strings are not copied, they must remain valid while converting.
+ *
+ * @param script path of the script, NULL for a plain conversion
+ * @param args the answers to the script dialogs, see Run_script_headless()
+ * @param nb_args the number of strings in @p args
+ */
+void Convert_set_script(const char * script, const char * const * args, int nb_args);
+
+/**
+ * Load a picture and save it in another format, without any
+ * user interface.
+ *
+ * Only the first layer / frame of the picture is saved.
+ * The script set with Convert_set_script() is run on the picture before
+ * it is saved.
+ *
+ * @param source path of the picture to load
+ * @param destination path of the file to write
+ * @param format the format to save, 0 to use the extension of @p destination
+ * @return 0 on success
+ */
+int Convert_file(const char * source, const char * destination, byte format);
+
+/**
+ * Convert a picture, or all the pictures of a directory.
+ *
+ * When @p source is a directory, @p destination must be a directory,
+ * and the files are named after the source files, with the default
+ * extension of the target format.
+ *
+ * @param source path of a picture or a directory
+ * @param destination path of the file or directory to write
+ * @param format_name name of the target format, or NULL
+ * @param jobs number of worker processes (where fork() is available)
+ * @return the number of files which could not be converted
+ */
+int Convert_files(const char * source, const char * destination, const char * format_name, int jobs);
+
+#endif
@@ -61,6 +61,9 @@
 #define NO_KEYBOARD
 #endif
 
+/// Longest wait for input in the main loop while an operation is in
+/// progress, in milliseconds
+#define ENGINE_OPERATION_DELAY 10
 
 // we need this as global
 short Old_MX = -1;
@@ -766,7 +769,9 @@ void Main_handler(void)
       Drop_file_name_unicode=NULL;
     }
     
-    if(Get_input(0))
+    // While idle, sleep until the next event. The operations in progress
+    // (airbrush...) are called regularly even if nothing happens.
+    if(Get_input((Mouse_K || Operation_stack_size) ? ENGINE_OPERATION_DELAY : GET_INPUT_IDLE))
     {
       action = 0;
 
@@ -1185,6 +1190,7 @@ void Main_handler(void)
                 break;
               case SPECIAL_EXCLUDE_COLORS_MENU : // Exclude colors menu
                 Menu_tag_colors("Tag colors to exclude",Exclude_color,&temp,1, NULL, SPECIAL_EXCLUDE_COLORS_MENU);
+                Invalidate_best_color_cache();
                 action++;
                 break;
               case SPECIAL_INVERT_SIEVE :
@@ -1505,13 +1511,6 @@ void Main_handler(void)
       if (action)
         Key=0;
     }
-    else
-    {
-#if defined(USE_SDL) || defined(USE_SDL2)
-      // Removed all SDL_Delay() timing here: relying on Get_input()
-      SDL_Delay(10);
-#endif
-    }
 
     // Gestion de la souris
 
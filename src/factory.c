@@ -32,6 +32,8 @@
 #include "errors.h"
 #include "filesel.h" // Get_item_by_index
 #include "fileseltools.h"
+#include "gfx2log.h"
+#include "gfx2surface.h"
 #include "global.h"
 #include "graph.h"
 #include "io.h"     // find_last_separator
@@ -62,6 +64,7 @@ char * Bound_script[10];
 #include <limits.h> //for INT_MIN
 #include <string.h> // strncpy()
 #include <stdlib.h> // for atof()
+#include <sys/stat.h> // for stat()
 #if defined(_MSC_VER)
 #define strdup _strdup
 #define putenv _putenv
@@ -92,6 +95,11 @@ static T_Page * Main_backup_page;
 static byte * Main_backup_screen;
 static byte Cursor_is_visible;
 static byte Window_needs_update;
+/// Set when the script runs from the command line, without screen
+static byte Script_headless = 0;
+/// Answers to the dialogs of a headless script, as "label=value"
+static const char * const * Headless_answers = NULL;
+static int Nb_headless_answers = 0;
 
 /// Helper function to clamp a double to 0-255 range
 static byte clamp_byte(double value)
@@ -184,6 +192,7 @@ void Register_main_readonly(lua_State* L);
 void Register_main_writable(lua_State* L);
 int L_SetColor(lua_State* L);
 int L_SetColor_unsaved(lua_State* L);
+static int Load_script_chunk(lua_State* L, const char * file_name);
 //
 
 const char * Lua_version(void)
@@ -203,6 +212,12 @@ const char * Lua_version(void)
 // Updates the screen colors after a running screen has modified the palette.
 void Update_colors_during_script(void)
 {
+  if (Script_headless)
+  {
+    // The palette is only used when saving the picture
+    Palette_has_changed=0;
+    return;
+  }
   if (Palette_has_changed)
   {
     Set_palette(Main.palette);
@@ -288,18 +303,9 @@ int L_GetBrushSize(lua_State* L)
   return 2;
 }
 
-int L_PutBrushPixel(lua_State* L)
+/// Called before the script modifies the brush
+static void Prepare_brush_for_writing(void)
 {
-  int x;
-  int y;
-  uint8_t c;
-  int nb_args=lua_gettop(L);
-  
-  LUA_ARG_LIMIT (3, "putbrushpixel");
-  LUA_ARG_NUMBER(1, "putbrushpixel", x, INT_MIN, INT_MAX);
-  LUA_ARG_NUMBER(2, "putbrushpixel", y, INT_MIN, INT_MAX);
-  LUA_ARG_NUMBER(3, "putbrushpixel", c, INT_MIN, INT_MAX);
-
   if (!Brush_was_altered)
   {
     int i;
@@ -313,6 +319,21 @@ int L_PutBrushPixel(lua_State* L)
     //--
     Brush_was_altered=1;
   }
+}
+
+int L_PutBrushPixel(lua_State* L)
+{
+  int x;
+  int y;
+  uint8_t c;
+  int nb_args=lua_gettop(L);
+  
+  LUA_ARG_LIMIT (3, "putbrushpixel");
+  LUA_ARG_NUMBER(1, "putbrushpixel", x, INT_MIN, INT_MAX);
+  LUA_ARG_NUMBER(2, "putbrushpixel", y, INT_MIN, INT_MAX);
+  LUA_ARG_NUMBER(3, "putbrushpixel", c, INT_MIN, INT_MAX);
+
+  Prepare_brush_for_writing();
   
   if (x<0 || y<0 || x>=Brush_width || y>=Brush_height)
   ;
@@ -721,6 +742,237 @@ int L_GetLayerPixel(lua_State* L)
   return 1;
 }
 
+// Block access to pixels
+// These functions transfer a whole rectangle between C and Lua at once, as
+// a string of width*height bytes, line by line.
+
+/// Function which reads a pixel, for Push_pixel_rect()
+typedef byte (* Func_read_pixel)(word x, word y);
+
+/// Pixel reader for the backup of the current layer
+static byte Read_pixel_from_lua_backup(word x, word y)
+{
+  // In a Lua script the "backup" can use a different screen dimension.
+  return *(Main_backup_screen + x + Main_backup_page->Width * y);
+}
+
+/// Push a string with the pixels of a rectangle.
+/// Pixels outside of width*height have the color "outside".
+static void Push_pixel_rect(lua_State* L, int x, int y, int w, int h,
+  int width, int height, Func_read_pixel read_pixel, byte outside)
+{
+  byte * buffer;
+  byte * p;
+  int i, j;
+
+  // A userdata is used as temporary buffer, so it is freed even if
+  // lua_pushlstring() fails.
+  buffer = (byte *)lua_newuserdata(L, (size_t)w * h + 1);
+  p = buffer;
+  for (j = y; j < y + h; j++)
+  {
+    if (j < 0 || j >= height)
+    {
+      memset(p, outside, w);
+      p += w;
+      continue;
+    }
+    for (i = x; i < x + w; i++)
+      *p++ = (i < 0 || i >= width) ? outside : read_pixel(i, j);
+  }
+  lua_pushlstring(L, (const char *)buffer, (size_t)w * h);
+  lua_remove(L, -2);
+}
+
+/// Reads the 4 arguments x, y, w, h of the block functions.
+/// x and y are limited like w and h, so x+w and y+h can't overflow an int.
+#define LUA_ARG_RECT(func_name, x, y, w, h) \
+do { \
+  LUA_ARG_NUMBER(1, func_name, x, -32768, 32767); \
+  LUA_ARG_NUMBER(2, func_name, y, -32768, 32767); \
+  LUA_ARG_NUMBER(3, func_name, w, 0, 32767); \
+  LUA_ARG_NUMBER(4, func_name, h, 0, 32767); \
+} while(0)
+
+/// Reads the pixel data argument of the put*rect() functions
+#define LUA_ARG_PIXELS(index, func_name, dest, w, h) \
+do { \
+  size_t length; \
+  if (nb_args < (index)) return luaL_error(L, "%s: Argument %d is missing.", func_name, (index)); \
+  if (!lua_isstring(L, (index))) return luaL_error(L, "%s: Argument %d is not a string.", func_name, (index)); \
+  dest = (const byte *)lua_tolstring(L, (index), &length); \
+  if (length < (size_t)(w) * (h)) return luaL_error(L, "%s: Argument %d has %d bytes, %d are needed.", func_name, (index), (int)length, (w) * (h)); \
+} while(0)
+
+int L_GetPictureRect(lua_State* L)
+{
+  int x, y, w, h;
+  int nb_args=lua_gettop(L);
+
+  LUA_ARG_LIMIT (4, "getpicturerect");
+  LUA_ARG_RECT("getpicturerect", x, y, w, h);
+
+  Push_pixel_rect(L, x, y, w, h, Main.image_width, Main.image_height,
+    Read_pixel_from_current_screen, Main.backups->Pages->Transparent_color);
+  return 1;
+}
+
+int L_GetLayerRect(lua_State* L)
+{
+  int x, y, w, h;
+  int nb_args=lua_gettop(L);
+
+  LUA_ARG_LIMIT (4, "getlayerrect");
+  LUA_ARG_RECT("getlayerrect", x, y, w, h);
+
+  Push_pixel_rect(L, x, y, w, h, Main.image_width, Main.image_height,
+    Read_pixel_from_current_layer, Main.backups->Pages->Transparent_color);
+  return 1;
+}
+
+int L_GetBackupRect(lua_State* L)
+{
+  int x, y, w, h;
+  int nb_args=lua_gettop(L);
+
+  LUA_ARG_LIMIT (4, "getbackuprect");
+  LUA_ARG_RECT("getbackuprect", x, y, w, h);
+
+  Push_pixel_rect(L, x, y, w, h, Main_backup_page->Width, Main_backup_page->Height,
+    Read_pixel_from_lua_backup, Main_backup_page->Transparent_color);
+  return 1;
+}
+
+int L_GetBrushRect(lua_State* L)
+{
+  int x, y, w, h;
+  int nb_args=lua_gettop(L);
+
+  LUA_ARG_LIMIT (4, "getbrushrect");
+  LUA_ARG_RECT("getbrushrect", x, y, w, h);
+
+  Push_pixel_rect(L, x, y, w, h, Brush_width, Brush_height,
+    Read_pixel_from_brush, Back_color);
+  return 1;
+}
+
+int L_PutPictureRect(lua_State* L)
+{
+  int x, y, w, h;
+  int i, j;
+  const byte * pixels;
+  int nb_args=lua_gettop(L);
+
+  LUA_ARG_LIMIT (5, "putpicturerect");
+  LUA_ARG_RECT("putpicturerect", x, y, w, h);
+  LUA_ARG_PIXELS(5, "putpicturerect", pixels, w, h);
+
+  for (j = y; j < y + h; j++, pixels += w)
+  {
+    // Pixels out of the picture are silently ignored
+    if (j < 0 || j >= Main.image_height)
+      continue;
+    for (i = Max(x, 0); i < x + w && i < Main.image_width; i++)
+      Pixel_in_current_screen(i, j, pixels[i - x]);
+  }
+  return 0; // no values returned for lua
+}
+
+int L_PutBrushRect(lua_State* L)
+{
+  int x, y, w, h;
+  int j;
+  const byte * pixels;
+  int nb_args=lua_gettop(L);
+
+  LUA_ARG_LIMIT (5, "putbrushrect");
+  LUA_ARG_RECT("putbrushrect", x, y, w, h);
+  LUA_ARG_PIXELS(5, "putbrushrect", pixels, w, h);
+
+  Prepare_brush_for_writing();
+  for (j = Max(y, 0); j < y + h && j < Brush_height; j++)
+  {
+    int x_start = Max(x, 0);
+    int x_end = Min(x + w, Brush_width);
+
+    if (x_start < x_end)
+      memcpy(Brush + (long)j * Brush_width + x_start, pixels + (long)(j - y) * w + (x_start - x), x_end - x_start);
+  }
+  return 0; // no values returned for lua
+}
+
+int L_RemapRect(lua_State* L)
+{
+  int x, y, w, h;
+  int i, j;
+  int c;
+  byte conversion[256];
+  int nb_args=lua_gettop(L);
+
+  LUA_ARG_LIMIT (5, "remaprect");
+  LUA_ARG_RECT("remaprect", x, y, w, h);
+  if (!lua_istable(L, 5))
+    return luaL_error(L, "remaprect: Argument 5 is not a table.");
+
+  // Colors which are not in the table are not modified
+  for (c = 0; c < 256; c++)
+  {
+    lua_rawgeti(L, 5, c);
+    if (lua_isnumber(L, -1))
+      conversion[c] = (byte)lua_tonumber(L, -1);
+    else
+      conversion[c] = (byte)c;
+    lua_pop(L, 1);
+  }
+
+  for (j = Max(y, 0); j < y + h && j < Main.image_height; j++)
+  {
+    for (i = Max(x, 0); i < x + w && i < Main.image_width; i++)
+    {
+      byte color = Read_pixel_from_current_layer(i, j);
+
+      if (conversion[color] != color)
+        Pixel_in_current_screen(i, j, conversion[color]);
+    }
+  }
+  return 0; // no values returned for lua
+}
+
+/// Iterator of picturerows() : returns the next line number and its pixels
+static int L_PictureRows_next(lua_State* L)
+{
+  int x = (int)lua_tointeger(L, lua_upvalueindex(1));
+  int y = (int)lua_tointeger(L, lua_upvalueindex(2));
+  int w = (int)lua_tointeger(L, lua_upvalueindex(3));
+  int y_end = (int)lua_tointeger(L, lua_upvalueindex(4));
+
+  if (y >= y_end)
+    return 0;
+  lua_pushinteger(L, y + 1);
+  lua_replace(L, lua_upvalueindex(2));
+  lua_pushinteger(L, y);
+  Push_pixel_rect(L, x, y, w, 1, Main.image_width, Main.image_height,
+    Read_pixel_from_current_screen, Main.backups->Pages->Transparent_color);
+  return 2;
+}
+
+/// for y, row in picturerows(x, y, w, h) do ... end
+int L_PictureRows(lua_State* L)
+{
+  int x, y, w, h;
+  int nb_args=lua_gettop(L);
+
+  LUA_ARG_LIMIT (4, "picturerows");
+  LUA_ARG_RECT("picturerows", x, y, w, h);
+
+  lua_pushinteger(L, x);
+  lua_pushinteger(L, y);
+  lua_pushinteger(L, w);
+  lua_pushinteger(L, y + h);
+  lua_pushcclosure(L, L_PictureRows_next, 4);
+  return 1;
+}
+
 // Spare
 
 int L_GetSparePictureSize(lua_State* L)
@@ -809,6 +1061,7 @@ int L_SetColor(lua_State* L)
   Main.palette[c].R=Round_palette_component(clamp_byte(r));
   Main.palette[c].G=Round_palette_component(clamp_byte(g));
   Main.palette[c].B=Round_palette_component(clamp_byte(b));
+  Invalidate_best_color_cache();
   // Set_color(c, r, g, b); Not needed. Update screen when script is finished
   Palette_has_changed=1;
   return 0;
@@ -989,6 +1242,21 @@ int L_SetBackColor(lua_State* L)
 }
 
 
+/// Find the answer given on the command line for a setting of a dialog.
+/// @return the text after "label=", or NULL if there is none
+static const char * Headless_answer(const char * label)
+{
+  size_t length = strlen(label);
+  int i;
+
+  for (i = 0; i < Nb_headless_answers; i++)
+  {
+    if (strncmp(Headless_answers[i], label, length) == 0 && Headless_answers[i][length] == '=')
+      return Headless_answers[i] + length + 1;
+  }
+  return NULL;
+}
+
 int L_InputBox(lua_State* L)
 {
 #define max_settings (9)
@@ -1078,6 +1346,43 @@ int L_InputBox(lua_State* L)
     if (label_length > (int)max_label_length)
       max_label_length = label_length;
   }
+
+  if (Script_headless)
+  {
+    // No window: the answers come from the command line, the other
+    // settings keep their default value, and the dialog is validated.
+    for (setting=0; setting<nb_settings; setting++)
+    {
+      const char * answer = Headless_answer(label[setting]);
+      char * end;
+      double value;
+
+      if (answer == NULL || (min_value[setting]==0 && max_value[setting]==0))
+        continue;
+      value = strtod(answer, &end);
+      if (end == answer || *end != '\0')
+        return luaL_error(L, "inputbox: Invalid value for \"%s\": %s", label[setting], answer);
+      if (decimal_places[setting]>=0)
+        value = Fround(value, decimal_places[setting]);
+      if (value < min_value[setting])
+        value = min_value[setting];
+      else if (value > max_value[setting])
+        value = max_value[setting];
+      current_value[setting] = value;
+      // Selecting a radio button unselects the others of the same family
+      if (min_value[setting]==0 && max_value[setting]==1 && decimal_places[setting]<0 && value!=0.0)
+      {
+        int other;
+        for (other=0; other<nb_settings; other++)
+          if (other != setting && min_value[other]==0 && max_value[other]==1 && decimal_places[other]==decimal_places[setting])
+            current_value[other]=0.0;
+      }
+    }
+    lua_pushboolean(L, 1);
+    for (setting=0; setting<nb_settings; setting++)
+      lua_pushnumber(L, current_value[setting]);
+    return 1 + nb_settings;
+  }
   // Max is 25 to keep window under 320 pixel wide
   if (max_label_length>25)
     max_label_length=25;
@@ -1320,6 +1625,25 @@ int L_SelectBox(lua_State* L)
       max_label_length = strlen(label[button]);
     LUA_ARG_FUNCTION(button*2+3, "selectbox");
   }
+  if (Script_headless)
+  {
+    // The choice is given on the command line as "caption=label"
+    const char * answer = Headless_answer(window_caption);
+
+    if (answer == NULL)
+      return luaL_error(L, "selectbox: No answer given for \"%s\"", window_caption);
+    for (button=0; button<nb_buttons; button++)
+    {
+      if (strcmp(answer, label[button]) == 0)
+      {
+        lua_pushvalue(L, 3+2*button);
+        lua_call(L, 0, 0);
+        return 0;
+      }
+    }
+    return luaL_error(L, "selectbox: \"%s\" is not a choice of \"%s\"", answer, window_caption);
+  }
+
   // Max is 25 to keep window under 320 pixel wide
   if (max_label_length>25)
     max_label_length=25;
@@ -1381,6 +1705,11 @@ int L_MessageBox(lua_State* L)
     return luaL_error(L, "messagebox: Needs one or two arguments.");
   }
 
+  if (Script_headless)
+  {
+    GFX2_Log(GFX2_INFO, "%s: %s\n", caption, message);
+    return 0;
+  }
   Update_colors_during_script();
   if (!Cursor_is_visible)
     Display_cursor();
@@ -1398,6 +1727,8 @@ int L_Wait(lua_State* L)
   LUA_ARG_LIMIT (1, "wait");
   LUA_ARG_NUMBER(1, "wait", delay, 0.0, 10.0);
 
+  if (Script_headless)
+    return 0;
   if (!Cursor_is_visible)
   {
     Display_cursor();
@@ -1428,6 +1759,12 @@ int L_WaitBreak(lua_State* L)
   LUA_ARG_LIMIT (1, "waitbreak");
   LUA_ARG_NUMBER(1, "waitbreak", delay, 0.0, DBL_MAX);
 
+  if (Script_headless)
+  {
+    // Nobody can press Esc
+    lua_pushinteger(L, 0);
+    return 1;
+  }
   if (!Cursor_is_visible)
   {
     Display_cursor();
@@ -1472,6 +1809,18 @@ int L_WaitInput(lua_State* L)
   LUA_ARG_LIMIT (1, "waitinput");
   LUA_ARG_NUMBER(1, "waitinput", delay, 0.0, DBL_MAX);
 
+  if (Script_headless)
+  {
+    // Report Esc, so the interactive loops of the scripts end
+    lua_pushboolean(L, 1);
+    lua_pushinteger(L, KEY_ESCAPE);
+    lua_pushinteger(L, 0);
+    lua_pushinteger(L, 0);
+    lua_pushinteger(L, 0);
+    lua_pushinteger(L, 0);
+    lua_pushinteger(L, 0);
+    return 7;
+  }
   if (!Cursor_is_visible)
   {
     Display_cursor();
@@ -1524,6 +1873,8 @@ int L_WindowOpen(lua_State* L)
     LUA_ARG_LIMIT (3, "windowopen");
   }
   
+  if (Script_headless)
+    return luaL_error(L, "windowopen: No screen to open a window");
   if (Windows_open>=7)
   {
     return luaL_error(L, "windowopen: Too many nested windows!");
@@ -1859,6 +2210,8 @@ int L_UpdateScreen(lua_State* L)
   
   LUA_ARG_LIMIT (0, "updatescreen");
   
+  if (Script_headless)
+    return 0;
   Update_colors_during_script();
   if (Cursor_is_visible)
     Hide_cursor();
@@ -1880,6 +2233,11 @@ int L_StatusMessage(lua_State* L)
   LUA_ARG_LIMIT(1,"statusmessage");
 
   LUA_ARG_STRING(1, "statusmessage", msg);
+  if (Script_headless)
+  {
+    GFX2_Log(GFX2_DEBUG, "%s\n", msg);
+    return 0;
+  }
   len=strlen(msg);
   if (len<=24)
   {
@@ -2103,7 +2461,7 @@ int L_Run(lua_State* L)
     file_name = full_path;
   }
 
-  if (luaL_loadfile(L, file_name) != 0)
+  if (Load_script_chunk(L, file_name) != 0)
   {
     int r;
     nb_args = lua_gettop(L);
@@ -2147,6 +2505,8 @@ DECLARE_UNSAVED(L_DrawDisk)
 DECLARE_UNSAVED(L_DrawFilledRect)
 DECLARE_UNSAVED(L_DrawLine)
 DECLARE_UNSAVED(L_PutPicturePixel)
+DECLARE_UNSAVED(L_PutPictureRect)
+DECLARE_UNSAVED(L_RemapRect)
 
 /// Bindings for screen-drawing Lua functions, if the current image is backed up.
 void Register_main_writable(lua_State* L)
@@ -2157,6 +2517,8 @@ void Register_main_writable(lua_State* L)
   lua_register(L,"drawcircle",L_DrawCircle);
   lua_register(L,"drawdisk",L_DrawDisk);
   lua_register(L,"clearpicture",L_ClearPicture);
+  lua_register(L,"putpicturerect",L_PutPictureRect);
+  lua_register(L,"remaprect",L_RemapRect);
 }
 
 /// Bindings for screen-drawing Lua functions, if the current image is not backed up yet.
@@ -2168,6 +2530,8 @@ void Register_main_readonly(lua_State* L)
   lua_register(L,"drawcircle",L_DrawCircle_unsaved);
   lua_register(L,"drawdisk",L_DrawDisk_unsaved);
   lua_register(L,"clearpicture",L_ClearPicture_unsaved);
+  lua_register(L,"putpicturerect",L_PutPictureRect_unsaved);
+  lua_register(L,"remaprect",L_RemapRect_unsaved);
 }
 
 
@@ -2359,43 +2723,250 @@ void Highlight_script(T_Fileselector *selector, T_List_button *list, const char
 
 static char * Last_run_script = NULL;
 
-// Before: Cursor hidden
-// After: Cursor shown
-void Run_script(const char *script_subdirectory, const char *script_filename)
+// Persistent interpreter
+// The Lua state is created once, and reused by all the scripts. Before each
+// run, the global variables, the loaded modules and the content of the
+// standard library tables (string, math, package...) are restored to their
+// initial values, so a script doesn't see what the previous one has left
+// there. Deeper changes, for example in package.searchers, are kept.
+// The compiled chunks are cached in the state, with the date and size of
+// their file, so a script or a library is only parsed again when it has
+// been modified.
+
+/// The Lua interpreter, NULL until the first script is run
+static lua_State * Script_state = NULL;
+
+#if defined(LUA_VERSION_NUM) && LUA_VERSION_NUM >= 502
+#define Lua_rawlen(L, index) lua_rawlen(L, index)
+#define Lua_push_globals(L) lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS)
+#else
+#define Lua_rawlen(L, index) lua_objlen(L, index)
+#define Lua_push_globals(L) lua_pushvalue(L, LUA_GLOBALSINDEX)
+#endif
+
+/// Registry keys of the persistent state
+#define REGISTRY_CHUNKS  "grafx2.chunks"   ///< path => { chunk, date, size }
+#define REGISTRY_GLOBALS "grafx2.globals"  ///< copy of the initial globals
+#define REGISTRY_LOADED  "grafx2.loaded"   ///< copy of the initial package.loaded
+#define REGISTRY_LIBRARY "grafx2.lib."     ///< prefix of the copies of the library tables
+
+/// Standard libraries whose tables are restored before each script
+static const char * const Reset_libraries[] = {
+  "string", "table", "math", "os", "io", "package", "coroutine", "utf8", "debug", "bit32"
+};
+
+///
+/// Pushes the compiled chunk of a Lua file, from the cache if the file
+/// hasn't changed since it was compiled.
+/// @return 0 for success, or the error code of luaL_loadfile(), with the
+/// error message on the stack.
+static int Load_script_chunk(lua_State* L, const char * file_name)
+{
+  struct stat info;
+  char * key;
+  int result;
+
+  if (stat(file_name, &info) != 0)
+    return luaL_loadfile(L, file_name); // for the error message
+
+  // The same script can be reached by different relative paths
+  key = Realpath(file_name);
+  if (key == NULL)
+    key = strdup(file_name);
+
+  lua_getfield(L, LUA_REGISTRYINDEX, REGISTRY_CHUNKS);
+  lua_getfield(L, -1, key);
+  if (lua_istable(L, -1))
+  {
+    lua_rawgeti(L, -1, 2);
+    lua_rawgeti(L, -2, 3);
+    if (lua_tonumber(L, -2) == (lua_Number)info.st_mtime
+     && lua_tonumber(L, -1) == (lua_Number)info.st_size)
+    {
+      lua_pop(L, 2);
+      lua_rawgeti(L, -1, 1);
+      lua_replace(L, -3); // remove the cache from the stack
+      lua_pop(L, 1);
+      free(key);
+      return 0;
+    }
+    lua_pop(L, 2);
+  }
+  lua_pop(L, 1);
+
+  result = luaL_loadfile(L, file_name);
+  if (result == 0)
+  {
+    lua_createtable(L, 3, 0);
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, -2, 1);
+    lua_pushnumber(L, (lua_Number)info.st_mtime);
+    lua_rawseti(L, -2, 2);
+    lua_pushnumber(L, (lua_Number)info.st_size);
+    lua_rawseti(L, -2, 3);
+    lua_setfield(L, -3, key);
+  }
+  lua_remove(L, -2); // remove the cache from the stack
+  free(key);
+  return result;
+}
+
+///
+/// Module searcher for require(), which looks in package.path like the
+/// standard one, but uses the chunk cache.
+static int L_Search_module(lua_State* L)
 {
-  lua_State* L;
-  const char* message;
-  byte  old_cursor_shape = Cursor_shape;
-  char * path;
-  int original_image_width = Main.image_width;
-  int original_image_height = Main.image_height;
-  int original_current_layer = Main.current_layer;
+  const char * name = luaL_checkstring(L, 1);
+  const char * path;
+  luaL_Buffer not_found;
 
-  // Some scripts are slow
-  Cursor_shape = CURSOR_SHAPE_HOURGLASS;
-  Display_cursor();
-  Flush_update();
-  Cursor_is_visible=1;
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "path");
+  path = lua_tostring(L, -1);
+  if (path == NULL)
+    return 0;
+  name = luaL_gsub(L, name, ".", LUA_DIRSEP);
+  luaL_buffinit(L, &not_found);
+  while (*path != '\0')
+  {
+    const char * end = strchr(path, ';');
+    const char * file_name;
 
-  free(Last_run_script);
-  if (script_subdirectory && script_subdirectory[0]!='\0')
-    Last_run_script = Filepath_append_to_dir(script_subdirectory, script_filename);
-  else
-    Last_run_script = strdup(script_filename);
-  
-  // This chdir is for the script's sake. Grafx2 itself will (try to)
-  // not rely on what is the system's current directory.
-  path = Extract_path(Last_run_script);
-  Change_directory(path);
-  free(path);
+    if (end == NULL)
+      end = path + strlen(path);
+    if (end > path)
+    {
+      lua_pushlstring(L, path, end - path);
+      file_name = luaL_gsub(L, lua_tostring(L, -1), "?", name);
+      lua_remove(L, -2);
+      if (File_exists(file_name))
+      {
+        if (Load_script_chunk(L, file_name) != 0)
+          return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s",
+                            lua_tostring(L, 1), file_name, lua_tostring(L, -1));
+        lua_pushstring(L, file_name); // passed to the loader by Lua 5.2+
+        return 2;
+      }
+      lua_pushfstring(L, "\n\tno file '%s'", file_name);
+      lua_remove(L, -2);
+      luaL_addvalue(&not_found);
+    }
+    path = (*end == ';') ? end + 1 : end;
+  }
+  luaL_pushresult(&not_found);
+#if defined(LUA_VERSION_NUM) && LUA_VERSION_NUM >= 504
+  // Since Lua 5.4, require() adds the separator before each message
+  if (Lua_rawlen(L, -1) >= 2)
+    lua_pushstring(L, lua_tostring(L, -1) + 2);
+#endif
+  return 1;
+}
 
-  L = luaL_newstate(); // used to be lua_open() on Lua 5.1, deprecated on 5.2
+/// Insert L_Search_module() before the standard file searcher
+static void Install_module_searcher(lua_State* L)
+{
+  int i;
+
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "searchers"); // Lua 5.2+
+  if (!lua_istable(L, -1))
+  {
+    lua_pop(L, 1);
+    lua_getfield(L, -1, "loaders"); // Lua 5.1
+  }
+  if (lua_istable(L, -1))
+  {
+    // The first searcher is the one for package.preload
+    for (i = (int)Lua_rawlen(L, -1); i >= 2; i--)
+    {
+      lua_rawgeti(L, -1, i);
+      lua_rawseti(L, -2, i + 1);
+    }
+    lua_pushcfunction(L, L_Search_module);
+    lua_rawseti(L, -2, 2);
+  }
+  lua_pop(L, 2);
+}
+
+/// Store a shallow copy of the table at the top of the stack in the registry
+static void Save_table_copy(lua_State* L, const char * registry_key)
+{
+  lua_newtable(L);
+  lua_pushnil(L);
+  while (lua_next(L, -3) != 0)
+  {
+    lua_pushvalue(L, -2);
+    lua_insert(L, -2);
+    lua_rawset(L, -4);
+  }
+  lua_setfield(L, LUA_REGISTRYINDEX, registry_key);
+  lua_pop(L, 1);
+}
+
+/// Restore the table at the top of the stack from its copy in the registry
+static void Restore_table_copy(lua_State* L, const char * registry_key)
+{
+  lua_getfield(L, LUA_REGISTRYINDEX, registry_key);
+  // Remove the keys which were added: they are set to nil while traversing,
+  // which lua_next() allows.
+  lua_pushnil(L);
+  while (lua_next(L, -3) != 0)
+  {
+    lua_pop(L, 1);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, -3);
+    if (lua_isnil(L, -1))
+    {
+      lua_pushvalue(L, -2);
+      lua_pushnil(L);
+      lua_rawset(L, -6);
+    }
+    lua_pop(L, 1);
+  }
+  // Restore the modified values
+  lua_pushnil(L);
+  while (lua_next(L, -2) != 0)
+  {
+    lua_pushvalue(L, -2);
+    lua_insert(L, -2);
+    lua_rawset(L, -5);
+  }
+  lua_pop(L, 2);
+}
+
+/// Save or restore the content of the standard library tables.
+/// The tables are the initial ones, even if a script has replaced the globals.
+static void Copy_library_tables(lua_State* L, int restore)
+{
+  int i;
+
+  for (i = 0; i < (int)(sizeof(Reset_libraries) / sizeof(Reset_libraries[0])); i++)
+  {
+    lua_getfield(L, LUA_REGISTRYINDEX, REGISTRY_GLOBALS);
+    lua_getfield(L, -1, Reset_libraries[i]);
+    if (lua_istable(L, -1))
+    {
+      const char * key = lua_pushfstring(L, REGISTRY_LIBRARY "%s", Reset_libraries[i]);
+
+      lua_insert(L, -2);
+      if (restore)
+        Restore_table_copy(L, key);
+      else
+        Save_table_copy(L, key);
+    }
+    lua_pop(L, 2);
+  }
+}
+
+/// Create the Lua interpreter and register the GrafX2 functions
+static lua_State * Create_script_state(void)
+{
+  lua_State* L;
+  char * path;
 
-  /// @todo as the value doesn't vary, this should be
-  /// done once at the start of the program
   path = GFX2_malloc(strlen(Data_directory) + strlen(SCRIPTS_SUBDIRECTORY) + strlen(LUALIB_SUBDIRECTORY) + 5 + 3 * strlen(PATH_SEPARATOR) + 9 + 1);
   if (path == NULL)
-    return;
+    return NULL;
   strcpy(path, Data_directory);
   Append_path(path, SCRIPTS_SUBDIRECTORY, NULL);
   Append_path(path, LUALIB_SUBDIRECTORY, NULL);
@@ -2420,10 +2991,15 @@ void Run_script(const char *script_subdirectory, const char *script_filename)
     GFX2_Log(GFX2_ERROR, "setenv(\"LUA_PATH\", \"%s\", 1) failed\n", path);
 #endif
   free(path);
+
+  L = luaL_newstate(); // used to be lua_open() on Lua 5.1, deprecated on 5.2
+  if (L == NULL)
+    return NULL;
   
   // Drawing
   lua_register(L,"putbrushpixel",L_PutBrushPixel);
   lua_register(L,"putsparepicturepixel",L_PutSparePicturePixel);
+  lua_register(L,"putbrushrect",L_PutBrushRect);
   Register_main_readonly(L);
 
   // Reading pixels
@@ -2434,6 +3010,11 @@ void Run_script(const char *script_subdirectory, const char *script_filename)
   lua_register(L,"getbackuppixel",L_GetBackupPixel);
   lua_register(L,"getsparelayerpixel",L_GetSpareLayerPixel);
   lua_register(L,"getsparepicturepixel",L_GetSparePicturePixel);
+  lua_register(L,"getbrushrect",L_GetBrushRect);
+  lua_register(L,"getpicturerect",L_GetPictureRect);
+  lua_register(L,"getlayerrect",L_GetLayerRect);
+  lua_register(L,"getbackuprect",L_GetBackupRect);
+  lua_register(L,"picturerows",L_PictureRows);
 
   // Sizes
   lua_register(L,"setbrushsize",L_SetBrushSize);
@@ -2508,6 +3089,35 @@ void Run_script(const char *script_subdirectory, const char *script_filename)
   //luaopen_debug(L);
   */
 
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, REGISTRY_CHUNKS);
+  Install_module_searcher(L);
+  // Keep the initial globals and modules, to restore them before each script
+  Lua_push_globals(L);
+  Save_table_copy(L, REGISTRY_GLOBALS);
+  Copy_library_tables(L, 0);
+  lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+  Save_table_copy(L, REGISTRY_LOADED);
+  return L;
+}
+
+/// Restore the globals, libraries and modules of the Lua state to their
+/// initial values
+static void Reset_script_state(lua_State* L)
+{
+  lua_settop(L, 0);
+  Lua_push_globals(L);
+  Restore_table_copy(L, REGISTRY_GLOBALS);
+  Copy_library_tables(L, 1);
+  lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+  Restore_table_copy(L, REGISTRY_LOADED);
+}
+
+/// Set up the state shared by the script functions before running a script:
+/// backups of the pages and of the brush, and the original colors.
+/// @return 0 if there isn't enough memory to backup the brush
+static int Prepare_script_run(void)
+{
   // TODO The script may modify the picture, so we do a backup here.
   // If the script is only touching the brush, this isn't needed...
   // The backup also allows the script to read from it to make something
@@ -2527,18 +3137,76 @@ void Run_script(const char *script_subdirectory, const char *script_filename)
   Brush_backup=(byte *)GFX2_malloc(((long)Brush_height)*Brush_width);
   Brush_backup_width = Brush_width;
   Brush_backup_height = Brush_height;
-  
   if (Brush_backup == NULL)
+    return 0;
+  memcpy(Brush_backup, Brush, ((long)Brush_height)*Brush_width);
+  return 1;
+}
+
+/// Clean up after a script run started by Prepare_script_run()
+static void End_script_run(void)
+{
+  free(Brush_backup);
+  Brush_backup=NULL;
+  Update_colors_during_script();
+  if (Is_backed_up)
+    End_of_modification();
+}
+
+// Before: Cursor hidden
+// After: Cursor shown
+void Run_script(const char *script_subdirectory, const char *script_filename)
+{
+  lua_State* L;
+  const char* message;
+  byte  old_cursor_shape = Cursor_shape;
+  char * path;
+  int original_image_width = Main.image_width;
+  int original_image_height = Main.image_height;
+  int original_current_layer = Main.current_layer;
+  int script_failed = 0;
+
+  // Some scripts are slow
+  Cursor_shape = CURSOR_SHAPE_HOURGLASS;
+  Display_cursor();
+  Flush_update();
+  Cursor_is_visible=1;
+
+  free(Last_run_script);
+  if (script_subdirectory && script_subdirectory[0]!='\0')
+    Last_run_script = Filepath_append_to_dir(script_subdirectory, script_filename);
+  else
+    Last_run_script = strdup(script_filename);
+  
+  // This chdir is for the script's sake. Grafx2 itself will (try to)
+  // not rely on what is the system's current directory.
+  path = Extract_path(Last_run_script);
+  Change_directory(path);
+  free(path);
+
+  if (Script_state == NULL)
+    Script_state = Create_script_state();
+  else
+    Reset_script_state(Script_state);
+  L = Script_state;
+  if (L == NULL)
+  {
+    Verbose_message("Error!", "Failed to start the Lua interpreter!");
+    Cursor_shape=old_cursor_shape;
+    Display_cursor();
+    return;
+  }
+
+  if (!Prepare_script_run())
   {
     Verbose_message("Error!", "Out of memory!");
   }
   else 
   {
-    memcpy(Brush_backup, Brush, ((long)Brush_height)*Brush_width);
-  
-    if (luaL_loadfile(L, Last_run_script) != 0)
+    if (Load_script_chunk(L, Last_run_script) != 0)
     {
       int stack_size;
+      script_failed = 1;
       stack_size= lua_gettop(L);
       if (stack_size>0 && (message = lua_tostring(L, stack_size))!=NULL)
         Verbose_message("Error!", message);
@@ -2548,6 +3216,7 @@ void Run_script(const char *script_subdirectory, const char *script_filename)
     else if (lua_pcall(L, 0, 0, 0) != 0)
     {
       int stack_size;
+      script_failed = 1;
       stack_size= lua_gettop(L);
       
       Update_colors_during_script();
@@ -2565,14 +3234,22 @@ void Run_script(const char *script_subdirectory, const char *script_filename)
     }
   }
   // Cleanup
-  free(Brush_backup);
-  Brush_backup=NULL;
-  Update_colors_during_script();
-  if (Is_backed_up)
-    End_of_modification();
+  End_script_run();
 	Print_in_menu("                        ",0);
 
-  lua_close(L);
+  if (script_failed)
+  {
+    // Start again from a new interpreter, in case the script has left it
+    // in a strange state.
+    lua_close(L);
+    Script_state = NULL;
+  }
+  else
+  {
+    // Free the memory used by the script
+    lua_settop(L, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+  }
   
   if (Brush_was_altered)
   {
@@ -2616,6 +3293,114 @@ void Run_script(const char *script_subdirectory, const char *script_filename)
   Display_cursor();
 }
 
+int Run_script_headless(const char * script_filename, T_GFX2_Surface ** surface, byte transparent_color, const char * const * answers, int nb_answers)
+{
+  T_GFX2_Surface * picture = *surface;
+  lua_State* L;
+  const char* message;
+  char * full_path;
+  char * path;
+  char * saved_directory;
+  int script_failed = 0;
+
+  // The script may use relative paths, from its own directory
+  full_path = Realpath(script_filename);
+  if (full_path == NULL || !File_exists(full_path))
+  {
+    GFX2_Log(GFX2_ERROR, "%s: script not found\n", script_filename);
+    free(full_path);
+    return 1;
+  }
+  Script_headless = 1;
+  Headless_answers = answers;
+  Nb_headless_answers = nb_answers;
+
+  // The picture becomes the main page, with a single layer
+  Main.current_layer = 0;
+  Main.layers_visible = 0xFFFFFFFF;
+  if (Main.backups->Pages == NULL)
+  {
+    if (!Init_all_backup_lists(IMAGE_MODE_LAYERED, picture->w, picture->h))
+    {
+      free(full_path);
+      return 1;
+    }
+  }
+  else if (!Backup_with_new_dimensions(picture->w, picture->h))
+  {
+    free(full_path);
+    return 1;
+  }
+  memcpy(Main.backups->Pages->Image[0].Pixels, picture->pixels, (long)picture->w * picture->h);
+  memcpy(Main.palette, picture->palette, sizeof(T_Palette));
+  Invalidate_best_color_cache();
+  memcpy(Main.backups->Pages->Palette, picture->palette, sizeof(T_Palette));
+  Main.backups->Pages->Transparent_color = transparent_color;
+  Redraw_layered_image();
+  End_of_modification();
+  if (Brush == NULL && Realloc_brush(1, 1, NULL, NULL) != 0)
+  {
+    free(full_path);
+    return 1;
+  }
+
+  if (Script_state == NULL)
+    Script_state = Create_script_state();
+  else
+    Reset_script_state(Script_state);
+  L = Script_state;
+  if (L == NULL)
+  {
+    GFX2_Log(GFX2_ERROR, "Failed to start the Lua interpreter\n");
+    free(full_path);
+    return 1;
+  }
+
+  if (!Prepare_script_run())
+  {
+    free(full_path);
+    return 1;
+  }
+
+  saved_directory = Get_current_directory(NULL, NULL, 0);
+  path = Extract_path(full_path);
+  Change_directory(path);
+  free(path);
+
+  if (Load_script_chunk(L, full_path) != 0 || lua_pcall(L, 0, 0, 0) != 0)
+  {
+    script_failed = 1;
+    if (lua_gettop(L) > 0 && (message = lua_tostring(L, -1)) != NULL)
+      GFX2_Log(GFX2_ERROR, "%s\n", message);
+    else
+      GFX2_Log(GFX2_ERROR, "%s: unknown error running script\n", script_filename);
+  }
+
+  Change_directory(saved_directory);
+  free(saved_directory);
+  free(full_path);
+  End_script_run();
+
+  if (script_failed)
+  {
+    lua_close(L);
+    Script_state = NULL;
+    return 1;
+  }
+  lua_settop(L, 0);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+
+  // The result is the visible image, the script may have resized it
+  picture = New_GFX2_Surface(Main.image_width, Main.image_height);
+  if (picture == NULL)
+    return 1;
+  memcpy(picture->pixels, Main.visible_image.Image, (long)Main.image_width * Main.image_height);
+  memcpy(picture->palette, Main.palette, sizeof(T_Palette));
+  Free_GFX2_Surface(*surface);
+  *surface = picture;
+  return 0;
+}
+
 void Run_numbered_script(byte index)
 {
 
@@ -2932,6 +3717,16 @@ void Button_Brush_Factory(void)
     Verbose_message("Error!", "The brush factory is not available in this build of GrafX2.");
 }
 
+int Run_script_headless(const char * script_filename, T_GFX2_Surface ** surface, byte transparent_color, const char * const * answers, int nb_answers)
+{
+  (void)surface;
+  (void)transparent_color;
+  (void)answers;
+  (void)nb_answers;
+  GFX2_Log(GFX2_ERROR, "%s: Lua scripts are not available in this build of GrafX2\n", script_filename);
+  return 1;
+}
+
 ///
 /// Returns a string stating the included Lua engine version,
 /// or "Disabled" if Grafx2 is compiled without Lua.
@@ -20,6 +20,8 @@
 #ifndef FACTORY_H__
 #define FACTORY_H__
 
+#include "gfx2surface.h"
+
 void Button_Brush_Factory(int);
 void Repeat_script(void);
 
@@ -32,6 +34,23 @@ extern char * Bound_script[10];
 /// After: Cursor shown
 void Run_numbered_script(byte index);
 
+///
+/// Run a Lua script on a picture, without screen nor user interface.
+///
+/// The picture becomes the main page of the script. The dialogs of the
+/// script are answered with @p answers: inputbox() settings are set by
+/// "label=value" (the other settings keep their default value) and
+/// selectbox() choices by "caption=button label". messagebox() and
+/// statusmessage() are logged, waitinput() reports the Esc key, and
+/// windowopen() raises an error.
+/// @param script_filename path of the script
+/// @param surface the picture, replaced by the result on success
+/// @param transparent_color the transparent color of the picture
+/// @param answers the answers to the dialogs
+/// @param nb_answers the number of strings in @p answers
+/// @return 0 on success
+int Run_script_headless(const char * script_filename, T_GFX2_Surface ** surface, byte transparent_color, const char * const * answers, int nb_answers);
+
 ///
 /// Returns a string stating the included Lua engine version,
 /// or "Disabled" if Grafx2 is compiled without Lua.
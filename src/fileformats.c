@@ -855,6 +855,8 @@ static void Load_BMP_Pixels(T_IO_Context * context, FILE * file, unsigned int co
   short y_pos;
   byte value;
   byte a,b;
+  byte * row = NULL;
+  byte run[256];
   int bits[4];
   int shift[4];
   int i;
@@ -878,6 +880,16 @@ static void Load_BMP_Pixels(T_IO_Context * context, FILE * file, unsigned int co
   {
     case 0 :  // BI_RGB : No compression
     case 3 :  // BI_BITFIELDS
+      if (nbbits <= 8)
+      {
+        // decoded lines, with some room for the last byte of 1, 2 and 4 bits lines
+        row = (byte *)malloc(context->Width + 8);
+        if (row == NULL)
+        {
+          File_error = 1;
+          return;
+        }
+      }
       for (y_pos=0; (y_pos < context->Height && !File_error); y_pos++)
       {
         short target_y;
@@ -886,21 +898,20 @@ static void Load_BMP_Pixels(T_IO_Context * context, FILE * file, unsigned int co
         switch (nbbits)
         {
           case 8 :
-            for (x_pos = 0; x_pos < context->Width; x_pos++)
-            {
-              if (!Read_byte(file, &value))
-                File_error = 2;
-              Set_pixel(context, x_pos, target_y, value);
-            }
+            if (!Read_bytes(file, row, context->Width))
+              File_error = 2;
+            else
+              Set_pixel_row(context, 0, target_y, context->Width, row);
             break;
           case 4 :
             for (x_pos = 0; x_pos < context->Width; )
             {
               if (!Read_byte(file, &value))
                 File_error = 2;
-              Set_pixel(context, x_pos++, target_y, (value >> 4) & 0x0F);
-              Set_pixel(context, x_pos++, target_y, value & 0x0F);
+              row[x_pos++] = (value >> 4) & 0x0F;
+              row[x_pos++] = value & 0x0F;
             }
+            Set_pixel_row(context, 0, target_y, context->Width, row);
             break;
           case 2:
             for (x_pos = 0; x_pos < context->Width; x_pos++)
@@ -910,9 +921,10 @@ static void Load_BMP_Pixels(T_IO_Context * context, FILE * file, unsigned int co
                 if (!Read_byte(file, &value))
                   File_error = 2;
               }
-              Set_pixel(context, x_pos, target_y, (value >> 6) & 3);
+              row[x_pos] = (value >> 6) & 3;
               value <<= 2;
             }
+            Set_pixel_row(context, 0, target_y, context->Width, row);
             break;
           case 1 :
             for (x_pos = 0; x_pos < context->Width; x_pos++)
@@ -928,9 +940,11 @@ static void Load_BMP_Pixels(T_IO_Context * context, FILE * file, unsigned int co
                   Set_pixel(context, x_pos, target_y, context->Transparent_color);
               }
               else
-                Set_pixel(context, x_pos, target_y, (value >> 7) & 1);
+                row[x_pos] = (value >> 7) & 1;
               value <<= 1;
             }
+            if (!(flags & LOAD_BMP_PIXEL_FLAG_TRANSP_PLANE))
+              Set_pixel_row(context, 0, target_y, context->Width, row);
             break;
           case 24:
             for (x_pos = 0; x_pos < context->Width; x_pos++)
@@ -970,6 +984,7 @@ static void Load_BMP_Pixels(T_IO_Context * context, FILE * file, unsigned int co
         if (((context->Width * nbbits + 7) >> 3) & 3)
           fseek(file, 4 - (((context->Width * nbbits + 7) >> 3) & 3), SEEK_CUR);
       }
+      free(row);
       break;
 
     case 1 : // BI_RLE8 Compression
@@ -983,8 +998,11 @@ static void Load_BMP_Pixels(T_IO_Context * context, FILE * file, unsigned int co
       while (!File_error)
       {
         if (a) // Encoded mode
-          for (index=1; index<=a; index++)
-            Set_pixel(context, x_pos++,y_pos,b);
+        {
+          memset(run, b, a);
+          Set_pixel_row(context, x_pos, y_pos, a, run);
+          x_pos += a;
+        }
         else   // Absolute mode
           switch (b)
           {
@@ -1001,19 +1019,12 @@ static void Load_BMP_Pixels(T_IO_Context * context, FILE * file, unsigned int co
               y_pos-=b;
               break;
             default: // Nouvelle série
-              while (b)
-              {
-                if(Read_byte(file, &a)!=1)
-                  File_error=2;
-                //Read_one_byte(file, &c);
-                Set_pixel(context, x_pos++,y_pos,a);
-                //if (--c)
-                //{
-                //  Set_pixel(context, x_pos++,y_pos,c);
-                //  b--;
-                //}
-                b--;
-              }
+              if (!Read_bytes(file, run, b))
+                File_error=2;
+              else
+                Set_pixel_row(context, x_pos, y_pos, b, run);
+              x_pos += b;
+              b = 0;
               if (ftell(file) & 1) fseek(file, 1, SEEK_CUR);
           }
         if (a==0 && b==1)
@@ -1879,11 +1890,21 @@ void Test_PCX(T_IO_Context * context, FILE * file)
     byte  byte_mask=(1<<depth)-1;
     byte  reduction_minus_one=reduction-1;
 
+    byte  pixels[256];
+    short count = 0;
+
     for (x_pos=0; x_pos<context->Width; x_pos++)
     {
       color=(buffer[x_pos/reduction]>>((reduction_minus_one-(x_pos%reduction))*depth)) & byte_mask;
-      Set_pixel(context, x_pos,y_pos,color);
+      pixels[count++] = color;
+      if (count == (short)sizeof(pixels))
+      {
+        Set_pixel_row(context, x_pos + 1 - count, y_pos, count, pixels);
+        count = 0;
+      }
     }
+    if (count > 0)
+      Set_pixel_row(context, context->Width - count, y_pos, count, pixels);
   }
 
 // generate CGA RGBI colors.
@@ -2073,24 +2094,28 @@ void Load_PCX(T_IO_Context * context)
                       if(Read_byte(file,&byte2)!=1) File_error = 2; // octet à répéter
                       if (!File_error)
                       {
-                        for (index=0; index<byte1; index++,position++)
+                        for (index=0; index<byte1; index++)
                           if (position<image_size)
-                            Set_pixel(context, position%line_size,
-                                                position/line_size,
-                                                byte2);
+                          {
+                            buffer[position%line_size]=byte2;
+                            if ((++position)%line_size == 0)
+                              Set_pixel_row(context, 0, position/line_size - 1, line_size, buffer);
+                          }
                           else
                             File_error=2;
                       }
                     }
                     else
                     {
-                      Set_pixel(context, position%line_size,
-                                          position/line_size,
-                                          byte1);
-                      position++;
+                      buffer[position%line_size]=byte1;
+                      if ((++position)%line_size == 0)
+                        Set_pixel_row(context, 0, position/line_size - 1, line_size, buffer);
                     }
                   }
                 }
+                // Output the pixels of an incomplete last line
+                if (position%line_size != 0)
+                  Set_pixel_row(context, 0, position/line_size, position%line_size, buffer);
               }
               else                 // couleurs rangées par plans
               {
@@ -2135,8 +2160,7 @@ void Load_PCX(T_IO_Context * context)
                 if ((width_read=Read_bytes(file,buffer,line_size)))
                 {
                   if (PCX_header.Plane==1)
-                    for (x_pos=0; x_pos<context->Width;x_pos++)
-                      Set_pixel(context, x_pos,y_pos,buffer[x_pos]);
+                    Set_pixel_row(context, 0, y_pos, context->Width, buffer);
                   else
                   {
                     if (PCX_header.Depth==1)
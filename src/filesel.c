@@ -65,6 +65,7 @@
 #include "unicode.h"
 #include "filesel.h"
 #include "fileseltools.h"
+#include "thumbcache.h"
 
 #define NORMAL_FILE_COLOR    MC_Light // color du texte pour une ligne de
   // fichier non sélectionné
@@ -653,113 +654,155 @@ static int Windows_Path_Compare(const char * s1, const char * s2)
 #endif
 
 
+/// Precomputed sort key of a file selector item
+typedef struct
+{
+  T_Fileselector_item * item;
+  int rank;                   ///< drives, then parent directory, then directories, then files
+  const char * name;          ///< name to compare
+  const word * unicode_name;  ///< unicode name to compare, NULL if not available
+} T_Sort_key;
+
+#ifdef WIN32
+// The keys are folded to lower case once, so they can be compared
+// case-sensitively.
+static int Windows_Key_Compare(const char * s1, const char * s2)
+{
+  // network shares path (starting with \\) at the end of the list
+  if (s1[0] == '\\')
+  {
+    if (s2[0] != '\\')
+      return 1;
+  }
+  else if (s2[0] == '\\')
+    return -1;
+  return strcmp(s1, s2);
+}
+#define SORT_KEY_COMPARE Windows_Key_Compare
+#define SORT_KEY_COMPARE_UNICODE Unicode_strcmp
+#else
+#define SORT_KEY_COMPARE FILENAME_COMPARE
+#define SORT_KEY_COMPARE_UNICODE FILENAME_COMPARE_UNICODE
+#endif
+
+/// Order of two file selector items
+static int Compare_sort_keys(const T_Sort_key * a, const T_Sort_key * b)
+{
+  if (a->rank != b->rank)
+    return b->rank - a->rank;
+  if (a->unicode_name != NULL && b->unicode_name != NULL)
+    return SORT_KEY_COMPARE_UNICODE(a->unicode_name, b->unicode_name);
+  return SORT_KEY_COMPARE(a->name, b->name);
+}
+
+/// Stable merge sort of sort keys
+/// @param keys the keys to sort
+/// @param temp work area of the same size
+/// @param count number of keys
+static void Merge_sort_keys(T_Sort_key * keys, T_Sort_key * temp, int count)
+{
+  int middle, i, j, k;
+
+  if (count < 2)
+    return;
+  middle = count / 2;
+  Merge_sort_keys(keys, temp, middle);
+  Merge_sort_keys(keys + middle, temp, count - middle);
+  // already in order
+  if (Compare_sort_keys(keys + middle - 1, keys + middle) <= 0)
+    return;
+  memcpy(temp, keys, middle * sizeof(T_Sort_key));
+  for (i = 0, j = middle, k = 0; i < middle && j < count; k++)
+  {
+    if (Compare_sort_keys(keys + j, temp + i) < 0)
+      keys[k] = keys[j++];
+    else
+      keys[k] = temp[i++];
+  }
+  while (i < middle)
+    keys[k++] = temp[i++];
+}
+
 /**
  * Sort a file/directory list.
  * The sord is done in that order :
  * Directories first, in alphabetical order,
  * then Files, in alphabetical order.
  *
+ * The items are gathered in an array with their sort key, sorted,
+ * then linked again in the new order.
  * List counts and index are updated.
  * @param list the linked list
  */
 void Sort_list_of_files(T_Fileselector *list)
 {
-  byte   list_is_sorted; // Booléen "La liste est triée"
-  byte   need_swap;          // Booléen "Il faut inverser les éléments"
-  T_Fileselector_item * prev_item;
-  T_Fileselector_item * current_item;
-  T_Fileselector_item * next_item;
-  T_Fileselector_item * next_to_next_item;
+  T_Fileselector_item * item;
+  T_Sort_key * keys;
+  int count, i;
+
+  count = 0;
+  for (item = list->First; item != NULL; item = item->Next)
+    count++;
 
   // Check there are at least two elements before sorting
-  if (list->First && list->First->Next)
+  if (count > 1)
   {
-    do
+    keys = (T_Sort_key *)malloc(2 * count * sizeof(T_Sort_key));
+    if (keys == NULL)
+      GFX2_Log(GFX2_ERROR, "Sort_list_of_files() failed to allocate %d keys\n", count);
+    else
     {
-      // Par défaut, on considère que la liste est triée
-      list_is_sorted=1;
-
-      current_item=list->First;
-      next_item=current_item->Next;
-
-      while ( (current_item!=NULL) && (next_item!=NULL) )
+      for (item = list->First, i = 0; item != NULL; item = item->Next, i++)
       {
-        // On commence par supposer qu'il n'y pas pas besoin d'inversion
-        need_swap=0;
-
-        // Ensuite, on vérifie si les deux éléments sont bien dans l'ordre ou
-        // non:
-
-          // Drives go at the top of the list, and files go after them
-        if ( (int)current_item->Type < (int)next_item->Type )
-          need_swap=1;
-          // If both elements have the same type, compare the file names, if
-		  // current is alphabetically before, we need to swap, unless it is
-          // parent directory, which should always go first
-        else if (current_item->Type == next_item->Type)
+        keys[i].item = item;
+        // Drives go at the top of the list, and files go after them.
+        // The parent directory goes before the other directories.
+        keys[i].rank = 2 * (int)item->Type;
+        if (FILENAME_COMPARE(item->Full_name, PARENT_DIR) == 0)
+          keys[i].rank++;
+#ifdef WIN32
         {
-          if (FILENAME_COMPARE(next_item->Full_name, PARENT_DIR) == 0)
-            need_swap = 1;
-          else if (FILENAME_COMPARE(current_item->Full_name, PARENT_DIR) != 0)
+          char * name = strdup(item->Full_name);
+          word * unicode_name = NULL;
+          char * c;
+
+          for (c = name; c != NULL && *c != '\0'; c++)
+            *c = tolower((unsigned char)*c);
+          if (item->Unicode_full_name != NULL)
           {
-            if (current_item->Unicode_full_name != NULL && next_item->Unicode_full_name != NULL)
-            {
-              // compare unicode file names if they are available
-              if (FILENAME_COMPARE_UNICODE(current_item->Unicode_full_name, next_item->Unicode_full_name) > 0)
-                need_swap = 1;
-            }
-            else
+            unicode_name = Unicode_strdup(item->Unicode_full_name);
+            if (unicode_name != NULL)
             {
-              if (FILENAME_COMPARE(current_item->Full_name, next_item->Full_name) > 0)
-                need_swap = 1;
+              word * w;
+              for (w = unicode_name; *w != 0; w++)
+                *w = towlower(*w);
             }
           }
+          keys[i].name = (name != NULL) ? name : item->Full_name;
+          keys[i].unicode_name = unicode_name;
         }
+#else
+        keys[i].name = item->Full_name;
+        keys[i].unicode_name = item->Unicode_full_name;
+#endif
+      }
 
+      Merge_sort_keys(keys, keys + count, count);
 
-        if (need_swap)
-        {
-          // Si les deux éléments nécessitent d'être inversé:
-
-          // On les inverses:
-
-          // On note avant tout les éléments qui encapsulent nos deux amis
-          prev_item         =current_item->Previous;
-          next_to_next_item=next_item->Next;
-
-          // On permute le chaînage des deux éléments entree eux
-          current_item->Next  =next_to_next_item;
-          current_item->Previous=next_item;
-          next_item->Next  =current_item;
-          next_item->Previous=prev_item;
-
-          // On tente un chaînage des éléments encapsulant les compères:
-          if (prev_item!=NULL)
-            prev_item->Next=next_item;
-          if (next_to_next_item!=NULL)
-            next_to_next_item->Previous=current_item;
-
-          // On fait bien attention à modifier la tête de liste en cas de besoin
-          if (current_item==list->First)
-            list->First=next_item;
-
-          // Ensuite, on se prépare à étudier les éléments précédents:
-          current_item=prev_item;
-
-          // Et on constate que la liste n'était pas encore génialement triée
-          list_is_sorted=0;
-        }
-        else
-        {
-          // Si les deux éléments sont dans l'ordre:
-
-          // On passe aux suivants
-          current_item=current_item->Next;
-          next_item=next_item->Next;
-        }
+      // Link the items in the sorted order
+      list->First = keys[0].item;
+      for (i = 0; i < count; i++)
+      {
+        keys[i].item->Previous = (i > 0) ? keys[i - 1].item : NULL;
+        keys[i].item->Next = (i < count - 1) ? keys[i + 1].item : NULL;
+#ifdef WIN32
+        if (keys[i].name != keys[i].item->Full_name)
+          free((char *)keys[i].name);
+        free((word *)keys[i].unicode_name);
+#endif
       }
+      free(keys);
     }
-    while (!list_is_sorted);
   }
   // Force a recount / re-index
   Recount_files(list);
@@ -1488,6 +1531,7 @@ byte Button_Load_or_Save(T_Selector_settings *settings, byte load, T_IO_Context
   short window_shortcut;
   const char * directory_to_change_to = NULL;
   int   load_from_clipboard = 0;
+  byte  display_preview = 0;
 #ifdef ENABLE_FILENAMES_ICONV
   size_t filename_length = 0;
 #endif
@@ -2358,6 +2402,7 @@ byte Button_Load_or_Save(T_Selector_settings *settings, byte load, T_IO_Context
         Update_window_area(183,95,PREVIEW_WIDTH,PREVIEW_HEIGHT);
       }
 
+      Cancel_preview_worker();
       New_preview_is_needed=0;
       Timer_state=0;         // State du chrono = Attente d'un Xème de seconde
       // On lit le temps de départ du chrono
@@ -2369,72 +2414,91 @@ byte Button_Load_or_Save(T_Selector_settings *settings, byte load, T_IO_Context
 
     if (Timer_state==1) // Il faut afficher la preview
     {
+      Timer_state=2; // On arrête le chrono
       if ( load_from_clipboard || ((Selector->Position+Selector->Offset>=Filelist.Nb_directories) && (Filelist.Nb_elements)) )
       {
-        T_IO_Context preview_context;
-
-        if (load_from_clipboard)
-        {
-          Init_context_preview(&preview_context, NULL, NULL);
-          preview_context.Format = FORMAT_CLIPBOARD;
-        }
+        // Previews which are not in the cache are decoded in the background
+        if (!load_from_clipboard && context->Type != CONTEXT_PALETTE
+            && !Thumbnail_is_cached(Selector->filename, Selector->Directory)
+            && Start_preview_worker(Selector->filename, Selector->Directory, Selector->Format_filter) == 0)
+          Timer_state=3;
         else
-        {
-          Init_context_preview(&preview_context, Selector->filename, Selector->Directory);
-          preview_context.Format = Selector->Format_filter;
-          preview_context.File_name_unicode = Unicode_strdup(Selector->filename_unicode);
-        }
-        Hide_cursor();
-        if (context->Type == CONTEXT_PALETTE)
-          preview_context.Type = CONTEXT_PREVIEW_PALETTE;
+          display_preview=1;
+      }
+    }
+    else if (Timer_state==3 && Check_preview_worker() != 1)
+    {
+      // The worker is done: the preview is now in the cache. If it has
+      // failed, the file is loaded the usual way to report the error.
+      Timer_state=2;
+      display_preview=1;
+    }
 
-        Load_image(&preview_context);
-        if (load_from_clipboard && (preview_context.File_directory != NULL))
-        {
-          short pos;
-          Change_directory(preview_context.File_directory);
-          free(Selector->Directory);
-          free(Selector->Directory_unicode);
-          Selector->Directory = Get_current_directory(NULL, &Selector->Directory_unicode, 0);
-          if ((preview_context.Format != FORMAT_CLIPBOARD) &&
-              ((int)Selector->Format_filter > (int)FORMAT_ALL_FILES))
-          {
-            Selector->Format_filter = preview_context.Format;
-            // update dropdown button
-            Print_in_window(68+2, 28+(11-7)/2,
-                Get_fileformat(Selector->Format_filter)->Label,
-                MC_Black,MC_Light);
-          }
-          // read the new directory
-          Read_list_of_files(&Filelist, Selector->Format_filter);
-          Sort_list_of_files(&Filelist);
+    if (display_preview)
+    {
+      T_IO_Context preview_context;
 
-          if (preview_context.File_name != NULL)
-          {
-            free(Selector->filename);
-            Selector->filename = strdup(preview_context.File_name);
-            free(Selector->filename_unicode);
-            Selector->filename_unicode = Get_Unicode_Filename(NULL, Selector->filename, ".");
-          }
+      if (load_from_clipboard)
+      {
+        Init_context_preview(&preview_context, NULL, NULL);
+        preview_context.Format = FORMAT_CLIPBOARD;
+      }
+      else
+      {
+        Init_context_preview(&preview_context, Selector->filename, Selector->Directory);
+        preview_context.Format = Selector->Format_filter;
+        preview_context.File_name_unicode = Unicode_strdup(Selector->filename_unicode);
+      }
+      Hide_cursor();
+      if (context->Type == CONTEXT_PALETTE)
+        preview_context.Type = CONTEXT_PREVIEW_PALETTE;
 
-          pos = Find_file_in_fileselector(&Filelist, Selector->filename);
-          Highlight_file((pos >= 0) ? pos : 0);
-          // display the 1st visible files
-          Prepare_and_display_filelist(Selector->Position, Selector->Offset, file_scroller, 0);
+      Load_image(&preview_context);
+      if (load_from_clipboard && (preview_context.File_directory != NULL))
+      {
+        short pos;
+        Change_directory(preview_context.File_directory);
+        free(Selector->Directory);
+        free(Selector->Directory_unicode);
+        Selector->Directory = Get_current_directory(NULL, &Selector->Directory_unicode, 0);
+        if ((preview_context.Format != FORMAT_CLIPBOARD) &&
+            ((int)Selector->Format_filter > (int)FORMAT_ALL_FILES))
+        {
+          Selector->Format_filter = preview_context.Format;
+          // update dropdown button
+          Print_in_window(68+2, 28+(11-7)/2,
+              Get_fileformat(Selector->Format_filter)->Label,
+              MC_Black,MC_Light);
+        }
+        // read the new directory
+        Read_list_of_files(&Filelist, Selector->Format_filter);
+        Sort_list_of_files(&Filelist);
 
-          // New directory, so we need to reset the quicksearch
-          Reset_quicksearch();
+        if (preview_context.File_name != NULL)
+        {
+          free(Selector->filename);
+          Selector->filename = strdup(preview_context.File_name);
+          free(Selector->filename_unicode);
+          Selector->filename_unicode = Get_Unicode_Filename(NULL, Selector->filename, ".");
         }
-        Destroy_context(&preview_context);
 
-        Update_window_area(0,0,Window_width,Window_height);
-        Display_cursor();
+        pos = Find_file_in_fileselector(&Filelist, Selector->filename);
+        Highlight_file((pos >= 0) ? pos : 0);
+        // display the 1st visible files
+        Prepare_and_display_filelist(Selector->Position, Selector->Offset, file_scroller, 0);
+
+        // New directory, so we need to reset the quicksearch
+        Reset_quicksearch();
       }
+      Destroy_context(&preview_context);
 
-      Timer_state=2; // On arrête le chrono
+      Update_window_area(0,0,Window_width,Window_height);
+      Display_cursor();
+      display_preview=0;
     }
   }
   while ( (!has_clicked_ok) && (clicked_button!=2) && !Quit_is_required);
+  Cancel_preview_worker();
 
   if (has_clicked_ok)
   {
@@ -39,6 +39,15 @@ byte Button_Load_or_Save(T_Selector_settings *settings, byte load, T_IO_Context
 
 void Free_fileselector_list(T_Fileselector *list);
 
+///
+/// Checks if a file has the requested file extension.
+/// The extension string can end with a ';' (remainder is ignored).
+/// This function allows wildcard '?', and '*' if it's the only character.
+/// @param filename_ext the extension of the file name, without the dot
+/// @param filter the extension to check for
+/// @return 1 if the extension matches, 0 otherwise
+int Check_extension(const char *filename_ext, const char * filter);
+
 void Sort_list_of_files(T_Fileselector *list);
 
 ///
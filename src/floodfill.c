@@ -0,0 +1,159 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file floodfill.c
+/// Scanline flood fill of 8 bits bitmaps.
+/// Based on the "seed fill" algorithm by Paul Heckbert, Graphics Gems (1990).
+
+#include <stdlib.h>
+#include "struct.h"
+#include "gfx2mem.h"
+#include "floodfill.h"
+
+/// A span of pixels to explore : line y, from x1 to x2, coming from line y-dy
+typedef struct
+{
+  int y;
+  int x1;
+  int x2;
+  int dy;
+} T_Fill_span;
+
+/// The stack of spans
+typedef struct
+{
+  T_Fill_span * spans;
+  int size;
+  int count;
+} T_Fill_stack;
+
+static int Push_span(T_Fill_stack * stack, int y, int x1, int x2, int dy)
+{
+  if (stack->count >= stack->size)
+  {
+    int new_size = stack->size ? stack->size * 2 : 256;
+    T_Fill_span * new_spans = realloc(stack->spans, new_size * sizeof(T_Fill_span));
+    if (new_spans == NULL)
+      return -1;
+    stack->spans = new_spans;
+    stack->size = new_size;
+  }
+  stack->spans[stack->count].y = y;
+  stack->spans[stack->count].x1 = x1;
+  stack->spans[stack->count].x2 = x2;
+  stack->spans[stack->count].dy = dy;
+  stack->count++;
+  return 0;
+}
+
+int Flood_fill(byte * pixels, int pitch,
+               int limit_left, int limit_top, int limit_right, int limit_bottom,
+               int x, int y, byte old_color, byte new_color,
+               short * left_reached, short * top_reached,
+               short * right_reached, short * bottom_reached)
+{
+  T_Fill_stack stack = { NULL, 0, 0 };
+  int min_x = x, max_x = x, min_y = y, max_y = y;
+  int error = 0;
+
+  // Push a span of line Y+DY, if it is within the limits
+#define PUSH(Y, X1, X2, DY) \
+  do { \
+    if ((Y) + (DY) >= limit_top && (Y) + (DY) <= limit_bottom) \
+      if (Push_span(&stack, (Y), (X1), (X2), (DY)) < 0) \
+        error = -1; \
+  } while (0)
+
+  if (old_color == new_color || pixels[y * pitch + x] != old_color)
+    error = -1;
+  else
+  {
+    PUSH(y, x, x, 1);
+    PUSH(y + 1, x, x, -1); // seed span, popped first
+  }
+
+  while (stack.count > 0 && error == 0)
+  {
+    // The span x1..x2 of line y-dy was filled,
+    // now explore the adjacent pixels of line y.
+    const T_Fill_span * span = stack.spans + (--stack.count);
+    int dy = span->dy;
+    int x1 = span->x1;
+    int x2 = span->x2;
+    int left;
+    int continued; // true if the span extended to the left of x1
+    byte * row;
+
+    y = span->y + dy;
+    row = pixels + y * pitch;
+
+    // Extend to the left
+    for (x = x1; x >= limit_left && row[x] == old_color; x--)
+      row[x] = new_color;
+    continued = (x < x1);
+    if (continued)
+    {
+      if (y < min_y)
+        min_y = y;
+      if (y > max_y)
+        max_y = y;
+      left = x + 1;
+      if (left < min_x)
+        min_x = left;
+      if (left < x1)
+        PUSH(y, left, x1 - 1, -dy); // leak on the left
+      x = x1 + 1;
+    }
+    else
+    {
+      // Skip to the first fillable pixel in x1..x2
+      for (x++; x <= x2 && row[x] != old_color; x++)
+        ;
+      left = x;
+    }
+    while (continued || x <= x2)
+    {
+      continued = 0;
+      if (y < min_y)
+        min_y = y;
+      if (y > max_y)
+        max_y = y;
+      for (; x <= limit_right && row[x] == old_color; x++)
+        row[x] = new_color;
+      if (x - 1 > max_x)
+        max_x = x - 1;
+      PUSH(y, left, x - 1, dy);
+      if (x > x2 + 1)
+        PUSH(y, x2 + 1, x - 1, -dy); // leak on the right
+      // Skip to the next fillable pixel in x1..x2
+      for (x++; x <= x2 && row[x] != old_color; x++)
+        ;
+      left = x;
+    }
+  }
+#undef PUSH
+
+  free(stack.spans);
+  *left_reached = min_x;
+  *top_reached = min_y;
+  *right_reached = max_x;
+  *bottom_reached = max_y;
+  return error;
+}
@@ -0,0 +1,51 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+
+///@file floodfill.h
+/// Scanline flood fill of 8 bits bitmaps.
+
+#ifndef FLOODFILL_H_INCLUDED
+#define FLOODFILL_H_INCLUDED
+
+/**
+ * Fill the 4-connected area of color @p old_color containing (x, y)
+ * with @p new_color.
+ *
+ * Spans of pixels are filled at once, and the spans to explore are kept in
+ * an explicit stack, so each pixel is visited a bounded number of times
+ * whatever the shape of the area.
+ *
+ * @param pixels the bitmap
+ * @param pitch number of bytes between two lines of the bitmap
+ * @param limit_left, limit_top, limit_right, limit_bottom the rectangle
+ *        (inclusive) where the fill is allowed
+ * @param x, y starting point. It must be of color @p old_color.
+ * @param old_color, new_color the colors to replace. They must be different.
+ * @param left_reached, top_reached, right_reached, bottom_reached receive
+ *        the bounding box (inclusive) of the filled pixels
+ * @return 0 for success, -1 if out of memory (the fill is incomplete)
+ */
+int Flood_fill(byte * pixels, int pitch,
+               int limit_left, int limit_top, int limit_right, int limit_bottom,
+               int x, int y, byte old_color, byte new_color,
+               short * left_reached, short * top_reached,
+               short * right_reached, short * bottom_reached);
+
+#endif
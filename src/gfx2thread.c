@@ -0,0 +1,172 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file gfx2thread.c
+/// Minimal worker threads for the image processing functions.
+
+#include <stdlib.h>
+#if defined(USE_THREADS)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "gfx2thread.h"
+#include "gfx2log.h"
+
+struct T_GFX2_lock
+{
+#if defined(USE_THREADS)
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#else
+  int dummy;
+#endif
+};
+
+#if defined(USE_THREADS)
+/// Parameters of a worker thread
+typedef struct
+{
+  T_GFX2_thread_func func;
+  void * data;
+} T_GFX2_thread_param;
+
+static void * GFX2_Thread_start(void * p)
+{
+  const T_GFX2_thread_param * param = (const T_GFX2_thread_param *)p;
+
+  param->func(param->data);
+  return NULL;
+}
+#endif
+
+int GFX2_Thread_count(void)
+{
+#if defined(USE_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (count < 1)
+    return 1;
+  if (count > GFX2_MAX_THREADS)
+    return GFX2_MAX_THREADS;
+  return (int)count;
+#else
+  return 1;
+#endif
+}
+
+int GFX2_Run_threads(int count, T_GFX2_thread_func func, void * data)
+{
+#if defined(USE_THREADS)
+  pthread_t threads[GFX2_MAX_THREADS];
+  T_GFX2_thread_param param;
+  int started = 0;
+  int i;
+
+  param.func = func;
+  param.data = data;
+  if (count > GFX2_MAX_THREADS)
+    count = GFX2_MAX_THREADS;
+  for (i = 1; i < count; i++)
+  {
+    if (pthread_create(&threads[started], NULL, GFX2_Thread_start, &param) != 0)
+    {
+      GFX2_Log(GFX2_WARNING, "GFX2_Run_threads() : failed to start thread #%d\n", i);
+      break;
+    }
+    started++;
+  }
+  func(data);
+  for (i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  return started + 1;
+#else
+  (void)count;
+  func(data);
+  return 1;
+#endif
+}
+
+T_GFX2_lock * GFX2_Lock_new(void)
+{
+  T_GFX2_lock * lock = (T_GFX2_lock *)malloc(sizeof(T_GFX2_lock));
+
+  if (lock == NULL)
+    return NULL;
+#if defined(USE_THREADS)
+  if (pthread_mutex_init(&lock->mutex, NULL) != 0)
+  {
+    free(lock);
+    return NULL;
+  }
+  if (pthread_cond_init(&lock->cond, NULL) != 0)
+  {
+    pthread_mutex_destroy(&lock->mutex);
+    free(lock);
+    return NULL;
+  }
+#endif
+  return lock;
+}
+
+void GFX2_Lock_delete(T_GFX2_lock * lock)
+{
+  if (lock == NULL)
+    return;
+#if defined(USE_THREADS)
+  pthread_cond_destroy(&lock->cond);
+  pthread_mutex_destroy(&lock->mutex);
+#endif
+  free(lock);
+}
+
+void GFX2_Lock(T_GFX2_lock * lock)
+{
+#if defined(USE_THREADS)
+  pthread_mutex_lock(&lock->mutex);
+#else
+  (void)lock;
+#endif
+}
+
+void GFX2_Unlock(T_GFX2_lock * lock)
+{
+#if defined(USE_THREADS)
+  pthread_mutex_unlock(&lock->mutex);
+#else
+  (void)lock;
+#endif
+}
+
+void GFX2_Lock_wait(T_GFX2_lock * lock)
+{
+#if defined(USE_THREADS)
+  pthread_cond_wait(&lock->cond, &lock->mutex);
+#else
+  (void)lock;
+#endif
+}
+
+void GFX2_Lock_signal(T_GFX2_lock * lock)
+{
+#if defined(USE_THREADS)
+  pthread_cond_broadcast(&lock->cond);
+#else
+  (void)lock;
+#endif
+}
@@ -0,0 +1,82 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file gfx2thread.h
+/// Minimal worker threads for the image processing functions.
+///
+/// Threads are only used when GrafX2 is built with USE_THREADS (POSIX
+/// threads). Otherwise the same functions run everything in the calling
+/// thread, so the callers don't need any conditional code.
+
+#ifndef GFX2THREAD_H_DEFINED
+#define GFX2THREAD_H_DEFINED
+
+/// Maximum number of threads started by GFX2_Run_threads()
+#define GFX2_MAX_THREADS 16
+
+/// Function run by the worker threads
+typedef void (* T_GFX2_thread_func)(void * data);
+
+/// Lock with a condition, to synchronize the worker threads
+typedef struct T_GFX2_lock T_GFX2_lock;
+
+/**
+ * Number of threads worth starting.
+ * @return the number of processors, 1 when threads are not available
+ */
+int GFX2_Thread_count(void);
+
+/**
+ * Run a function in several threads, and wait until they are all done.
+ *
+ * The calling thread is one of them. The function may be run by fewer
+ * threads than requested, even only once by the calling thread, so
+ * the work has to be shared dynamically, for example with a counter
+ * protected by a T_GFX2_lock.
+ * @param count the number of threads wanted
+ * @param func the function to run
+ * @param data the parameter of the function
+ * @return the number of threads which have run the function
+ */
+int GFX2_Run_threads(int count, T_GFX2_thread_func func, void * data);
+
+/// Create a lock. @return NULL if out of memory
+T_GFX2_lock * GFX2_Lock_new(void);
+
+/// Free a lock
+void GFX2_Lock_delete(T_GFX2_lock * lock);
+
+/// Acquire a lock
+void GFX2_Lock(T_GFX2_lock * lock);
+
+/// Release a lock
+void GFX2_Unlock(T_GFX2_lock * lock);
+
+/**
+ * Wait until another thread calls GFX2_Lock_signal().
+ *
+ * The lock must be held. It is released while waiting.
+ * Without threads, it returns immediately.
+ */
+void GFX2_Lock_wait(T_GFX2_lock * lock);
+
+/// Wake up all the threads waiting on a lock
+void GFX2_Lock_signal(T_GFX2_lock * lock);
+
+#endif
@@ -121,118 +121,142 @@ void Test_GIF(T_IO_Context * context, FILE * file)
 
 typedef struct {
   word nb_bits;        ///< bits for a code
-  word remainder_bits; ///< available bits in @ref last_byte field
+  word remainder_bits; ///< available bits in @ref bits field
   byte remainder_byte; ///< Remaining bytes in current block
   word current_code;   ///< current code (generally the one just read)
-  byte last_byte;      ///< buffer byte for reading bits for codes
+  dword bits;          ///< bit buffer for reading or writing codes
+  byte block_pos;      ///< position of the next byte to read in @ref block
+  byte block[255];     ///< current Raster Data block (loading)
   word pos_X;          ///< Current coordinates
   word pos_Y;
   word interlaced;     ///< interlaced flag
   word pass;           ///< current pass in interlaced decoding
   word stop;           ///< Stop flag (end of picture)
+  byte * row;          ///< pixels of the line being decoded
 } T_GIF_context;
 
 
 /// Reads the next code (GIF.nb_bits bits)
+///
+/// Raster Data blocks are read at once in @ref T_GIF_context::block
+/// and the codes are extracted from a 32 bits buffer.
 static word GIF_get_next_code(FILE * GIF_file, T_GIF_context * gif)
 {
-  word nb_bits_to_process = gif->nb_bits;
-  word nb_bits_processed = 0;
-  word current_nb_bits;
-
-  gif->current_code = 0;
-
-  while (nb_bits_to_process)
+  while (gif->remainder_bits < gif->nb_bits)
   {
-    if (gif->remainder_bits == 0) // Il ne reste plus de bits...
+    // Si on a atteint la fin du bloc de Raster Data
+    if (gif->remainder_byte == 0)
     {
-      // Lire l'octet suivant:
-
-      // Si on a atteint la fin du bloc de Raster Data
-      if (gif->remainder_byte == 0)
+      // Lire l'octet nous donnant la taille du bloc de Raster Data suivant
+      if(Read_byte(GIF_file, &gif->remainder_byte)!=1)
       {
-        // Lire l'octet nous donnant la taille du bloc de Raster Data suivant
-        if(Read_byte(GIF_file, &gif->remainder_byte)!=1)
-        {
-          File_error=2;
-          return 0;
-        }
-        if (gif->remainder_byte == 0) // still nothing ? That is the end data block
-        {
-          File_error = 2;
-          GFX2_Log(GFX2_WARNING, "GIF 0 sized data block\n");
-          return gif->current_code;
-        }
+        File_error=2;
+        return 0;
       }
-      if(Read_byte(GIF_file,&gif->last_byte)!=1)
+      if (gif->remainder_byte == 0) // still nothing ? That is the end data block
+      {
+        File_error = 2;
+        GFX2_Log(GFX2_WARNING, "GIF 0 sized data block\n");
+        gif->current_code = gif->bits & ((1 << gif->nb_bits) - 1);
+        return gif->current_code;
+      }
+      // a truncated block will fail at the next block size reading
+      gif->remainder_byte = (byte)fread(gif->block, 1, gif->remainder_byte, GIF_file);
+      gif->block_pos = 0;
+      if (gif->remainder_byte == 0)
       {
         File_error = 2;
         GFX2_Log(GFX2_ERROR, "GIF failed to load data byte\n");
         return 0;
       }
-      gif->remainder_byte--;
-      gif->remainder_bits=8;
     }
-
-    current_nb_bits=(nb_bits_to_process<=gif->remainder_bits)?nb_bits_to_process:gif->remainder_bits;
-
-    gif->current_code |= (gif->last_byte & ((1<<current_nb_bits)-1))<<nb_bits_processed;
-    gif->last_byte >>= current_nb_bits;
-    nb_bits_processed += current_nb_bits;
-    nb_bits_to_process -= current_nb_bits;
-    gif->remainder_bits -= current_nb_bits;
+    gif->bits |= (dword)gif->block[gif->block_pos++] << gif->remainder_bits;
+    gif->remainder_byte--;
+    gif->remainder_bits += 8;
   }
 
+  gif->current_code = gif->bits & ((1 << gif->nb_bits) - 1);
+  gif->bits >>= gif->nb_bits;
+  gif->remainder_bits -= gif->nb_bits;
+
   return gif->current_code;
 }
 
-/// Put a new pixel
-static void GIF_new_pixel(T_IO_Context * context, T_GIF_context * gif, T_GIF_IDB *idb, int is_transparent, byte color)
+/// Write the first @p width pixels of the current line to the context.
+///
+/// Transparent pixels are skipped so the previous frame shows through.
+static void GIF_flush_row(T_IO_Context * context, T_GIF_context * gif, T_GIF_IDB *idb, int is_transparent, word width)
 {
-  if (!is_transparent || color!=context->Transparent_color)
-    Set_pixel(context, idb->Pos_X+gif->pos_X, idb->Pos_Y+gif->pos_Y,color);
-
-  gif->pos_X++;
+  word start, end;
 
-  if (gif->pos_X >= idb->Image_width)
+  if (!is_transparent)
+  {
+    Set_pixel_row(context, idb->Pos_X, idb->Pos_Y+gif->pos_Y, width, gif->row);
+    return;
+  }
+  start = 0;
+  while (start < width)
   {
-    gif->pos_X=0;
+    while (start < width && gif->row[start] == context->Transparent_color)
+      start++;
+    end = start;
+    while (end < width && gif->row[end] != context->Transparent_color)
+      end++;
+    if (end > start)
+      Set_pixel_row(context, idb->Pos_X+start, idb->Pos_Y+gif->pos_Y, end - start, gif->row + start);
+    start = end;
+  }
+}
 
-    if (!gif->interlaced)
+/// Output the completed line and go to the next one
+static void GIF_next_line(T_IO_Context * context, T_GIF_context * gif, T_GIF_IDB *idb, int is_transparent)
+{
+  GIF_flush_row(context, gif, idb, is_transparent, idb->Image_width);
+  gif->pos_X=0;
+
+  if (!gif->interlaced)
+  {
+    gif->pos_Y++;
+    if (gif->pos_Y >= idb->Image_height)
+      gif->stop = 1;
+  }
+  else
+  {
+    switch (gif->pass)
     {
-      gif->pos_Y++;
-      if (gif->pos_Y >= idb->Image_height)
-        gif->stop = 1;
+      case 0 :
+      case 1 : gif->pos_Y+=8;
+               break;
+      case 2 : gif->pos_Y+=4;
+               break;
+      default: gif->pos_Y+=2;
     }
-    else
-    {
-      switch (gif->pass)
-      {
-        case 0 :
-        case 1 : gif->pos_Y+=8;
-                 break;
-        case 2 : gif->pos_Y+=4;
-                 break;
-        default: gif->pos_Y+=2;
-      }
 
-      if (gif->pos_Y >= idb->Image_height)
+    if (gif->pos_Y >= idb->Image_height)
+    {
+      switch(++(gif->pass))
       {
-        switch(++(gif->pass))
-        {
-        case 1 : gif->pos_Y=4;
-                 break;
-        case 2 : gif->pos_Y=2;
-                 break;
-        case 3 : gif->pos_Y=1;
-                 break;
-        case 4 : gif->stop = 1;
-        }
+      case 1 : gif->pos_Y=4;
+               break;
+      case 2 : gif->pos_Y=2;
+               break;
+      case 3 : gif->pos_Y=1;
+               break;
+      case 4 : gif->stop = 1;
       }
     }
   }
 }
 
+/// Put a new pixel
+static void GIF_new_pixel(T_IO_Context * context, T_GIF_context * gif, T_GIF_IDB *idb, int is_transparent, byte color)
+{
+  gif->row[gif->pos_X++] = color;
+
+  if (gif->pos_X >= idb->Image_width)
+    GIF_next_line(context, gif, idb, is_transparent);
+}
+
 
 /// Load GIF file
 void Load_GIF(T_IO_Context * context)
@@ -244,6 +268,7 @@ void Load_GIF(T_IO_Context * context)
   word * alphabet_stack;     // Pile de décodage d'une chaîne
   word * alphabet_prefix;  // Table des préfixes des codes
   word * alphabet_suffix;  // Table des suffixes des codes
+  word * alphabet_length;  // Length of the string of each code
   word   alphabet_free;     // Position libre dans l'alphabet
   word   alphabet_max;      // Nombre d'entrées possibles dans l'alphabet
   word   alphabet_stack_pos; // Position dans la pile de décodage d'un chaîne
@@ -295,6 +320,7 @@ void Load_GIF(T_IO_Context * context)
       alphabet_stack  = (word *)GFX2_malloc(4096*sizeof(word));
       alphabet_prefix = (word *)GFX2_malloc(4096*sizeof(word));
       alphabet_suffix = (word *)GFX2_malloc(4096*sizeof(word));
+      alphabet_length = (word *)GFX2_malloc(4096*sizeof(word));
 
       if (Read_word_le(GIF_file,&(LSDB.Width))
       && Read_word_le(GIF_file,&(LSDB.Height))
@@ -621,10 +647,22 @@ void Load_GIF(T_IO_Context * context)
                 File_error=0;
                 if (!Read_byte(GIF_file,&(initial_nb_bits)))
                   File_error=1;
+                else if (initial_nb_bits > 11)
+                {
+                  // codes would not fit in the 12 bits alphabet
+                  GFX2_Log(GFX2_ERROR, "Load_GIF() invalid LZW minimum code size %u\n", initial_nb_bits);
+                  File_error=2;
+                  initial_nb_bits = 8;
+                }
 
                 value_clr    =(1<<initial_nb_bits)+0;
                 value_eof    =(1<<initial_nb_bits)+1;
                 alphabet_free=(1<<initial_nb_bits)+2;
+                for (color_index = 0; color_index < value_clr; color_index++)
+                  alphabet_length[color_index] = 1;
+                // so a frame not starting with a Clear code only refers to this frame's codes
+                old_code = 0;
+                special_case = 0;
 
                 GIF.nb_bits  =initial_nb_bits + 1;
                 alphabet_max      =((1 <<  GIF.nb_bits)-1);
@@ -635,13 +673,19 @@ void Load_GIF(T_IO_Context * context)
 
 
                 GIF.stop = 0;
+                GIF.row = GFX2_malloc(IDB.Image_width);
+                if (GIF.row == NULL)
+                {
+                  File_error = 1;
+                  break;
+                }
 
                 //////////////////////////////////////////// DECOMPRESSION LZW //
 
                 GIF.pos_X=0;
                 GIF.pos_Y=0;
                 alphabet_stack_pos=0;
-                GIF.last_byte    =0;
+                GIF.bits         =0;
                 GIF.remainder_bits    =0;
                 GIF.remainder_byte    =0;
 
@@ -655,33 +699,70 @@ void Load_GIF(T_IO_Context * context)
                   }
                   else if (GIF.current_code != value_clr)
                   {
+                    word length;
+
                     byte_read = GIF.current_code;
                     if (alphabet_free == GIF.current_code)
-                    {
-                      GIF.current_code=old_code;
-                      alphabet_stack[alphabet_stack_pos++]=special_case;
-                    }
+                      length = alphabet_length[old_code] + 1;
+                    else
+                      length = alphabet_length[GIF.current_code];
 
-                    while (GIF.current_code > value_clr)
+                    if (GIF.pos_X + length <= IDB.Image_width)
                     {
-                      if (GIF.current_code >= 4096)
+                      // The string fits in the current line : expand it
+                      // directly in the line buffer, from its last pixel
+                      byte * pixel = GIF.row + GIF.pos_X + length - 1;
+
+                      if (alphabet_free == GIF.current_code)
                       {
-                        GFX2_Log(GFX2_ERROR, "Load_GIF() GIF.current_code = %u >= 4096\n", GIF.current_code);
-                        File_error = 2;
-                        break;
+                        *pixel-- = special_case;
+                        GIF.current_code=old_code;
                       }
-                      alphabet_stack[alphabet_stack_pos++] = alphabet_suffix[GIF.current_code];
-                      GIF.current_code = alphabet_prefix[GIF.current_code];
+                      while (GIF.current_code > value_clr)
+                      {
+                        *pixel-- = alphabet_suffix[GIF.current_code];
+                        GIF.current_code = alphabet_prefix[GIF.current_code];
+                      }
+                      *pixel = special_case = GIF.current_code;
+
+                      GIF.pos_X += length;
+                      if (GIF.pos_X >= IDB.Image_width)
+                        GIF_next_line(context, &GIF, &IDB, is_transparent);
                     }
+                    else
+                    {
+                      if (alphabet_free == GIF.current_code)
+                      {
+                        GIF.current_code=old_code;
+                        alphabet_stack[alphabet_stack_pos++]=special_case;
+                      }
+
+                      while (GIF.current_code > value_clr)
+                      {
+                        if (GIF.current_code >= 4096)
+                        {
+                          GFX2_Log(GFX2_ERROR, "Load_GIF() GIF.current_code = %u >= 4096\n", GIF.current_code);
+                          File_error = 2;
+                          break;
+                        }
+                        alphabet_stack[alphabet_stack_pos++] = alphabet_suffix[GIF.current_code];
+                        GIF.current_code = alphabet_prefix[GIF.current_code];
+                      }
 
-                    special_case = alphabet_stack[alphabet_stack_pos++] = GIF.current_code;
+                      special_case = alphabet_stack[alphabet_stack_pos++] = GIF.current_code;
 
-                    do
-                      GIF_new_pixel(context, &GIF, &IDB, is_transparent, alphabet_stack[--alphabet_stack_pos]);
-                    while (alphabet_stack_pos!=0);
+                      do
+                        GIF_new_pixel(context, &GIF, &IDB, is_transparent, alphabet_stack[--alphabet_stack_pos]);
+                      while (alphabet_stack_pos!=0);
+                    }
 
-                    alphabet_prefix[alphabet_free  ]=old_code;
-                    alphabet_suffix[alphabet_free++]=GIF.current_code;
+                    // the alphabet is full : wait for a Clear code
+                    if (alphabet_free < 4096)
+                    {
+                      alphabet_prefix[alphabet_free]=old_code;
+                      alphabet_suffix[alphabet_free]=GIF.current_code;
+                      alphabet_length[alphabet_free++]=alphabet_length[old_code] + 1;
+                    }
                     old_code=byte_read;
 
                     if (alphabet_free>alphabet_max)
@@ -708,6 +789,12 @@ void Load_GIF(T_IO_Context * context)
                   }
                 }
 
+                // Output the pixels of an incomplete last line
+                if (GIF.pos_X > 0 && !GIF.stop)
+                  GIF_flush_row(context, &GIF, &IDB, is_transparent, GIF.pos_X);
+                free(GIF.row);
+                GIF.row = NULL;
+
                 if (File_error == 2 && GIF.pos_X == 0 && GIF.pos_Y == IDB.Image_height)
                   File_error=0;
 
@@ -747,10 +834,11 @@ void Load_GIF(T_IO_Context * context)
       early_exit:
 
       // Libération de la mémoire utilisée par les tables & piles de traitement:
+      free(alphabet_length);
       free(alphabet_suffix);
       free(alphabet_prefix);
       free(alphabet_stack);
-      alphabet_suffix = alphabet_prefix = alphabet_stack = NULL;
+      alphabet_length = alphabet_suffix = alphabet_prefix = alphabet_stack = NULL;
     } // Le fichier contenait au moins la signature GIF87a ou GIF89a
     else
       File_error=1;
@@ -782,34 +870,19 @@ static void GIF_empty_buffer(FILE * file, T_GIF_context *gif, byte * GIF_buffer)
 /// Write a code (GIF_nb_bits bits)
 static void GIF_set_code(FILE * GIF_file, T_GIF_context * gif, byte * GIF_buffer, word Code)
 {
-  word nb_bits_to_process = gif->nb_bits;
-  word nb_bits_processed  =0;
-  word current_nb_bits;
+  gif->bits |= (dword)Code << gif->remainder_bits;
+  gif->remainder_bits += gif->nb_bits;
 
-  while (nb_bits_to_process)
+  while (gif->remainder_bits >= 8)
   {
-    current_nb_bits = (nb_bits_to_process <= (8-gif->remainder_bits)) ?
-                          nb_bits_to_process: (8-gif->remainder_bits);
-
-    gif->last_byte |= (Code & ((1<<current_nb_bits)-1))<<gif->remainder_bits;
-    Code>>=current_nb_bits;
-    gif->remainder_bits    +=current_nb_bits;
-    nb_bits_processed  +=current_nb_bits;
-    nb_bits_to_process-=current_nb_bits;
-
-    if (gif->remainder_bits==8) // Il ne reste plus de bits à coder sur l'octet courant
-    {
-      // Ecrire l'octet à balancer:
-      GIF_buffer[++(gif->remainder_byte)] = gif->last_byte;
+    GIF_buffer[++(gif->remainder_byte)] = (byte)gif->bits;
 
-      // Si on a atteint la fin du bloc de Raster Data
-      if (gif->remainder_byte==255)
-        // On doit vider le buffer qui est maintenant plein
-        GIF_empty_buffer(GIF_file, gif, GIF_buffer);
+    // Flush the buffer when a Raster Data block is complete
+    if (gif->remainder_byte==255)
+      GIF_empty_buffer(GIF_file, gif, GIF_buffer);
 
-      gif->last_byte=0;
-      gif->remainder_bits=0;
-    }
+    gif->bits >>= 8;
+    gif->remainder_bits -= 8;
   }
 }
 
@@ -831,11 +904,13 @@ static byte GIF_next_pixel(T_IO_Context *context, T_GIF_context *gif, T_GIF_IDB
   return temp;
 }
 
+/// Size of the hash table of the LZW encoder : a prime number above 4096
+#define GIF_HASH_SIZE 5003
+
+/// LZW encoder dictionary : (prefix code, suffix pixel) -> code
 struct gif_alphabet {
-  word prefix[4096];    // code prefix array
-  word suffix[4096];    // code suffix array
-  word daughter[4096];  // daughter strings array (greater length)
-  word sister[4096];    // sister strings array (same length)
+  dword key[GIF_HASH_SIZE]; // (prefix << 8 | suffix) + 1 of the entry, 0 for a free slot
+  word code[GIF_HASH_SIZE]; // code of the entry
   word free;            // first free slot in the alphabet
   word max;             // maximum number of entry in the alphabet
 };
@@ -847,8 +922,6 @@ void Save_GIF(T_IO_Context * context)
   byte GIF_buffer[256];   // buffer d'écriture de bloc de données compilées
 
   struct gif_alphabet * alphabet;
-  word   start;            // Code précédent (sert au linkage des chaînes)
-  int    descend;          // Booléen "On vient de descendre"
 
   T_GIF_context GIF;
   T_GIF_LSDB LSDB;
@@ -858,7 +931,8 @@ void Save_GIF(T_IO_Context * context)
   byte block_identifier;  // Code indicateur du type de bloc en cours
   word current_string;   // Code de la chaîne en cours de traitement
   byte current_char;         // Caractère à coder
-  word index;            // index de recherche de chaîne
+  int    hash;           // position of the string in the alphabet hash table
+  dword  key;            // (prefix << 8 | suffix) + 1 of the string
   int current_layer;
 
   word clear;   // LZW clear code
@@ -1169,54 +1243,47 @@ void Save_GIF(T_IO_Context * context)
 
                 GIF.pos_X=IDB.Pos_X;
                 GIF.pos_Y=IDB.Pos_Y;
-                GIF.last_byte=0;
+                GIF.bits=0;
                 GIF.remainder_bits=0;
                 GIF.remainder_byte=0;
 
-#define GIF_INVALID_CODE (65535)
-                index=GIF_INVALID_CODE;
                 File_error=0;
                 GIF.stop=0;
 
-                // Réintialisation de la table:
+                // Reinitialize the alphabet
                 alphabet->free = clear + 2;  // 258 for 8bpp
                 GIF.nb_bits = IDB.Nb_bits_pixel + 1; // 9 for 8 bpp
                 alphabet->max = clear+clear-1;  // 511 for 8bpp
                 GIF_set_code(GIF_file, &GIF, GIF_buffer, clear);  //256 for 8bpp
-                for (start=0; start<4096; start++)
-                {
-                  alphabet->daughter[start] = GIF_INVALID_CODE;
-                  alphabet->sister[start] = GIF_INVALID_CODE;
-                }
+                memset(alphabet->key, 0, sizeof(alphabet->key));
 
                 ////////////////////////////////////////////// COMPRESSION LZW //
 
-                start=current_string=GIF_next_pixel(context, &GIF, &IDB);
-                descend=1;
+                current_string=GIF_next_pixel(context, &GIF, &IDB);
 
                 while ((!GIF.stop) && (!File_error))
                 {
                   current_char=GIF_next_pixel(context, &GIF, &IDB);
 
-                  // look for (current_string,current_char) in the alphabet
-                  while ( (index != GIF_INVALID_CODE) &&
-                          ( (current_string != alphabet->prefix[index]) ||
-                            (current_char   != alphabet->suffix[index]) ) )
+                  // look for (current_string,current_char) in the alphabet,
+                  // using open addressing: on a collision, the next slot is
+                  // hash*2 modulo GIF_HASH_SIZE (slot 0 goes on to the last one).
+                  // 2 is a primitive root of 5003, so the probes go through
+                  // all the non-zero slots before coming back to the first.
+                  key = (((dword)current_string << 8) | current_char) + 1;
+                  hash = ((int)current_char << 4) ^ current_string;
+                  while (alphabet->key[hash] != 0 && alphabet->key[hash] != key)
                   {
-                    descend = 0;
-                    start = index;
-                    index = alphabet->sister[index];
+                    hash -= (hash == 0) ? 1 : GIF_HASH_SIZE - hash;
+                    if (hash < 0)
+                      hash += GIF_HASH_SIZE;
                   }
 
-                  if (index != GIF_INVALID_CODE)
+                  if (alphabet->key[hash] == key)
                   {
-                    // (current_string,current_char) == (alphabet_prefix,alphabet_suffix)[index]
                     // We have found (current_string,current_char) in the alphabet
-                    // at the index position. So go on and prepare for then next character
-
-                    descend = 1;
-                    start = current_string = index;
-                    index = alphabet->daughter[index];
+                    // So go on and prepare for then next character
+                    current_string = alphabet->code[hash];
                   }
                   else
                   {
@@ -1225,15 +1292,9 @@ void Save_GIF(T_IO_Context * context)
                     GIF_set_code(GIF_file, &GIF, GIF_buffer, current_string);
 
                     if(alphabet->free < 4096) {
-                      // link current_string and the new one
-                      if (descend)
-                        alphabet->daughter[start] = alphabet->free;
-                      else
-                        alphabet->sister[start] = alphabet->free;
-
                       // add (current_string,current_char) to the alphabet
-                      alphabet->prefix[alphabet->free] = current_string;
-                      alphabet->suffix[alphabet->free] = current_char;
+                      alphabet->key[hash] = key;
+                      alphabet->code[hash] = alphabet->free;
                       alphabet->free++;
                     }
 
@@ -1244,24 +1305,17 @@ void Save_GIF(T_IO_Context * context)
                       alphabet->free=clear+2;  // 258 for 8bpp
                       GIF.nb_bits = IDB.Nb_bits_pixel + 1;  // 9 for 8bpp
                       alphabet->max = clear+clear-1;    // 511 for 8bpp
-                      for (start=0;start<4096;start++)
-                      {
-                        alphabet->daughter[start] = GIF_INVALID_CODE;
-                        alphabet->sister[start] = GIF_INVALID_CODE;
-                      }
+                      memset(alphabet->key, 0, sizeof(alphabet->key));
                     }
                     else if (alphabet->free > (alphabet->max + 1))
                     {
-                      // On augmente le nb de bits
-
+                      // Increase the code size
                       GIF.nb_bits++;
                       alphabet->max = (1<<GIF.nb_bits)-1;
                     }
 
                     // initialize current_string as the string "current_char"
-                    index = alphabet->daughter[current_char];
-                    start = current_string = current_char;
-                    descend = 1;
+                    current_string = current_char;
                   }
                 }
 
@@ -1289,8 +1343,8 @@ void Save_GIF(T_IO_Context * context)
                   if (GIF.remainder_bits!=0)
                   {
                     // Write last byte (this is an incomplete byte)
-                    GIF_buffer[++GIF.remainder_byte]=GIF.last_byte;
-                    GIF.last_byte=0;
+                    GIF_buffer[++GIF.remainder_byte]=(byte)GIF.bits;
+                    GIF.bits=0;
                     GIF.remainder_bits=0;
                   }
                   GIF_empty_buffer(GIF_file, &GIF, GIF_buffer); // On envoie les dernières données du buffer GIF dans le buffer KM
@@ -146,6 +146,9 @@ byte Read_pixel_from_layer(int layer, word x,word y);
 /// Paint a single pixel in image AND optionnaly on screen.
 extern Func_pixel_opt_preview Pixel_in_current_screen_with_opt_preview;
 
+/// Paint a row of pixels in image only.
+void Pixel_row_in_current_screen(word x, word y, word width, const byte * pixels);
+
 /// Update the pixel functions according to the current Image_mode.
 /// Sets ::Pixel_in_current_screen and ::Pixel_in_current_screen_with_preview
 /// through ::Pixel_in_current_screen_with_opt_preview
@@ -282,9 +282,27 @@ void Draw_IFF_line(T_IO_Context *context, const byte * buffer, short y_pos, shor
       Set_pixel_24b(context, x_pos,y_pos, rgb, rgb >> 8, rgb >> 16);  // R is 8 LSB, etc.
     }
   }
-  else for (x_pos=0; x_pos<context->Width; x_pos++)
+  else
   {
-    Set_pixel(context, x_pos, y_pos, Get_IFF_color(buffer, x_pos,real_line_size, bitplanes));
+    // Convert by chunks of 256 pixels and output whole rows of pixels
+    byte pixels[256];
+    short count;
+    int plane, i;
+
+    for (x_pos=0; x_pos<context->Width; x_pos+=count)
+    {
+      count = context->Width - x_pos;
+      if (count > (short)sizeof(pixels))
+        count = sizeof(pixels);
+      memset(pixels, 0, count);
+      for (plane=0; plane<bitplanes; plane++)
+      {
+        const byte * src = buffer + ((real_line_size * plane + x_pos) >> 3);
+        for (i=0; i<count; i++)
+          pixels[i] |= ((src[i>>3] >> (7 - (i&7))) & 1) << plane;
+      }
+      Set_pixel_row(context, x_pos, y_pos, count, pixels);
+    }
   }
 }
 
@@ -394,14 +412,20 @@ static void PBM_Decode(T_IO_Context * context, FILE * file, byte compression, wo
       for (y_pos=0; ((y_pos<height) && (!File_error)); y_pos++)
       {
         if (Read_bytes(file,line_buffer,real_line_size))
-          for (x_pos=0; x_pos<width; x_pos++)
-            Set_pixel(context, x_pos,y_pos,line_buffer[x_pos]);
+          Set_pixel_row(context, 0, y_pos, width, line_buffer);
         else
           File_error=26;
       }
       free(line_buffer);
       break;
     case 1: // Compressed
+      // runs may overflow the line by up to 127 bytes
+      line_buffer=(byte *)malloc(real_line_size + 128);
+      if (line_buffer == NULL)
+      {
+        File_error=1;
+        break;
+      }
       for (y_pos=0; ((y_pos<height) && (!File_error)); y_pos++)
       {
         for (x_pos=0; ((x_pos<real_line_size) && (!File_error)); )
@@ -419,24 +443,22 @@ static void PBM_Decode(T_IO_Context * context, FILE * file, byte compression, wo
               File_error=28;
               break;
             }
-            do {
-              Set_pixel(context, x_pos++,y_pos,color);
-            }
-            while(temp_byte++ != 0);
+            memset(line_buffer + x_pos, color, 257 - temp_byte);
+            x_pos += 257 - temp_byte;
           }
           else
-            do
+          {
+            if (!Read_bytes(file, line_buffer + x_pos, temp_byte + 1))
             {
-              if(Read_byte(file, &color)!=1)
-              {
-                File_error=29;
-                break;
-              }
-              Set_pixel(context, x_pos++,y_pos,color);
+              File_error=29;
+              break;
             }
-            while(temp_byte-- > 0);
+            x_pos += temp_byte + 1;
+          }
         }
+        Set_pixel_row(context, 0, y_pos, (x_pos < width) ? x_pos : width, line_buffer);
       }
+      free(line_buffer);
       break;
     default:
       GFX2_Log(GFX2_ERROR, "PBM only supports compression type 0 and 1 (not %d)\n", compression);
@@ -1842,6 +1842,7 @@ int Load_CFG(int reload_all)
         {
           if (!Read_bytes(Handle, Exclude_color, 256))
             goto Erreur_lecture_config;
+          Invalidate_best_color_cache();
         }
         else
         {
@@ -2383,6 +2384,7 @@ void Set_config_defaults(void)
   // Exclude colors
   for (index=0; index<256; index++)
     Exclude_color[index]=0;
+  Invalidate_best_color_cache();
 
   // Quick shade
   Quick_shade_step=1;
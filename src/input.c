@@ -38,6 +38,7 @@
 #ifdef USE_X11
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/select.h>
 #include <X11/Xlib.h>
 #include <X11/XKBlib.h>
 #include <X11/Xutil.h>
@@ -76,6 +77,20 @@ extern Window X11_window;
 // In case this is annoying for some platforms, disable it.
 
 static int Color_cycling(void);
+static int Input_wait_delay(int sleep_time);
+
+/// Longest wait of Get_input(GET_INPUT_IDLE), in milliseconds.
+/// All timers should be known to Input_wait_delay(), this is only a safety.
+#define INPUT_IDLE_MAX_DELAY 1000
+/// Longest wait of Get_input() while the cursor is moved by the joystick
+/// or the keyboard, in milliseconds
+#define INPUT_EMULATION_DELAY 10
+/// Longest wait of Get_input() with SDL 1.2, which can't wake up when an
+/// event arrives: the events are polled at this interval, in milliseconds
+#define INPUT_POLL_DELAY 10
+
+/// Time of the first call to Color_cycling(), the start of the cycles
+static long Cycling_start = 0;
 
 // public Globals (available as extern)
 
@@ -1944,8 +1959,17 @@ int Get_input(int sleep_time)
     GFX2_UpdateScreen();
 #endif
     // Nothing significant happened
+    sleep_time = Input_wait_delay(sleep_time);
+#if defined(USE_SDL2)
+    // Wake up as soon as an event arrives, it stays in the queue
+    if (sleep_time)
+      SDL_WaitEventTimeout(NULL, sleep_time);
+#else
+    if (sleep_time > INPUT_POLL_DELAY)
+      sleep_time = INPUT_POLL_DELAY;
     if (sleep_time)
       SDL_Delay(sleep_time);
+#endif
 #elif defined(WIN32)
     MSG msg;
 
@@ -1993,6 +2017,7 @@ int Get_input(int sleep_time)
       }
       return 1;
     }
+    sleep_time = Input_wait_delay(sleep_time);
     if (sleep_time == 0)
       sleep_time = 20;  // default of 20 ms
     // TODO : we should check where Get_input(0) is called
@@ -2215,12 +2240,74 @@ int Get_input(int sleep_time)
     if (user_feedback_required)
       return 1;
     // Nothing significant happened
-    if (sleep_time)
-      usleep(1000 * sleep_time);
+    sleep_time = Input_wait_delay(sleep_time);
+    if (sleep_time && XPending(X11_display) == 0)
+    {
+      // Wait for data from the X server, or the timeout
+      int fd = ConnectionNumber(X11_display);
+      fd_set fds;
+      struct timeval timeout;
+
+      FD_ZERO(&fds);
+      FD_SET(fd, &fds);
+      timeout.tv_sec = sleep_time / 1000;
+      timeout.tv_usec = (sleep_time % 1000) * 1000;
+      select(fd + 1, &fds, NULL, NULL, &timeout);
+    }
 #endif
     return 0;
 }
 
+/// Time until the next step of the color cycling, in milliseconds,
+/// or -1 when the palette doesn't cycle
+static int Color_cycling_delay(void)
+{
+  const T_Gradient_range * range;
+  long elapsed;
+  int delay = -1;
+  int i;
+
+  if (!Allow_colorcycling || !Cycling_mode || Cycling_start == 0)
+    return -1;
+  elapsed = GFX2_GetTicks() - Cycling_start;
+  for (i=0; i<16; i++)
+  {
+    range = &Main.backups->Pages->Gradients->Range[i];
+    if (range->End > range->Start && range->Speed)
+    {
+      // Same period as in Color_cycling()
+      int period = (int)(1000.0/(range->Speed*0.2856));
+      int next;
+
+      if (period < 1)
+        period = 1;
+      next = period - elapsed % period;
+      if (delay < 0 || next < delay)
+        delay = next;
+    }
+  }
+  return delay;
+}
+
+/// Compute how long Get_input() can wait for an event, so the timers
+/// of the program are not late.
+/// @param sleep_time the longest wait asked by the caller, or GET_INPUT_IDLE
+/// @return the delay in milliseconds, 0 for no wait
+static int Input_wait_delay(int sleep_time)
+{
+  int delay;
+
+  if (sleep_time == GET_INPUT_IDLE)
+    sleep_time = INPUT_IDLE_MAX_DELAY;
+  delay = Color_cycling_delay();
+  if (delay >= 0 && delay < sleep_time)
+    sleep_time = delay;
+  // The cursor moved by the joystick or the keyboard needs regular calls
+  if (Directional_first_move != 0 && sleep_time > INPUT_EMULATION_DELAY)
+    sleep_time = INPUT_EMULATION_DELAY;
+  return sleep_time;
+}
+
 void Adjust_mouse_sensitivity(word fullscreen)
 {
   // Deprecated
@@ -2236,12 +2323,11 @@ static int Color_cycling(void)
   int len;
   
   long now;
-  static long start=0;
   
-  if (start==0)
+  if (Cycling_start==0)
   {
     // First run
-    start = GFX2_GetTicks();
+    Cycling_start = GFX2_GetTicks();
     return 1;
   }
   if (!Allow_colorcycling || !Cycling_mode)
@@ -2260,7 +2346,7 @@ static int Color_cycling(void)
     {
       int new_offset;
       
-      new_offset=(now-start)/(int)(1000.0/(range->Speed*0.2856)) % len;
+      new_offset=(now-Cycling_start)/(int)(1000.0/(range->Speed*0.2856)) % len;
       if (!range->Inverse)
         new_offset=len - new_offset;
       
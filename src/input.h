@@ -37,8 +37,16 @@
 /// The latest input variables are held in ::Key, ::Key_ANSI, ::Key_UNICODE, ::Mouse_X, ::Mouse_Y, ::Mouse_K.
 /// Note that ::Key, ::Key_ANSI and ::Key_UNICODE are not persistent, they will be reset to 0
 /// on subsequent calls to ::Get_input().
+/// When nothing happened, it waits at most @p sleep_time milliseconds for
+/// the next event, and returns as soon as one arrives.
+/// With ::GET_INPUT_IDLE, it waits until the next event or the next timer
+/// of the program (color cycling...). SDL 1.2 can't wait for an event, it
+/// still polls the events every few milliseconds.
 int  Get_input(int sleep_time);
 
+/// Value of the Get_input() @p sleep_time to wait while the program is idle
+#define GET_INPUT_IDLE (-1)
+
 /// Returns true if the keycode has been set as a keyboard shortcut for the function.
 int Is_shortcut(word key, word function);
 
@@ -40,12 +40,14 @@
 void Layer_activate(int layer, short side)
 {
   dword old_layers;
+  int old_current_layer;
 
   if (layer >= Main.backups->Pages->Nb_layers)
     return;
   
   // Keep a copy of which layers were visible
   old_layers = Main.layers_visible;
+  old_current_layer = Main.current_layer;
   
   if (Main.backups->Pages->Image_mode != IMAGE_MODE_ANIMATION)
   {
@@ -94,7 +96,15 @@ void Layer_activate(int layer, short side)
 
   Hide_cursor();
   if (Main.layers_visible != old_layers)
-    Redraw_layered_image();
+  {
+    // The depth buffer depends on the current layer: when it changes, the
+    // whole image is redrawn. Toggling the visibility of the current layer
+    // itself can still be done incrementally.
+    if (Main.current_layer == old_current_layer)
+      Redraw_layers_visibility_change(old_layers);
+    else
+      Redraw_layered_image();
+  }
   else
     Update_depth_buffer(); // Only need the depth buffer
   //Download_infos_page_main(Main.backups->Pages);
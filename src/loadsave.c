@@ -25,6 +25,12 @@
 #ifndef _MSC_VER
 #include <unistd.h>
 #endif
+#if defined(__unix__) || defined(__macosx__) || defined(__HAIKU__)
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#define SAFETY_BACKUP_USE_FORK
+#endif
 #if defined(WIN32)
 #include <windows.h>
 #if defined(_MSC_VER)
@@ -72,6 +78,7 @@
 #include "filesel.h"
 #include "unicode.h"
 #include "fileformats.h"
+#include "thumbcache.h"
 #include "bitcount.h"
 
 #if defined(USE_X11) || (defined(SDL_VIDEO_DRIVER_X11) && !defined(NO_X11))
@@ -171,6 +178,173 @@ unsigned int Nb_known_formats(void)
   return sizeof(File_formats)/sizeof(File_formats[0]);
 }
 
+/// Signature (magic number) of a file format
+typedef struct {
+  enum FILE_FORMATS Identifier; ///< Format which requires this signature
+  byte Offset;                  ///< Position of the signature in the file
+  byte Length;                  ///< Length of the signature in bytes
+  const char * Signature;       ///< The signature bytes
+} T_Format_signature;
+
+/// Number of bytes read at the start of a file to look for the signatures
+#define SIGNATURE_HEADER_SIZE 16
+
+/// Signatures of the formats whose Test function only accepts files
+/// starting with a magic number. A format can have several entries.
+/// The formats not listed here are always tested.
+static const T_Format_signature Format_signatures[] = {
+  {FORMAT_GIF,  0, 4, "GIF8"},
+  {FORMAT_PNG,  0, 8, "\x89PNG\r\n\x1a\n"},
+  {FORMAT_BMP,  0, 2, "BM"},
+  {FORMAT_PCX,  0, 1, "\x0a"},
+  {FORMAT_PKM,  0, 4, "PKM\0"},
+  {FORMAT_LBM,  0, 4, "FORM"},
+  {FORMAT_PBM,  0, 4, "FORM"},
+  {FORMAT_ACBM, 0, 4, "FORM"},
+  {FORMAT_IMG,  0, 6, "\x01\x00\x47\x12\x6d\xb0"},
+  {FORMAT_SCx,  0, 3, "RIX"},
+  {FORMAT_PRG,  0, 2, "\x01\x08"},
+  {FORMAT_GPL,  0, 12, "GIMP Palette"},
+  {FORMAT_ICO,  0, 4, "\0\0\x01\0"},
+  {FORMAT_ICO,  0, 4, "\0\0\x02\0"},
+  {FORMAT_INFO, 0, 4, "\xe3\x10\0\x01"},
+  {FORMAT_FLI,  4, 2, "\x11\xaf"},
+  {FORMAT_FLI,  4, 2, "\x12\xaf"},
+  {FORMAT_2GS,  4, 5, "\x04MAIN"},
+  {FORMAT_TIFF, 0, 4, "MM\0*"},
+  {FORMAT_TIFF, 0, 4, "II*\0"},
+  {FORMAT_GRB,  0, 8, "HPHP48-R"},
+  {FORMAT_MSX,  0, 1, "\xfe"},
+};
+
+/// Check a file header against the signatures of a format
+/// @return 1 if one of the signatures of the format is found
+/// @return 0 if none of them is found
+/// @return -1 if the format has no known signature
+static int Check_format_signature(enum FILE_FORMATS format, const byte * header, size_t header_size)
+{
+  unsigned int i;
+  int result = -1;
+
+  for (i = 0; i < sizeof(Format_signatures)/sizeof(Format_signatures[0]); i++)
+  {
+    const T_Format_signature * signature = Format_signatures + i;
+
+    if (signature->Identifier != format)
+      continue;
+    if ((size_t)signature->Offset + signature->Length <= header_size
+        && memcmp(header + signature->Offset, signature->Signature, signature->Length) == 0)
+      return 1;
+    result = 0;
+  }
+  return result;
+}
+
+/// Check if the extension of a file name is in a list of extensions
+static int Check_extension_list(const char * file_name, const char * extensions)
+{
+  const char * ext = NULL;
+  int pos = Position_last_dot(file_name);
+
+  if (pos < 0)
+    return 0;
+  ext = file_name + pos + 1;
+  while (*extensions != '\0')
+  {
+    if (Check_extension(ext, extensions))
+      return 1;
+    extensions += strcspn(extensions, ";");
+    if (*extensions == ';')
+      extensions++;
+  }
+  return 0;
+}
+
+/// Find the formats which may recognize a file, in the order to test them.
+///
+/// The start of the file is read once and checked against
+/// Format_signatures[] :
+/// - first come the formats whose signature is found,
+/// - then the formats without a known signature, those matching the file
+///   extension first.
+///
+/// The formats whose signature isn't found are left out, so only a few
+/// Test functions are called for any file.
+/// @param context the IO context, for the file name
+/// @param f the opened file
+/// @param candidates receives the formats to test
+/// @return the number of formats in candidates
+static int Find_candidate_formats(T_IO_Context * context, FILE * f, const T_Format ** candidates)
+{
+  byte header[SIGNATURE_HEADER_SIZE];
+  size_t header_size;
+  int count = 0;
+  int pass;
+  int id;
+
+  fseek(f, 0, SEEK_SET);
+  header_size = fread(header, 1, sizeof(header), f);
+
+  for (pass = 0; pass < 3; pass++)
+  {
+    for (id = FORMAT_ALL_FILES + 1; id < FORMAT_CLIPBOARD; id++)
+    {
+      const T_Format * format = Get_fileformat(id);
+      int signature;
+
+      // the format is not compiled in, or cannot be loaded
+      if ((int)format->Identifier != id || format->Test == NULL)
+        continue;
+      signature = Check_format_signature(format->Identifier, header, header_size);
+      if (pass == 0 && signature <= 0)
+        continue;
+      if (pass > 0)
+      {
+        if (signature >= 0)
+          continue;
+        if (Check_extension_list(context->File_name, format->Extensions) != (pass == 1))
+          continue;
+      }
+      candidates[count++] = format;
+    }
+  }
+  return count;
+}
+
+/// Store a pixel in the preview bitmap (on load)
+static void Set_preview_pixel(T_IO_Context *context, short x_pos, short y_pos, byte color)
+{
+  // Skip pixels of transparent index if :
+  // it's a layer above the first one
+  if (color == context->Transparent_color && context->Current_layer > 0)
+    return;
+
+  if (((x_pos % context->Preview_factor_X)==0) && ((y_pos % context->Preview_factor_Y)==0))
+  {
+    // Tag the color as 'used'
+    context->Preview_usage[color]=1;
+
+    // Store pixel
+    if (context->Ratio == PIXEL_WIDE &&
+      Pixel_ratio != PIXEL_WIDE &&
+      Pixel_ratio != PIXEL_WIDE2)
+    {
+      context->Preview_bitmap[x_pos/context->Preview_factor_X*2 + (y_pos/context->Preview_factor_Y)*PREVIEW_WIDTH*Menu_factor_X]=color;
+      context->Preview_bitmap[x_pos/context->Preview_factor_X*2+1 + (y_pos/context->Preview_factor_Y)*PREVIEW_WIDTH*Menu_factor_X]=color;
+    }
+    else if (context->Ratio == PIXEL_TALL &&
+      Pixel_ratio != PIXEL_TALL &&
+      Pixel_ratio != PIXEL_TALL2 &&
+      Pixel_ratio != PIXEL_TALL3)
+    {
+      context->Preview_bitmap[x_pos/context->Preview_factor_X + (y_pos/context->Preview_factor_Y*2)*PREVIEW_WIDTH*Menu_factor_X]=color;
+      context->Preview_bitmap[x_pos/context->Preview_factor_X + (y_pos/context->Preview_factor_Y*2+1)*PREVIEW_WIDTH*Menu_factor_X]=color;
+    }
+    else
+      context->Preview_bitmap[x_pos/context->Preview_factor_X + (y_pos/context->Preview_factor_Y)*PREVIEW_WIDTH*Menu_factor_X]=color;
+  }
+}
+
 /// Set the color of a pixel (on load)
 void Set_pixel(T_IO_Context *context, short x_pos, short y_pos, byte color)
 {
@@ -193,36 +367,7 @@ void Set_pixel(T_IO_Context *context, short x_pos, short y_pos, byte color)
 
     // Chargement des pixels dans la preview
     case CONTEXT_PREVIEW:
-      // Skip pixels of transparent index if :
-      // it's a layer above the first one
-      if (color == context->Transparent_color && context->Current_layer > 0)
-        break;
-
-      if (((x_pos % context->Preview_factor_X)==0) && ((y_pos % context->Preview_factor_Y)==0))
-      {
-        // Tag the color as 'used'
-        context->Preview_usage[color]=1;
-
-        // Store pixel
-        if (context->Ratio == PIXEL_WIDE &&
-          Pixel_ratio != PIXEL_WIDE &&
-          Pixel_ratio != PIXEL_WIDE2)
-        {
-          context->Preview_bitmap[x_pos/context->Preview_factor_X*2 + (y_pos/context->Preview_factor_Y)*PREVIEW_WIDTH*Menu_factor_X]=color;
-          context->Preview_bitmap[x_pos/context->Preview_factor_X*2+1 + (y_pos/context->Preview_factor_Y)*PREVIEW_WIDTH*Menu_factor_X]=color;
-        }
-        else if (context->Ratio == PIXEL_TALL &&
-          Pixel_ratio != PIXEL_TALL &&
-          Pixel_ratio != PIXEL_TALL2 &&
-          Pixel_ratio != PIXEL_TALL3)
-        {
-          context->Preview_bitmap[x_pos/context->Preview_factor_X + (y_pos/context->Preview_factor_Y*2)*PREVIEW_WIDTH*Menu_factor_X]=color;
-          context->Preview_bitmap[x_pos/context->Preview_factor_X + (y_pos/context->Preview_factor_Y*2+1)*PREVIEW_WIDTH*Menu_factor_X]=color;
-        }
-        else
-          context->Preview_bitmap[x_pos/context->Preview_factor_X + (y_pos/context->Preview_factor_Y)*PREVIEW_WIDTH*Menu_factor_X]=color;
-      }
-
+      Set_preview_pixel(context, x_pos, y_pos, color);
       break;
 
     // Load pixels into a Surface
@@ -238,6 +383,55 @@ void Set_pixel(T_IO_Context *context, short x_pos, short y_pos, byte color)
 
 }
 
+/// Set the colors of consecutive pixels of a line (on load)
+void Set_pixel_row(T_IO_Context *context, short x_pos, short y_pos, int width, const byte * pixels)
+{
+  int i;
+
+  // Clipping
+  if (y_pos < 0 || y_pos >= context->Height)
+    return;
+  if (x_pos < 0)
+  {
+    pixels -= x_pos;
+    width += x_pos;
+    x_pos = 0;
+  }
+  if (x_pos + width > context->Width)
+    width = context->Width - x_pos;
+  if (width <= 0)
+    return;
+
+  switch (context->Type)
+  {
+    case CONTEXT_MAIN_IMAGE:
+      Pixel_row_in_current_screen(x_pos, y_pos, width, pixels);
+      break;
+
+    case CONTEXT_BRUSH:
+      memcpy(context->Buffer_image + y_pos * context->Pitch + x_pos, pixels, width);
+      break;
+
+    case CONTEXT_PREVIEW:
+      for (i = 0; i < width; i++)
+        Set_preview_pixel(context, x_pos + i, y_pos, pixels[i]);
+      break;
+
+    case CONTEXT_SURFACE:
+      if (y_pos < context->Surface->h && x_pos < context->Surface->w)
+      {
+        if (x_pos + width > context->Surface->w)
+          width = context->Surface->w - x_pos;
+        memcpy(context->Surface->pixels + y_pos * context->Surface->w + x_pos, pixels, width);
+      }
+      break;
+
+    case CONTEXT_PALETTE:
+    case CONTEXT_PREVIEW_PALETTE:
+      break;
+  }
+}
+
 void Fill_canvas(T_IO_Context *context, byte color)
 {
   switch (context->Type)
@@ -368,12 +562,67 @@ enum IMAGE_MODES Get_image_mode(T_IO_Context *context)
   return IMAGE_MODE_LAYERED;
 }
 
+///
+/// Display the informations about a picture being previewed in the
+/// file selector, and clear the previous preview.
+static void Display_preview_infos(const T_IO_Context *context, int format)
+{
+  char  str[10];
+
+  // Affichage des données "Image size:"
+  memcpy(str, "VERY BIG!", 10); // default string
+  if (context->Original_width != 0)
+  {
+    if (context->Original_width < 10000 && context->Original_height < 10000)
+      snprintf(str, sizeof(str), "%4hux%4hu", context->Original_width, context->Original_height);
+  }
+  else if ((context->Width<10000) && (context->Height<10000))
+  {
+    snprintf(str, sizeof(str), "%4hux%4hu", context->Width, context->Height);
+  }
+  Print_in_window(101,59,str,MC_Black,MC_Light);
+  snprintf(str, sizeof(str), "%2dbpp", context->bpp);
+  Print_in_window(181,59,str,MC_Black,MC_Light);
+
+  // Affichage de la taille du fichier
+  if (context->File_size<1048576)
+  {
+    // Le fichier fait moins d'un Mega, on affiche sa taille direct
+    Num2str(context->File_size,str,7);
+  }
+  else if (((context->File_size+512)/1024)<100000)
+  {
+    // Le fichier fait plus d'un Mega, on peut afficher sa taille en Ko
+    Num2str((context->File_size+512)/1024,str,5);
+    strcpy(str+5,"KB");
+  }
+  else
+  {
+    // Le fichier fait plus de 100 Mega octets (cas très rare :))
+    memcpy(str,"LARGE!!",8);
+  }
+  Print_in_window(236,59,str,MC_Black,MC_Light);
+
+  // Affichage du vrai format
+  Print_in_window( 59,59,Get_fileformat(format)->Label,MC_Black,MC_Light);
+
+  // On efface le commentaire précédent
+  Window_rectangle(45,70,32*8,8,MC_Light);
+
+  // On nettoie la zone où va s'afficher la preview:
+  Window_rectangle(183,95,PREVIEW_WIDTH,PREVIEW_HEIGHT,MC_Light);
+
+  // Un update pour couvrir les 4 zones: 3 libellés plus le commentaire
+  Update_window_area(45,48,256,30);
+  // Zone de preview
+  Update_window_area(183,95,PREVIEW_WIDTH,PREVIEW_HEIGHT);
+}
+
 ///
 /// Generic allocation and similar stuff, done at beginning of image load,
 /// as soon as size is known.
 void Pre_load(T_IO_Context *context, short width, short height, long file_size, int format, enum PIXEL_RATIO ratio, byte bpp)
 {
-  char  str[10];
   byte truecolor;
 
   if (width < 0 || width > 9999 || height < 0 || height > 9999)
@@ -404,45 +653,7 @@ void Pre_load(T_IO_Context *context, short width, short height, long file_size,
       if (!context->Preview_bitmap)
         File_error=1;
 
-      // Affichage des données "Image size:"
-      memcpy(str, "VERY BIG!", 10); // default string
-      if (context->Original_width != 0)
-      {
-        if (context->Original_width < 10000 && context->Original_height < 10000)
-          snprintf(str, sizeof(str), "%4hux%4hu", context->Original_width, context->Original_height);
-      }
-      else if ((width<10000) && (height<10000))
-      {
-        snprintf(str, sizeof(str), "%4hux%4hu", width, height);
-      }
-      Print_in_window(101,59,str,MC_Black,MC_Light);
-      snprintf(str, sizeof(str), "%2dbpp", bpp);
-      Print_in_window(181,59,str,MC_Black,MC_Light);
-
-      // Affichage de la taille du fichier
-      if (file_size<1048576)
-      {
-        // Le fichier fait moins d'un Mega, on affiche sa taille direct
-        Num2str(file_size,str,7);
-      }
-      else if (((file_size+512)/1024)<100000)
-      {
-        // Le fichier fait plus d'un Mega, on peut afficher sa taille en Ko
-        Num2str((file_size+512)/1024,str,5);
-        strcpy(str+5,"KB");
-      }
-      else
-      {
-        // Le fichier fait plus de 100 Mega octets (cas très rare :))
-        memcpy(str,"LARGE!!",8);
-      }
-      Print_in_window(236,59,str,MC_Black,MC_Light);
-
-      // Affichage du vrai format
-      Print_in_window( 59,59,Get_fileformat(format)->Label,MC_Black,MC_Light);
-
-      // On efface le commentaire précédent
-      Window_rectangle(45,70,32*8,8,MC_Light);
+      context->File_size=file_size;
 
       // Calcul des données nécessaires à l'affichage de la preview:
       if (ratio == PIXEL_WIDE &&
@@ -469,13 +680,8 @@ void Pre_load(T_IO_Context *context, short width, short height, long file_size,
       context->Preview_pos_X=Window_pos_X+183*Menu_factor_X;
       context->Preview_pos_Y=Window_pos_Y+ 95*Menu_factor_Y;
 
-      // On nettoie la zone où va s'afficher la preview:
-      Window_rectangle(183,95,PREVIEW_WIDTH,PREVIEW_HEIGHT,MC_Light);
-
-      // Un update pour couvrir les 4 zones: 3 libellés plus le commentaire
-      Update_window_area(45,48,256,30);
-      // Zone de preview
-      Update_window_area(183,95,PREVIEW_WIDTH,PREVIEW_HEIGHT);
+      if (!context->Preview_headless)
+        Display_preview_infos(context, format);
       break;
 
     // Other loading
@@ -574,6 +780,101 @@ void Pre_load(T_IO_Context *context, short width, short height, long file_size,
 
 /////////////////////////////////////////////////////////////////////////////
 
+void Get_preview_size(const T_IO_Context *context, int *width, int *height)
+{
+  *width=context->Width/context->Preview_factor_X;
+  *height=context->Height/context->Preview_factor_Y;
+  if (context->Ratio == PIXEL_WIDE &&
+      Pixel_ratio != PIXEL_WIDE &&
+      Pixel_ratio != PIXEL_WIDE2)
+    *width*=2;
+  else if (context->Ratio == PIXEL_TALL &&
+      Pixel_ratio != PIXEL_TALL &&
+      Pixel_ratio != PIXEL_TALL2 &&
+      Pixel_ratio != PIXEL_TALL3)
+    *height*=2;
+}
+
+///
+/// Display a loaded preview in the file selector: adapt the palette to
+/// the GUI, then draw the picture (or the palette) and the comment.
+static void Display_preview(T_IO_Context *context)
+{
+  // Try to adapt the palette to accomodate the GUI.
+  int c;
+  int count_unused;
+  byte unused_color[4];
+
+  if (context->Type == CONTEXT_PREVIEW && context->bpp > 8)
+    Set_palette_fake_24b(context->Palette);
+
+  count_unused=0;
+  // Try find 4 unused colors and insert good colors there
+  for (c=255; c>=0 && count_unused<4; c--)
+  {
+    if (!context->Preview_usage[c])
+    {
+      unused_color[count_unused]=c;
+      count_unused++;
+    }
+  }
+  // Found! replace them with some favorites
+  if (count_unused==4)
+  {
+    int gui_index;
+    for (gui_index=0; gui_index<4; gui_index++)
+    {
+      context->Palette[unused_color[gui_index]]=*Favorite_GUI_color(gui_index);
+    }
+  }
+  // All preview display is here
+
+  // Update palette and screen first
+  Compute_optimal_menu_colors(context->Palette);
+  Remap_screen_after_menu_colors_change();
+  Set_palette(context->Palette);
+
+  // Display palette preview
+  if (Get_fileformat(context->Format)->Palette_only
+      || context->Type == CONTEXT_PREVIEW_PALETTE)
+  {
+    short index;
+
+    if (context->Type == CONTEXT_PREVIEW || context->Type == CONTEXT_PREVIEW_PALETTE)
+      for (index=0; index<256; index++)
+        Window_rectangle(183+(index/16)*7,95+(index&15)*5,5,5,index);
+
+  }
+  // Display normal image
+  else if (context->Preview_bitmap)
+  {
+    int x_pos,y_pos;
+    int width,height;
+
+    Get_preview_size(context, &width, &height);
+
+    for (y_pos=0; y_pos<height;y_pos++)
+      for (x_pos=0; x_pos<width;x_pos++)
+      {
+        byte color=context->Preview_bitmap[x_pos+y_pos*PREVIEW_WIDTH*Menu_factor_X];
+
+        // Skip transparent if image has transparent background.
+        if (color == context->Transparent_color && context->Background_transparent)
+          color=MC_Window;
+
+        Pixel(context->Preview_pos_X+x_pos,
+              context->Preview_pos_Y+y_pos,
+              color);
+      }
+  }
+  // Refresh modified part
+  Update_window_area(183,95,PREVIEW_WIDTH,PREVIEW_HEIGHT);
+
+  // Preview comment
+  Print_in_window(45,70,context->Comment,MC_Black,MC_Light);
+  //Update_window_area(45,70,32*8,8);
+}
+
 // -- Charger n'importe connu quel type de fichier d'image (ou palette) -----
 void Load_image(T_IO_Context *context)
 {
@@ -582,10 +883,24 @@ void Load_image(T_IO_Context *context)
   int i;
   byte old_cursor_shape;
   FILE * f;
+  byte cacheable_preview;
 
   // Not sure it's the best place...
   context->Color_cycles=0;
 
+  // Previews of files already seen are taken from the thumbnail cache
+  cacheable_preview = (context->Type == CONTEXT_PREVIEW
+      && context->Format != FORMAT_CLIPBOARD
+      && context->File_name != NULL);
+  if (cacheable_preview && !context->Preview_headless
+      && Thumbnail_cache_load(context) == 0)
+  {
+    File_error=0;
+    Display_preview_infos(context, context->Format);
+    Display_preview(context);
+    return;
+  }
+
   // On place par défaut File_error à vrai au cas où on ne sache pas
   // charger le format du fichier:
   File_error=1;
@@ -604,7 +919,8 @@ void Load_image(T_IO_Context *context)
     if (context->File_name == NULL)
     {
       GFX2_Log(GFX2_ERROR, "Load_Image() called with NULL file name\n");
-      Error(0);
+      if (!context->Preview_headless)
+        Error(0);
       return;
     }
 
@@ -612,7 +928,8 @@ void Load_image(T_IO_Context *context)
     if (f == NULL)
     {
       GFX2_Log(GFX2_WARNING, "Cannot open file for reading\n");
-      Error(0);
+      if (!context->Preview_headless)
+        Error(0);
       return;
     }
 
@@ -627,14 +944,15 @@ void Load_image(T_IO_Context *context)
     {
       //  Sinon, on va devoir scanner les différents formats qu'on connait pour
       // savoir à quel format est le fichier:
-      for (index=0; index < Nb_known_formats(); index++)
+      const T_Format * candidates[sizeof(File_formats)/sizeof(File_formats[0])];
+      int nb_candidates = Find_candidate_formats(context, f, candidates);
+
+      for (index=0; index < (unsigned int)nb_candidates; index++)
       {
-        format = Get_fileformat(index);
-        // Loadable format
-        if (format->Test == NULL)
-          continue;
+        format = candidates[index];
 
         fseek(f, 0, SEEK_SET); // rewind
+        File_error = 1;
         // On appelle le testeur du format:
         format->Test(context, f);
         // On s'arrête si le fichier est au bon format:
@@ -682,7 +1000,7 @@ void Load_image(T_IO_Context *context)
     if (File_error>0)
     {
       GFX2_Log(GFX2_WARNING, "Unable to load file %s (error %d)! format:%s\n", context->File_name, File_error, format->Label);
-      if (context->Type!=CONTEXT_SURFACE)
+      if (context->Type!=CONTEXT_SURFACE && !context->Preview_headless)
         Error(0);
     }
   }
@@ -703,7 +1021,7 @@ void Load_image(T_IO_Context *context)
           Cursor_shape=CURSOR_SHAPE_HOURGLASS;
           Display_cursor();
           Flush_update();
-          if (Convert_24b_bitmap_to_256(Main.backups->Pages->Image[0].Pixels,context->Buffer_image_24b,context->Width,context->Height,context->Palette))
+          if (Convert_24b_bitmap_to_256(Main.backups->Pages->Image[0].Pixels,context->Buffer_image_24b,context->Width,context->Height,context->Palette,(enum QUANTIZER)Config.Quantizer,Config.Dither_24b))
             File_error=2;
           Hide_cursor();
           Cursor_shape=old_cursor_shape;
@@ -717,7 +1035,7 @@ void Load_image(T_IO_Context *context)
           Cursor_shape=CURSOR_SHAPE_HOURGLASS;
           Display_cursor();
           Flush_update();
-          if (Convert_24b_bitmap_to_256(context->Buffer_image,context->Buffer_image_24b,context->Width,context->Height,context->Palette))
+          if (Convert_24b_bitmap_to_256(context->Buffer_image,context->Buffer_image_24b,context->Width,context->Height,context->Palette,(enum QUANTIZER)Config.Quantizer,Config.Dither_24b))
             File_error=2;
           Hide_cursor();
           Cursor_shape=old_cursor_shape;
@@ -730,7 +1048,7 @@ void Load_image(T_IO_Context *context)
           break;
 
         case CONTEXT_SURFACE:
-          if (Convert_24b_bitmap_to_256(context->Surface->pixels,context->Buffer_image_24b,context->Width,context->Height,context->Palette))
+          if (Convert_24b_bitmap_to_256(context->Surface->pixels,context->Buffer_image_24b,context->Width,context->Height,context->Palette,(enum QUANTIZER)Config.Quantizer,Config.Dither_24b))
           File_error=1;
           break;
 
@@ -800,6 +1118,7 @@ void Load_image(T_IO_Context *context)
       }
       // Copy the loaded palette
       memcpy(Main.palette, context->Palette, sizeof(T_Palette));
+      Invalidate_best_color_cache();
       memcpy(Main.backups->Pages->Palette, context->Palette, sizeof(T_Palette));
 
       // For formats that handle more than just the palette:
@@ -894,6 +1213,7 @@ void Load_image(T_IO_Context *context)
       Backup_layers(LAYER_NONE);
       // Copy the loaded palette
       memcpy(Main.palette, context->Palette, sizeof(T_Palette));
+      Invalidate_best_color_cache();
       memcpy(Main.backups->Pages->Palette, context->Palette, sizeof(T_Palette));
     }
   }
@@ -925,90 +1245,10 @@ void Load_image(T_IO_Context *context)
     /*&& !context->Buffer_image_24b*/
     /*&& !Get_fileformat(context->Format)->Palette_only*/)
   {
-
-    // Try to adapt the palette to accomodate the GUI.
-    int c;
-    int count_unused;
-    byte unused_color[4];
-
-    if (context->Type == CONTEXT_PREVIEW && context->bpp > 8)
-      Set_palette_fake_24b(context->Palette);
-
-    count_unused=0;
-    // Try find 4 unused colors and insert good colors there
-    for (c=255; c>=0 && count_unused<4; c--)
-    {
-      if (!context->Preview_usage[c])
-      {
-        unused_color[count_unused]=c;
-        count_unused++;
-      }
-    }
-    // Found! replace them with some favorites
-    if (count_unused==4)
-    {
-      int gui_index;
-      for (gui_index=0; gui_index<4; gui_index++)
-      {
-        context->Palette[unused_color[gui_index]]=*Favorite_GUI_color(gui_index);
-      }
-    }
-    // All preview display is here
-
-    // Update palette and screen first
-    Compute_optimal_menu_colors(context->Palette);
-    Remap_screen_after_menu_colors_change();
-    Set_palette(context->Palette);
-
-    // Display palette preview
-    if (Get_fileformat(context->Format)->Palette_only
-        || context->Type == CONTEXT_PREVIEW_PALETTE)
-    {
-      short index;
-
-      if (context->Type == CONTEXT_PREVIEW || context->Type == CONTEXT_PREVIEW_PALETTE)
-        for (index=0; index<256; index++)
-          Window_rectangle(183+(index/16)*7,95+(index&15)*5,5,5,index);
-
-    }
-    // Display normal image
-    else if (context->Preview_bitmap)
-    {
-      int x_pos,y_pos;
-      int width,height;
-      width=context->Width/context->Preview_factor_X;
-      height=context->Height/context->Preview_factor_Y;
-      if (context->Ratio == PIXEL_WIDE &&
-          Pixel_ratio != PIXEL_WIDE &&
-          Pixel_ratio != PIXEL_WIDE2)
-        width*=2;
-      else if (context->Ratio == PIXEL_TALL &&
-          Pixel_ratio != PIXEL_TALL &&
-          Pixel_ratio != PIXEL_TALL2 &&
-          Pixel_ratio != PIXEL_TALL3)
-        height*=2;
-
-      for (y_pos=0; y_pos<height;y_pos++)
-        for (x_pos=0; x_pos<width;x_pos++)
-        {
-          byte color=context->Preview_bitmap[x_pos+y_pos*PREVIEW_WIDTH*Menu_factor_X];
-
-          // Skip transparent if image has transparent background.
-          if (color == context->Transparent_color && context->Background_transparent)
-            color=MC_Window;
-
-          Pixel(context->Preview_pos_X+x_pos,
-                context->Preview_pos_Y+y_pos,
-                color);
-        }
-    }
-    // Refresh modified part
-    Update_window_area(183,95,PREVIEW_WIDTH,PREVIEW_HEIGHT);
-
-    // Preview comment
-    Print_in_window(45,70,context->Comment,MC_Black,MC_Light);
-    //Update_window_area(45,70,32*8,8);
-
+    if (cacheable_preview && File_error == 0)
+      Thumbnail_cache_save(context);
+    if (!context->Preview_headless)
+      Display_preview(context);
   }
 
 }
@@ -2187,6 +2427,77 @@ if (Create_lock_file(Config_directory))
   return restored_main + restored_spare;
 }
 
+#ifdef SAFETY_BACKUP_USE_FORK
+/// Process writing the last safety backup, 0 if none is running
+static pid_t Safety_backup_pid = 0;
+
+///
+/// Check if the process writing a safety backup has finished.
+/// @param wait wait for the process to finish
+/// @return 1 if the process is still running, 0 otherwise
+static int Check_safety_backup_process(int wait)
+{
+  int status;
+  pid_t pid;
+
+  if (Safety_backup_pid == 0)
+    return 0;
+  pid = waitpid(Safety_backup_pid, &status, wait ? 0 : WNOHANG);
+  if (pid == 0)
+    return 1;
+  if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    GFX2_Log(GFX2_WARNING, "Safety backup process %d failed\n", (int)Safety_backup_pid);
+  Safety_backup_pid = 0;
+  return 0;
+}
+#endif
+
+///
+/// Write a safety backup of the main page.
+///
+/// Where fork() is available, the backup is written by a child process.
+/// It works on a copy-on-write snapshot of the memory, so the pages
+/// can be modified in the meantime, and the program doesn't wait for
+/// the GIF encoder.
+static void Save_safety_backup(T_IO_Context * context)
+{
+  dword start = GFX2_GetTicks();
+#ifdef SAFETY_BACKUP_USE_FORK
+  pid_t pid;
+
+  fflush(stdout);
+  fflush(stderr);
+  pid = fork();
+  if (pid == 0)
+  {
+    // The handlers of the parent would write an emergency backup
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGABRT, SIG_DFL);
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGFPE, SIG_DFL);
+
+    // Call the GIF saver directly: Save_image() could open a window
+    // or flash the screen, which this process must not do.
+    File_error = 0;
+    Get_fileformat(context->Format)->Save(context);
+    GFX2_Log(GFX2_DEBUG, "Safety backup %s written in %lu ms\n",
+             context->File_name, (unsigned long)(GFX2_GetTicks() - start));
+    // _exit() : the child must not run the atexit() handlers of the parent
+    _exit(File_error ? 1 : 0);
+  }
+  if (pid > 0)
+  {
+    Safety_backup_pid = pid;
+    return;
+  }
+  // fork() failed, write the backup in this process
+#endif
+  Save_image(context);
+  GFX2_Log(GFX2_DEBUG, "Safety backup %s written in %lu ms\n",
+           context->File_name, (unsigned long)(GFX2_GetTicks() - start));
+}
+
 void Rotate_safety_backups(void)
 {
   dword now;
@@ -2196,6 +2507,12 @@ void Rotate_safety_backups(void)
   if (!Safety_backup_active)
     return;
 
+#ifdef SAFETY_BACKUP_USE_FORK
+  // Wait for the end of the previous backup: it will be done later.
+  if (Check_safety_backup_process(0))
+    return;
+#endif
+
   now = GFX2_GetTicks();
   // It's time to save if either:
   // - Many edits have taken place
@@ -2235,7 +2552,7 @@ void Rotate_safety_backups(void)
     context.Original_file_name = Main.backups->Pages->Filename != NULL ? strdup(Main.backups->Pages->Filename) : NULL;
     context.Original_file_directory = Main.backups->Pages->File_directory != NULL ? strdup(Main.backups->Pages->File_directory) : NULL;
 
-    Save_image(&context);
+    Save_safety_backup(&context);
     Destroy_context(&context);
 
     Main.safety_number++;
@@ -2251,6 +2568,11 @@ void Delete_safety_backups(void)
   if (!Safety_backup_active)
     return;
 
+#ifdef SAFETY_BACKUP_USE_FORK
+  // Don't let a backup being written survive the deletion
+  Check_safety_backup_process(1);
+#endif
+
   Backups_main = NULL;
   Backups_spare = NULL;
 
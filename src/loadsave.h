@@ -105,6 +105,10 @@ typedef struct
   short Preview_pos_Y;
   byte *Preview_bitmap;
   byte  Preview_usage[256];
+  /// Internal: size of the file in bytes, displayed with the preview
+  long  File_size;
+  /// Preview only: decode without drawing anything, used by the background worker
+  byte  Preview_headless;
   
   // Internal: returned surface for Surface case
   T_GFX2_Surface * Surface;
@@ -211,6 +215,8 @@ unsigned int Nb_known_formats(void);
 
 /// Generic allocation and similar stuff, done at beginning of image load, as soon as size is known.
 void Pre_load(T_IO_Context *context, short width, short height, long file_size, int format, enum PIXEL_RATIO ratio, byte bpp);
+/// Size in pixels of the part of context->Preview_bitmap which is displayed
+void Get_preview_size(const T_IO_Context *context, int *width, int *height);
 /// Fill the entire current layer/frame of an image being loaded with a color.
 void Fill_canvas(T_IO_Context *context, byte color);
 
@@ -218,6 +224,8 @@ void Fill_canvas(T_IO_Context *context, byte color);
 byte Get_pixel(T_IO_Context *context, short x, short y);
 /// Set the color of a pixel (on load)
 void Set_pixel(T_IO_Context *context, short x, short y, byte c);
+/// Set the colors of @p width pixels of line @p y, starting at @p x (on load)
+void Set_pixel_row(T_IO_Context *context, short x, short y, int width, const byte * pixels);
 /// Set the color of a 24bit pixel (on load)
 void Set_pixel_24b(T_IO_Context *context, short x, short y, byte r, byte g, byte b);
 /// Function to call when need to switch layers.
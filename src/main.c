@@ -133,6 +133,8 @@ static const char *__attribute__((used)) version_tag = "$VER:" AMIGA_VERSION_SIG
 #include "help.h"
 #include "filesel.h"
 #include "factory.h"
+#include "convert.h"
+#include "cmdline.h"
 #if defined(WIN32) && !(defined(USE_SDL) || defined(USE_SDL2))
 #include "win32screen.h"
 #endif
@@ -150,6 +152,20 @@ extern char Program_version[]; // generated in pversion.c
 static int setsize_width;
 static int setsize_height;
 
+/// Source of the -convert command line switch, NULL when not used
+static const char * convert_source = NULL;
+/// Destination of the -convert command line switch
+static const char * convert_destination = NULL;
+/// Target format of the conversion (-format switch)
+static const char * convert_format = NULL;
+/// Number of worker processes for the conversion (-jobs switch)
+static int convert_jobs = 1;
+/// Lua script to run on the converted pictures (-script switch)
+static const char * convert_script = NULL;
+/// Answers to the dialogs of the script (-scriptarg switches)
+static const char ** convert_script_args = NULL;
+static int nb_convert_script_args = 0;
+
 #if (defined(USE_SDL) || defined(USE_SDL2)) && defined(USE_JOYSTICK)
 /// Pointer to the current joystick controller.
 static SDL_Joystick* Joystick;
@@ -182,6 +198,13 @@ void Display_syntax(void)
     "\t-skin <filename>   to use an alternate file with the menu graphics\n"
     "\t-mode <videomode>  to set a video mode\n"
     "\t-size <resolution> to set the image size\n"
+    "\t-convert <source> <destination>\n"
+    "\t                   to convert a picture (or a directory) and quit\n"
+    "\t-format <format>   to choose the format of -convert (ie: png, gif, pkm)\n"
+    "\t-jobs n            to convert the files of a directory with n processes\n"
+    "\t-script <script>   to run a Lua script on the pictures of -convert\n"
+    "\t-scriptarg <label>=<value>\n"
+    "\t                   to answer a setting of the dialogs of the script\n"
     "Arguments can be prefixed either by / - or --\n"
     "They can also be abbreviated.\n\n";
   fputs(syntax, stdout);
@@ -219,6 +242,9 @@ void Error_function(int error_code, const char *filename, int line_number, const
 
   if (error_code==0)
   {
+    // No screen to flash when converting from the command line
+    if (convert_source != NULL)
+      return;
     // L'erreur 0 n'est pas une vraie erreur, elle fait seulement un flash rouge de l'écran pour dire qu'il y a un problème.
     // Toutes les autres erreurs déclenchent toujours une sortie en catastrophe du programme !
     memcpy(backup_palette, Get_current_palette(), sizeof(T_Palette));
@@ -295,51 +321,6 @@ void Error_function(int error_code, const char *filename, int line_number, const
   }
 }
 
-enum CMD_PARAMS
-{
-    CMDPARAM_HELP,
-    CMDPARAM_MODE,
-    CMDPARAM_PIXELRATIO_TALL,
-    CMDPARAM_PIXELRATIO_WIDE,
-    CMDPARAM_PIXELRATIO_DOUBLE,
-    CMDPARAM_PIXELRATIO_TRIPLE,
-    CMDPARAM_PIXELRATIO_QUAD,
-    CMDPARAM_PIXELRATIO_TALL2,
-    CMDPARAM_PIXELRATIO_TALL3,
-    CMDPARAM_PIXELRATIO_WIDE2,
-    CMDPARAM_RGB,
-    CMDPARAM_GAMMA,
-    CMDPARAM_SKIN,
-    CMDPARAM_SIZE,
-    CMDPARAM_VERBOSE,
-};
-
-struct {
-    const char *param;
-    int id;
-} cmdparams[] = {
-    {"?", CMDPARAM_HELP},
-    {"h", CMDPARAM_HELP},
-    {"H", CMDPARAM_HELP},
-    {"help", CMDPARAM_HELP},
-    {"mode", CMDPARAM_MODE},
-    {"tall", CMDPARAM_PIXELRATIO_TALL},
-    {"wide", CMDPARAM_PIXELRATIO_WIDE},
-    {"double", CMDPARAM_PIXELRATIO_DOUBLE},
-    {"triple", CMDPARAM_PIXELRATIO_TRIPLE},
-    {"quadruple", CMDPARAM_PIXELRATIO_QUAD},
-    {"tall2", CMDPARAM_PIXELRATIO_TALL2},
-    {"tall3", CMDPARAM_PIXELRATIO_TALL3},
-    {"wide2", CMDPARAM_PIXELRATIO_WIDE2},
-    {"rgb", CMDPARAM_RGB},
-    {"gamma", CMDPARAM_GAMMA},
-    {"skin", CMDPARAM_SKIN},
-    {"size", CMDPARAM_SIZE},
-    {"verbose", CMDPARAM_VERBOSE},
-};
-
-#define ARRAY_SIZE(x) (int)(sizeof(x) / sizeof(x[0]))
-
 /**
  * Parse the command line.
  *
@@ -367,13 +348,10 @@ int Analyze_command_line(int argc, char * argv[], char * filenames[], char * dir
   {
     char *s = argv[index];
     int is_switch = ((strchr(s,'/') == s) || (strchr(s,'-') == s) || (strstr(s,"--") == s));
-    int tmpi;
     char *tmpcp;
     int paramtype = -1;
     if (is_switch)
     {
-      int param_matches = 0;
-      int param_match = -1;
       if (*s == '-')
       {
         s++;
@@ -389,22 +367,7 @@ int Analyze_command_line(int argc, char * argv[], char * filenames[], char * dir
         continue;
 #endif
 
-      for (tmpi = 0; tmpi < ARRAY_SIZE(cmdparams); tmpi++)
-      {
-        if (!strcmp(s, cmdparams[tmpi].param))
-        {
-          paramtype = cmdparams[tmpi].id;
-          break;
-        }
-        else if (strstr(cmdparams[tmpi].param, s))
-        {
-          param_matches++;
-          param_match = cmdparams[tmpi].id;
-        }
-      }
-      if (paramtype == -1 && param_matches == 1)
-        paramtype = param_match;
-
+      paramtype = Find_command_line_switch(s);
     }
     switch (paramtype)
     {
@@ -531,6 +494,71 @@ int Analyze_command_line(int argc, char * argv[], char * filenames[], char * dir
       case CMDPARAM_VERBOSE:
         GFX2_verbosity_level++;
         break;
+      case CMDPARAM_CONVERT:
+        if (index + 2 < argc)
+        {
+          // will be processed as soon as the settings are loaded
+          convert_source = argv[++index];
+          convert_destination = argv[++index];
+        }
+        else
+        {
+          Error(ERROR_COMMAND_LINE);
+          exit(0);
+        }
+        break;
+      case CMDPARAM_FORMAT:
+        index++;
+        if (index<argc)
+        {
+          convert_format = argv[index];
+        }
+        else
+        {
+          Error(ERROR_COMMAND_LINE);
+          exit(0);
+        }
+        break;
+      case CMDPARAM_JOBS:
+        index++;
+        if (index<argc && atoi(argv[index]) >= 1)
+        {
+          convert_jobs = atoi(argv[index]);
+        }
+        else
+        {
+          Error(ERROR_COMMAND_LINE);
+          exit(0);
+        }
+        break;
+      case CMDPARAM_SCRIPT:
+        index++;
+        if (index<argc)
+        {
+          convert_script = argv[index];
+        }
+        else
+        {
+          Error(ERROR_COMMAND_LINE);
+          exit(0);
+        }
+        break;
+      case CMDPARAM_SCRIPTARG:
+        index++;
+        if (index<argc && strchr(argv[index], '=') != NULL)
+        {
+          if (convert_script_args == NULL)
+            convert_script_args = (const char **)GFX2_malloc(argc * sizeof(char *));
+          if (convert_script_args == NULL)
+            Error(ERROR_MEMORY);
+          convert_script_args[nb_convert_script_args++] = argv[index];
+        }
+        else
+        {
+          Error(ERROR_COMMAND_LINE);
+          exit(0);
+        }
+        break;
       default:
         // Si ce n'est pas un paramètre, c'est le nom du fichier à ouvrir
         if (file_in_command_line > 1)
@@ -567,6 +595,12 @@ int Analyze_command_line(int argc, char * argv[], char * filenames[], char * dir
         break;
     }
   }
+  // The scripts only run without screen on the pictures to convert
+  if (convert_script != NULL && convert_source == NULL)
+  {
+    Error(ERROR_COMMAND_LINE);
+    exit(0);
+  }
   return file_in_command_line;
 }
 
@@ -669,6 +703,17 @@ int Init_program(int argc,char * argv[])
   // On en profite pour le mémoriser dans le répertoire principal:
   Initial_directory = strdup(Main.selector.Directory);
 
+  if (convert_source != NULL)
+  {
+    // Headless conversion : only the settings are needed by the
+    // loaders and savers, no video initialization.
+    temp=Load_INI(&Config);
+    if (temp)
+      Error(temp);
+    Convert_set_script(convert_script, convert_script_args, nb_convert_script_args);
+    exit(Convert_files(convert_source, convert_destination, convert_format, convert_jobs) ? 1 : 0);
+  }
+
   // On initialise les données sur le nom de fichier de l'image de brouillon:
   Spare.selector.Directory = strdup(Main.selector.Directory);
   Spare.selector.Directory_unicode = Unicode_strdup(Main.selector.Directory_unicode);
@@ -977,6 +1022,7 @@ int Init_program(int argc,char * argv[])
   Load_Unicode_fonts();
 
   memcpy(Main.palette, Gfx->Default_palette, sizeof(T_Palette));
+  Invalidate_best_color_cache();
 
   Fore_color=Best_color_range(255,255,255,Config.Palette_cells_X*Config.Palette_cells_Y);
   Back_color=Best_color_range(0,0,0,Config.Palette_cells_X*Config.Palette_cells_Y);
@@ -166,6 +166,8 @@ void Set_palette(T_Palette palette)
   int i;
 
   memcpy(Current_palette, palette, sizeof(T_Palette));
+  // The palette is often Main.palette, which is rounded below
+  Invalidate_best_color_cache();
   for(i=0;i<256;i++)
   {
     palette[i].R = Round_palette_component(palette[i].R);
@@ -122,6 +122,7 @@ void Copy_part_of_image_to_another(byte * source,word source_x,word source_y,wor
 GFX2_GLOBAL byte Timer_state; // State du chrono: 0=Attente d'un Xème de seconde
                               //                 1=Il faut afficher la preview
                               //                 2=Plus de chrono à gerer pour l'instant
+                              //                 3=Waiting for the background preview worker
 GFX2_GLOBAL dword Timer_delay;     // Nombre de 18.2ème de secondes demandés
 GFX2_GLOBAL dword Timer_start;       // Heure de départ du chrono
 
@@ -648,10 +648,31 @@ void Load_PKM(T_IO_Context * context)
 }
 
 
+/// Count the usage of each color in the picture being saved.
+///
+/// The main image is used when saving it or its palette, otherwise the
+/// pixels of the context (brush, surface) are counted.
+static void Count_used_colors_of_context(T_IO_Context * context, dword * usage)
+{
+  short x_pos, y_pos;
+
+  if (context->Type == CONTEXT_MAIN_IMAGE || context->Type == CONTEXT_PALETTE)
+  {
+    Count_used_colors(usage);
+    return;
+  }
+  memset(usage, 0, 256 * sizeof(dword));
+  if (context->Target_address == NULL)
+    return;
+  for (y_pos = 0; y_pos < context->Height; y_pos++)
+    for (x_pos = 0; x_pos < context->Width; x_pos++)
+      usage[Get_pixel(context, x_pos, y_pos)]++;
+}
+
 // -- Sauver un fichier au format PKM ---------------------------------------
 
   // Trouver quels sont les octets de reconnaissance
-  void Find_recog(byte * recog1, byte * recog2)
+  static void Find_recog(T_IO_Context * context, byte * recog1, byte * recog2)
   {
     dword Find_recon[256]; // Table d'utilisation de couleurs
     byte  best;   // Meilleure couleur pour recon (recon1 puis recon2)
@@ -660,7 +681,7 @@ void Load_PKM(T_IO_Context * context)
 
 
     // On commence par compter l'utilisation de chaque couleurs
-    Count_used_colors(Find_recon);
+    Count_used_colors_of_context(context, Find_recon);
 
     // Ensuite recog1 devient celle la moins utilisée de celles-ci
     *recog1=0;
@@ -704,7 +725,7 @@ void Save_PKM(T_IO_Context * context)
   // Construction du header
   memcpy(header.Ident,"PKM",3);
   header.Method=0;
-  Find_recog(&header.Recog1,&header.Recog2);
+  Find_recog(context, &header.Recog1,&header.Recog2);
   header.Width=context->Width;
   header.Height=context->Height;
   memcpy(header.Palette,context->Palette,sizeof(T_Palette));
@@ -1054,7 +1075,7 @@ void Save_CEL(T_IO_Context * context)
 
 
   // On commence par compter l'utilisation de chaque couleurs
-  Count_used_colors(color_usage);
+  Count_used_colors_of_context(context, color_usage);
 
   File_error=0;
   if ((file=Open_file_write(context)))
@@ -1355,7 +1376,7 @@ void Save_KCF(T_IO_Context * context)
   dword color_usage[256]; // Table d'utilisation de couleurs
 
   // On commence par compter l'utilisation de chaque couleurs
-  Count_used_colors(color_usage);
+  Count_used_colors_of_context(context, color_usage);
 
   File_error=0;
   if ((file=Open_file_write(context)))
@@ -31,6 +31,7 @@
 #include "op_c.h"
 #include "errors.h"
 #include "colorred.h"
+#include "gfx2thread.h"
 
 // If GRAFX2_QUANTIZE_CLUSTER_POPULATION_SPLIT is defined,
 // the clusters are splitted in two half of equal (pixel) population.
@@ -233,9 +234,12 @@ T_Occurrence_table * OT_new(int nbb_r,int nbb_g,int nbb_b)
     // Allocate the table
     size=(n->rng_r)*(n->rng_g)*(n->rng_b);
     n->table=(int *)calloc(size, sizeof(int));
-    if (n->table == NULL)
+    n->sat=(int *)calloc((n->rng_r+1)*(n->rng_g+1)*(n->rng_b+1), sizeof(int));
+    if (n->table == NULL || n->sat == NULL)
     {
       // Not enough memory !
+      free(n->table);
+      free(n->sat);
       free(n);
       n=NULL;
     }
@@ -249,6 +253,7 @@ T_Occurrence_table * OT_new(int nbb_r,int nbb_g,int nbb_b)
 void OT_delete(T_Occurrence_table * t)
 {
   free(t->table);
+  free(t->sat);
   free(t);
   t = NULL;
 }
@@ -281,14 +286,261 @@ void OT_inc(T_Occurrence_table * t,byte r,byte g,byte b)
 }
 
 
+/// Minimum number of pixels to use several threads for the counting
+#define OT_MIN_PIXELS_PER_THREAD 262144
+
+/// Maximum memory used by the private tables of the counting threads
+#define OT_MAX_HISTOGRAMS_SIZE (16*1024*1024)
+
+/// Number of pixels a thread counts before taking the next ones
+#define OT_CHUNK_SIZE 65536
+
+/// Shared state of the threads of OT_count_occurrences()
+typedef struct
+{
+  T_Occurrence_table * to;
+  const T_Components * image;
+  int size;
+  T_GFX2_lock * lock;
+  int * histograms;    ///< Tables of the threads other than the first one, or NULL
+  int nb_histograms;   ///< Number of tables, including the occurrence table
+  int next_histogram;  ///< Next table to give to a thread
+  int nb_slices;       ///< Number of red slices, when there are no private tables
+  int next;            ///< Next pixel to count, or next red slice
+} T_OT_count_context;
+
+/// Index of a 24bit color in an occurrence table
+#define OT_INDEX(t, c) \
+  ((((c)->R >> (t)->red_r) << (t)->dec_r) | (((c)->G >> (t)->red_g) << (t)->dec_g) | ((c)->B >> (t)->red_b))
+
+/// Count the occurrences in a part of the picture, or for a part of the colors
+static void OT_Count_worker(void * data)
+{
+  T_OT_count_context * context = (T_OT_count_context *)data;
+  const T_Occurrence_table * t = context->to;
+  const T_Components * ptr;
+  const T_Components * end;
+
+  if (context->histograms != NULL)
+  {
+    int * table;
+    int index;
+
+    GFX2_Lock(context->lock);
+    index = context->next_histogram++;
+    GFX2_Unlock(context->lock);
+    if (index == 0)
+      table = t->table;
+    else
+      table = context->histograms + (index - 1) * (long)t->rng_r * t->rng_g * t->rng_b;
+
+    for (;;)
+    {
+      int start;
+
+      GFX2_Lock(context->lock);
+      start = context->next;
+      context->next += OT_CHUNK_SIZE;
+      GFX2_Unlock(context->lock);
+      if (start >= context->size)
+        return;
+
+      end = context->image + ((context->size - start < OT_CHUNK_SIZE) ? context->size : start + OT_CHUNK_SIZE);
+      for (ptr = context->image + start; ptr < end; ptr++)
+        table[OT_INDEX(t, ptr)]++;
+    }
+  }
+  else
+  {
+    end = context->image + context->size;
+    for (;;)
+    {
+      int slice;
+      int r_low, r_high;
+
+      GFX2_Lock(context->lock);
+      slice = context->next++;
+      GFX2_Unlock(context->lock);
+      if (slice >= context->nb_slices)
+        return;
+
+      r_low = (slice * t->rng_r / context->nb_slices) << t->red_r;
+      r_high = ((slice + 1) * t->rng_r / context->nb_slices) << t->red_r;
+      for (ptr = context->image; ptr < end; ptr++)
+      {
+        if (ptr->R >= r_low && ptr->R < r_high)
+          t->table[OT_INDEX(t, ptr)]++;
+      }
+    }
+  }
+}
+
 /// Count the use of each color in a 24bit picture and fill in the table
 void OT_count_occurrences(T_Occurrence_table* t, T_Bitmap24B image, int size)
 {
-  T_Bitmap24B ptr;
-  int index;
+  T_OT_count_context context;
+  long table_size = (long)t->rng_r * t->rng_g * t->rng_b;
+  int nb_threads;
+  int i;
+
+  nb_threads = GFX2_Thread_count();
+  if (size < nb_threads * OT_MIN_PIXELS_PER_THREAD)
+    nb_threads = size / OT_MIN_PIXELS_PER_THREAD;
+  if (nb_threads < 1)
+    nb_threads = 1;
+
+  memset(&context, 0, sizeof(context));
+  context.to = t;
+  context.image = image;
+  context.size = size;
+  if (nb_threads > 1)
+    context.lock = GFX2_Lock_new();
+  if (context.lock == NULL)
+    nb_threads = 1;
+  else if ((nb_threads - 1) * table_size * (long)sizeof(int) <= OT_MAX_HISTOGRAMS_SIZE)
+  {
+    // Each thread counts a part of the picture in its own table
+    context.histograms = (int *)calloc((nb_threads - 1) * table_size, sizeof(int));
+    context.nb_histograms = nb_threads;
+  }
+  if (context.histograms == NULL)
+  {
+    // The tables would be too big: each thread counts a slice of the colors
+    // in the whole picture
+    context.nb_slices = nb_threads;
+  }
+
+  if (nb_threads > 1)
+  {
+    GFX2_Run_threads(nb_threads, OT_Count_worker, &context);
+    // Merge the tables of the threads
+    for (i = 0; i < context.nb_histograms - 1; i++)
+    {
+      const int * histogram = context.histograms + i * table_size;
+      long index;
+
+      for (index = 0; index < table_size; index++)
+        t->table[index] += histogram[index];
+    }
+  }
+  else
+  {
+    T_Bitmap24B ptr;
+    int index;
+
+    for (index = size, ptr = image; index > 0; index--, ptr++)
+      OT_inc(t, ptr->R, ptr->G, ptr->B);
+  }
+  free(context.histograms);
+  GFX2_Lock_delete(context.lock);
+
+  OT_compute_sums(t);
+}
+
+
+/// Index of a color in the summed volume table
+#define OT_SUM_INDEX(t, r, g, b) \
+  ((((long)(r) * ((t)->rng_g + 1)) + (g)) * ((t)->rng_b + 1) + (b))
+
+/// Shared state of the threads of OT_compute_sums()
+typedef struct
+{
+  T_Occurrence_table * to;
+  T_GFX2_lock * lock;
+  int next_plane;
+} T_OT_sums_context;
 
-  for (index = size, ptr = image; index > 0; index--, ptr++)
-    OT_inc(t, ptr->R, ptr->G, ptr->B);
+/// Compute the 2D sums of a red plane
+static void OT_sum_plane(T_Occurrence_table * t, int r)
+{
+  int g, b;
+
+  for (g = 1; g <= t->rng_g; g++)
+  {
+    const int * occurrences = t->table + ((r - 1) << t->dec_r) + ((g - 1) << t->dec_g);
+    const int * above = t->sat + OT_SUM_INDEX(t, r, g - 1, 1);
+    int * sum = t->sat + OT_SUM_INDEX(t, r, g, 1);
+    int line = 0;
+
+    for (b = 0; b < t->rng_b; b++)
+    {
+      line += occurrences[b];
+      sum[b] = above[b] + line;
+    }
+  }
+}
+
+/// Compute the 2D sums of the red planes, the planes are independent
+static void OT_Sums_worker(void * data)
+{
+  T_OT_sums_context * context = (T_OT_sums_context *)data;
+  int r;
+
+  for (;;)
+  {
+    GFX2_Lock(context->lock);
+    r = ++context->next_plane;
+    GFX2_Unlock(context->lock);
+    if (r > context->to->rng_r)
+      return;
+    OT_sum_plane(context->to, r);
+  }
+}
+
+/// Compute the summed volume table from the occurrences
+void OT_compute_sums(T_Occurrence_table * t)
+{
+  T_OT_sums_context context;
+  long plane_size = (long)(t->rng_g + 1) * (t->rng_b + 1);
+  int r;
+
+  context.to = t;
+  context.next_plane = 0;
+  context.lock = GFX2_Lock_new();
+  if (context.lock != NULL)
+  {
+    GFX2_Run_threads(GFX2_Thread_count(), OT_Sums_worker, &context);
+    GFX2_Lock_delete(context.lock);
+  }
+  else
+  {
+    for (r = 1; r <= t->rng_r; r++)
+      OT_sum_plane(t, r);
+  }
+
+  // Then add the planes together
+  for (r = 2; r <= t->rng_r; r++)
+  {
+    const int * previous = t->sat + OT_SUM_INDEX(t, r - 1, 0, 0);
+    int * sum = t->sat + OT_SUM_INDEX(t, r, 0, 0);
+    long index;
+
+    for (index = 0; index < plane_size; index++)
+      sum[index] += previous[index];
+  }
+}
+
+
+/// Number of pixels in a box of the occurrence table (bounds included),
+/// in constant time thanks to the summed volume table.
+int OT_count_box(const T_Occurrence_table * t, int rmin, int rmax,
+  int gmin, int gmax, int bmin, int bmax)
+{
+  const int * s = t->sat;
+
+  // The summed volume table has an extra plane at 0 on each axis,
+  // so the sum up to rmax is at rmax+1, and the sum before rmin at rmin.
+  rmax++;
+  gmax++;
+  bmax++;
+  return s[OT_SUM_INDEX(t, rmax, gmax, bmax)]
+       - s[OT_SUM_INDEX(t, rmin, gmax, bmax)]
+       - s[OT_SUM_INDEX(t, rmax, gmin, bmax)]
+       - s[OT_SUM_INDEX(t, rmax, gmax, bmin)]
+       + s[OT_SUM_INDEX(t, rmin, gmin, bmax)]
+       + s[OT_SUM_INDEX(t, rmin, gmax, bmin)]
+       + s[OT_SUM_INDEX(t, rmax, gmin, bmin)]
+       - s[OT_SUM_INDEX(t, rmin, gmin, bmin)];
 }
 
 
@@ -323,127 +575,87 @@ int OT_count_colors(T_Occurrence_table * t)
 // plane and the first pixel actually in a cluster
 
 
+/// Smallest value of a component such that the part of the box up to this
+/// value holds at least @p limit pixels. The box is {rmin,rmax,gmin,gmax,bmin,bmax}.
+static int OT_search_first(const T_Occurrence_table * to, const int * box, int axis, int limit)
+{
+  int b[6];
+  int low = box[axis * 2];
+  int high = box[axis * 2 + 1];
+
+  memcpy(b, box, sizeof(b));
+  while (low < high)
+  {
+    int middle = (low + high) / 2;
+
+    b[axis * 2 + 1] = middle;
+    if (OT_count_box(to, b[0], b[1], b[2], b[3], b[4], b[5]) >= limit)
+      high = middle;
+    else
+      low = middle + 1;
+  }
+  return low;
+}
+
+/// Biggest value of a component such that the part of the box from this
+/// value holds at least @p limit pixels.
+static int OT_search_last(const T_Occurrence_table * to, const int * box, int axis, int limit)
+{
+  int b[6];
+  int low = box[axis * 2];
+  int high = box[axis * 2 + 1];
+
+  memcpy(b, box, sizeof(b));
+  while (low < high)
+  {
+    int middle = (low + high + 1) / 2;
+
+    b[axis * 2] = middle;
+    if (OT_count_box(to, b[0], b[1], b[2], b[3], b[4], b[5]) >= limit)
+      low = middle;
+    else
+      high = middle - 1;
+  }
+  return low;
+}
+
 /// Pack a cluster, ie compute its {r,v,b}{min,max} values
 void Cluster_pack(T_Cluster * c,const T_Occurrence_table * const to)
 {
-  int rmin,rmax,vmin,vmax,bmin,bmax;
+  int box[6];
   int r,g,b;
 
-  // Find min. and max. values actually used for each component in this cluster
-
-  // Pre-shift everything to avoid using OT_Get and be faster.
-  // GIMP use only 6 bits for G and B components in this table.
-  rmin=c->rmax << to->dec_r; rmax=c->rmin << to->dec_r;
-  vmin=c->vmax << to->dec_g; vmax=c->vmin << to->dec_g;
-  bmin=c->bmax << to->dec_b; bmax=c->bmin << to->dec_b;
-  c->occurences=0;
-
-  // Unoptimized code kept here for documentation purpose because the optimized
-  // one is unreadable : run over the whole cluster and find the min and max,
-  // and count the occurrences at the same time.
-  /*
-  for (r=c->rmin<<to->dec_r;r<=c->rmax<<to->dec_r;r+=1<<to->dec_r)
-    for (g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-      for (b=c->bmin;b<=c->bmax;b++)
-      {
-        nbocc=to->table[r + g + b]; // OT_get
-        if (nbocc)
-        {
-          if (r<rmin) rmin=r;
-          else if (r>rmax) rmax=r;
-          if (g<vmin) vmin=g;
-          else if (g>vmax) vmax=g;
-          if (b<bmin) bmin=b;
-          else if (b>bmax) bmax=b;
-          c->occurrences+=nbocc;
-        }
-      }
-  */
-  
-  // Optimized version : find the extremums one at a time, so we can reduce the
-  // area to seek for the next one. Start at the edges of the cluster and go to
-  // the center until we find a pixel.
-
-  for(r=c->rmin<<to->dec_r;r<=c->rmax<<to->dec_r;r+=1<<to->dec_r)
-      for(g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-          for(b=c->bmin;b<=c->bmax;b++)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                rmin=r;
-                goto RMAX;
-            }
-          }
-RMAX:
-  for(r=c->rmax<<to->dec_r;r>=rmin;r-=1<<to->dec_r)
-      for(g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-          for(b=c->bmin;b<=c->bmax;b++)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                rmax=r;
-                goto VMIN;
-            }
-          }
-VMIN:
-  for(g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-      for(r=rmin;r<=rmax;r+=1<<to->dec_r)
-          for(b=c->bmin;b<=c->bmax;b++)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                vmin=g;
-                goto VMAX;
-            }
-          }
-VMAX:
-  for(g=c->vmax<<to->dec_g;g>=vmin;g-=1<<to->dec_g)
-      for(r=rmin;r<=rmax;r+=1<<to->dec_r)
-          for(b=c->bmin;b<=c->bmax;b++)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                vmax=g;
-                goto BMIN;
-            }
-          }
-BMIN:
-  for(b=c->bmin;b<=c->bmax;b++)
-      for(r=rmin;r<=rmax;r+=1<<to->dec_r)
-          for(g=vmin;g<=vmax;g+=1<<to->dec_g)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                bmin=b;
-                goto BMAX;
-            }
-          }
-BMAX:
-  for(b=c->bmax;b>=bmin;b--)
-      for(r=rmin;r<=rmax;r+=1<<to->dec_r)
-          for(g=vmin;g<=vmax;g+=1<<to->dec_g)
-          {
-            if(to->table[r + g + b]) // OT_get
-            {
-                bmax=b;
-                goto ENDCRUSH;
-            }
-          }
-ENDCRUSH:
-  // We still need to seek the internal part of the cluster to count pixels
-  // inside it
-  for(r=rmin;r<=rmax;r+=1<<to->dec_r)
-      for(g=vmin;g<=vmax;g+=1<<to->dec_g)
-          for(b=bmin;b<=bmax;b++)
-          {
-            c->occurences+=to->table[r + g + b]; // OT_get
-          }
-
-  // Unshift the values and put them in the cluster info
-  c->rmin=rmin>>to->dec_r; c->rmax=rmax>>to->dec_r;
-  c->vmin=vmin>>to->dec_g; c->vmax=vmax>>to->dec_g;
-  c->bmin=bmin;     c->bmax=bmax;
-  
+  box[0] = c->rmin; box[1] = c->rmax;
+  box[2] = c->vmin; box[3] = c->vmax;
+  box[4] = c->bmin; box[5] = c->bmax;
+  c->occurences = OT_count_box(to, box[0], box[1], box[2], box[3], box[4], box[5]);
+
+  if (c->occurences == 0)
+  {
+    // Empty cluster, it will be dropped. Swap the bounds like the search
+    // below would do.
+    c->rmin = box[1]; c->rmax = box[0];
+    c->vmin = box[3]; c->vmax = box[2];
+    c->bmin = box[5]; c->bmax = box[4];
+  }
+  else
+  {
+    // Find min. and max. values actually used for each component in this
+    // cluster, one at a time, so we can reduce the area to seek for the next
+    // one. The number of pixels in a part of the cluster is given by the
+    // summed volume table, so each test is done in constant time.
+    box[0] = OT_search_first(to, box, 0, 1);
+    box[1] = OT_search_last(to, box, 0, 1);
+    box[2] = OT_search_first(to, box, 1, 1);
+    box[3] = OT_search_last(to, box, 1, 1);
+    box[4] = OT_search_first(to, box, 2, 1);
+    box[5] = OT_search_last(to, box, 2, 1);
+
+    c->rmin = box[0]; c->rmax = box[1];
+    c->vmin = box[2]; c->vmax = box[3];
+    c->bmin = box[4]; c->bmax = box[5];
+  }
+
   // Find the longest axis to know which way to split the cluster
   r = c->rmax-c->rmin;
   g = c->vmax-c->vmin;
@@ -551,35 +763,19 @@ void Cluster_split(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue,
   const T_Occurrence_table * const to)
 {
   int limit;
-  int cumul;
+  int box[6];
   int r, g, b;
 
   // Split criterion: each of the cluster will have the same number of pixels
   limit = c->occurences / 2;
-  cumul = 0;
+  box[0] = c->rmin; box[1] = c->rmax;
+  box[2] = c->vmin; box[3] = c->vmax;
+  box[4] = c->bmin; box[5] = c->bmax;
   if (hue == 0) // split on red
   {
-    // Run over the cluster until we reach the requested number of pixels
-    for (r = c->rmin<<to->dec_r; r<=c->rmax<<to->dec_r; r+=1<<to->dec_r)
-    {
-      for (g = c->vmin<<to->dec_g; g<=c->vmax<<to->dec_g; g+=1<<to->dec_g)
-      {
-        for (b = c->bmin; b<=c->bmax; b++)
-        {
-          cumul+=to->table[r + g + b];
-          if (cumul>=limit)
-            break;
-        }
-        if (cumul>=limit)
-          break;
-      }
-      if (cumul>=limit)
-        break;
-    }
+    // Find the first red value where we reach the requested number of pixels
+    r = OT_search_first(to, box, 0, limit);
 
-    r>>=to->dec_r;
-    g>>=to->dec_g;
-    
     // More than half of the cluster pixel have r = rmin. Ensure we split somewhere anyway.
     if (r == c->rmin) r++;
 
@@ -600,26 +796,8 @@ void Cluster_split(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue,
   else
   if (hue==1) // split on green
   {
+    g = OT_search_first(to, box, 1, limit);
 
-    for (g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-    {
-      for (r=c->rmin<<to->dec_r;r<=c->rmax<<to->dec_r;r+=1<<to->dec_r)
-      {
-        for (b=c->bmin;b<=c->bmax;b++)
-        {
-          cumul+=to->table[r + g + b];
-          if (cumul>=limit)
-            break;
-        }
-        if (cumul>=limit)
-          break;
-      }
-      if (cumul>=limit)
-        break;
-    }
-
-    r>>=to->dec_r; g>>=to->dec_g;
-    
     if (g == c->vmin) g++;
 
     c1->Rmin=c->Rmin; c1->Rmax=c->Rmax;
@@ -638,26 +816,8 @@ void Cluster_split(T_Cluster * c, T_Cluster * c1, T_Cluster * c2, int hue,
   }
   else // split on blue
   {
+    b = OT_search_first(to, box, 2, limit);
 
-    for (b=c->bmin;b<=c->bmax;b++)
-    {
-      for (g=c->vmin<<to->dec_g;g<=c->vmax<<to->dec_g;g+=1<<to->dec_g)
-      {
-        for (r=c->rmin<<to->dec_r;r<=c->rmax<<to->dec_r;r+=1<<to->dec_r)
-        {
-          cumul+=to->table[r + g + b];
-          if (cumul>=limit)
-            break;
-        }
-        if (cumul>=limit)
-          break;
-      }
-      if (cumul>=limit)
-        break;
-    }
-
-    r>>=to->dec_r; g>>=to->dec_g;
-    
     if (b == c->bmin) b++;
 
     c1->Rmin=c->Rmin; c1->Rmax=c->Rmax;
@@ -1219,6 +1379,471 @@ CT_Tree* Optimize_palette(T_Bitmap24B image, int size,
 }
 
 
+// Wu's color quantizer
+// Xiaolin Wu, "Efficient Statistical Computations for Optimal Color
+// Quantization", Graphics Gems II.
+// The RGB cube is cut in boxes, always choosing the box and the cut which
+// reduce the most the sum of squared errors. The moments of the colors are
+// stored in summed volume tables, so the statistics of any box are computed
+// in constant time.
+
+/// Number of levels for each component, plus one for the summed tables
+#define WU_SIZE 33
+
+/// Index in the Wu tables
+#define WU_INDEX(r, g, b) (((r) * WU_SIZE + (g)) * WU_SIZE + (b))
+
+/// Moments of the colors, as summed volume tables
+typedef struct
+{
+  double * wt; ///< Number of pixels
+  double * mr; ///< Sum of red
+  double * mg; ///< Sum of green
+  double * mb; ///< Sum of blue
+  double * m2; ///< Sum of r^2+g^2+b^2
+} T_Wu_moments;
+
+/// A box of the Wu quantizer. Lower bounds are excluded, upper bounds are included.
+typedef struct
+{
+  int r0, r1;
+  int g0, g1;
+  int b0, b1;
+  int vol;
+} T_Wu_box;
+
+/// Sum of a moment in a box
+static double Wu_volume(const T_Wu_box * c, const double * m)
+{
+  return m[WU_INDEX(c->r1, c->g1, c->b1)] - m[WU_INDEX(c->r1, c->g1, c->b0)]
+       - m[WU_INDEX(c->r1, c->g0, c->b1)] + m[WU_INDEX(c->r1, c->g0, c->b0)]
+       - m[WU_INDEX(c->r0, c->g1, c->b1)] + m[WU_INDEX(c->r0, c->g1, c->b0)]
+       + m[WU_INDEX(c->r0, c->g0, c->b1)] - m[WU_INDEX(c->r0, c->g0, c->b0)];
+}
+
+/// Part of Wu_volume() which doesn't depend on the position of the cut
+static double Wu_bottom(const T_Wu_box * c, int dir, const double * m)
+{
+  switch (dir)
+  {
+    case 0:
+      return - m[WU_INDEX(c->r0, c->g1, c->b1)] + m[WU_INDEX(c->r0, c->g1, c->b0)]
+             + m[WU_INDEX(c->r0, c->g0, c->b1)] - m[WU_INDEX(c->r0, c->g0, c->b0)];
+    case 1:
+      return - m[WU_INDEX(c->r1, c->g0, c->b1)] + m[WU_INDEX(c->r1, c->g0, c->b0)]
+             + m[WU_INDEX(c->r0, c->g0, c->b1)] - m[WU_INDEX(c->r0, c->g0, c->b0)];
+    default:
+      return - m[WU_INDEX(c->r1, c->g1, c->b0)] + m[WU_INDEX(c->r1, c->g0, c->b0)]
+             + m[WU_INDEX(c->r0, c->g1, c->b0)] - m[WU_INDEX(c->r0, c->g0, c->b0)];
+  }
+}
+
+/// Part of Wu_volume() which depends on the position of the cut
+static double Wu_top(const T_Wu_box * c, int dir, int pos, const double * m)
+{
+  switch (dir)
+  {
+    case 0:
+      return m[WU_INDEX(pos, c->g1, c->b1)] - m[WU_INDEX(pos, c->g1, c->b0)]
+           - m[WU_INDEX(pos, c->g0, c->b1)] + m[WU_INDEX(pos, c->g0, c->b0)];
+    case 1:
+      return m[WU_INDEX(c->r1, pos, c->b1)] - m[WU_INDEX(c->r1, pos, c->b0)]
+           - m[WU_INDEX(c->r0, pos, c->b1)] + m[WU_INDEX(c->r0, pos, c->b0)];
+    default:
+      return m[WU_INDEX(c->r1, c->g1, pos)] - m[WU_INDEX(c->r1, c->g0, pos)]
+           - m[WU_INDEX(c->r0, c->g1, pos)] + m[WU_INDEX(c->r0, c->g0, pos)];
+  }
+}
+
+/// Sum of squared errors of a box, when it is replaced by its mean color
+static double Wu_variance(const T_Wu_box * c, const T_Wu_moments * m)
+{
+  double dr = Wu_volume(c, m->mr);
+  double dg = Wu_volume(c, m->mg);
+  double db = Wu_volume(c, m->mb);
+  double xx = Wu_volume(c, m->m2);
+
+  return xx - (dr * dr + dg * dg + db * db) / Wu_volume(c, m->wt);
+}
+
+/// Find the best cut of a box in one direction
+static double Wu_maximize(const T_Wu_moments * m, const T_Wu_box * c, int dir,
+  int first, int last, int * cut,
+  double whole_r, double whole_g, double whole_b, double whole_w)
+{
+  double base_r = Wu_bottom(c, dir, m->mr);
+  double base_g = Wu_bottom(c, dir, m->mg);
+  double base_b = Wu_bottom(c, dir, m->mb);
+  double base_w = Wu_bottom(c, dir, m->wt);
+  double max = 0.0;
+  int i;
+
+  *cut = -1;
+  for (i = first; i < last; i++)
+  {
+    double half_r = base_r + Wu_top(c, dir, i, m->mr);
+    double half_g = base_g + Wu_top(c, dir, i, m->mg);
+    double half_b = base_b + Wu_top(c, dir, i, m->mb);
+    double half_w = base_w + Wu_top(c, dir, i, m->wt);
+    double temp;
+
+    // The two parts must not be empty
+    if (half_w == 0)
+      continue;
+    temp = (half_r * half_r + half_g * half_g + half_b * half_b) / half_w;
+    half_r = whole_r - half_r;
+    half_g = whole_g - half_g;
+    half_b = whole_b - half_b;
+    half_w = whole_w - half_w;
+    if (half_w == 0)
+      continue;
+    temp += (half_r * half_r + half_g * half_g + half_b * half_b) / half_w;
+    if (temp > max)
+    {
+      max = temp;
+      *cut = i;
+    }
+  }
+  return max;
+}
+
+/// Cut a box in two. @return 0 if the box can't be cut
+static int Wu_cut(const T_Wu_moments * m, T_Wu_box * set1, T_Wu_box * set2)
+{
+  double whole_r = Wu_volume(set1, m->mr);
+  double whole_g = Wu_volume(set1, m->mg);
+  double whole_b = Wu_volume(set1, m->mb);
+  double whole_w = Wu_volume(set1, m->wt);
+  double max_r, max_g, max_b;
+  int cut_r, cut_g, cut_b;
+  int dir;
+
+  max_r = Wu_maximize(m, set1, 0, set1->r0 + 1, set1->r1, &cut_r, whole_r, whole_g, whole_b, whole_w);
+  max_g = Wu_maximize(m, set1, 1, set1->g0 + 1, set1->g1, &cut_g, whole_r, whole_g, whole_b, whole_w);
+  max_b = Wu_maximize(m, set1, 2, set1->b0 + 1, set1->b1, &cut_b, whole_r, whole_g, whole_b, whole_w);
+
+  if (max_r >= max_g && max_r >= max_b)
+  {
+    dir = 0;
+    if (cut_r < 0)
+      return 0; // Can't split the box
+  }
+  else if (max_g >= max_r && max_g >= max_b)
+    dir = 1;
+  else
+    dir = 2;
+
+  *set2 = *set1;
+  switch (dir)
+  {
+    case 0:
+      set2->r0 = set1->r1 = cut_r;
+      break;
+    case 1:
+      set2->g0 = set1->g1 = cut_g;
+      break;
+    default:
+      set2->b0 = set1->b1 = cut_b;
+      break;
+  }
+  set1->vol = (set1->r1 - set1->r0) * (set1->g1 - set1->g0) * (set1->b1 - set1->b0);
+  set2->vol = (set2->r1 - set2->r0) * (set2->g1 - set2->g0) * (set2->b1 - set2->b0);
+  return 1;
+}
+
+/// Add a Wu box to a color tree
+static void Wu_set_tree(CT_Tree* tc, const T_Wu_box * c, byte index)
+{
+  CT_set(tc, c->r0 << 3, c->g0 << 3, c->b0 << 3,
+         (c->r1 << 3) - 1, (c->g1 << 3) - 1, (c->b1 << 3) - 1, index);
+}
+
+/// Count the colors of the picture, and compute the summed volume tables
+static void Wu_compute_moments(T_Wu_moments * m, T_Bitmap24B image, int size)
+{
+  double area_w[WU_SIZE], area_r[WU_SIZE], area_g[WU_SIZE], area_b[WU_SIZE], area_2[WU_SIZE];
+  int r, g, b;
+  int i;
+
+  for (i = 0; i < size; i++)
+  {
+    int index = WU_INDEX((image[i].R >> 3) + 1, (image[i].G >> 3) + 1, (image[i].B >> 3) + 1);
+
+    m->wt[index] += 1;
+    m->mr[index] += image[i].R;
+    m->mg[index] += image[i].G;
+    m->mb[index] += image[i].B;
+    m->m2[index] += image[i].R * image[i].R + image[i].G * image[i].G + image[i].B * image[i].B;
+  }
+
+  for (r = 1; r < WU_SIZE; r++)
+  {
+    for (i = 0; i < WU_SIZE; i++)
+      area_w[i] = area_r[i] = area_g[i] = area_b[i] = area_2[i] = 0;
+    for (g = 1; g < WU_SIZE; g++)
+    {
+      double line_w = 0, line_r = 0, line_g = 0, line_b = 0, line_2 = 0;
+
+      for (b = 1; b < WU_SIZE; b++)
+      {
+        int index = WU_INDEX(r, g, b);
+        int previous = WU_INDEX(r - 1, g, b);
+
+        line_w += m->wt[index];
+        line_r += m->mr[index];
+        line_g += m->mg[index];
+        line_b += m->mb[index];
+        line_2 += m->m2[index];
+        area_w[b] += line_w;
+        area_r[b] += line_r;
+        area_g[b] += line_g;
+        area_b[b] += line_b;
+        area_2[b] += line_2;
+        m->wt[index] = m->wt[previous] + area_w[b];
+        m->mr[index] = m->mr[previous] + area_r[b];
+        m->mg[index] = m->mg[previous] + area_g[b];
+        m->mb[index] = m->mb[previous] + area_b[b];
+        m->m2[index] = m->m2[previous] + area_2[b];
+      }
+    }
+  }
+}
+
+/// Computes the best palette for a 24b picture with Wu's quantizer.
+///
+/// @returns a conversion tree to be used for converting the picture to
+/// indexed with the generated palette, NULL if out of memory.
+///
+/// @param image The true-color image for which the palette needs to be optimized
+/// @param size in pixels (number of pixels, the height/width doesn't matter)
+/// @param palette pointer to the space where the palette will be stored (256 entries at most)
+CT_Tree* Optimize_palette_Wu(T_Bitmap24B image, int size, T_Components * palette)
+{
+  T_Wu_moments m;
+  T_Wu_box cube[256];
+  double vv[256];
+  CT_Tree* tc;
+  int nb_colors;
+  int next;
+  int i;
+
+  m.wt = (double *)calloc(5 * WU_SIZE * WU_SIZE * WU_SIZE, sizeof(double));
+  tc = CT_new();
+  if (m.wt == NULL || tc == NULL)
+  {
+    free(m.wt);
+    CT_delete(tc);
+    return NULL;
+  }
+  m.mr = m.wt + WU_SIZE * WU_SIZE * WU_SIZE;
+  m.mg = m.mr + WU_SIZE * WU_SIZE * WU_SIZE;
+  m.mb = m.mg + WU_SIZE * WU_SIZE * WU_SIZE;
+  m.m2 = m.mb + WU_SIZE * WU_SIZE * WU_SIZE;
+  Wu_compute_moments(&m, image, size);
+
+  cube[0].r0 = cube[0].g0 = cube[0].b0 = 0;
+  cube[0].r1 = cube[0].g1 = cube[0].b1 = WU_SIZE - 1;
+  cube[0].vol = (WU_SIZE - 1) * (WU_SIZE - 1) * (WU_SIZE - 1);
+  vv[0] = 0;
+  next = 0;
+  nb_colors = 1;
+  while (nb_colors < 256)
+  {
+    T_Wu_box parent = cube[next];
+
+    if (Wu_cut(&m, &cube[next], &cube[nb_colors]))
+    {
+      // The box which is cut is a node of the color tree, its two halves
+      // are added later, either when they are cut or at the end.
+      Wu_set_tree(tc, &parent, 0);
+      vv[next] = (cube[next].vol > 1) ? Wu_variance(&cube[next], &m) : 0.0;
+      vv[nb_colors] = (cube[nb_colors].vol > 1) ? Wu_variance(&cube[nb_colors], &m) : 0.0;
+      nb_colors++;
+    }
+    else
+      vv[next] = 0.0; // Don't try to cut this one again
+
+    // Cut the box with the biggest error next
+    next = 0;
+    for (i = 1; i < nb_colors; i++)
+      if (vv[i] > vv[next])
+        next = i;
+    if (vv[next] <= 0.0)
+      break;
+  }
+
+  for (i = 0; i < nb_colors; i++)
+  {
+    double weight = Wu_volume(&cube[i], m.wt);
+
+    if (weight > 0)
+    {
+      palette[i].R = (byte)(Wu_volume(&cube[i], m.mr) / weight + 0.5);
+      palette[i].G = (byte)(Wu_volume(&cube[i], m.mg) / weight + 0.5);
+      palette[i].B = (byte)(Wu_volume(&cube[i], m.mb) / weight + 0.5);
+    }
+    else
+      palette[i].R = palette[i].G = palette[i].B = 0;
+    Wu_set_tree(tc, &cube[i], i);
+  }
+  free(m.wt);
+  return tc;
+}
+
+
+// K-means refinement of a palette
+// Each color of the picture is assigned to its nearest palette entry, and
+// each palette entry is moved to the mean of its colors. This never
+// increases the error, and a few iterations from the median cut palette are
+// enough to get most of the improvement.
+
+/// Number of bits per component of the colors used by the k-means refinement
+#define KMEANS_BITS 6
+
+/// Number of bits per component of the lookup grid of a k-means palette
+#define KMEANS_GRID_BITS 6
+
+/// Number of k-means passes done by Convert_24b_bitmap_to_256()
+#define KMEANS_ITERATIONS 4
+
+/// A color of the picture, for the k-means refinement
+typedef struct
+{
+  float r, g, b;  ///< Mean color of the pixels
+  int weight;     ///< Number of pixels
+} T_Kmeans_color;
+
+/// Nearest color of a palette
+static int Kmeans_nearest(const T_Components * palette, int nb_colors, float r, float g, float b)
+{
+  float best_distance = 1e9f;
+  int best = 0;
+  int i;
+
+  for (i = 0; i < nb_colors; i++)
+  {
+    float dr = r - palette[i].R;
+    float dg = g - palette[i].G;
+    float db = b - palette[i].B;
+    float distance = dr * dr + dg * dg + db * db;
+
+    if (distance < best_distance)
+    {
+      best_distance = distance;
+      best = i;
+    }
+  }
+  return best;
+}
+
+/// Refine a palette with the k-means algorithm.
+///
+/// @returns a conversion tree for the refined palette, or NULL if out of
+/// memory. In that case the palette is not modified.
+///
+/// @param image The true-color image
+/// @param size in pixels
+/// @param palette the palette to refine, generated by Optimize_palette()
+/// @param tc the conversion tree of the palette, used to know the number of colors
+/// @param iterations number of refinement passes
+CT_Tree* Refine_palette_kmeans(T_Bitmap24B image, int size, T_Components * palette,
+  const CT_Tree* tc, int iterations)
+{
+  const int table_size = 1 << (3 * KMEANS_BITS);
+  const int shift = 8 - KMEANS_BITS;
+  T_Components refined[256];
+  T_Kmeans_color * colors;
+  double * sums;
+  int nb_palette = 0;
+  int nb_colors;
+  int i;
+
+  // The palette of the median cut uses the first entries
+  for (i = 0; i < tc->nodecount; i++)
+    if (tc->nodes[i].children[0] == 0 && tc->nodes[i].children[1] >= nb_palette)
+      nb_palette = tc->nodes[i].children[1] + 1;
+  if (nb_palette < 1)
+    return NULL;
+
+  // Reduce the picture to the list of its colors (at KMEANS_BITS precision)
+  sums = (double *)calloc(4 * table_size, sizeof(double));
+  if (sums == NULL)
+    return NULL;
+  for (i = 0; i < size; i++)
+  {
+    double * sum = sums + 4 * (((image[i].R >> shift) << (2 * KMEANS_BITS))
+                             | ((image[i].G >> shift) << KMEANS_BITS)
+                             | (image[i].B >> shift));
+    sum[0] += image[i].R;
+    sum[1] += image[i].G;
+    sum[2] += image[i].B;
+    sum[3] += 1;
+  }
+  nb_colors = 0;
+  for (i = 0; i < table_size; i++)
+    if (sums[4 * i + 3] > 0)
+      nb_colors++;
+  colors = (T_Kmeans_color *)malloc(nb_colors * sizeof(T_Kmeans_color));
+  if (colors == NULL)
+  {
+    free(sums);
+    return NULL;
+  }
+  nb_colors = 0;
+  for (i = 0; i < table_size; i++)
+  {
+    const double * sum = sums + 4 * i;
+
+    if (sum[3] > 0)
+    {
+      colors[nb_colors].r = (float)(sum[0] / sum[3]);
+      colors[nb_colors].g = (float)(sum[1] / sum[3]);
+      colors[nb_colors].b = (float)(sum[2] / sum[3]);
+      colors[nb_colors].weight = (int)sum[3];
+      nb_colors++;
+    }
+  }
+
+  memcpy(refined, palette, nb_palette * sizeof(T_Components));
+  while (iterations-- > 0)
+  {
+    // The table is reused for the sums of each palette entry
+    memset(sums, 0, 4 * nb_palette * sizeof(double));
+    for (i = 0; i < nb_colors; i++)
+    {
+      const T_Kmeans_color * c = colors + i;
+      double * sum = sums + 4 * Kmeans_nearest(refined, nb_palette, c->r, c->g, c->b);
+
+      sum[0] += (double)c->r * c->weight;
+      sum[1] += (double)c->g * c->weight;
+      sum[2] += (double)c->b * c->weight;
+      sum[3] += c->weight;
+    }
+    for (i = 0; i < nb_palette; i++)
+    {
+      const double * sum = sums + 4 * i;
+
+      // An unused entry keeps its color
+      if (sum[3] > 0)
+      {
+        refined[i].R = (byte)(sum[0] / sum[3] + 0.5);
+        refined[i].G = (byte)(sum[1] / sum[3] + 0.5);
+        refined[i].B = (byte)(sum[2] / sum[3] + 0.5);
+      }
+    }
+  }
+  free(colors);
+  free(sums);
+
+  // The palette is not a partition of the RGB cube anymore, so the
+  // conversion uses a grid of the nearest colors
+  tc = CT_new_nearest(refined, nb_palette, KMEANS_GRID_BITS);
+  if (tc != NULL)
+    memcpy(palette, refined, nb_palette * sizeof(T_Components));
+  return (CT_Tree*)tc;
+}
+
+
 /// Change a value with proper ceiling and flooring
 int Modified_value(int value,int modif)
 {
@@ -1235,101 +1860,173 @@ int Modified_value(int value,int modif)
 }
 
 
-/// Convert a 24b image to 256 colors (with a given palette and conversion table).
-/// This destroys the 24b picture !
-/// Uses floyd steinberg dithering.
-void Convert_24b_bitmap_to_256_Floyd_Steinberg(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette,CT_Tree* tc)
+/// Number of pixels processed before the progress of a line is published
+#define FS_PROGRESS_STEP 64
+
+/// Minimum number of pixels to use several threads for the dithering
+#define FS_MIN_PIXELS_PER_THREAD 65536
+
+/// Shared state of the threads of Convert_24b_bitmap_to_256_Floyd_Steinberg()
+typedef struct
 {
-  T_Bitmap24B current;
-  T_Bitmap24B c_plus1;
-  T_Bitmap24B u_minus1;
-  T_Bitmap24B next;
-  T_Bitmap24B u_plus1;
-  T_Bitmap256 d;
-  int x_pos,y_pos;
-  int red,green,blue;
-  float e_red,e_green,e_blue;
+  T_Bitmap256 dest;
+  const T_Components * source;
+  int width;
+  int height;
+  const T_Components * palette;
+  CT_Tree * tc;
+  T_GFX2_lock * lock;
+  int next_line;    ///< Next line to be processed by a thread
+  int * progress;   ///< Number of pixels done, for each line
+  int nb_buffers;   ///< Number of lines of error buffers
+  int * errors;     ///< Errors diffused to the lines, in 1/16th
+} T_FS_context;
 
-  // On initialise les variables de parcours:
-  current =source;      // Le pixel dont on s'occupe
-  next =current+width; // Le pixel en dessous
-  c_plus1 =current+1;   // Le pixel à droite
-  u_minus1=next-1;   // Le pixel en bas à gauche
-  u_plus1 =next+1;   // Le pixel en bas à droite
-  d       =dest;
+/**
+ * Floyd-Steinberg worker.
+ *
+ * Each thread takes the next line to process, and follows the line above,
+ * which must be processed at least until the pixel on the upper right.
+ * Errors are kept in fixed point (1/16th) in a buffer for each line being
+ * processed, the source picture is left untouched.
+ */
+static void FS_Worker(void * data)
+{
+  T_FS_context * context = (T_FS_context *)data;
+  int width = context->width;
+  int line_size = (width + 2) * 3;
 
-  // On parcours chaque pixel:
-  for (y_pos=0;y_pos<height;y_pos++)
+  for (;;)
   {
-    for (x_pos=0;x_pos<width;x_pos++)
+    const T_Components * src;
+    T_Bitmap256 d;
+    int * errors_above;
+    int * errors_below;
+    int available;
+    int x, y;
+    int e_red = 0, e_green = 0, e_blue = 0; // Error for the pixel on the right
+
+    GFX2_Lock(context->lock);
+    y = context->next_line++;
+    GFX2_Unlock(context->lock);
+    if (y >= context->height)
+      return;
+
+    // Errors are stored at x+1 so the pixels on the left and on the right
+    // of the line don't need any special case
+    errors_above = context->errors + (y % context->nb_buffers) * line_size;
+    errors_below = context->errors + ((y + 1) % context->nb_buffers) * line_size;
+    memset(errors_below, 0, line_size * sizeof(int));
+
+    src = context->source + (long)y * width;
+    d = context->dest + (long)y * width;
+    available = (y == 0) ? width : 0;
+    for (x = 0; x < width; x++)
     {
-      // On prends la meilleure couleur de la palette qui traduit la couleur
-      // 24 bits de la source:
-      red=current->R;
-      green =current->G;
-      blue =current->B;
-      // Cherche la couleur correspondant dans la palette et la range dans l'image de destination
-      *d=CT_get(tc,red,green,blue);
-
-      // Puis on calcule pour chaque composante l'erreur dûe à l'approximation
-      red-=palette[*d].R;
-      green -=palette[*d].G;
-      blue -=palette[*d].B;
-
-      // Et dans chaque pixel voisin on propage l'erreur
-      // A droite:
-        e_red=(red*7)/16.0;
-        e_green =(green *7)/16.0;
-        e_blue =(blue *7)/16.0;
-        if (x_pos+1<width)
-        {
-          // Modified_value fait la somme des 2 params en bornant sur [0,255]
-          c_plus1->R=Modified_value(c_plus1->R,e_red);
-          c_plus1->G=Modified_value(c_plus1->G,e_green );
-          c_plus1->B=Modified_value(c_plus1->B,e_blue );
-        }
-      // En bas à gauche:
-      if (y_pos+1<height)
+      int needed = (x + 2 < width) ? x + 2 : width;
+      int red, green, blue;
+      int * e;
+      byte index;
+
+      // The line above must have diffused all its errors to this pixel
+      if (available < needed)
       {
-        e_red=(red*3)/16.0;
-        e_green =(green *3)/16.0;
-        e_blue =(blue *3)/16.0;
-        if (x_pos>0)
-        {
-          u_minus1->R=Modified_value(u_minus1->R,e_red);
-          u_minus1->G=Modified_value(u_minus1->G,e_green );
-          u_minus1->B=Modified_value(u_minus1->B,e_blue );
-        }
-      // En bas:
-        e_red=(red*5/16.0);
-        e_green =(green*5 /16.0);
-        e_blue =(blue*5 /16.0);
-        next->R=Modified_value(next->R,e_red);
-        next->G=Modified_value(next->G,e_green );
-        next->B=Modified_value(next->B,e_blue );
-      // En bas à droite:
-        if (x_pos+1<width)
-        {
-        e_red=(red/16.0);
-        e_green =(green /16.0);
-        e_blue =(blue /16.0);
-          u_plus1->R=Modified_value(u_plus1->R,e_red);
-          u_plus1->G=Modified_value(u_plus1->G,e_green );
-          u_plus1->B=Modified_value(u_plus1->B,e_blue );
-        }
+        GFX2_Lock(context->lock);
+        while ((available = context->progress[y - 1]) < needed)
+          GFX2_Lock_wait(context->lock);
+        GFX2_Unlock(context->lock);
       }
 
-      // On passe au pixel suivant :
-      current++;
-      c_plus1++;
-      u_minus1++;
-      next++;
-      u_plus1++;
+      e = errors_above + (x + 1) * 3;
+      red = Modified_value(src->R, (e[0] + e_red + 8) >> 4);
+      green = Modified_value(src->G, (e[1] + e_green + 8) >> 4);
+      blue = Modified_value(src->B, (e[2] + e_blue + 8) >> 4);
+      index = CT_get(context->tc, red, green, blue);
+      *d = index;
+
+      red -= context->palette[index].R;
+      green -= context->palette[index].G;
+      blue -= context->palette[index].B;
+
+      // Right: 7/16
+      e_red = red * 7;
+      e_green = green * 7;
+      e_blue = blue * 7;
+      // Bottom left: 3/16, bottom: 5/16, bottom right: 1/16
+      e = errors_below + x * 3;
+      e[0] += red * 3;
+      e[1] += green * 3;
+      e[2] += blue * 3;
+      e[3] += red * 5;
+      e[4] += green * 5;
+      e[5] += blue * 5;
+      e[6] += red;
+      e[7] += green;
+      e[8] += blue;
+
+      src++;
       d++;
+      if (((x + 1) % FS_PROGRESS_STEP) == 0 || x + 1 == width)
+      {
+        GFX2_Lock(context->lock);
+        context->progress[y] = x + 1;
+        GFX2_Lock_signal(context->lock);
+        GFX2_Unlock(context->lock);
+      }
     }
   }
 }
 
+/// Convert a 24b image to 256 colors (with a given palette and conversion table).
+/// Uses floyd steinberg dithering.
+///
+/// Large pictures are processed by several threads, a few pixels behind each
+/// other. The result is the same whatever the number of threads.
+/// @param nb_threads the number of threads, 0 to choose it from the number
+///                   of processors and the size of the picture
+void Convert_24b_bitmap_to_256_Floyd_Steinberg(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette,CT_Tree* tc,int nb_threads)
+{
+  T_FS_context context;
+
+  if (nb_threads <= 0)
+  {
+    nb_threads = GFX2_Thread_count();
+    if ((long)width * height < (long)nb_threads * FS_MIN_PIXELS_PER_THREAD)
+      nb_threads = (int)(((long)width * height) / FS_MIN_PIXELS_PER_THREAD);
+  }
+  if (nb_threads > GFX2_MAX_THREADS)
+    nb_threads = GFX2_MAX_THREADS;
+  if (nb_threads > height)
+    nb_threads = height;
+  if (nb_threads < 1)
+    nb_threads = 1;
+
+  context.dest = dest;
+  context.source = source;
+  context.width = width;
+  context.height = height;
+  context.palette = palette;
+  context.tc = tc;
+  context.next_line = 0;
+  // A line buffer is reused once the line above it is completely done.
+  // As the lines are finished in order, it is enough to have one more
+  // buffer than the number of threads.
+  context.nb_buffers = nb_threads + 1;
+  context.lock = GFX2_Lock_new();
+  context.progress = (int *)calloc(height, sizeof(int));
+  context.errors = (int *)calloc((size_t)context.nb_buffers * (width + 2) * 3, sizeof(int));
+  if (context.lock == NULL || context.progress == NULL || context.errors == NULL)
+  {
+    // Not enough memory: at least convert the picture
+    Convert_24b_bitmap_to_256_nearest_neighbor(dest, source, width, height, palette, tc);
+  }
+  else
+    GFX2_Run_threads(nb_threads, FS_Worker, &context);
+  free(context.errors);
+  free(context.progress);
+  GFX2_Lock_delete(context.lock);
+}
+
 
 /// Converts from 24b to 256c without dithering, using given conversion table
 void Convert_24b_bitmap_to_256_nearest_neighbor(T_Bitmap256 dest,
@@ -1429,9 +2126,11 @@ static const byte precision_24b[]=
  * @param[in] width the width of the picture
  * @param[in] height the height of the picture
  * @param[out] palette the palette of the converted 8bpp picture
+ * @param quantizer the color reduction algorithm
+ * @param dither true to use Floyd-Steinberg dithering
  * @return 0 for OK, 1 for error
  */
-int Convert_24b_bitmap_to_256(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette)
+int Convert_24b_bitmap_to_256(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette,enum QUANTIZER quantizer,int dither)
 {
 #if !(defined(__GP2X__) || defined(__gp2x__) || defined(__WIZ__) || defined(__CAANOO__))
   CT_Tree* table; // table de conversion
@@ -1442,24 +2141,49 @@ int Convert_24b_bitmap_to_256(T_Bitmap256 dest,T_Bitmap24B source,int width,int
     return 0;
 
   #if defined(__GP2X__) || defined(__gp2x__) || defined(__WIZ__) || defined(__CAANOO__)
+  (void)quantizer;
+  (void)dither;
   return Convert_24b_bitmap_to_256_fast(dest, source, width, height, palette);  
 
   #else
-  // On essaye d'obtenir une table de conversion qui loge en mémoire, avec la
-  // meilleure précision possible
-  for (ip=0;ip<(10*3);ip+=3)
+  table = NULL;
+  if (quantizer == QUANTIZER_WU)
+    table = Optimize_palette_Wu(source, width*height, palette);
+  if (table == NULL)
   {
-    table = Optimize_palette(source,width*height,palette,
-                             precision_24b[ip], precision_24b[ip+1], precision_24b[ip+2]);
-    if (table != NULL) {
-      break;
+    // On essaye d'obtenir une table de conversion qui loge en mémoire, avec la
+    // meilleure précision possible
+    for (ip=0;ip<(10*3);ip+=3)
+    {
+      table = Optimize_palette(source,width*height,palette,
+                               precision_24b[ip], precision_24b[ip+1], precision_24b[ip+2]);
+      if (table != NULL) {
+        break;
+      }
+    }
+    if (table != NULL && quantizer == QUANTIZER_KMEANS)
+    {
+      CT_Tree* refined = Refine_palette_kmeans(source, width*height, palette, table, KMEANS_ITERATIONS);
+
+      // Keep the median cut palette if there is not enough memory
+      if (refined != NULL)
+      {
+        CT_delete(table);
+        table = refined;
+      }
     }
   }
 
   if (table!=NULL)
   {
-    //Convert_24b_bitmap_to_256_Floyd_Steinberg(dest,source,width,height,palette,table);
-    Convert_24b_bitmap_to_256_nearest_neighbor(dest,source,width,height,palette,table);
+    // For big pictures, a lookup grid is faster than walking the tree
+    // for each pixel. It is not needed for the conversion to succeed.
+    if (table->grid == NULL && (long)width * height >= (1L << (3 * CT_GRID_BITS)))
+      CT_build_grid(table, CT_GRID_BITS);
+    if (dither)
+      Convert_24b_bitmap_to_256_Floyd_Steinberg(dest,source,width,height,palette,table,0);
+    else
+      Convert_24b_bitmap_to_256_nearest_neighbor(dest,source,width,height,palette,table);
     CT_delete(table);
     return 0;
   }
@@ -36,6 +36,15 @@
 typedef T_Components * T_Bitmap24B;
 typedef byte * T_Bitmap256;
 
+/// Color quantization algorithms used by Convert_24b_bitmap_to_256()
+enum QUANTIZER
+{
+  QUANTIZER_MEDIAN_CUT = 0, ///< Median cut, with the palette sorted by hue and luminance
+  QUANTIZER_WU,             ///< Xiaolin Wu's variance minimization
+  QUANTIZER_KMEANS,         ///< Median cut refined with a few k-means passes
+  QUANTIZER_COUNT           ///< Number of quantizers
+};
+
 
 ///////////////////////////////////////// Définition d'une table d'occurences
 
@@ -65,6 +74,10 @@ typedef struct
   int red_b; // Coefficient réducteur de traduction d'une couleur bleue (= 8-nbb_b)
 
   int * table;
+  /// Summed volume table: number of pixels in the box from (0,0,0) to each
+  /// color, with an extra plane of 0 before each axis.
+  /// Computed by OT_count_occurrences().
+  int * sat;
 } T_Occurrence_table;
 
 
@@ -175,6 +188,8 @@ void OT_delete(T_Occurrence_table * t);
 int OT_get(T_Occurrence_table * t,byte r,byte g,byte b);
 void OT_inc(T_Occurrence_table * t,byte r,byte g,byte b);
 void OT_count_occurrences(T_Occurrence_table * t,T_Bitmap24B image,int size);
+void OT_compute_sums(T_Occurrence_table * t);
+int OT_count_box(const T_Occurrence_table * t,int rmin,int rmax,int gmin,int gmax,int bmin,int bmax);
 
 
 
@@ -210,5 +225,10 @@ T_Gradient_set * GS_New(T_Cluster_set * cs);
 void GS_Delete(T_Gradient_set * ds);
 void GS_Generate(T_Gradient_set * ds,T_Cluster_set * cs);
 
-int Convert_24b_bitmap_to_256(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette);
+CT_Tree* Optimize_palette(T_Bitmap24B image, int size, T_Components * palette, int r, int g, int b);
+CT_Tree* Optimize_palette_Wu(T_Bitmap24B image, int size, T_Components * palette);
+CT_Tree* Refine_palette_kmeans(T_Bitmap24B image, int size, T_Components * palette, const CT_Tree* tc, int iterations);
+void Convert_24b_bitmap_to_256_Floyd_Steinberg(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette,CT_Tree* tc,int nb_threads);
+void Convert_24b_bitmap_to_256_nearest_neighbor(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette,CT_Tree* tc);
+int Convert_24b_bitmap_to_256(T_Bitmap256 dest,T_Bitmap24B source,int width,int height,T_Components * palette,enum QUANTIZER quantizer,int dither);
 #endif
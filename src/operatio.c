@@ -2808,7 +2808,7 @@ void Scroll_12_0(void)
   Operation_push(Paintbrush_Y);
   Operation_push(Mouse_K); // LEFT_SIDE or RIGHT_SIDE
   if (Mouse_K == LEFT_SIDE)
-    Backup();
+    Backup_layers(Main.current_layer); // Scroll_picture() doesn't record the changes
   else
   {
     Backup_layers(LAYER_ALL); // Main.layers_visible
@@ -95,60 +95,512 @@ T_Page * New_page(int nb_layers)
 // ==============================================================
 // Layers allocation functions.
 //
-// Layers are made of a "number of users" (short), followed by
-// the actual pixel data (a large number of bytes).
+// Layers are made of a header (T_Layer_header, with the "number of
+// users"), followed by the actual pixel data (a large number of bytes).
 // Every time a layer is 'duplicated' as a reference, the number
 // of users is incremented.
 // Every time a layer is freed, the number of users is decreased,
 // and only when it reaches zero the pixel data is freed.
+//
+// When Config.Compress_undo is set, the layers which are only used by
+// old history steps are "packed": the pixel data is replaced by a table
+// of LAYER_TILE_SIZE x LAYER_TILE_SIZE tiles. The tiles are reference
+// counted too: a packed layer shares all the tiles which are identical
+// to the ones of the same layer in the older neighbour step, so only the
+// tiles where the user actually painted use new memory.
+// The current page and its ->Next (read as "the backup" by many tools)
+// are never packed, because all drawing functions expect a flat bitmap
+// in T_Image::Pixels. Undo and Redo unpack the pages they bring there, and
+// give up if there isn't enough memory to do it.
+//
+// The copies made by Backup() are flat too, but they don't cost a full
+// copy of the layer:
+// - Each layer copy remembers which layer it was copied from (Parent),
+//   and Mark_layer_changes(), called by the pixel functions of graph.c,
+//   flags the tiles that are painted in it afterwards (Changed).
+// - When a layer is packed, its flat block is recycled instead of freed.
+//   The next Backup() of the following step finds there the pixels of
+//   its parent, and only has to copy the tiles that were flagged.
+// - Packing shares the tiles which are not flagged without comparing them.
+// So a stroke costs a copy of the tiles it touched, plus one pointer per
+// tile of the layer.
 // ==============================================================
 
-/// Allocate a new layer
-byte * New_layer(long pixel_size)
+/// Width and height, in pixels, of the tiles of a packed layer.
+#define LAYER_TILE_SIZE 64
+
+/// A tile of a packed layer, shared by all packed layers where it's identical.
+typedef struct
 {
-  short * ptr = GFX2_malloc(sizeof(short)+pixel_size);
-  if (ptr==NULL)
+  long Users;  ///< Number of packed layers using this tile
+  byte Pixels[LAYER_TILE_SIZE*LAYER_TILE_SIZE];
+} T_Layer_tile;
+
+/// Data stored in front of the pixels of each layer.
+typedef struct T_Layer_header
+{
+  long  Size;    ///< Number of bytes allocated after the header
+  int   Width;   ///< Width of the layer, 0 if unknown
+  int   Height;  ///< Height of the layer, 0 if unknown
+  dword Id;      ///< Unique number of these pixels, kept when the layer is packed
+  dword Parent;  ///< Id of the layer this one was copied from, 0 if none
+  byte * Changed; ///< One byte per tile, non-zero if it can differ from Parent. NULL if unknown
+  short Users;   ///< Number of references to this layer
+  byte  Packed;  ///< Boolean, true if the data is a table of T_Layer_tile pointers
+} T_Layer_header;
+
+#define LAYER_HEADER(layer) (((T_Layer_header *)(layer))-1)
+
+/// Number of tiles needed to cover @p size pixels
+#define LAYER_TILES(size) (((size) + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE)
+
+/// Last value given to T_Layer_header::Id
+static dword Last_layer_id = 0;
+
+/// Number of flat blocks kept by Recycle_layer_block()
+#define NB_RECYCLED_LAYERS 2
+
+/// Flat blocks of layers that were just packed, most recent first.
+/// They are still counted in the stats.
+static T_Layer_header * Recycled_layers[NB_RECYCLED_LAYERS];
+
+/// Allocate a layer block with room for @p size bytes of data.
+static T_Layer_header * Allocate_layer_block(long size)
+{
+  T_Layer_header * header = GFX2_malloc(sizeof(T_Layer_header)+size);
+  if (header==NULL)
     return NULL;
-    
+
   // Stats
   Stats_pages_number++;
-  Stats_pages_memory+=pixel_size;
-  
-  *ptr = 1;
-  return (byte *)(ptr+1);
+  Stats_pages_memory+=size;
+
+  header->Size = size;
+  header->Width = 0;
+  header->Height = 0;
+  header->Id = ++Last_layer_id;
+  header->Parent = 0;
+  header->Changed = NULL;
+  header->Users = 1;
+  header->Packed = 0;
+  return header;
 }
 
-/// Free a layer
-void Free_layer(T_Page * page, int layer)
+/// Remove a reference to a tile, and free it when it's no longer used.
+static void Release_tile(T_Layer_tile * tile)
 {
-  short * ptr;
-  if (page->Image[layer].Pixels==NULL)
+  if (tile==NULL || -- tile->Users)
     return;
-    
-  ptr = (short *)(page->Image[layer].Pixels);
-  if (-- (*(ptr-1))) // Users--
-    return;
-  else {
-    free(ptr-1);
+  Stats_pages_memory-=sizeof(T_Layer_tile);
+  free(tile);
+}
+
+/// Free a layer block and its tiles, without looking at its number of users.
+static void Free_layer_block(T_Layer_header * header)
+{
+  if (header->Packed)
+  {
+    T_Layer_tile ** tiles = (T_Layer_tile **)(header+1);
+    long nb_tiles = header->Size / sizeof(T_Layer_tile *);
+    long i;
+    for (i=0; i<nb_tiles; i++)
+      Release_tile(tiles[i]);
   }
-    
   // Stats
   Stats_pages_number--;
-  Stats_pages_memory-=page->Width * page->Height;
+  Stats_pages_memory-=header->Size;
+
+  free(header->Changed);
+  free(header);
+}
+
+/// Keep the flat block of a layer which was just packed, so Copy_layer()
+/// can reuse it. The oldest recycled block is freed if there's no room.
+static void Recycle_layer_block(T_Layer_header * header)
+{
+  int i;
+
+  free(header->Changed);
+  header->Changed = NULL;
+  if (Recycled_layers[NB_RECYCLED_LAYERS-1] != NULL)
+    Free_layer_block(Recycled_layers[NB_RECYCLED_LAYERS-1]);
+  for (i = NB_RECYCLED_LAYERS-1; i > 0; i--)
+    Recycled_layers[i] = Recycled_layers[i-1];
+  Recycled_layers[0] = header;
+}
+
+/// Free all the recycled blocks.
+static void Free_recycled_layers(void)
+{
+  int i;
+
+  for (i = 0; i < NB_RECYCLED_LAYERS; i++)
+  {
+    if (Recycled_layers[i] != NULL)
+      Free_layer_block(Recycled_layers[i]);
+    Recycled_layers[i] = NULL;
+  }
+}
+
+/// Take a recycled block of @p size bytes, preferably the one with Id @p id.
+/// @return NULL if there is none
+static T_Layer_header * Take_recycled_layer_block(long size, dword id)
+{
+  T_Layer_header * header;
+  int found = -1;
+  int i;
+
+  for (i = 0; i < NB_RECYCLED_LAYERS && Recycled_layers[i] != NULL; i++)
+  {
+    if (Recycled_layers[i]->Size != size)
+      continue;
+    if (Recycled_layers[i]->Id == id)
+    {
+      found = i;
+      break;
+    }
+    if (found < 0)
+      found = i;
+  }
+  if (found < 0)
+    return NULL;
+  header = Recycled_layers[found];
+  for (i = found; i < NB_RECYCLED_LAYERS-1; i++)
+    Recycled_layers[i] = Recycled_layers[i+1];
+  Recycled_layers[NB_RECYCLED_LAYERS-1] = NULL;
+  return header;
+}
+
+/// Allocate a new layer
+byte * New_layer(long pixel_size)
+{
+  T_Layer_header * header = Allocate_layer_block(pixel_size);
+  if (header==NULL)
+    return NULL;
+  return (byte *)(header+1);
+}
+
+/// Remove a reference to a layer, and free it when it's no longer used.
+static void Release_layer(byte * layer)
+{
+  T_Layer_header * header;
+
+  if (layer==NULL)
+    return;
+  header = LAYER_HEADER(layer);
+  if (-- header->Users) // Users--
+    return;
+  Free_layer_block(header);
+}
+
+/// Free a layer
+void Free_layer(T_Page * page, int layer)
+{
+  Release_layer(page->Image[layer].Pixels);
 }
 
 /// Duplicate a layer (new reference)
 byte * Dup_layer(byte * layer)
 {
-  short * ptr = (short *)(layer);
-  
   if (layer==NULL)
     return NULL;
-  
-  (*(ptr-1)) ++; // Users ++
+
+  LAYER_HEADER(layer)->Users++; // Users ++
   return layer;
 }
 
+///
+/// Make a new flat copy of a layer of @p width x @p height pixels.
+/// If the tiles changed in @p layer since it was copied are known, and its
+/// parent is still in a recycled block, only those tiles are copied.
+/// With @p track_changes, the copy records the tiles that Mark_layer_changes()
+/// reports afterwards.
+/// @return NULL if there is not enough memory
+static byte * Copy_layer(byte * layer, int width, int height, int track_changes)
+{
+  T_Layer_header * source = LAYER_HEADER(layer);
+  T_Layer_header * header;
+  byte * pixels;
+
+  header = Take_recycled_layer_block(source->Size, source->Parent);
+  if (header == NULL)
+    header = Allocate_layer_block(source->Size);
+  if (header == NULL)
+    return NULL;
+  pixels = (byte *)(header+1);
+
+  if (source->Changed != NULL && source->Width == width && source->Height == height
+    && source->Parent != 0 && header->Id == source->Parent)
+  {
+    // The block holds the parent: only bring the changed tiles up to date
+    int nb_tiles_x = LAYER_TILES(width);
+    int nb_tiles_y = LAYER_TILES(height);
+    int tile_x, tile_y;
+    long i = 0;
+
+    for (tile_y = 0; tile_y < nb_tiles_y; tile_y++)
+    {
+      int tile_height = Min(LAYER_TILE_SIZE, height - tile_y*LAYER_TILE_SIZE);
+      for (tile_x = 0; tile_x < nb_tiles_x; tile_x++, i++)
+      {
+        long offset = (long)tile_y*LAYER_TILE_SIZE*width + tile_x*LAYER_TILE_SIZE;
+        int tile_width = Min(LAYER_TILE_SIZE, width - tile_x*LAYER_TILE_SIZE);
+        int y;
+
+        if (!source->Changed[i])
+          continue;
+        for (y = 0; y < tile_height; y++, offset += width)
+          memcpy(pixels + offset, layer + offset, tile_width);
+      }
+    }
+  }
+  else
+    memcpy(pixels, layer, source->Size);
+
+  header->Width = width;
+  header->Height = height;
+  header->Id = ++Last_layer_id;
+  header->Parent = source->Id;
+  header->Users = 1;
+  if (track_changes && (long)width*height == source->Size)
+  {
+    header->Changed = GFX2_malloc((long)LAYER_TILES(width) * LAYER_TILES(height));
+    if (header->Changed != NULL)
+      memset(header->Changed, 0, (long)LAYER_TILES(width) * LAYER_TILES(height));
+  }
+  return pixels;
+}
+
+/// Records that a rectangle of a layer was modified, see Copy_layer().
+void Mark_layer_changes(byte * layer, int x_pos, int y_pos, int width, int height)
+{
+  T_Layer_header * header = LAYER_HEADER(layer);
+  int tile_x, tile_y;
+
+  if (header->Changed == NULL || width <= 0 || height <= 0)
+    return;
+  for (tile_y = y_pos / LAYER_TILE_SIZE; tile_y <= (y_pos + height - 1) / LAYER_TILE_SIZE; tile_y++)
+    for (tile_x = x_pos / LAYER_TILE_SIZE; tile_x <= (x_pos + width - 1) / LAYER_TILE_SIZE; tile_x++)
+      header->Changed[tile_y * LAYER_TILES(header->Width) + tile_x] = 1;
+}
+
+/// Replace all uses of a layer by another one, in all pages of a list.
+static void Replace_layer(T_List_of_pages * list, byte * old_layer, byte * new_layer)
+{
+  T_Page * page;
+  int i;
+
+  page = list->Pages;
+  do
+  {
+    for (i=0; i<page->Nb_layers; i++)
+      if (page->Image[i].Pixels == old_layer)
+        page->Image[i].Pixels = new_layer;
+    page = page->Next;
+  } while (page != list->Pages);
+}
+
+///
+/// Replace the pixels of a layer by a table of tiles.
+/// The tiles which are identical in @p neighbour (a packed layer of same
+/// dimensions, or NULL) are shared instead of copied.
+static void Pack_layer(T_List_of_pages * list, byte * layer, int width, int height, byte * neighbour)
+{
+  T_Layer_header * header = LAYER_HEADER(layer);
+  T_Layer_header * packed;
+  T_Layer_tile ** tiles;
+  T_Layer_tile ** neighbour_tiles = NULL;
+  const byte * changed = NULL;
+  int nb_tiles_x, nb_tiles_y;
+  int tile_x, tile_y;
+  long i;
+
+  if (header->Packed || header->Size != (long)width*height)
+    return;
+  if (neighbour != NULL && neighbour != layer
+    && LAYER_HEADER(neighbour)->Packed
+    && LAYER_HEADER(neighbour)->Width == width
+    && LAYER_HEADER(neighbour)->Height == height)
+  {
+    neighbour_tiles = (T_Layer_tile **)neighbour;
+    // If the layer was copied from the neighbour, the tiles not flagged
+    // as changed are identical.
+    if (LAYER_HEADER(neighbour)->Id == header->Parent)
+      changed = header->Changed;
+  }
+
+  nb_tiles_x = LAYER_TILES(width);
+  nb_tiles_y = LAYER_TILES(height);
+  packed = Allocate_layer_block((long)nb_tiles_x * nb_tiles_y * sizeof(T_Layer_tile *));
+  if (packed == NULL)
+    return;
+  packed->Width = width;
+  packed->Height = height;
+  packed->Packed = 1;
+  tiles = (T_Layer_tile **)(packed+1);
+
+  i = 0;
+  for (tile_y = 0; tile_y < nb_tiles_y; tile_y++)
+  {
+    int tile_height = Min(LAYER_TILE_SIZE, height - tile_y*LAYER_TILE_SIZE);
+    for (tile_x = 0; tile_x < nb_tiles_x; tile_x++, i++)
+    {
+      int tile_width = Min(LAYER_TILE_SIZE, width - tile_x*LAYER_TILE_SIZE);
+      const byte * src = layer + (long)tile_y*LAYER_TILE_SIZE*width + tile_x*LAYER_TILE_SIZE;
+      int y;
+
+      if (neighbour_tiles != NULL)
+      {
+        T_Layer_tile * tile = neighbour_tiles[i];
+        if (changed != NULL && !changed[i])
+          y = tile_height; // Not painted since the copy
+        else
+        {
+          for (y = 0; y < tile_height; y++)
+            if (memcmp(tile->Pixels + y*LAYER_TILE_SIZE, src + (long)y*width, tile_width))
+              break;
+        }
+        if (y == tile_height)
+        {
+          // Identical: share it
+          tile->Users++;
+          tiles[i] = tile;
+          continue;
+        }
+      }
+      tiles[i] = GFX2_malloc(sizeof(T_Layer_tile));
+      if (tiles[i] == NULL)
+      {
+        // Not enough memory: keep the layer as it is.
+        // Only the first i tiles are set, so release them here and free
+        // the table as an unpacked block, with the size it was counted for.
+        while (i > 0)
+          Release_tile(tiles[--i]);
+        packed->Packed = 0;
+        Free_layer_block(packed);
+        return;
+      }
+      Stats_pages_memory+=sizeof(T_Layer_tile);
+      tiles[i]->Users = 1;
+      for (y = 0; y < tile_height; y++)
+        memcpy(tiles[i]->Pixels + y*LAYER_TILE_SIZE, src + (long)y*width, tile_width);
+    }
+  }
+  packed->Id = header->Id;
+  packed->Users = header->Users;
+  Replace_layer(list, layer, (byte *)(packed+1));
+  Recycle_layer_block(header);
+}
+
+/// Restore the pixels of a packed layer.
+/// @return 0 if there is not enough memory, the layer is left packed then
+static int Unpack_layer(T_List_of_pages * list, byte * layer)
+{
+  T_Layer_header * header;
+  T_Layer_header * unpacked;
+  T_Layer_tile ** tiles;
+  byte * pixels;
+  int width, height;
+  int x, y;
+
+  if (layer == NULL || !LAYER_HEADER(layer)->Packed)
+    return 1;
+  header = LAYER_HEADER(layer);
+  width = header->Width;
+  height = header->Height;
+
+  unpacked = Allocate_layer_block((long)width*height);
+  if (unpacked == NULL)
+    return 0;
+  pixels = (byte *)(unpacked+1);
+  tiles = (T_Layer_tile **)layer;
+  for (y = 0; y < height; y++)
+  {
+    T_Layer_tile ** tile_row = tiles + (y / LAYER_TILE_SIZE) * LAYER_TILES(width);
+    int offset = (y % LAYER_TILE_SIZE) * LAYER_TILE_SIZE;
+    for (x = 0; x < width; x += LAYER_TILE_SIZE)
+      memcpy(pixels + (long)y*width + x, tile_row[x / LAYER_TILE_SIZE]->Pixels + offset, Min(LAYER_TILE_SIZE, width - x));
+  }
+  unpacked->Users = header->Users;
+
+  Replace_layer(list, layer, pixels);
+  Free_layer_block(header);
+  return 1;
+}
+
+/// Restore the pixels of all the layers of a page.
+/// @return 0 if there is not enough memory
+static int Unpack_page(T_List_of_pages * list, T_Page * page)
+{
+  int i;
+  for (i=0; i<page->Nb_layers; i++)
+    if (!Unpack_layer(list, page->Image[i].Pixels))
+      return 0;
+  return 1;
+}
+
+/// Returns true if a layer is used by one of the given pages.
+static int Is_layer_used_by(byte * layer, T_Page ** pages, int nb_pages)
+{
+  int p, i;
+  for (p=0; p<nb_pages; p++)
+    for (i=0; i<pages[p]->Nb_layers; i++)
+      if (pages[p]->Image[i].Pixels == layer)
+        return 1;
+  return 0;
+}
+
+/// Pack the layers of @p page, sharing tiles with the ones of @p neighbour_page.
+static void Pack_page(T_List_of_pages * list, T_Page * page, T_Page * neighbour_page, T_Page ** near_pages)
+{
+  int i;
+  for (i=0; i<page->Nb_layers; i++)
+  {
+    byte * layer = page->Image[i].Pixels;
+    if (layer == NULL || LAYER_HEADER(layer)->Packed || Is_layer_used_by(layer, near_pages, 2))
+      continue;
+    Pack_layer(list, layer, page->Width, page->Height,
+      i < neighbour_page->Nb_layers ? neighbour_page->Image[i].Pixels : NULL);
+  }
+}
+
+///
+/// Packs the layers of all pages except the current one and its ->Next,
+/// if Config.Compress_undo is set. Those two pages must be unpacked already.
+/// Pages are packed from the farthest to the nearest, so each one can share
+/// the tiles of its (already packed) neighbour on the far side.
+static void Pack_list_of_pages(T_List_of_pages * list)
+{
+  T_Page * near_pages[2];
+  T_Page * page;
+  int nb_next, nb_prev;
+  int i;
+
+  if (list == NULL || list->Pages == NULL)
+    return;
+  if (!Config.Compress_undo || list->List_size <= 2)
+    return;
+
+  near_pages[0] = list->Pages;
+  near_pages[1] = list->Pages->Next;
+
+  // Older steps, on the ->Next side
+  nb_next = (list->List_size - 1) / 2;
+  page = list->Pages->Next->Next;
+  for (i=1; i<nb_next; i++)
+    page = page->Next;
+  for (i=0; i<nb_next; i++, page = page->Prev)
+    Pack_page(list, page, page->Next, near_pages);
+
+  // Steps on the ->Prev side (redo steps, or oldest steps)
+  nb_prev = list->List_size - 2 - nb_next;
+  page = list->Pages->Prev;
+  for (i=1; i<nb_prev; i++)
+    page = page->Prev;
+  for (i=0; i<nb_prev; i++, page = page->Next)
+    Pack_page(list, page, page->Prev, near_pages);
+}
+
 // ==============================================================
 
 /// Adds a shared reference to the gradient data of another page. Pass NULL for new.
@@ -183,6 +635,7 @@ void Download_infos_page_main(T_Page * page)
     Main.image_width=page->Width;
     Main.image_height=page->Height;
     memcpy(Main.palette,page->Palette,sizeof(T_Palette));
+    Invalidate_best_color_cache();
     Main.fileformat=page->File_format;
 
     if (size_is_modified)
@@ -201,33 +654,127 @@ void Download_infos_page_main(T_Page * page)
   
 }
 
+/// A qword with all 8 bytes set to @p b
+#define QWORD_OF_BYTES(b) ((qword)(b) * (qword)0x0101010101010101ULL)
+
+/// True if one of the 8 bytes of @p v is zero.
+#define QWORD_HAS_ZERO_BYTE(v) ((((v) - (qword)0x0101010101010101ULL) & ~(v) & (qword)0x8080808080808080ULL) != 0)
+
+///
+/// Draw a row of a layer over a row of the visible image, skipping its
+/// transparent pixels.
+/// 8 pixels are tested at a time, so large transparent or opaque areas
+/// cost a single comparison. When @p depth is not NULL, it receives
+/// @p layer for each opaque pixel. When @p dest is NULL, only the depth is
+/// updated.
+static void Blend_layer_row(byte * dest, byte * depth, const byte * src, int width, byte transparent_color, byte layer)
+{
+  const qword transparent = QWORD_OF_BYTES(transparent_color);
+  const qword layer_pattern = QWORD_OF_BYTES(layer);
+  int x = 0;
+
+  for (; x + 8 <= width; x += 8)
+  {
+    qword pixels;
+    qword diff;
+
+    memcpy(&pixels, src + x, sizeof(qword));
+    if (pixels == transparent)
+      continue; // 8 transparent pixels
+    diff = pixels ^ transparent;
+    if (!QWORD_HAS_ZERO_BYTE(diff))
+    {
+      // 8 opaque pixels
+      if (dest != NULL)
+        memcpy(dest + x, &pixels, sizeof(qword));
+      if (depth != NULL)
+        memcpy(depth + x, &layer_pattern, sizeof(qword));
+    }
+    else
+    {
+      int i;
+      for (i = x; i < x + 8; i++)
+      {
+        if (src[i] != transparent_color)
+        {
+          if (dest != NULL)
+            dest[i] = src[i];
+          if (depth != NULL)
+            depth[i] = layer;
+        }
+      }
+    }
+  }
+  for (; x < width; x++)
+  {
+    if (src[x] != transparent_color)
+    {
+      if (dest != NULL)
+        dest[x] = src[x];
+      if (depth != NULL)
+        depth[x] = layer;
+    }
+  }
+}
+
 void Redraw_layered_image(void)
 {
+  Redraw_layered_image_area(0, 0, Main.image_width, Main.image_height);
+}
+
+void Redraw_layered_image_area(int x_pos, int y_pos, int width, int height)
+{
+  // Clip to the image
+  if (x_pos < 0)
+  {
+    width += x_pos;
+    x_pos = 0;
+  }
+  if (y_pos < 0)
+  {
+    height += y_pos;
+    y_pos = 0;
+  }
+  if (x_pos + width > Main.image_width)
+    width = Main.image_width - x_pos;
+  if (y_pos + height > Main.image_height)
+    height = Main.image_height - y_pos;
+
   if (Main.backups->Pages->Image_mode != IMAGE_MODE_ANIMATION)
   {
     // Re-construct the image with the visible layers
-    byte layer=0;  
+    byte layer=0;
+    int y;
+
+    if (width <= 0 || height <= 0)
+    {
+      Update_FX_feedback(Config.FX_Feedback);
+      return;
+    }
     // First layer
     if ((Main.backups->Pages->Image_mode == IMAGE_MODE_MODE5
 		|| Main.backups->Pages->Image_mode == IMAGE_MODE_RASTER) && Main.layers_visible & (1<<4))
     {
       // The raster result layer is visible: start there
       // Copy it in Main_visible_image
-      int i;
-      for (i=0; i< Main.image_width*Main.image_height; i++)
+      for (y = y_pos; y < y_pos + height; y++)
       {
-        layer = *(Main.backups->Pages->Image[4].Pixels+i);
-        if (Main.layers_visible & (1 << layer))
-          Main.visible_image.Image[i]=*(Main.backups->Pages->Image[layer].Pixels+i);
-        else
-          Main.visible_image.Image[i] = layer;
+        long i = (long)y * Main.image_width + x_pos;
+        long end = i + width;
+        for (; i < end; i++)
+        {
+          layer = *(Main.backups->Pages->Image[4].Pixels+i);
+          if (Main.layers_visible & (1 << layer))
+            Main.visible_image.Image[i]=*(Main.backups->Pages->Image[layer].Pixels+i);
+          else
+            Main.visible_image.Image[i] = layer;
+        }
+        // Copy it to the depth buffer
+        memcpy(Main_visible_image_depth_buffer.Image + (long)y * Main.image_width + x_pos,
+          Main.backups->Pages->Image[4].Pixels + (long)y * Main.image_width + x_pos,
+          width);
       }
-        
-      // Copy it to the depth buffer
-      memcpy(Main_visible_image_depth_buffer.Image,
-        Main.backups->Pages->Image[4].Pixels,
-        Main.image_width*Main.image_height);
-        
+
       // Next
       layer= (1<<4)+1;
     }
@@ -237,19 +784,22 @@ void Redraw_layered_image(void)
       {
         if ((1<<layer) & Main.layers_visible)
         {
-           // Copy it in Main_visible_image
-           memcpy(Main.visible_image.Image,
-             Main.backups->Pages->Image[layer].Pixels,
-             Main.image_width*Main.image_height);
-           
-           // Initialize the depth buffer
-           memset(Main_visible_image_depth_buffer.Image,
-             layer,
-             Main.image_width*Main.image_height);
-           
-           // skip all other layers
-           layer++;
-           break;
+          for (y = y_pos; y < y_pos + height; y++)
+          {
+            long offset = (long)y * Main.image_width + x_pos;
+            // Copy it in Main_visible_image
+            memcpy(Main.visible_image.Image + offset,
+              Main.backups->Pages->Image[layer].Pixels + offset,
+              width);
+
+            // Initialize the depth buffer
+            memset(Main_visible_image_depth_buffer.Image + offset,
+              layer,
+              width);
+          }
+          // skip all other layers
+          layer++;
+          break;
         }
       }
     }
@@ -258,16 +808,15 @@ void Redraw_layered_image(void)
     {
       if ((1<<layer) & Main.layers_visible)
       {
-        int i;
-        for (i=0; i<Main.image_width*Main.image_height; i++)
+        for (y = y_pos; y < y_pos + height; y++)
         {
-          byte color = *(Main.backups->Pages->Image[layer].Pixels+i);
-          if (color != Main.backups->Pages->Transparent_color) // transparent color
-          {
-            *(Main.visible_image.Image+i) = color;
-            if (layer != Main.current_layer)
-              *(Main_visible_image_depth_buffer.Image+i) = layer;
-          }
+          long offset = (long)y * Main.image_width + x_pos;
+          Blend_layer_row(Main.visible_image.Image + offset,
+            layer != Main.current_layer ? Main_visible_image_depth_buffer.Image + offset : NULL,
+            Main.backups->Pages->Image[layer].Pixels + offset,
+            width,
+            Main.backups->Pages->Transparent_color,
+            layer);
         }
       }
     }
@@ -279,6 +828,96 @@ void Redraw_layered_image(void)
   Update_FX_feedback(Config.FX_Feedback);
 }
 
+int Get_layer_bounds(int layer, int * x_pos, int * y_pos, int * width, int * height)
+{
+  const byte * pixels = Main.backups->Pages->Image[layer].Pixels;
+  const byte transparent_color = Main.backups->Pages->Transparent_color;
+  const qword transparent = QWORD_OF_BYTES(transparent_color);
+  int min_x = Main.image_width;
+  int max_x = -1;
+  int min_y = -1;
+  int max_y = -1;
+  int x, y;
+
+  for (y = 0; y < Main.image_height; y++)
+  {
+    const byte * row = pixels + (long)y * Main.image_width;
+    int first = -1;
+    int last = -1;
+
+    // Leftmost opaque pixel
+    for (x = 0; x + 8 <= Main.image_width; x += 8)
+    {
+      qword v;
+      memcpy(&v, row + x, sizeof(qword));
+      if (v != transparent)
+        break;
+    }
+    for (; x < Main.image_width; x++)
+      if (row[x] != transparent_color)
+      {
+        first = x;
+        break;
+      }
+    if (first < 0)
+      continue; // fully transparent row
+    // Rightmost opaque pixel
+    for (x = Main.image_width - 1; x > first; x--)
+      if (row[x] != transparent_color)
+        break;
+    last = x;
+
+    if (min_y < 0)
+      min_y = y;
+    max_y = y;
+    if (first < min_x)
+      min_x = first;
+    if (last > max_x)
+      max_x = last;
+  }
+  if (min_y < 0)
+    return 0;
+  *x_pos = min_x;
+  *y_pos = min_y;
+  *width = max_x - min_x + 1;
+  *height = max_y - min_y + 1;
+  return 1;
+}
+
+void Redraw_layers_visibility_change(dword old_layers_visible)
+{
+  dword changed = old_layers_visible ^ Main.layers_visible;
+  dword lowest_visible;
+  int layer;
+  int x_pos, y_pos, width, height;
+
+  // The incremental path only handles a single layer being shown or hidden,
+  // above the lowest visible layer (which is drawn opaque).
+  // It works for the current layer too: Redraw_layered_image_area() keeps
+  // it out of the depth buffer, like Redraw_layered_image() does.
+  lowest_visible = old_layers_visible | Main.layers_visible;
+  lowest_visible &= ~(lowest_visible - 1);
+  if (changed == 0 || (changed & (changed - 1)) != 0 || changed <= lowest_visible
+    || Main.backups->Pages->Image_mode == IMAGE_MODE_ANIMATION
+    || Main.backups->Pages->Image_mode == IMAGE_MODE_MODE5
+    || Main.backups->Pages->Image_mode == IMAGE_MODE_RASTER)
+  {
+    Redraw_layered_image();
+    return;
+  }
+  for (layer = 0; !(changed & (1 << layer)); layer++)
+    ;
+  if (layer >= Main.backups->Pages->Nb_layers)
+  {
+    Redraw_layered_image();
+    return;
+  }
+  if (Get_layer_bounds(layer, &x_pos, &y_pos, &width, &height))
+    Redraw_layered_image_area(x_pos, y_pos, width, height);
+  else
+    Update_FX_feedback(Config.FX_Feedback);
+}
+
 void Update_depth_buffer(void)
 {
   if (Main.backups->Pages->Image_mode != IMAGE_MODE_ANIMATION)
@@ -312,15 +951,12 @@ void Update_depth_buffer(void)
         
       if ((1<<layer) & Main.layers_visible)
       {
-        int i;
-        for (i=0; i<Main.image_width*Main.image_height; i++)
-        {
-          byte color = *(Main.backups->Pages->Image[layer].Pixels+i);
-          if (color != Main.backups->Pages->Transparent_color) // transparent color
-          {
-            *(Main_visible_image_depth_buffer.Image+i) = layer;
-          }
-        }
+        Blend_layer_row(NULL,
+          Main_visible_image_depth_buffer.Image,
+          Main.backups->Pages->Image[layer].Pixels,
+          Main.image_width*Main.image_height,
+          Main.backups->Pages->Transparent_color,
+          layer);
       }
     }
   }
@@ -358,17 +994,13 @@ void Redraw_spare_image(void)
     {
       if ((1<<layer) & Spare.layers_visible)
       {
-        int i;
-        for (i=0; i<Spare.image_width*Spare.image_height; i++)
-        {
-          byte color = *(Spare.backups->Pages->Image[layer].Pixels+i);
-          if (color != Spare.backups->Pages->Transparent_color) // transparent color
-          {
-            *(Spare.visible_image.Image+i) = color;
-            //if (layer != Spare.current_layer)
-            //  *(Spare_visible_image_depth_buffer.Image+i) = layer;
-          }
-        }
+        // No depth buffer in the spare
+        Blend_layer_row(Spare.visible_image.Image,
+          NULL,
+          Spare.backups->Pages->Image[layer].Pixels,
+          Spare.image_width*Spare.image_height,
+          Spare.backups->Pages->Transparent_color,
+          layer);
       }
     }
   }
@@ -509,7 +1141,7 @@ int Allocate_list_of_pages(T_List_of_pages * list)
 }
 
 
-void Backward_in_list_of_pages(T_List_of_pages * list)
+int Backward_in_list_of_pages(T_List_of_pages * list)
 {
   // Cette fonction fait l'équivalent d'un "Undo" dans la liste de pages.
   // Elle effectue une sorte de ROL (Rotation Left) sur la liste:
@@ -539,17 +1171,25 @@ void Backward_in_list_of_pages(T_List_of_pages * list)
       page0 = list->Pages;
       page1 = list->Pages->Next;
       
+      if (!Unpack_page(list, page1->Next))
+        return 0;
       page0->Next = page1->Next;
       page1->Prev = page0->Prev;
       page0->Prev = page1;
       page1->Next = page0;
       list->Pages = page0;
-      return;
+      Pack_list_of_pages(list);
+      return 1;
   }
+  // The new current page is already unpacked, but not its ->Next
+  if (!Unpack_page(list, list->Pages->Next->Next))
+    return 0;
   list->Pages = list->Pages->Next;
+  Pack_list_of_pages(list);
+  return 1;
 }
 
-void Advance_in_list_of_pages(T_List_of_pages * list)
+int Advance_in_list_of_pages(T_List_of_pages * list)
 {
   // Cette fonction fait l'équivalent d'un "Redo" dans la liste de pages.
   // Elle effectue une sorte de ROR (Rotation Right) sur la liste:
@@ -578,14 +1218,22 @@ void Advance_in_list_of_pages(T_List_of_pages * list)
       page0 = list->Pages;
       page1 = list->Pages->Prev;
       
+      if (!Unpack_page(list, page1))
+        return 0;
       page0->Prev = page1->Prev;
       page1->Next = page0->Next;
       page0->Next = page1;
       page1->Prev = page0;
       list->Pages = page1;
-      return;
+      Pack_list_of_pages(list);
+      return 1;
   }
+  // The new ->Next is the current page, already unpacked
+  if (!Unpack_page(list, list->Pages->Prev))
+    return 0;
   list->Pages = list->Pages->Prev;
+  Pack_list_of_pages(list);
+  return 1;
 }
 
 void Free_last_page_of_list(T_List_of_pages * list)
@@ -607,6 +1255,10 @@ void Free_last_page_of_list(T_List_of_pages * list)
         free(page);
         page = NULL;
         list->List_size--;
+        if (list->List_size>0)
+          Pack_list_of_pages(list);
+        else
+          Free_recycled_layers();
     }
   }
 }
@@ -651,7 +1303,9 @@ int Create_new_page(T_Page * new_page, T_List_of_pages * list, int layer)
   list->Pages->Prev = new_page;
   list->Pages = new_page;
   list->List_size++;
-  
+
+  Pack_list_of_pages(list);
+
   return 1;
 }
 
@@ -672,7 +1326,12 @@ void Free_page_of_a_list(T_List_of_pages * list)
   {
     // On fait faire un undo à la liste, comme ça, la nouvelle page courante
     // est la page précédente
-    Backward_in_list_of_pages(Main.backups);
+    if (!Backward_in_list_of_pages(Main.backups))
+    {
+      // Not enough memory to unpack the previous page: keep the current one
+      Error(0);
+      return;
+    }
 
     // Puis on détruit la dernière page, qui est l'ancienne page courante
     Free_last_page_of_list(list);
@@ -989,7 +1648,7 @@ int Backup_in_place(int width,int height)
     {
       // Allocation error
       for (; i>0; i--)
-        free(new_layer[i]);
+        Release_layer(new_layer[i-1]);
       free(new_layer);
       return 0;
     }
@@ -1089,14 +1748,11 @@ int Backup_and_resize_the_spare(int width,int height)
   return return_code;
 }
 
-void Backup(void)
-// Sauve la page courante comme première page de backup et crée une nouvelle page
-// pur continuer à dessiner. Utilisé par exemple pour le fill
-{
-  Backup_layers(Main.current_layer);
-}
-
-void Backup_layers(int layer)
+///
+/// Backs up the main page, with new copies of @p layer (a layer number or
+/// LAYER_ALL). With @p track_changes, the copies record the tiles modified by
+/// the pixel functions, which makes the next backup and the packing cheaper.
+static void Backup_layers_and_track(int layer, int track_changes)
 {
   int i;
   T_Page *new_page;
@@ -1120,22 +1776,33 @@ void Backup_layers(int layer)
   
   // Fill it with a copy of the latest history
   Copy_S_page(new_page,Main.backups->Pages);
-  Create_new_page(new_page,Main.backups,layer);
+  // All layers are references at first: the layers of the previous step
+  // are packed before copying, so their blocks can be recycled.
+  Create_new_page(new_page,Main.backups,LAYER_NONE);
   Download_infos_page_main(new_page);
 
-  Update_FX_feedback(Config.FX_Feedback);
-
   // Copy the actual pixels from the backup to the latest page
   if (layer != LAYER_NONE)
   {
     for (i=0; i<Main.backups->Pages->Nb_layers;i++)
     {
       if (layer == LAYER_ALL || i == layer)
-        memcpy(Main.backups->Pages->Image[i].Pixels,
-               Main.backups->Pages->Next->Image[i].Pixels,
-               Main.image_width*Main.image_height);
+      {
+        byte * pixels = Copy_layer(Main.backups->Pages->Next->Image[i].Pixels,
+                                   Main.image_width, Main.image_height,
+                                   track_changes);
+        if (pixels == NULL)
+        {
+          // The layer stays shared with the previous step
+          Error(0);
+          continue;
+        }
+        Free_layer(Main.backups->Pages, i);
+        Main.backups->Pages->Image[i].Pixels = pixels;
+      }
     }
   }
+  Update_FX_feedback(Config.FX_Feedback);
   // Light up the 'has unsaved changes' indicator
   Main.image_is_modified=1;
   
@@ -1144,6 +1811,18 @@ void Backup_layers(int layer)
   */
 }
 
+void Backup(void)
+// Sauve la page courante comme première page de backup et crée une nouvelle page
+// pur continuer à dessiner. Utilisé par exemple pour le fill
+{
+  Backup_layers_and_track(Main.current_layer, 1);
+}
+
+void Backup_layers(int layer)
+{
+  Backup_layers_and_track(layer, 0);
+}
+
 /// Backs up a layer, unless it's already different from previous history step.
 // This function checks if a layer/frame shares the same
 // bitmap as its Undo history parent.
@@ -1153,12 +1832,14 @@ int Dup_layer_if_shared(T_Page * page, int layer)
 {
   if (page->Image[layer].Pixels == page->Next->Image[layer].Pixels)
   {
+    byte * pixels = Copy_layer(page->Next->Image[layer].Pixels, page->Width, page->Height, 0);
+    if (pixels == NULL)
+    {
+      Error(0);
+      return 0;
+    }
     Free_layer(page, layer);
-    page->Image[layer].Pixels=New_layer(page->Height*page->Width);
-    memcpy(
-      page->Image[layer].Pixels,
-      page->Next->Image[layer].Pixels,
-      page->Width*page->Height);
+    page->Image[layer].Pixels = pixels;
     return 1;
   }
   return 0;
@@ -1179,7 +1860,7 @@ void Backup_the_spare(int layer)
   
   // Fill it with a copy of the latest history
   Copy_S_page(new_page,Spare.backups->Pages);
-  Create_new_page(new_page,Spare.backups,layer);
+  Create_new_page(new_page,Spare.backups,LAYER_NONE);
 
   // Copy the actual pixels from the backup to the latest page
   if (layer != LAYER_NONE)
@@ -1187,9 +1868,17 @@ void Backup_the_spare(int layer)
     for (i=0; i<Spare.backups->Pages->Nb_layers;i++)
     {
       if (layer == LAYER_ALL || i == layer)
-        memcpy(Spare.backups->Pages->Image[i].Pixels,
-               Spare.backups->Pages->Next->Image[i].Pixels,
-               Spare.image_width*Spare.image_height);
+      {
+        byte * pixels = Copy_layer(Spare.backups->Pages->Next->Image[i].Pixels,
+                                   Spare.image_width, Spare.image_height, 0);
+        if (pixels == NULL)
+        {
+          Error(0);
+          continue;
+        }
+        Free_layer(Spare.backups->Pages, i);
+        Spare.backups->Pages->Image[i].Pixels = pixels;
+      }
     }
   }
   // Light up the 'has unsaved changes' indicator
@@ -1221,7 +1910,12 @@ void Undo(void)
   // retrouver plus tard)
   Upload_infos_page(&Main);
   // On fait faire un undo à la liste des backups de la page principale
-  Backward_in_list_of_pages(Main.backups);
+  if (!Backward_in_list_of_pages(Main.backups))
+  {
+    // Not enough memory to unpack the step: stay on the current one
+    Error(0);
+    return;
+  }
 
   Update_buffers(Main.backups->Pages->Width, Main.backups->Pages->Height);
 
@@ -1254,7 +1948,12 @@ void Redo(void)
   // retrouver plus tard)
   Upload_infos_page(&Main);
   // On fait faire un redo à la liste des backups de la page principale
-  Advance_in_list_of_pages(Main.backups);
+  if (!Advance_in_list_of_pages(Main.backups))
+  {
+    // Not enough memory to unpack the step: stay on the current one
+    Error(0);
+    return;
+  }
 
   Update_buffers(Main.backups->Pages->Width, Main.backups->Pages->Height);
 
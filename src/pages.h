@@ -70,8 +70,10 @@ void Upload_infos_page(T_Document * doc);
 void Init_list_of_pages(T_List_of_pages * list);
 // private
 int Allocate_list_of_pages(T_List_of_pages * list);
-void Backward_in_list_of_pages(T_List_of_pages * list);
-void Advance_in_list_of_pages(T_List_of_pages * list);
+/// Makes the previous step the current one. @return 0 if out of memory, nothing is changed then
+int Backward_in_list_of_pages(T_List_of_pages * list);
+/// Makes the next step the current one. @return 0 if out of memory, nothing is changed then
+int Advance_in_list_of_pages(T_List_of_pages * list);
 void Free_last_page_of_list(T_List_of_pages * list);
 int Create_new_page(T_Page * new_page,T_List_of_pages * current_list, int layer);
 void Change_page_number_of_list(T_List_of_pages * list,int number);
@@ -99,9 +101,13 @@ int Backup_in_place(int width,int height);
 void Backup_the_spare(int layer);
 int Backup_and_resize_the_spare(int width,int height);
 /// Backup with a new copy for the working layer, and references for all others.
+/// The copy records the tiles modified by the pixel functions of graph.c, so
+/// operations which write in the layer directly must use Backup_layers().
 void Backup(void);
 /// Backup with a new copy of some layers (the others are references).
 void Backup_layers(int layer);
+/// Records that a rectangle of a layer was modified, see Backup().
+void Mark_layer_changes(byte * layer, int x_pos, int y_pos, int width, int height);
 void Undo(void);
 void Redo(void);
 void Free_current_page(void); // 'Kill' button
@@ -109,6 +115,12 @@ void End_of_modification(void);
 
 void Update_depth_buffer(void);
 void Redraw_layered_image(void);
+/// Re-composes a rectangle of the visible image and depth buffer from the visible layers.
+void Redraw_layered_image_area(int x_pos, int y_pos, int width, int height);
+/// Computes the bounding box of the non-transparent pixels of a layer. Returns 0 if it's fully transparent.
+int Get_layer_bounds(int layer, int * x_pos, int * y_pos, int * width, int * height);
+/// Re-composes the visible image after a change of Main.layers_visible, only where it's needed.
+void Redraw_layers_visibility_change(dword old_layers_visible);
 void Redraw_current_layer(void);
 
 void Update_screen_targets(void);
@@ -569,6 +569,7 @@ void Set_nice_menu_colors(dword * color_usage,int not_picture)
     Main.palette[color].G=Round_palette_component(target_rgb->G);
     Main.palette[color].B=Round_palette_component(target_rgb->B);
   }
+  Invalidate_best_color_cache();
 
   //   Maintenant qu'on a placé notre nouvelle palette, on va chercher quelles
   // sont les couleurs qui peuvent remplacer les anciennes
@@ -2006,9 +2007,11 @@ void Button_Palette(int btn)
             {
                 memcpy(temp_palette, Main.palette, sizeof(T_Palette));
                 memcpy(Main.palette, working_palette, sizeof(T_Palette));
+                Invalidate_best_color_cache();
                 Set_nice_menu_colors(color_usage, 0);
                 memcpy(working_palette, Main.palette, sizeof(T_Palette));
                 memcpy(Main.palette, temp_palette, sizeof(T_Palette));
+                Invalidate_best_color_cache();
             }
 
             Set_palette(working_palette); // On définit la nouvelle palette
@@ -2053,9 +2056,11 @@ void Button_Palette(int btn)
         {
           memcpy(temp_palette,Main.palette,sizeof(T_Palette));
           memcpy(Main.palette,working_palette,sizeof(T_Palette));
+          Invalidate_best_color_cache();
           Set_nice_menu_colors(color_usage,0);
           memcpy(working_palette,Main.palette,sizeof(T_Palette));
           memcpy(Main.palette,temp_palette,sizeof(T_Palette));
+          Invalidate_best_color_cache();
         }
 
         Set_palette(working_palette);
@@ -2642,11 +2647,13 @@ void Button_Palette(int btn)
       case 26: // Load palette
         memcpy(backup_palette, Main.palette, sizeof(T_Palette));
         memcpy(Main.palette, working_palette, sizeof(T_Palette));
+        Invalidate_best_color_cache();
         Load_picture(CONTEXT_PALETTE);
         memcpy(working_palette, Main.palette, sizeof(T_Palette));
         Set_palette(working_palette);
         memcpy(temp_palette,working_palette,sizeof(T_Palette));
         memcpy(Main.palette, backup_palette, sizeof(T_Palette));
+        Invalidate_best_color_cache();
         need_to_remap=1;
         break;
 
@@ -2654,8 +2661,10 @@ void Button_Palette(int btn)
         // Save the working palette (the one currently being edited)
         memcpy(backup_palette, Main.palette, sizeof(T_Palette));
         memcpy(Main.palette, working_palette, sizeof(T_Palette));
+        Invalidate_best_color_cache();
         Save_picture(CONTEXT_PALETTE);
         memcpy(Main.palette, backup_palette, sizeof(T_Palette));
+        Invalidate_best_color_cache();
         need_to_remap=1;
         break;
 
@@ -2758,9 +2767,11 @@ void Button_Palette(int btn)
           Palette_edit_step();
           memcpy(temp_palette,Main.palette,sizeof(T_Palette));
           memcpy(Main.palette,working_palette,sizeof(T_Palette));
+          Invalidate_best_color_cache();
           Set_nice_menu_colors(color_usage,0);
           memcpy(working_palette,Main.palette,sizeof(T_Palette));
           memcpy(Main.palette,temp_palette,sizeof(T_Palette));
+          Invalidate_best_color_cache();
           Set_palette(working_palette);
           memcpy(temp_palette,working_palette,sizeof(T_Palette));
           Draw_all_palette_sliders(red_slider,green_slider,blue_slider,working_palette,block_start,block_end);
@@ -2880,6 +2891,7 @@ void Button_Palette(int btn)
       && memcmp(Main.palette,working_palette,sizeof(T_Palette)) )
       Backup_layers(LAYER_NONE);
     memcpy(Main.palette,working_palette,sizeof(T_Palette));
+    Invalidate_best_color_cache();
     End_of_modification();
     // Not really needed, the change was in palette entries
   }
@@ -3087,6 +3099,7 @@ void Button_Secondary_palette(int btn)
   if (clicked_button==1)
   {
     Menu_tag_colors("Tag colors to exclude",Exclude_color,&dummy,1, NULL, SPECIAL_EXCLUDE_COLORS_MENU);
+    Invalidate_best_color_cache();
   }
   else if (clicked_button==2)
   {
@@ -463,8 +463,7 @@ void Load_PNG_Sub(T_IO_Context * context, FILE * file, const char * memory_buffe
                 png_read_image(png_ptr, Row_pointers);
 
                 for (y=0; y<context->Height; y++)
-                  for (x=0; x<context->Width; x++)
-                    Set_pixel(context, x, y, Row_pointers[y][x]);
+                  Set_pixel_row(context, 0, y, context->Width, Row_pointers[y]);
               }
               else
               {
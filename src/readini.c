@@ -29,6 +29,7 @@
 #include "errors.h"
 #include "global.h"
 #include "misc.h"
+#include "op_c.h"
 #include "readini.h"
 #include "setup.h"
 #include "realpath.h"
@@ -132,111 +133,233 @@ int Load_INI_seek_pattern(const char * buffer,const char * pattern)
   return 0;
 }
 
+/// Hash of an option name (or a group name) in a group
+static unsigned int Load_INI_hash(int group, const char * key)
+{
+  dword hash = 2166136261u ^ (dword)(group + 1);
+
+  for (; *key != '\0'; key++)
+    hash = (hash ^ (byte)*key) * 16777619u;
+  return hash & (INI_HASH_SIZE - 1);
+}
+
+/// Add a line at the end of its hash bucket, to keep the order of the file
+static void Load_INI_hash_line(T_INI_file * ini, int index)
+{
+  unsigned int hash = Load_INI_hash(ini->Lines[index].Group, ini->Lines[index].Key);
+  int * link = &ini->Hash[hash];
+
+  while (*link >= 0)
+    link = &ini->Lines[*link].Next;
+  *link = index;
+}
+
 /**
- * Read lines until a group is found
+ * Extract the key of a line: an option name or a group.
  *
- * @return 0 when the group is reached
- * @return @ref ERROR_INI_CORRUPTED if the group is not found
+ * @param line a line of the .ini file
+ * @param[out] key receives the upper case key, without spaces
+ * @param size size of the key buffer
+ * @return 1 if the line has a key, 0 for comments and empty lines
  */
-static int Load_INI_reach_group(FILE * file,char * buffer,const char * group)
+static int Load_INI_get_key(const char * line, char * key, size_t size)
 {
-  int    stop_seek;
-  char * group_upper;
-  char * upper_buffer;
+  size_t length = 0;
+  const char * c;
 
-  // On alloue les zones de mémoire:
-  group_upper=(char *)malloc(1024);
-  upper_buffer=(char *)malloc(1024);
+  for (c = line; *c != '\0' && *c != '=' && *c != ';' && *c != '#'
+       && *c != '\r' && *c != '\n'; c++)
+  {
+    if (*c == ' ' || *c == '\t')
+      continue;
+    if (length + 1 >= size)
+      return 0;
+#ifndef GCWZERO  //this causes gcw to crash
+    key[length++] = toupper((int)*c);
+#else
+    key[length++] = *c;
+#endif
+  }
+  key[length] = '\0';
+  if (length == 0)
+    return 0;
+  // An option must have a value, a group must have brackets
+  return *c == '=' || key[0] == '[';
+}
+
+int Load_INI_parse(T_INI_file * ini, FILE * file)
+{
+  char * raw = NULL;
+  size_t raw_size = 0;
+  size_t length = 0;
+  size_t read;
+  size_t position;
+  char * text;
+  char * key;
+  char * end;
+  int    nb_lines = 1;
+  int    group = -1;
+  int    index;
 
-  // On commence par se faire une version majuscule du groupe à rechercher:
-  strcpy(group_upper,group);
-  Load_INI_clear_string(group_upper, 0);
+  memset(ini, 0, sizeof(T_INI_file));
+  for (index = 0; index < INI_HASH_SIZE; index++)
+    ini->Hash[index] = -1;
 
-  stop_seek=0;
+  // Read the whole file at once
   do
   {
-    // On lit une ligne dans le fichier:
-    if (fgets(buffer,1024,file)==0)
+    if (length + 1024 > raw_size)
     {
-      free(upper_buffer);
-      free(group_upper);
-      return ERROR_INI_CORRUPTED;
+      char * new_raw;
+
+      raw_size = raw_size ? raw_size * 2 : 16384;
+      new_raw = (char *)realloc(raw, raw_size);
+      if (new_raw == NULL)
+      {
+        free(raw);
+        return ERROR_MEMORY;
+      }
+      raw = new_raw;
+    }
+    read = fread(raw + length, 1, raw_size - length, file);
+    length += read;
+  } while (read > 0);
+
+  // Lines are cut like fgets() would do with a 1024 bytes buffer
+  for (end = memchr(raw, '\n', length); end != NULL;
+       end = memchr(end + 1, '\n', length - (end + 1 - raw)))
+    nb_lines++;
+  nb_lines += (int)(length / 1023);
+
+  ini->Lines = (T_INI_line *)malloc(nb_lines * sizeof(T_INI_line));
+  // One buffer holds the text of all the lines, followed by their keys
+  ini->Data = (char *)malloc(2 * (length + nb_lines));
+  if (ini->Lines == NULL || ini->Data == NULL)
+  {
+    free(raw);
+    Load_INI_free(ini);
+    return ERROR_MEMORY;
+  }
+  text = ini->Data;
+  key = ini->Data + length + nb_lines;
+
+  position = 0;
+  while (position < length)
+  {
+    T_INI_line * line = ini->Lines + ini->Nb_lines;
+    size_t start = position;
+    size_t max_length = length - start < 1023 ? length - start : 1023;
+
+    end = memchr(raw + start, '\n', max_length);
+    position = (end != NULL) ? (size_t)(end + 1 - raw) : start + max_length;
+    memcpy(text, raw + start, position - start);
+    text[position - start] = '\0';
+
+    line->Text = text;
+    line->Key = NULL;
+    line->Group = group;
+    line->Next = -1;
+    line->Used = 0;
+    line->Allocated = 0;
+    ini->Nb_lines++;
+    text += position - start + 1;
+
+    // The key is the upper case version of what is before the "=",
+    // without the spaces, like Load_INI_clear_string() does.
+    if (!Load_INI_get_key(line->Text, key, 1024))
+      continue;
+    if (key[0] == '[')
+    {
+      group = ini->Nb_lines - 1;
+      line->Group = -1;
     }
+    line->Key = key;
+    key += strlen(key) + 1;
+    Load_INI_hash_line(ini, ini->Nb_lines - 1);
+  }
+  free(raw);
+  ini->Current_group = -1;
+  return 0;
+}
+
+void Load_INI_free(T_INI_file * ini)
+{
+  int index;
 
-    Line_number_in_INI_file++;
+  for (index = 0; index < ini->Nb_lines; index++)
+  {
+    if (ini->Lines[index].Allocated)
+      free(ini->Lines[index].Text);
+  }
+  free(ini->Lines);
+  free(ini->Data);
+  ini->Lines = NULL;
+  ini->Data = NULL;
+  ini->Nb_lines = 0;
+}
 
-    // On s'en fait une version en majuscule:
-    strcpy(upper_buffer,buffer);
-    Load_INI_clear_string(upper_buffer, 0);
+/// Find a line in the hash table.
+static int Load_INI_find(T_INI_file * ini, int group, const char * name)
+{
+  char   upper[1024];
+  int    index;
 
-    // On compare la chaîne avec le groupe recherché:
-    stop_seek=Load_INI_seek_pattern(upper_buffer,group_upper);
+  strcpy(upper, name);
+  Load_INI_clear_string(upper, 0);
+  for (index = ini->Hash[Load_INI_hash(group, upper)]; index >= 0; index = ini->Lines[index].Next)
+  {
+    if (!ini->Lines[index].Used && ini->Lines[index].Group == group
+        && strcmp(ini->Lines[index].Key, upper) == 0)
+    {
+      Line_number_in_INI_file = index + 1;
+      return index;
+    }
   }
-  while (!stop_seek);
+  Line_number_in_INI_file = ini->Nb_lines;
+  return -1;
+}
 
-  free(upper_buffer);
-  free(group_upper);
+int Load_INI_reach_group(T_INI_file * ini, const char * group)
+{
+  int index = Load_INI_find(ini, -1, group);
 
+  if (index < 0)
+    return ERROR_INI_CORRUPTED;
+  ini->Current_group = index;
   return 0;
 }
 
+int Load_INI_find_option(T_INI_file * ini, const char * option_name)
+{
+  int index = Load_INI_find(ini, ini->Current_group, option_name);
+
+  if (index >= 0)
+    ini->Lines[index].Used = 1;
+  return index;
+}
+
 ///
 /// Find the next string in the .INI file.
-/// @param file INI file currently opened
-/// @param buffer Current text buffer, preserved from one call to the next
+/// @param ini the parsed INI file
 /// @param option_name string to search
 /// @param return_code the found value will be copied there. (must be allocaed)
 /// @param raw_text Boolean: true to return the raw value (up to end-of-line), false to strip comments.
 /// @return 0 when OK
 /// @return @ref ERROR_INI_CORRUPTED if the option is not found
-static int Load_INI_get_string(FILE * file,char * buffer,const char * option_name,char * return_code, byte raw_text)
+static int Load_INI_get_string(T_INI_file * ini,const char * option_name,char * return_code, byte raw_text)
 {
-  int    stop_seek;
-  char * option_upper;
-  char * upper_buffer;
-  int    buffer_index;
-
-  // On alloue les zones de mémoire:
-  option_upper=(char *)malloc(1024);
-  upper_buffer=(char *)malloc(1024);
-
-  // On commence par se faire une version majuscule de l'option à rechercher:
-  strcpy(option_upper,option_name);
-  Load_INI_clear_string(option_upper, 0);
-
-  stop_seek=0;
-  do
-  {
-    // On lit une ligne dans le fichier:
-    if (fgets(buffer,1024,file)==NULL)
-    {
-      free(upper_buffer);
-      free(option_upper);
-      return ERROR_INI_CORRUPTED;
-    }
-
-    Line_number_in_INI_file++;
-
-    // On s'en fait une version en majuscule:
-    strcpy(upper_buffer,buffer);
-    Load_INI_clear_string(upper_buffer, raw_text);
-
-    // On compare la chaîne avec l'option recherchée:
-    stop_seek=Load_INI_seek_pattern(upper_buffer,option_upper);
+  char   upper_buffer[1024];
+  int    index;
 
-    // Si on l'a trouvée:
-    if (stop_seek)
-    {
-      // On se positionne juste après la chaîne "="
-      buffer_index=Load_INI_seek_pattern(upper_buffer,"=");
+  index = Load_INI_find_option(ini, option_name);
+  if (index < 0)
+    return ERROR_INI_CORRUPTED;
 
-      strcpy(return_code, upper_buffer + buffer_index);
-    }
-  }
-  while (!stop_seek);
+  strcpy(upper_buffer, ini->Lines[index].Text);
+  Load_INI_clear_string(upper_buffer, raw_text);
 
-  free(upper_buffer);
-  free(option_upper);
+  // On se positionne juste après la chaîne "="
+  strcpy(return_code, upper_buffer + Load_INI_seek_pattern(upper_buffer,"="));
 
   return 0;
 }
@@ -384,91 +507,51 @@ static int Load_INI_get_value(const char * str,int * index,int * value)
  *
  * The values are comma separated
  *
- * @param file handle to gfx2.ini
- * @param buffer Current text buffer, preserved from one call to the next
+ * @param ini the parsed INI file
  * @param option_name name of the option to read
  * @param nb_expected_values number of values to read from the line
  * @param[out] values the values will be put there
  * @return 0 when OK
  * @return @ref ERROR_INI_CORRUPTED if no value was found, or not enough
  */
-static int Load_INI_get_values(FILE * file,char * buffer,const char * option_name,int nb_expected_values,int * values)
+static int Load_INI_get_values(T_INI_file * ini,const char * option_name,int nb_expected_values,int * values)
 {
-  int    stop_seek;
-  char * option_upper;
-  char * upper_buffer;
+  char   upper_buffer[1024];
+  int    index;
   int    buffer_index;
   int    nb_values;
 
-  // On alloue les zones de mémoire:
-  option_upper=(char *)malloc(1024);
-  upper_buffer=(char *)malloc(1024);
-
-  // On commence par se faire une version majuscule de l'option à rechercher:
-  strcpy(option_upper,option_name);
-  Load_INI_clear_string(option_upper, 0);
+  index = Load_INI_find_option(ini, option_name);
+  if (index < 0)
+    return ERROR_INI_CORRUPTED;
 
-  stop_seek=0;
-  do
-  {
-    // On lit une ligne dans le fichier:
-    if (fgets(buffer,1024,file)==0)
-    {
-      free(upper_buffer);
-      free(option_upper);
-      return ERROR_INI_CORRUPTED;
-    }
+  strcpy(upper_buffer, ini->Lines[index].Text);
+  Load_INI_clear_string(upper_buffer, 0);
 
-    Line_number_in_INI_file++;
+  nb_values=0;
 
-    // On s'en fait une version en majuscule:
-    strcpy(upper_buffer,buffer);
-    Load_INI_clear_string(upper_buffer, 0);
+  // On se positionne juste après la chaîne "="
+  buffer_index=Load_INI_seek_pattern(upper_buffer,"=");
 
-    // On compare la chaîne avec l'option recherchée:
-    stop_seek=Load_INI_seek_pattern(upper_buffer,option_upper);
+  // Tant qu'on a pas atteint la fin de la ligne
+  while (upper_buffer[buffer_index]!='\0')
+  {
+    if (Load_INI_get_value(upper_buffer,&buffer_index,values+nb_values))
+      return ERROR_INI_CORRUPTED;
 
-    // Si on l'a trouvée:
-    if (stop_seek)
+    if ( ((++nb_values) == nb_expected_values) &&
+         (upper_buffer[buffer_index]!='\0') )
     {
-      nb_values=0;
-
-      // On se positionne juste après la chaîne "="
-      buffer_index=Load_INI_seek_pattern(upper_buffer,"=");
-
-      // Tant qu'on a pas atteint la fin de la ligne
-      while (upper_buffer[buffer_index]!='\0')
-      {
-        if (Load_INI_get_value(upper_buffer,&buffer_index,values+nb_values))
-        {
-          free(upper_buffer);
-          free(option_upper);
-          return ERROR_INI_CORRUPTED;
-        }
-
-        if ( ((++nb_values) == nb_expected_values) &&
-             (upper_buffer[buffer_index]!='\0') )
-        {
-          // Too many values !
-          free(upper_buffer);
-          free(option_upper);
-          return ERROR_INI_CORRUPTED;
-        }
-      }
-
-      if (nb_values<nb_expected_values)
-      {
-        // Not enough values !
-        free(upper_buffer);
-        free(option_upper);
-        return ERROR_INI_CORRUPTED;
-      }
+      // Too many values !
+      return ERROR_INI_CORRUPTED;
     }
   }
-  while (!stop_seek);
 
-  free(upper_buffer);
-  free(option_upper);
+  if (nb_values<nb_expected_values)
+  {
+    // Not enough values !
+    return ERROR_INI_CORRUPTED;
+  }
 
   return 0;
 }
@@ -484,7 +567,7 @@ static int Load_INI_get_values(FILE * file,char * buffer,const char * option_nam
 int Load_INI(T_Config * conf)
 {
   FILE * file;
-  char * buffer;
+  T_INI_file ini;
   int    values[3];
   int    index;
   char * filename;
@@ -499,9 +582,6 @@ int Load_INI(T_Config * conf)
   conf->Stylus_mode = 0;
 #endif
 
-  // allocate buffer
-  buffer = (char *)GFX2_malloc(1024);
-
   filename = Filepath_append_to_dir(Config_directory, INI_FILENAME);
   file = fopen(filename, "r");
   if (file == NULL)
@@ -514,49 +594,54 @@ int Load_INI(T_Config * conf)
     {
       GFX2_Log(GFX2_ERROR, "Load_INI() cannot open %s\n", filename);
       free(filename);
-      free(buffer);
       return ERROR_INI_MISSING;
     }
   }
   GFX2_Log(GFX2_DEBUG, "Load_INI() loading %s\n", filename);
   free(filename);
+
+  // The whole file is read once, the options are then found in memory
+  return_code = Load_INI_parse(&ini, file);
+  fclose(file);
+  if (return_code)
+    return return_code;
   
-  if ((return_code=Load_INI_reach_group(file,buffer,"[MOUSE]")))
+  if ((return_code=Load_INI_reach_group(&ini,"[MOUSE]")))
     goto Erreur_Retour;
 
-  if ((return_code=Load_INI_get_values (file,buffer,"X_sensitivity",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"X_sensitivity",1,values)))
     goto Erreur_Retour;
   if ((values[0]<1) || (values[0]>4))
     conf->Mouse_sensitivity_index_x=1;
   else
     conf->Mouse_sensitivity_index_x=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Y_sensitivity",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Y_sensitivity",1,values)))
     goto Erreur_Retour;
   if ((values[0]<1) || (values[0]>4))
     conf->Mouse_sensitivity_index_y=1;
   else
     conf->Mouse_sensitivity_index_y=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"X_correction_factor",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"X_correction_factor",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>4))
     goto Erreur_ERREUR_INI_CORROMPU;
   // Deprecated setting, unused
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Y_correction_factor",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Y_correction_factor",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>4))
     goto Erreur_ERREUR_INI_CORROMPU;
   // Deprecated setting, unused
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Cursor_aspect",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Cursor_aspect",1,values)))
     goto Erreur_Retour;
   if ((values[0]<1) || (values[0]>3))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Cursor=values[0]-1;
 
-  if ((return_code=Load_INI_reach_group(file,buffer,"[MENU]")))
+  if ((return_code=Load_INI_reach_group(&ini,"[MENU]")))
     goto Erreur_Retour;
 
   conf->Fav_menu_colors[0].R=0;
@@ -566,7 +651,7 @@ int Load_INI(T_Config * conf)
   conf->Fav_menu_colors[3].G=255;
   conf->Fav_menu_colors[3].B=255;
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Light_color",3,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Light_color",3,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>63))
     goto Erreur_ERREUR_INI_CORROMPU;
@@ -578,7 +663,7 @@ int Load_INI(T_Config * conf)
   conf->Fav_menu_colors[2].G=(values[1]<<2)|(values[1]>>4);
   conf->Fav_menu_colors[2].B=(values[2]<<2)|(values[2]>>4);
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Dark_color",3,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Dark_color",3,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>63))
     goto Erreur_ERREUR_INI_CORROMPU;
@@ -590,180 +675,180 @@ int Load_INI(T_Config * conf)
   conf->Fav_menu_colors[1].G=(values[1]<<2)|(values[1]>>4);
   conf->Fav_menu_colors[1].B=(values[2]<<2)|(values[2]>>4);
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Menu_ratio",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Menu_ratio",1,values)))
     goto Erreur_Retour;
   if ((values[0]<-4) || (values[0]>2))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Ratio=values[0];
 
-  if ((return_code=Load_INI_reach_group(file,buffer,"[FILE_SELECTOR]")))
+  if ((return_code=Load_INI_reach_group(&ini,"[FILE_SELECTOR]")))
     goto Erreur_Retour;
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Show_hidden_files",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Show_hidden_files",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Show_hidden_files=values[0]?1:0;
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Show_hidden_directories",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Show_hidden_directories",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Show_hidden_directories=values[0]?1:0;
 
-/*  if ((return_code=Load_INI_get_values (file,buffer,"Show_system_directories",1,values)))
+/*  if ((return_code=Load_INI_get_values (&ini,"Show_system_directories",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Show_system_directories=values[0]?1:0;
 */
-  if ((return_code=Load_INI_get_values (file,buffer,"Preview_delay",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Preview_delay",1,values)))
     goto Erreur_Retour;
   if ((values[0]<1) || (values[0]>256))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Timer_delay=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Maximize_preview",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Maximize_preview",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Maximize_preview=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Find_file_fast",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Find_file_fast",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>2))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Find_file_fast=values[0];
 
 
-  if ((return_code=Load_INI_reach_group(file,buffer,"[LOADING]")))
+  if ((return_code=Load_INI_reach_group(&ini,"[LOADING]")))
     goto Erreur_Retour;
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Auto_set_resolution",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Auto_set_resolution",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Auto_set_res=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Set_resolution_according_to",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Set_resolution_according_to",1,values)))
     goto Erreur_Retour;
   if ((values[0]<1) || (values[0]>2))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Set_resolution_according_to=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Clear_palette",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Clear_palette",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Clear_palette=values[0];
 
 
-  if ((return_code=Load_INI_reach_group(file,buffer,"[MISCELLANEOUS]")))
+  if ((return_code=Load_INI_reach_group(&ini,"[MISCELLANEOUS]")))
     goto Erreur_Retour;
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Draw_limits",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Draw_limits",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Display_image_limits=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Adjust_brush_pick",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Adjust_brush_pick",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Adjust_brush_pick=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Coordinates",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Coordinates",1,values)))
     goto Erreur_Retour;
   if ((values[0]<1) || (values[0]>2))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Coords_rel=2-values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Backup",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Backup",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Backup=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Undo_pages",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Undo_pages",1,values)))
     goto Erreur_Retour;
   if ((values[0]<1) || (values[0]>99))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Max_undo_pages=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Gauges_scrolling_speed_Left",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Gauges_scrolling_speed_Left",1,values)))
     goto Erreur_Retour;
   if ((values[0]<1) || (values[0]>255))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Delay_left_click_on_slider=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Gauges_scrolling_speed_Right",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Gauges_scrolling_speed_Right",1,values)))
     goto Erreur_Retour;
   if ((values[0]<1) || (values[0]>255))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Delay_right_click_on_slider=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Auto_save",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Auto_save",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Auto_save=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Vertices_per_polygon",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Vertices_per_polygon",1,values)))
     goto Erreur_Retour;
   if ((values[0]<2) || (values[0]>16384))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Nb_max_vertices_per_polygon=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Fast_zoom",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Fast_zoom",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Fast_zoom=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Separate_colors",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Separate_colors",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Separate_colors=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"FX_feedback",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"FX_feedback",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->FX_Feedback=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Safety_colors",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Safety_colors",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Safety_colors=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Opening_message",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Opening_message",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Opening_message=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Clear_with_stencil",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Clear_with_stencil",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Clear_with_stencil=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Auto_discontinuous",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Auto_discontinuous",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Auto_discontinuous=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Save_screen_size_in_GIF",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Save_screen_size_in_GIF",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
   conf->Screen_size_in_GIF=values[0];
 
-  if ((return_code=Load_INI_get_values (file,buffer,"Auto_nb_colors_used",1,values)))
+  if ((return_code=Load_INI_get_values (&ini,"Auto_nb_colors_used",1,values)))
     goto Erreur_Retour;
   if ((values[0]<0) || (values[0]>1))
     goto Erreur_ERREUR_INI_CORROMPU;
@@ -771,7 +856,7 @@ int Load_INI(T_Config * conf)
 
   // Optionnel, le mode video par défaut (à partir de beta 97.0%)
   conf->Default_resolution=0;
-  if (!Load_INI_get_string (file,buffer,"Default_video_mode",value_label, 0))
+  if (!Load_INI_get_string (&ini,"Default_video_mode",value_label, 0))
   {
     int mode = Convert_videomode_arg(value_label);
     if (mode>=0)
@@ -784,7 +869,7 @@ int Load_INI(T_Config * conf)
   {
     Video_mode[0].Width = 640;
     Video_mode[0].Height = 480;
-    if (!Load_INI_get_values (file,buffer,"Default_window_size",2,values))
+    if (!Load_INI_get_values (&ini,"Default_window_size",2,values))
     {
       if ((values[0]>=320))
         Default_window_width = Video_mode[0].Width = values[0];
@@ -795,7 +880,7 @@ int Load_INI(T_Config * conf)
 
   conf->Mouse_merge_movement=100;
   // Optionnel, paramètre pour grouper les mouvements souris (>98.0%)
-  if (!Load_INI_get_values (file,buffer,"Merge_movement",1,values))
+  if (!Load_INI_get_values (&ini,"Merge_movement",1,values))
   {
     if ((values[0]<0) || (values[0]>1000))
       goto Erreur_ERREUR_INI_CORROMPU;
@@ -804,7 +889,7 @@ int Load_INI(T_Config * conf)
 
   conf->Mouse_motion_debounce=0;
   // Optional: debounce mouse motion handling by a given number of milliseconds
-  if (!Load_INI_get_values( file, buffer, "Mouse_motion_debounce",1,values))
+  if (!Load_INI_get_values(&ini,"Mouse_motion_debounce",1,values))
   {
     if (values[0] < 0 || values[0] > 1000)
       goto Erreur_ERREUR_INI_CORROMPU;
@@ -813,7 +898,7 @@ int Load_INI(T_Config * conf)
 
   conf->Palette_cells_X=16;
   // Optionnel, nombre de colonnes dans la palette (>98.0%)
-  if (!Load_INI_get_values (file,buffer,"Palette_cells_X",1,values))
+  if (!Load_INI_get_values (&ini,"Palette_cells_X",1,values))
   {
     if ((values[0]<1) || (values[0]>256))
       goto Erreur_ERREUR_INI_CORROMPU;
@@ -821,7 +906,7 @@ int Load_INI(T_Config * conf)
   }
   conf->Palette_cells_Y=4;
   // Optionnel, nombre de lignes dans la palette (>98.0%)
-  if (!Load_INI_get_values (file,buffer,"Palette_cells_Y",1,values))
+  if (!Load_INI_get_values (&ini,"Palette_cells_Y",1,values))
   {
     if (values[0]<1 || values[0]>16)
       goto Erreur_ERREUR_INI_CORROMPU;
@@ -835,7 +920,7 @@ int Load_INI(T_Config * conf)
   }
   for (index=0;index<NB_BOOKMARKS;index++)
   {
-    if (!Load_INI_get_string (file,buffer,"Bookmark_label",value_label, 1))
+    if (!Load_INI_get_string (&ini,"Bookmark_label",value_label, 1))
     {
       size_t size = strlen(value_label);
       if (size!=0)
@@ -851,7 +936,7 @@ int Load_INI(T_Config * conf)
     }
     else
       break;
-    if (!Load_INI_get_string (file,buffer,"Bookmark_directory",value_label, 1))
+    if (!Load_INI_get_string (&ini,"Bookmark_directory",value_label, 1))
     {
       size_t size = strlen(value_label);
       if (size!=0)
@@ -865,7 +950,7 @@ int Load_INI(T_Config * conf)
   }
   conf->Palette_vertical=1;
   // Optional, vertical palette option (>98.0%)
-  if (!Load_INI_get_values (file,buffer,"Palette_vertical",1,values))
+  if (!Load_INI_get_values (&ini,"Palette_vertical",1,values))
   {
     if ((values[0]<0) || (values[0]>1))
       goto Erreur_ERREUR_INI_CORROMPU;
@@ -875,7 +960,7 @@ int Load_INI(T_Config * conf)
   // Optional, the window position (>98.0%)
   conf->Window_pos_x=9999;
   conf->Window_pos_y=9999;
-  if (!Load_INI_get_values (file,buffer,"Window_position",2,values))
+  if (!Load_INI_get_values (&ini,"Window_position",2,values))
   {
     conf->Window_pos_x = values[0];
     conf->Window_pos_y = values[1];
@@ -883,7 +968,7 @@ int Load_INI(T_Config * conf)
   
   conf->Double_click_speed=500;
   // Optional, speed of double-click (>2.0)
-  if (!Load_INI_get_values (file,buffer,"Double_click_speed",1,values))
+  if (!Load_INI_get_values (&ini,"Double_click_speed",1,values))
   {
     if ((values[0]>0) || (values[0]<=2000))
       conf->Double_click_speed=values[0];
@@ -891,14 +976,14 @@ int Load_INI(T_Config * conf)
 
   conf->Double_key_speed=500;
   // Optional, speed of double-keypress (>2.0)
-  if (!Load_INI_get_values (file,buffer,"Double_key_speed",1,values))
+  if (!Load_INI_get_values (&ini,"Double_key_speed",1,values))
   {
     if ((values[0]>0) || (values[0]<=2000))
       conf->Double_key_speed=values[0];
   }
 
   // Optional, name of skin file. (>2.0)
-  if(!Load_INI_get_string(file,buffer,"Skin_file",value_label,1))
+  if(!Load_INI_get_string(&ini,"Skin_file",value_label,1))
   {
     conf->Skin_file = strdup(value_label);
   }
@@ -906,13 +991,13 @@ int Load_INI(T_Config * conf)
     conf->Skin_file = strdup(DEFAULT_SKIN_FILENAME);
 
   // Optional, name of font file. (>2.0)
-  if(!Load_INI_get_string(file,buffer,"Font_file",value_label,1))
+  if(!Load_INI_get_string(&ini,"Font_file",value_label,1))
     conf->Font_file = strdup(value_label);
   else
     conf->Font_file = strdup(DEFAULT_FONT_FILENAME);
 
   // Optional, "fake hardware zoom" factor (>2.1)
-  if (!Load_INI_get_values (file, buffer,"Pixel_ratio",1,values))
+  if (!Load_INI_get_values (&ini,"Pixel_ratio",1,values))
   {
     Pixel_ratio = values[0];
     switch(Pixel_ratio) {
@@ -956,7 +1041,7 @@ int Load_INI(T_Config * conf)
   }
   
   // Optional, Menu bars visibility (> 2.1)
-  if (!Load_INI_get_values (file, buffer,"Menubars_visible",1,values))
+  if (!Load_INI_get_values (&ini,"Menubars_visible",1,values))
   {
     byte anim_visible = (values[0] & 2)!=0;
     byte tools_visible = (values[0] & 4)!=0;
@@ -969,21 +1054,21 @@ int Load_INI(T_Config * conf)
   
   conf->Right_click_colorpick=0;
   // Optional, right mouse button to pick colors (>=2.3)
-  if (!Load_INI_get_values (file,buffer,"Right_click_colorpick",1,values))
+  if (!Load_INI_get_values (&ini,"Right_click_colorpick",1,values))
   {
     conf->Right_click_colorpick=(values[0]!=0);
   }
   
   conf->Sync_views=1;
   // Optional, synced view of main and spare (>=2.3)
-  if (!Load_INI_get_values (file,buffer,"Sync_views",1,values))
+  if (!Load_INI_get_values (&ini,"Sync_views",1,values))
   {
     conf->Sync_views=(values[0]!=0);
   }
   
   conf->Swap_buttons=0;
   // Optional, key for swap buttons (>=2.3)
-  if (!Load_INI_get_values (file,buffer,"Swap_buttons",1,values))
+  if (!Load_INI_get_values (&ini,"Swap_buttons",1,values))
   {
     switch(values[0])
     {
@@ -999,7 +1084,7 @@ int Load_INI(T_Config * conf)
   // Optional, Location of last directory used for Lua scripts browsing (>=2.3)
   free(conf->Scripts_directory);
   conf->Scripts_directory = NULL;
-  if (!Load_INI_get_string (file,buffer,"Scripts_directory",value_label, 1))
+  if (!Load_INI_get_string (&ini,"Scripts_directory",value_label, 1))
   {
     if (value_label[0] != '\0')
       conf->Scripts_directory = strdup(value_label);
@@ -1014,35 +1099,35 @@ int Load_INI(T_Config * conf)
   
   conf->Allow_multi_shortcuts=0;
   // Optional, allow or disallow multiple shortcuts on same key (>=2.3)
-  if (!Load_INI_get_values (file,buffer,"Allow_multi_shortcuts",1,values))
+  if (!Load_INI_get_values (&ini,"Allow_multi_shortcuts",1,values))
   {
     conf->Allow_multi_shortcuts=(values[0]!=0);
   }
   
   conf->Tilemap_allow_flipped_x=0;
   // Optional, makes tilemap effect detect x-flipped tiles (>=2.4)
-  if (!Load_INI_get_values (file,buffer,"Tilemap_detect_mirrored_x",1,values))
+  if (!Load_INI_get_values (&ini,"Tilemap_detect_mirrored_x",1,values))
   {
     conf->Tilemap_allow_flipped_x=(values[0]!=0);
   }
   
   conf->Tilemap_allow_flipped_y=0;
   // Optional, makes tilemap effect detect y-flipped tiles (>=2.4)
-  if (!Load_INI_get_values (file,buffer,"Tilemap_detect_mirrored_y",1,values))
+  if (!Load_INI_get_values (&ini,"Tilemap_detect_mirrored_y",1,values))
   {
     conf->Tilemap_allow_flipped_y=(values[0]!=0);
   }
   
   conf->Tilemap_show_count=0;
   // Optional, makes tilemap effect display tile count (>=2.4)
-  if (!Load_INI_get_values (file,buffer,"Tilemap_count",1,values))
+  if (!Load_INI_get_values (&ini,"Tilemap_count",1,values))
   {
     conf->Tilemap_show_count=(values[0]!=0);
   }
   
   conf->Use_virtual_keyboard=0;
   // Optional, enables virtual keyboard (>=2.4)
-  if (!Load_INI_get_values (file,buffer,"Use_virtual_keyboard",1,values))
+  if (!Load_INI_get_values (&ini,"Use_virtual_keyboard",1,values))
   {
     if (values[0]>=0 && values[0]<=2)
       conf->Use_virtual_keyboard=values[0];
@@ -1050,35 +1135,53 @@ int Load_INI(T_Config * conf)
 
   conf->Default_mode_layers=0;
   // Optional, remembers if the user last chose layers or anim (>=2.4)
-  if (!Load_INI_get_values (file,buffer,"Default_mode_layers",1,values))
+  if (!Load_INI_get_values (&ini,"Default_mode_layers",1,values))
   {
     conf->Default_mode_layers=(values[0]!=0);
   }
 
   conf->MOTO_gamma=28;
   // Optional, gamma value used for palette of load/save Thomson MO/TO pictures (>=2.6)
-  if (!Load_INI_get_values (file,buffer,"MOTO_gamma",1,values))
+  if (!Load_INI_get_values (&ini,"MOTO_gamma",1,values))
   {
     conf->MOTO_gamma=(byte)values[0];
   }
+
+  conf->Compress_undo=1;
+  // Optional, store older undo steps as shared tiles (>=2.9)
+  if (!Load_INI_get_values (&ini,"Compress_undo",1,values))
+  {
+    conf->Compress_undo=(values[0]!=0);
+  }
+
+  conf->Quantizer=0;
+  // Optional, color reduction algorithm for 24bit pictures (>=2.9)
+  if (!Load_INI_get_values (&ini,"Quantizer",1,values))
+  {
+    if (values[0]>=0 && values[0]<QUANTIZER_COUNT)
+      conf->Quantizer=(byte)values[0];
+  }
+
+  conf->Dither_24b=0;
+  // Optional, dithering of 24bit pictures (>=2.9)
+  if (!Load_INI_get_values (&ini,"Dither_24b",1,values))
+  {
+    conf->Dither_24b=(values[0]!=0);
+  }
   
   // Insert new values here
 
-  fclose(file);
-
-  free(buffer);
+  Load_INI_free(&ini);
   return 0;
 
   // Gestion des erreurs:
 
   Erreur_Retour:
-    fclose(file);
-    free(buffer);
+    Load_INI_free(&ini);
     return return_code;
 
   Erreur_ERREUR_INI_CORROMPU:
 
-    fclose(file);
-    free(buffer);
+    Load_INI_free(&ini);
     return ERROR_INI_CORRUPTED;
 }
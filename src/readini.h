@@ -23,6 +23,64 @@
 /// Reading settings in gfx2.ini
 //////////////////////////////////////////////////////////////////////////////
 
+#include <stdio.h>
+
+/// Size of the hash table of T_INI_file. Must be a power of 2.
+#define INI_HASH_SIZE 256
+
+/// A line of a .ini file
+typedef struct
+{
+  char * Text;  ///< The line, as read in the file
+  char * Key;   ///< Upper case option name, or "[GROUP]", NULL for other lines
+  int    Group; ///< Index of the line of the group of this option, -1 for groups
+  int    Next;  ///< Next line in the same bucket of the hash table, -1 at the end
+  byte   Used;  ///< Set once the option has been read or written
+  byte   Allocated; ///< Text has been replaced by a malloc'ed string
+} T_INI_line;
+
+/// Contents of a .ini file, with its options hashed by group and name
+typedef struct
+{
+  T_INI_line * Lines;
+  char * Data;             ///< Text and keys of all the lines
+  int Nb_lines;
+  int Current_group;       ///< Group where the options are searched
+  int Hash[INI_HASH_SIZE]; ///< First line of each bucket, -1 if empty
+} T_INI_file;
+
 int Load_INI(T_Config * conf);
 int Load_INI_seek_pattern(const char * buffer, const char * pattern);
 void Load_INI_clear_string(char * str, byte keep_comments);
+
+/**
+ * Read a whole .ini file in memory.
+ * @param[out] ini the structure to fill
+ * @param file the file opened for reading
+ * @return 0 when OK
+ * @return @ref ERROR_MEMORY if allocation failed
+ */
+int Load_INI_parse(T_INI_file * ini, FILE * file);
+
+/// Free the memory used by a T_INI_file.
+void Load_INI_free(T_INI_file * ini);
+
+/**
+ * Select the group where the next options are searched.
+ * @param ini the parsed .ini file
+ * @param group the group name, for example "[MOUSE]"
+ * @return 0 when OK
+ * @return @ref ERROR_INI_CORRUPTED if the group is not found
+ */
+int Load_INI_reach_group(T_INI_file * ini, const char * group);
+
+/**
+ * Find the next unused occurrence of an option in the current group.
+ *
+ * The line is marked as used, so options that appear several times
+ * (like bookmarks) are returned in the order of the file.
+ * @param ini the parsed .ini file
+ * @param option_name the option name, case insensitive
+ * @return the index of the line, or -1 if the option is not found
+ */
+int Load_INI_find_option(T_INI_file * ini, const char * option_name);
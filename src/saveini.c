@@ -30,56 +30,6 @@
 #include "setup.h"
 #include "windows.h"
 
-/**
- * go forward in gfx2.ini until the group is found
- */
-static int Save_INI_reach_group(FILE * old_file,FILE * new_file,char * buffer,const char * group)
-{
-  int    stop_seek;
-  char * group_upper;
-  char * upper_buffer;
-
-  // On alloue les zones de mémoire:
-  group_upper =(char *)malloc(1024);
-  upper_buffer=(char *)malloc(1024);
-
-  // On commence par se faire une version majuscule du groupe à rechercher:
-  strcpy(group_upper,group);
-  Load_INI_clear_string(group_upper, 0);
-
-  stop_seek=0;
-  do
-  {
-    // On lit une ligne dans le fichier:
-    if (fgets(buffer,1024,old_file)==0)
-    {
-      free(upper_buffer);
-      free(group_upper);
-      return ERROR_INI_CORRUPTED;
-    }
-
-    // On s'en fait une version en majuscule:
-    strcpy(upper_buffer,buffer);
-    Load_INI_clear_string(upper_buffer, 0);
-
-    // On compare la chaîne avec le groupe recherché:
-    stop_seek=Load_INI_seek_pattern(upper_buffer,group_upper);
-    if (fprintf(new_file,"%s",buffer)<0)
-    {
-      free(upper_buffer);
-      free(group_upper);
-      return ERROR_SAVING_INI;
-    }
-  }
-  while (stop_seek==0);
-
-  free(upper_buffer);
-  free(group_upper);
-
-  return 0;
-}
-
-
 /**
  * Check if a character is [-$.0-9A-Z]
  * which are the allowed characters for values
@@ -266,77 +216,27 @@ static void Save_INI_set_string(char * dest,const char * source,const char * val
 /**
  * Set an option value in gfx2.ini
  */
-static int Save_INI_set_strings(FILE * old_file,FILE * new_file,char * buffer,const char * option_name,const char * value)
+static int Save_INI_set_strings(T_INI_file * ini,const char * option_name,const char * value)
 {
-  int    stop_seek;
-  char * option_upper;
-  char * upper_buffer;
   char * result_buffer;
-  //int    buffer_index;
-
-  // On alloue les zones de mémoire:
-  option_upper=(char *)malloc(1024);
-  upper_buffer=(char *)malloc(1024);
-  result_buffer=(char *)malloc(1024);
+  int    index;
 
   // On convertit un eventuel argument NULL en chaine vide.
   if (value == NULL)
     value="";
 
-  // On commence par se faire une version majuscule de l'option à rechercher:
-  strcpy(option_upper,option_name);
-  Load_INI_clear_string(option_upper, 0);
-
-  stop_seek=0;
-  do
-  {
-    // On lit une ligne dans le fichier:
-    if (fgets(buffer,1024,old_file)==0)
-    {
-      free(result_buffer);
-      free(upper_buffer);
-      free(option_upper);
-      return ERROR_INI_CORRUPTED;
-    }
-
-    // On s'en fait une version en majuscule:
-    strcpy(upper_buffer,buffer);
-    Load_INI_clear_string(upper_buffer, 0);
-
-    // On compare la chaîne avec l'option recherchée:
-    stop_seek=Load_INI_seek_pattern(upper_buffer,option_upper);
-
-    if (stop_seek)
-    {
-      // On l'a trouvée:
-
-      Save_INI_set_string(result_buffer,buffer,value);
-      if (fprintf(new_file,"%s",result_buffer)<0)
-      {
-        free(result_buffer);
-        free(upper_buffer);
-        free(option_upper);
-        return ERROR_SAVING_INI;
-      }
-    }
-    else
-    {
-      // On l'a pas trouvée:
-
-      if (fprintf(new_file,"%s",buffer)<0)
-      {
-        free(result_buffer);
-        free(upper_buffer);
-        free(option_upper);
-        return ERROR_SAVING_INI;
-      }
-    }
-  }
-  while (stop_seek==0);
+  index = Load_INI_find_option(ini, option_name);
+  if (index < 0)
+    return ERROR_INI_CORRUPTED;
 
-  free(result_buffer);
-  free(upper_buffer);
-  free(option_upper);
+  result_buffer=(char *)malloc(1024);
+  if (result_buffer == NULL)
+    return ERROR_MEMORY;
+  Save_INI_set_string(result_buffer,ini->Lines[index].Text,value);
+  if (ini->Lines[index].Allocated)
+    free(ini->Lines[index].Text);
+  ini->Lines[index].Text = result_buffer;
+  ini->Lines[index].Allocated = 1;
 
   return 0;
 }
@@ -344,85 +244,41 @@ static int Save_INI_set_strings(FILE * old_file,FILE * new_file,char * buffer,co
 /**
  * set option values in the gfx2.ini file
  */
-static int Save_INI_set_values(FILE * old_file,FILE * new_file,char * buffer,const char * option_name,int nb_values_to_set,const int * values,int litteral)
+static int Save_INI_set_values(T_INI_file * ini,const char * option_name,int nb_values_to_set,const int * values,int litteral)
 {
-  int    stop_seek;
-  char * option_upper;
-  char * upper_buffer;
   char * result_buffer;
-  //int    buffer_index;
-
-  // On alloue les zones de mémoire:
-  option_upper=(char *)malloc(1024);
-  upper_buffer=(char *)malloc(1024);
-  result_buffer=(char *)malloc(1024);
-
-  // On commence par se faire une version majuscule de l'option à rechercher:
-  strcpy(option_upper,option_name);
-  Load_INI_clear_string(option_upper, 0);
+  int    index;
 
-  stop_seek=0;
-  do
+  index = Load_INI_find_option(ini, option_name);
+  if (index < 0)
   {
-    // On lit une ligne dans le fichier:
-    if (fgets(buffer,1024,old_file)==0)
-    {
-      free(result_buffer);
-      free(upper_buffer);
-      free(option_upper);
-      GFX2_Log(GFX2_WARNING, "%s(): END OF FILE\n", __func__);
-      return ERROR_INI_CORRUPTED;
-    }
-
-    // On s'en fait une version en majuscule:
-    strcpy(upper_buffer,buffer);
-    Load_INI_clear_string(upper_buffer, 0);
-
-    // On compare la chaîne avec l'option recherchée:
-    stop_seek=Load_INI_seek_pattern(upper_buffer,option_upper);
-
-    if (stop_seek)
-    {
-      // On l'a trouvée:
-
-      Save_INI_set_value(result_buffer,buffer,nb_values_to_set,values,litteral);
-      if (fprintf(new_file,"%s",result_buffer)<0)
-      {
-        free(result_buffer);
-        free(upper_buffer);
-        free(option_upper);
-        return ERROR_SAVING_INI;
-      }
-    }
-    else
-    {
-      // On l'a pas trouvée:
-
-      if (fprintf(new_file,"%s",buffer)<0)
-      {
-        free(result_buffer);
-        free(upper_buffer);
-        free(option_upper);
-        return ERROR_SAVING_INI;
-      }
-    }
+    GFX2_Log(GFX2_WARNING, "%s(): %s not found\n", __func__, option_name);
+    return ERROR_INI_CORRUPTED;
   }
-  while (stop_seek==0);
 
-  free(result_buffer);
-  free(upper_buffer);
-  free(option_upper);
+  result_buffer=(char *)malloc(1024);
+  if (result_buffer == NULL)
+    return ERROR_MEMORY;
+  Save_INI_set_value(result_buffer,ini->Lines[index].Text,nb_values_to_set,values,litteral);
+  if (ini->Lines[index].Allocated)
+    free(ini->Lines[index].Text);
+  ini->Lines[index].Text = result_buffer;
+  ini->Lines[index].Allocated = 1;
 
   return 0;
 }
 
 /**
- * copy all remaining lines
+ * write all the lines
  */
-static void Save_INI_flush(FILE * old_file,FILE * new_file,char * buffer)
+static int Save_INI_write(const T_INI_file * ini,FILE * new_file)
 {
-  while (fgets(buffer,1024,old_file) != NULL)
-    fprintf(new_file,"%s",buffer);
+  int index;
+
+  for (index = 0; index < ini->Nb_lines; index++)
+    if (fputs(ini->Lines[index].Text, new_file) < 0)
+      return ERROR_SAVING_INI;
+  return 0;
 }
 
 
@@ -433,7 +289,7 @@ int Save_INI(const T_Config * conf)
 {
   FILE * old_file;
   FILE * new_file;
-  char * buffer;
+  T_INI_file ini;
   int    values[3];
   char * filename;
   char * temp_filename = NULL;
@@ -451,6 +307,11 @@ int Save_INI(const T_Config * conf)
     return ERROR_INI_MISSING;
   }
   free(ref_ini_file);
+  // Read it in memory, the new file is written from this copy
+  return_code = Load_INI_parse(&ini, old_file);
+  fclose(old_file);
+  if (return_code)
+    return return_code;
 
   // Check if the ini file already exists
   filename = Filepath_append_to_dir(Config_directory, INI_FILENAME);
@@ -463,7 +324,7 @@ int Save_INI(const T_Config * conf)
     // Rename current config file as gfx2.$$$
     if (rename(filename, temp_filename) != 0)
     {
-      fclose(old_file);
+      Load_INI_free(&ini);
       free(filename);
       free(temp_filename);
       return ERROR_SAVING_INI;
@@ -473,178 +334,175 @@ int Save_INI(const T_Config * conf)
   new_file = fopen(filename, "w");
   if (new_file == 0)
   {
-    fclose(old_file);
+    Load_INI_free(&ini);
     free(filename);
     free(temp_filename);
     return ERROR_SAVING_INI;
   }
   free(filename);
 
-  // Allocate work memory buffer
-  buffer = (char *)malloc(1024);
-
-  if ((return_code=Save_INI_reach_group(old_file,new_file,buffer,"[MOUSE]")))
+  if ((return_code=Load_INI_reach_group(&ini,"[MOUSE]")))
     goto Erreur_Retour;
 
   values[0]=conf->Mouse_sensitivity_index_x;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"X_sensitivity",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"X_sensitivity",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=conf->Mouse_sensitivity_index_y;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Y_sensitivity",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Y_sensitivity",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=0;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"X_correction_factor",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"X_correction_factor",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=0;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Y_correction_factor",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Y_correction_factor",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=(conf->Cursor)+1;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Cursor_aspect",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Cursor_aspect",1,values,0)))
     goto Erreur_Retour;
 
-  if ((return_code=Save_INI_reach_group(old_file,new_file,buffer,"[MENU]")))
+  if ((return_code=Load_INI_reach_group(&ini,"[MENU]")))
     goto Erreur_Retour;
 
   values[0]=conf->Fav_menu_colors[2].R>>2;
   values[1]=conf->Fav_menu_colors[2].G>>2;
   values[2]=conf->Fav_menu_colors[2].B>>2;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Light_color",3,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Light_color",3,values,0)))
     goto Erreur_Retour;
 
   values[0]=conf->Fav_menu_colors[1].R>>2;
   values[1]=conf->Fav_menu_colors[1].G>>2;
   values[2]=conf->Fav_menu_colors[1].B>>2;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Dark_color",3,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Dark_color",3,values,0)))
     goto Erreur_Retour;
 
   values[0]=conf->Ratio;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Menu_ratio",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Menu_ratio",1,values,0)))
     goto Erreur_Retour;
 
-  if ((return_code=Save_INI_reach_group(old_file,new_file,buffer,"[FILE_SELECTOR]")))
+  if ((return_code=Load_INI_reach_group(&ini,"[FILE_SELECTOR]")))
     goto Erreur_Retour;
 
   values[0]=conf->Show_hidden_files?1:0;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Show_hidden_files",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Show_hidden_files",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Show_hidden_directories?1:0;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Show_hidden_directories",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Show_hidden_directories",1,values,1)))
     goto Erreur_Retour;
 
 /*  values[0]=conf->Show_system_directories?1:0;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Show_system_directories",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Show_system_directories",1,values,1)))
     goto Erreur_Retour;
 */
   values[0]=conf->Timer_delay;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Preview_delay",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Preview_delay",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=conf->Maximize_preview;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Maximize_preview",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Maximize_preview",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Find_file_fast;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Find_file_fast",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Find_file_fast",1,values,0)))
     goto Erreur_Retour;
 
 
-  if ((return_code=Save_INI_reach_group(old_file,new_file,buffer,"[LOADING]")))
+  if ((return_code=Load_INI_reach_group(&ini,"[LOADING]")))
     goto Erreur_Retour;
 
   values[0]=conf->Auto_set_res;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Auto_set_resolution",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Auto_set_resolution",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Set_resolution_according_to;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Set_resolution_according_to",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Set_resolution_according_to",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=conf->Clear_palette;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Clear_palette",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Clear_palette",1,values,1)))
     goto Erreur_Retour;
 
 
-  if ((return_code=Save_INI_reach_group(old_file,new_file,buffer,"[MISCELLANEOUS]")))
+  if ((return_code=Load_INI_reach_group(&ini,"[MISCELLANEOUS]")))
     goto Erreur_Retour;
 
   values[0]=conf->Display_image_limits;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Draw_limits",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Draw_limits",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Adjust_brush_pick;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Adjust_brush_pick",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Adjust_brush_pick",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=2-conf->Coords_rel;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Coordinates",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Coordinates",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=conf->Backup;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Backup",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Backup",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Max_undo_pages;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Undo_pages",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Undo_pages",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=conf->Delay_left_click_on_slider;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Gauges_scrolling_speed_Left",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Gauges_scrolling_speed_Left",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=conf->Delay_right_click_on_slider;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Gauges_scrolling_speed_Right",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Gauges_scrolling_speed_Right",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=conf->Auto_save;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Auto_save",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Auto_save",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Nb_max_vertices_per_polygon;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Vertices_per_polygon",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Vertices_per_polygon",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=conf->Fast_zoom;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Fast_zoom",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Fast_zoom",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Separate_colors;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Separate_colors",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Separate_colors",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->FX_Feedback;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"FX_feedback",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"FX_feedback",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Safety_colors;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Safety_colors",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Safety_colors",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Opening_message;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Opening_message",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Opening_message",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Clear_with_stencil;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Clear_with_stencil",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Clear_with_stencil",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Auto_discontinuous;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Auto_discontinuous",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Auto_discontinuous",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Screen_size_in_GIF;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Save_screen_size_in_GIF",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Save_screen_size_in_GIF",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Auto_nb_used;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Auto_nb_colors_used",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Auto_nb_colors_used",1,values,1)))
     goto Erreur_Retour;
 
-  if ((return_code=Save_INI_set_strings (old_file,new_file,buffer,"Default_video_mode",Mode_label(conf->Default_resolution))))
+  if ((return_code=Save_INI_set_strings (&ini,"Default_video_mode",Mode_label(conf->Default_resolution))))
     goto Erreur_Retour;
 
   if (Default_window_width > 0)
@@ -655,57 +513,57 @@ int Save_INI(const T_Config * conf)
     values[1] = Default_window_height;
   else
     values[1] = Video_mode[0].Height;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Default_window_size",2,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Default_window_size",2,values,0)))
     goto Erreur_Retour;
 
   values[0]=(conf->Mouse_merge_movement);
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Merge_movement",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Merge_movement",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=(conf->Mouse_motion_debounce);
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Mouse_motion_debounce",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Mouse_motion_debounce",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=(conf->Palette_cells_X);
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Palette_cells_X",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Palette_cells_X",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=(conf->Palette_cells_Y);
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Palette_cells_Y",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Palette_cells_Y",1,values,0)))
     goto Erreur_Retour;
 
   for (index=0;index<NB_BOOKMARKS;index++)
   {
-    if ((return_code=Save_INI_set_strings (old_file,new_file,buffer,"Bookmark_label",conf->Bookmark_label[index])))
+    if ((return_code=Save_INI_set_strings (&ini,"Bookmark_label",conf->Bookmark_label[index])))
       goto Erreur_Retour;
-    if ((return_code=Save_INI_set_strings (old_file,new_file,buffer,"Bookmark_directory",conf->Bookmark_directory[index])))
+    if ((return_code=Save_INI_set_strings (&ini,"Bookmark_directory",conf->Bookmark_directory[index])))
       goto Erreur_Retour;
   }
   values[0]=(conf->Palette_vertical);
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Palette_vertical",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Palette_vertical",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Window_pos_x;
   values[1]=conf->Window_pos_y;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Window_position",2,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Window_position",2,values,0)))
     goto Erreur_Retour;
 
   values[0]=(conf->Double_click_speed);
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Double_click_speed",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Double_click_speed",1,values,0)))
     goto Erreur_Retour;
     
   values[0]=(conf->Double_key_speed);
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Double_key_speed",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Double_key_speed",1,values,0)))
     goto Erreur_Retour;
 
-  if ((return_code=Save_INI_set_strings (old_file,new_file,buffer,"Skin_file",conf->Skin_file)))
+  if ((return_code=Save_INI_set_strings (&ini,"Skin_file",conf->Skin_file)))
     goto Erreur_Retour;
     
-  if ((return_code=Save_INI_set_strings (old_file,new_file,buffer,"Font_file",conf->Font_file)))
+  if ((return_code=Save_INI_set_strings (&ini,"Font_file",conf->Font_file)))
     goto Erreur_Retour;
 
   values[0]=(Pixel_ratio);
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Pixel_ratio",1,values,0))) {
+  if ((return_code=Save_INI_set_values (&ini,"Pixel_ratio",1,values,0))) {
     DEBUG("saving pixel ratio",return_code);
     goto Erreur_Retour;
   }
@@ -718,15 +576,15 @@ int Save_INI(const T_Config * conf)
   values[0]=255 ^ values[0];
   // Remaining bits are filled so that when new toolbars get implemented, they will
   // be visible by default.
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Menubars_visible",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Menubars_visible",1,values,0)))
     goto Erreur_Retour;
 
   values[0]=(conf->Right_click_colorpick);
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Right_click_colorpick",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Right_click_colorpick",1,values,1)))
     goto Erreur_Retour;
     
   values[0]=(conf->Sync_views);
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Sync_views",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Sync_views",1,values,1)))
     goto Erreur_Retour;
     
   switch(conf->Swap_buttons)
@@ -740,52 +598,64 @@ int Save_INI(const T_Config * conf)
       default:
         values[0]=0;
   }
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Swap_buttons",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Swap_buttons",1,values,0)))
     goto Erreur_Retour;
   
-  if ((return_code=Save_INI_set_strings (old_file,new_file,buffer,"Scripts_directory",conf->Scripts_directory)))
+  if ((return_code=Save_INI_set_strings (&ini,"Scripts_directory",conf->Scripts_directory)))
       goto Erreur_Retour;
 
   values[0]=(conf->Allow_multi_shortcuts);
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Allow_multi_shortcuts",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Allow_multi_shortcuts",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->Tilemap_allow_flipped_x;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Tilemap_detect_mirrored_x",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Tilemap_detect_mirrored_x",1,values,1)))
     goto Erreur_Retour;
   
   values[0]=conf->Tilemap_allow_flipped_y;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Tilemap_detect_mirrored_y",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Tilemap_detect_mirrored_y",1,values,1)))
     goto Erreur_Retour;
   
   values[0]=conf->Tilemap_show_count;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Tilemap_count",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Tilemap_count",1,values,1)))
     goto Erreur_Retour;
   
   values[0]=conf->Use_virtual_keyboard;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Use_virtual_keyboard",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"Use_virtual_keyboard",1,values,0)))
     goto Erreur_Retour;
   
   values[0]=conf->Default_mode_layers;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"Default_mode_layers",1,values,1)))
+  if ((return_code=Save_INI_set_values (&ini,"Default_mode_layers",1,values,1)))
     goto Erreur_Retour;
 
   values[0]=conf->MOTO_gamma;
-  if ((return_code=Save_INI_set_values (old_file,new_file,buffer,"MOTO_gamma",1,values,0)))
+  if ((return_code=Save_INI_set_values (&ini,"MOTO_gamma",1,values,0)))
+    goto Erreur_Retour;
+
+  values[0]=conf->Compress_undo;
+  if ((return_code=Save_INI_set_values (&ini,"Compress_undo",1,values,1)))
+    goto Erreur_Retour;
+
+  values[0]=conf->Quantizer;
+  if ((return_code=Save_INI_set_values (&ini,"Quantizer",1,values,0)))
+    goto Erreur_Retour;
+
+  values[0]=conf->Dither_24b;
+  if ((return_code=Save_INI_set_values (&ini,"Dither_24b",1,values,1)))
     goto Erreur_Retour;
 
   // Insert new values here
   
-  Save_INI_flush(old_file, new_file, buffer);
+  if ((return_code=Save_INI_write(&ini, new_file)))
+    goto Erreur_Retour;
 
   fclose(new_file);
-  fclose(old_file);
+  Load_INI_free(&ini);
 
   // Remove temporary file <=> old version of .INI
   if (ini_file_exists && temp_filename != NULL)
     remove(temp_filename);
   free(temp_filename);
-  free(buffer);
   return 0;
 
   // Error Handling
@@ -793,7 +663,7 @@ int Save_INI(const T_Config * conf)
 Erreur_Retour:
 
   fclose(new_file);
-  fclose(old_file);
+  Load_INI_free(&ini);
 
   if (ini_file_exists && temp_filename != NULL)
   {
@@ -803,7 +673,6 @@ Erreur_Retour:
     rename(temp_filename, filename);
     free(filename);
   }
-  free(buffer);
   free(temp_filename);
   return return_code;
 }
@@ -39,12 +39,13 @@
 #include "misc.h"
 #include "gfx2log.h"
 #include "io.h"
+#include "gfx2thread.h"
 
 // Update method that does a large number of small rectangles, aiming
 // for a minimum number of total pixels updated.
 #define UPDATE_METHOD_MULTI_RECTANGLE 1
-// Intermediate update method, does only one update with the smallest
-// rectangle that includes all modified pixels.
+// Intermediate update method, gathers the modified pixels in a few
+// rectangles, which are merged when they are close to each other.
 #define UPDATE_METHOD_CUMULATED       2
 // Total screen update, for platforms that impose a Vsync on each SDL update.
 #define UPDATE_METHOD_FULL_PAGE       3
@@ -73,6 +74,12 @@ static SDL_Window * Window_SDL = NULL;
 static SDL_Renderer * Renderer_SDL = NULL;
 static SDL_Texture * Texture_SDL = NULL;
 static SDL_Surface * icon = NULL;
+/// ARGB8888 value of each color of the screen palette
+static Uint32 ARGB_palette[256];
+/// Palette of Screen_SDL when ARGB_palette was computed
+static const SDL_Palette * ARGB_palette_source = NULL;
+/// Version of the palette when ARGB_palette was computed
+static Uint32 ARGB_palette_version = 0;
 #endif
 
 volatile int Allow_colorcycling=1;
@@ -176,6 +183,8 @@ void GFX2_Set_mode(int *width, int *height, int fullscreen)
   if (Screen_SDL != NULL)
     SDL_FreeSurface(Screen_SDL);
   Screen_SDL = SDL_CreateRGBSurface(0, Screen_width * Pixel_width, Screen_height * Pixel_height, 8, 0, 0, 0, 0);
+  // The new texture is empty: the next palette change can't be a partial refresh
+  ARGB_palette_source = NULL;
 #endif
 
   // Trick borrowed to Barrage (http://www.mail-archive.com/debian-bugs-dist@lists.debian.org/msg737265.html) :
@@ -197,12 +206,34 @@ void GFX2_Set_mode(int *width, int *height, int fullscreen)
 }
 
 #if defined(USE_SDL2)
+/// Update ARGB_palette if the screen palette has changed
+static void Update_ARGB_palette(void)
+{
+  const SDL_Palette * palette = Screen_SDL->format->palette;
+  int i;
+
+  if (palette == ARGB_palette_source && palette->version == ARGB_palette_version)
+    return;
+  for (i = 0; i < 256; i++)
+  {
+    if (i < palette->ncolors)
+      ARGB_palette[i] = 0xff000000 | ((Uint32)palette->colors[i].r << 16)
+                      | ((Uint32)palette->colors[i].g << 8) | palette->colors[i].b;
+    else
+      ARGB_palette[i] = 0xff000000;
+  }
+  ARGB_palette_source = palette;
+  ARGB_palette_version = palette->version;
+}
+
+/// Convert the 8bit screen to the ARGB texture.
+/// Each line is translated through ARGB_palette directly into the locked
+/// texture, without going through an intermediate 32bit surface.
 static void GFX2_UpdateRect(int x, int y, int width, int height)
 {
   byte * pixels;
   int pitch;
   int line;
-  static SDL_Surface *RGBcopy = NULL;
   SDL_Rect source_rect;
 
   source_rect.x = x;
@@ -214,30 +245,205 @@ static void GFX2_UpdateRect(int x, int y, int width, int height)
     source_rect.w = width;
     source_rect.h = height;
   }
-
-  if (RGBcopy != NULL && (Screen_SDL->w > RGBcopy->w || Screen_SDL->h > RGBcopy->h))
+  // Clip to the screen, the texture has the same size
+  if (source_rect.x < 0)
+  {
+    source_rect.w += source_rect.x;
+    source_rect.x = 0;
+  }
+  if (source_rect.y < 0)
   {
-    SDL_FreeSurface(RGBcopy);
-    RGBcopy = NULL;
+    source_rect.h += source_rect.y;
+    source_rect.y = 0;
   }
+  if (source_rect.x + source_rect.w > Screen_SDL->w)
+    source_rect.w = Screen_SDL->w - source_rect.x;
+  if (source_rect.y + source_rect.h > Screen_SDL->h)
+    source_rect.h = Screen_SDL->h - source_rect.y;
+  if (source_rect.w <= 0 || source_rect.h <= 0)
+    return;
 
-  if (RGBcopy == NULL)
+  Update_ARGB_palette();
+  // conversion ARGB and upload texture
+  if (SDL_LockTexture(Texture_SDL, &source_rect, (void **)(&pixels), &pitch) < 0)
   {
-    RGBcopy = SDL_CreateRGBSurface(0,
-    Screen_SDL->w, Screen_SDL->h,
-    32, 0, 0, 0, 0);
+    GFX2_Log(GFX2_WARNING, "SDL_LockTexture() failed : %s\n", SDL_GetError());
+    return;
   }
-  // conversion ARGB
-  SDL_BlitSurface(Screen_SDL, &source_rect, RGBcopy, &source_rect);
-  // upload texture
-  SDL_LockTexture(Texture_SDL, &source_rect, (void **)(&pixels), &pitch );
   for (line = 0; line < source_rect.h; line++)
   {
-     memcpy(pixels + line * pitch, (const byte *)RGBcopy->pixels + source_rect.x * 4 + (source_rect.y+line)* RGBcopy->pitch, source_rect.w * 4 );
+    const byte * src = (const byte *)Screen_SDL->pixels + source_rect.x + (source_rect.y + line) * Screen_SDL->pitch;
+    Uint32 * dest = (Uint32 *)(pixels + line * pitch);
+    int count = source_rect.w;
+
+    for (; count >= 4; count -= 4)
+    {
+      dest[0] = ARGB_palette[src[0]];
+      dest[1] = ARGB_palette[src[1]];
+      dest[2] = ARGB_palette[src[2]];
+      dest[3] = ARGB_palette[src[3]];
+      src += 4;
+      dest += 4;
+    }
+    while (count-- > 0)
+      *dest++ = ARGB_palette[*src++];
   }
   SDL_UnlockTexture(Texture_SDL);
 }
 
+/// Lines of the screen scanned together by a thread of Refresh_palette_changes()
+#define PALETTE_REFRESH_BAND 32
+/// Threads are only started when the screen has more pixels than this
+#define PALETTE_REFRESH_THREAD_MIN (640*480)
+/// Modified areas separated by fewer unchanged lines are uploaded together
+#define PALETTE_REFRESH_MERGE_LINES 16
+
+/// Data shared by the threads of Refresh_palette_changes()
+typedef struct
+{
+  const byte * changed;  ///< non-zero for the colors which have a new ARGB value
+  int * line_x1;         ///< first pixel of each line using a changed color, -1 if none
+  int * line_x2;         ///< last pixel of each line using a changed color
+  int next_line;         ///< first line of the next band to scan
+  T_GFX2_lock * lock;
+} T_Palette_refresh_context;
+
+/// First and last changed pixels of each screen line (2 * Palette_refresh_size)
+static int * Palette_refresh_lines = NULL;
+static int Palette_refresh_size = 0;
+
+/// Find the pixels using a changed color in the lines [first, last[
+static void Scan_palette_changes(T_Palette_refresh_context * context, int first, int last)
+{
+  const byte * changed = context->changed;
+  int width = Screen_SDL->w;
+  int line;
+
+  for (line = first; line < last; line++)
+  {
+    const byte * src = (const byte *)Screen_SDL->pixels + line * Screen_SDL->pitch;
+    int x1 = 0;
+    int x2 = width - 1;
+
+    while (x1 < width && !changed[src[x1]])
+      x1++;
+    if (x1 == width)
+    {
+      context->line_x1[line] = -1;
+      continue;
+    }
+    while (!changed[src[x2]])
+      x2--;
+    context->line_x1[line] = x1;
+    context->line_x2[line] = x2;
+  }
+}
+
+static void Scan_palette_changes_worker(void * data)
+{
+  T_Palette_refresh_context * context = (T_Palette_refresh_context *)data;
+
+  for (;;)
+  {
+    int first;
+
+    GFX2_Lock(context->lock);
+    first = context->next_line;
+    context->next_line += PALETTE_REFRESH_BAND;
+    GFX2_Unlock(context->lock);
+    if (first >= Screen_SDL->h)
+      return;
+    Scan_palette_changes(context, first, Min(first + PALETTE_REFRESH_BAND, Screen_SDL->h));
+  }
+}
+
+/// Update the texture after a palette change.
+///
+/// Only the pixels using the colors whose value changed are converted
+/// again and uploaded, so color cycling doesn't redraw the whole screen.
+/// ARGB_palette has to be up to date with the palette before the change.
+/// @return 0 if a full screen update is needed instead
+static int Refresh_palette_changes(void)
+{
+  const SDL_Palette * palette = Screen_SDL->format->palette;
+  T_Palette_refresh_context context;
+  byte changed[256];
+  int nb_changed = 0;
+  int i;
+  int line;
+  int y1 = -1, y2 = 0, x1 = 0, x2 = 0;
+
+  if (Texture_SDL == NULL || palette != ARGB_palette_source)
+    return 0;
+  for (i = 0; i < 256; i++)
+  {
+    Uint32 argb = 0xff000000;
+
+    if (i < palette->ncolors)
+      argb |= ((Uint32)palette->colors[i].r << 16)
+            | ((Uint32)palette->colors[i].g << 8) | palette->colors[i].b;
+    changed[i] = (argb != ARGB_palette[i]);
+    if (changed[i])
+    {
+      ARGB_palette[i] = argb;
+      nb_changed++;
+    }
+  }
+  ARGB_palette_version = palette->version;
+  if (nb_changed == 0)
+    return 1;
+
+  if (Palette_refresh_size < Screen_SDL->h)
+  {
+    int * lines = (int *)realloc(Palette_refresh_lines, 2 * Screen_SDL->h * sizeof(int));
+    if (lines == NULL)
+      return 0;
+    Palette_refresh_lines = lines;
+    Palette_refresh_size = Screen_SDL->h;
+  }
+  context.changed = changed;
+  context.line_x1 = Palette_refresh_lines;
+  context.line_x2 = Palette_refresh_lines + Screen_SDL->h;
+  context.next_line = 0;
+  context.lock = NULL;
+  if ((long)Screen_SDL->w * Screen_SDL->h > PALETTE_REFRESH_THREAD_MIN && GFX2_Thread_count() > 1)
+    context.lock = GFX2_Lock_new();
+  if (context.lock != NULL)
+  {
+    GFX2_Run_threads(GFX2_Thread_count(), Scan_palette_changes_worker, &context);
+    GFX2_Lock_delete(context.lock);
+  }
+  else
+    Scan_palette_changes(&context, 0, Screen_SDL->h);
+
+  // Group the modified lines in rectangles, and upload them
+  for (line = 0; line < Screen_SDL->h; line++)
+  {
+    if (context.line_x1[line] < 0)
+      continue;
+    if (y1 >= 0 && line - y2 > PALETTE_REFRESH_MERGE_LINES)
+    {
+      GFX2_UpdateRect(x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+      y1 = -1;
+    }
+    if (y1 < 0)
+    {
+      y1 = line;
+      x1 = context.line_x1[line];
+      x2 = context.line_x2[line];
+    }
+    else
+    {
+      x1 = Min(x1, context.line_x1[line]);
+      x2 = Max(x2, context.line_x2[line]);
+    }
+    y2 = line;
+  }
+  if (y1 >= 0)
+    GFX2_UpdateRect(x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+  return 1;
+}
+
 void GFX2_UpdateScreen(void)
 {
   SDL_RenderClear(Renderer_SDL);
@@ -247,12 +453,123 @@ void GFX2_UpdateScreen(void)
 #endif
 
 #if (UPDATE_METHOD == UPDATE_METHOD_CUMULATED)
-short Min_X=0;
-short Min_Y=0;
-short Max_X=10000;
-short Max_Y=10000;
+/// Maximum number of separate rectangles updated by Flush_update()
+#define UPDATE_MAX_RECTANGLES 8
+/// Two rectangles are merged when their bounding box adds less than this
+/// area (in screen pixels, before Pixel_width/Pixel_height scaling), or
+/// less than a quarter of their own area.
+#define UPDATE_MERGE_WASTE    1024
+
+/// A modified area of the screen. x2 and y2 are excluded.
+typedef struct
+{
+  int x1, y1;
+  int x2, y2;
+} T_Dirty_rect;
+
+/// The modified areas of the screen, the first update is a full screen one
+static T_Dirty_rect Dirty_rects[UPDATE_MAX_RECTANGLES] = { { 0, 0, 10000, 10000 } };
+static int Nb_dirty_rects = 1;
 short Status_line_dirty_begin=0;
 short Status_line_dirty_end=0;
+
+static long Dirty_rect_area(const T_Dirty_rect * r)
+{
+  return (long)(r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+/// Bounding box of two rectangles
+static void Dirty_rect_union(T_Dirty_rect * result, const T_Dirty_rect * a, const T_Dirty_rect * b)
+{
+  result->x1 = Min(a->x1, b->x1);
+  result->y1 = Min(a->y1, b->y1);
+  result->x2 = Max(a->x2, b->x2);
+  result->y2 = Max(a->y2, b->y2);
+}
+
+/// Area which would be updated for nothing if the two rectangles were merged
+static long Dirty_rect_waste(const T_Dirty_rect * a, const T_Dirty_rect * b)
+{
+  T_Dirty_rect merged;
+  int overlap_w = Min(a->x2, b->x2) - Max(a->x1, b->x1);
+  int overlap_h = Min(a->y2, b->y2) - Max(a->y1, b->y1);
+  long overlap = (overlap_w > 0 && overlap_h > 0) ? (long)overlap_w * overlap_h : 0;
+
+  Dirty_rect_union(&merged, a, b);
+  return Dirty_rect_area(&merged) - (Dirty_rect_area(a) + Dirty_rect_area(b) - overlap);
+}
+
+/// Add a modified area to the list, merging it with the areas close to it.
+static void Add_dirty_rect(int x1, int y1, int x2, int y2)
+{
+  T_Dirty_rect r;
+  int i, j;
+
+  r.x1 = x1;
+  r.y1 = y1;
+  r.x2 = x2;
+  r.y2 = y2;
+  for (;;)
+  {
+    int best_i = 0, best_j = -1;
+    long best_waste = -1;
+
+    i = 0;
+    while (i < Nb_dirty_rects)
+    {
+      long waste = Dirty_rect_waste(&Dirty_rects[i], &r);
+
+      if (waste <= UPDATE_MERGE_WASTE
+       || waste * 4 <= Dirty_rect_area(&Dirty_rects[i]) + Dirty_rect_area(&r))
+      {
+        // The bigger rectangle may now be close to some previous ones
+        Dirty_rect_union(&r, &r, &Dirty_rects[i]);
+        Dirty_rects[i] = Dirty_rects[--Nb_dirty_rects];
+        i = 0;
+      }
+      else
+        i++;
+    }
+    if (Nb_dirty_rects < UPDATE_MAX_RECTANGLES)
+    {
+      Dirty_rects[Nb_dirty_rects++] = r;
+      return;
+    }
+    // The list is full: merge the two rectangles (the new one included)
+    // which waste the least, then try again.
+    for (i = 0; i < Nb_dirty_rects; i++)
+    {
+      long waste = Dirty_rect_waste(&Dirty_rects[i], &r);
+
+      if (best_waste < 0 || waste < best_waste)
+      {
+        best_waste = waste;
+        best_i = i;
+        best_j = -1;
+      }
+      for (j = i + 1; j < Nb_dirty_rects; j++)
+      {
+        waste = Dirty_rect_waste(&Dirty_rects[i], &Dirty_rects[j]);
+        if (waste < best_waste)
+        {
+          best_waste = waste;
+          best_i = i;
+          best_j = j;
+        }
+      }
+    }
+    if (best_j < 0)
+    {
+      Dirty_rect_union(&r, &r, &Dirty_rects[best_i]);
+      Dirty_rects[best_i] = Dirty_rects[--Nb_dirty_rects];
+    }
+    else
+    {
+      Dirty_rect_union(&Dirty_rects[best_i], &Dirty_rects[best_i], &Dirty_rects[best_j]);
+      Dirty_rects[best_j] = Dirty_rects[--Nb_dirty_rects];
+    }
+  }
+}
 #endif
 
 #if (UPDATE_METHOD == UPDATE_METHOD_FULL_PAGE)
@@ -276,25 +593,37 @@ void Flush_update(void)
   }
 #endif
   #if (UPDATE_METHOD == UPDATE_METHOD_CUMULATED)
-  if (Min_X>=Max_X || Min_Y>=Max_Y)
-  {
-    ; // Nothing to do
-  }
-  else
+  int i;
+#if defined(USE_SDL)
+  SDL_Rect rects[UPDATE_MAX_RECTANGLES];
+  int nb_rects = 0;
+#endif
+
+  for (i = 0; i < Nb_dirty_rects; i++)
   {
-    if (Min_X<0)
-      Min_X=0;
-    if (Min_Y<0)
-      Min_Y=0;
+    // Clip to the screen, which may have been resized since
+    int x1 = Max(Dirty_rects[i].x1, 0);
+    int y1 = Max(Dirty_rects[i].y1, 0);
+    int x2 = Min(Dirty_rects[i].x2, Screen_width);
+    int y2 = Min(Dirty_rects[i].y2, Screen_height);
+
+    if (x1 >= x2 || y1 >= y2)
+      continue; // Nothing to do
 #if defined(USE_SDL)
-    SDL_UpdateRect(Screen_SDL, Min_X*Pixel_width, Min_Y*Pixel_height, Min(Screen_width-Min_X, Max_X-Min_X)*Pixel_width, Min(Screen_height-Min_Y, Max_Y-Min_Y)*Pixel_height);
+    rects[nb_rects].x = x1*Pixel_width;
+    rects[nb_rects].y = y1*Pixel_height;
+    rects[nb_rects].w = (x2-x1)*Pixel_width;
+    rects[nb_rects].h = (y2-y1)*Pixel_height;
+    nb_rects++;
 #else
-    GFX2_UpdateRect(Min_X*Pixel_width, Min_Y*Pixel_height, Min(Screen_width-Min_X, Max_X-Min_X)*Pixel_width, Min(Screen_height-Min_Y, Max_Y-Min_Y)*Pixel_height);
+    GFX2_UpdateRect(x1*Pixel_width, y1*Pixel_height, (x2-x1)*Pixel_width, (y2-y1)*Pixel_height);
 #endif
-
-    Min_X=Min_Y=10000;
-    Max_X=Max_Y=0;
   }
+#if defined(USE_SDL)
+  if (nb_rects > 0)
+    SDL_UpdateRects(Screen_SDL, nb_rects, rects);
+#endif
+  Nb_dirty_rects = 0;
   if (Status_line_dirty_end)
   {
 #if defined(USE_SDL)
@@ -323,20 +652,13 @@ void Update_rect(short x, short y, unsigned short width, unsigned short height)
   #if (UPDATE_METHOD == UPDATE_METHOD_CUMULATED)
   if (width==0 || height==0)
   {
-    Min_X=Min_Y=0;
-    Max_X=Max_Y=10000;
+    // Full screen update
+    Dirty_rects[0].x1 = Dirty_rects[0].y1 = 0;
+    Dirty_rects[0].x2 = Dirty_rects[0].y2 = 10000;
+    Nb_dirty_rects = 1;
   }
   else
-  {
-    if (x < Min_X)
-      Min_X = x;
-    if (y < Min_Y)
-      Min_Y = y;
-    if (x+width>Max_X)
-      Max_X=x+width;
-    if (y+height>Max_Y)
-      Max_Y=y+height;
-  }
+    Add_dirty_rect(x, y, x + width, y + height);
   #endif
 
   #if (UPDATE_METHOD == UPDATE_METHOD_FULL_PAGE)
@@ -476,6 +798,9 @@ int GFX2_SetPalette(const T_Components * colors, int firstcolor, int ncolors)
 {
   int i;
   SDL_Color PaletteSDL[256];
+#if defined(USE_SDL2)
+  int up_to_date;
+#endif
 
   for (i = 0; i < ncolors; i++) {
     PaletteSDL[i].r = colors[i].R;
@@ -485,10 +810,13 @@ int GFX2_SetPalette(const T_Components * colors, int firstcolor, int ncolors)
 #if defined(USE_SDL)
   return SDL_SetPalette(Screen_SDL, SDL_PHYSPAL | SDL_LOGPAL, PaletteSDL, firstcolor, ncolors);
 #else
-  // When using SDL2, we need to force screen update so the
-  // 8bit => True color conversion will be performed
+  // When using SDL2, the 8bit => True color conversion has to be performed
+  // again. Only the pixels using the changed colors are converted when
+  // ARGB_palette is up to date, otherwise the whole screen is updated.
+  up_to_date = (Screen_SDL->format->palette == ARGB_palette_source
+             && Screen_SDL->format->palette->version == ARGB_palette_version);
   i = SDL_SetPaletteColors(Screen_SDL->format->palette, PaletteSDL, firstcolor, ncolors);
-  if (i == 0)
+  if (i == 0 && !(up_to_date && Refresh_palette_changes()))
     Update_rect(0, 0, Screen_SDL->w, Screen_SDL->h);
   return i;
 #endif
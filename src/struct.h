@@ -380,6 +380,9 @@ typedef struct
   byte Use_virtual_keyboard;             ///< 0: Auto, 1: On, 2: Off
   byte Default_mode_layers;              ///< Indicates if default new image has layers (alternative is animation)
   byte MOTO_gamma;                       ///< Number, 10 x the Gamma used for converting MO6/TO8/TO9 palette
+  byte Compress_undo;                    ///< Boolean, true to store older Undo/Redo steps as tiles shared between steps.
+  byte Quantizer;                        ///< Color reduction of 24bit pictures, see enum QUANTIZER
+  byte Dither_24b;                       ///< Boolean, true to use Floyd-Steinberg dithering when reducing 24bit pictures
 
 } T_Config;
 
@@ -392,13 +395,13 @@ typedef struct
 
 typedef struct T_Image
 {
-  byte * Pixels;
+  byte * Pixels;  ///< Flat bitmap for the current page and its neighbours, table of shared tiles for older history steps (see pages.c)
   int Duration;
 } T_Image;
 
 /// This is the data for one step of Undo/Redo, for one image.
 /// This structure is resized dynamically to hold pointers to all of the layers in the picture.
-/// The pointed layers are just byte* holding the raw pixel data. But at Image[0]-1 you will find a short that is used as a reference counter for each layer.
+/// The pointed layers are just byte* holding the raw pixel data. But in front of the pixels of each layer you will find a header with a reference counter.
 /// This way we can use the same pixel data in many undo pages when the user edit only one of the layers (which is what they usually do).
 typedef struct T_Page
 {
@@ -85,6 +85,14 @@ void Set_pixel(T_IO_Context *context, short x, short y, byte c)
   }
 }
 
+void Set_pixel_row(T_IO_Context *context, short x, short y, int width, const byte * pixels)
+{
+  int i;
+
+  for (i = 0; i < width && x + i < context->Width; i++)
+    Set_pixel(context, x + i, y, pixels[i]);
+}
+
 void Set_pixel_24b(T_IO_Context *context, short x, short y, byte r, byte g, byte b)
 {
   (void)context;
@@ -0,0 +1,64 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+    Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file testcmdline.c
+/// Unit tests for the command line switches.
+///
+#include <stdio.h>
+#include "tests.h"
+#include "../cmdline.h"
+
+int Test_Find_command_line_switch(char * errmsg)
+{
+  static const struct {
+    const char * arg;
+    int expected;
+  } tests[] = {
+    { "verbose", CMDPARAM_VERBOSE },
+    { "v", CMDPARAM_VERBOSE },    // "convert" contains a 'v' too
+    { "m", CMDPARAM_MODE },       // "gamma" and "format" contain a 'm' too
+    { "mode", CMDPARAM_MODE },
+    { "c", CMDPARAM_CONVERT },
+    { "f", CMDPARAM_FORMAT },
+    { "h", CMDPARAM_HELP },
+    { "tall", CMDPARAM_PIXELRATIO_TALL },
+    { "tall2", CMDPARAM_PIXELRATIO_TALL2 },
+    { "script", CMDPARAM_SCRIPT },
+    { "scripta", CMDPARAM_SCRIPTARG },
+    { "uad", CMDPARAM_PIXELRATIO_QUAD },  // no prefix: any part of the name
+    { "s", -1 },                  // skin, size, script, scriptarg
+    { "t", -1 },                  // tall, triple...
+    { "2", -1 },                  // tall2, wide2
+    { "unknown", -1 },
+    { "", -1 },
+  };
+  unsigned int i;
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+  {
+    int result = Find_command_line_switch(tests[i].arg);
+    if (result != tests[i].expected)
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "Find_command_line_switch(\"%s\") returned %d, expected %d",
+               tests[i].arg, result, tests[i].expected);
+      return 0;
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,243 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+    Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file testfloodfill.c
+/// Unit tests and benchmark for the flood fill.
+///
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tests.h"
+#include "../struct.h"
+#include "../floodfill.h"
+#include "../gfx2log.h"
+
+// random()/srandom() not available with mingw32
+#if defined(WIN32)
+#define random (long)rand
+#endif
+
+#define FILL_TEST_SIZE 512
+
+/**
+ * The multi-pass sweep used by Fill() before the scanline fill :
+ * sweeps the lines up and down, filling the segments of color 1 that
+ * touch a pixel of color 2, until nothing changes.
+ * Kept as a reference for correctness and speed.
+ */
+static void Sweep_fill(byte * pixels, int width, int height, int x, int y)
+{
+  int changes_made = 1;
+  int top = y;
+  int bottom = (y + 1 < height) ? y + 1 : height - 1;
+  int direction = 1;
+
+  pixels[y * width + x] = 2;
+  while (changes_made)
+  {
+    int line, first, last;
+
+    changes_made = 0;
+    if (direction > 0)
+    {
+      first = top;
+      last = bottom;
+    }
+    else
+    {
+      if (top > 0)
+        top--;
+      first = bottom;
+      last = top;
+    }
+    for (line = first; direction > 0 ? line <= last : line >= last; line += direction)
+    {
+      byte * row = pixels + line * width;
+      int line_is_modified = 0;
+      int start_x = 0;
+
+      while (start_x < width)
+      {
+        int end_x, i, can_propagate;
+
+        while (start_x < width && row[start_x] != 1)
+          start_x++;
+        if (start_x >= width)
+          break;
+        for (end_x = start_x + 1; end_x < width && row[end_x] == 1; end_x++)
+          ;
+        can_propagate = (start_x > 0 && row[start_x - 1] == 2)
+                     || (end_x < width && row[end_x] == 2);
+        if (!can_propagate && line - direction >= 0 && line - direction < height)
+          for (i = start_x; i < end_x; i++)
+            if (row[i - direction * width] == 2)
+            {
+              can_propagate = 1;
+              break;
+            }
+        if (can_propagate)
+        {
+          memset(row + start_x, 2, end_x - start_x);
+          changes_made = 1;
+          line_is_modified = 1;
+        }
+        start_x = end_x + 1;
+      }
+      if (line == bottom && direction > 0 && line_is_modified && bottom < height - 1)
+      {
+        bottom++;
+        last++;
+      }
+      if (line == top && direction < 0 && line_is_modified && top > 0)
+      {
+        top--;
+        last--;
+      }
+    }
+    direction = -direction;
+  }
+}
+
+/// A spiral corridor, 1 pixel wide : worst case for the sweep
+static void Draw_spiral(byte * pixels, int size)
+{
+  int left = 0, top = 0, right = size - 1, bottom = size - 1;
+  int x;
+
+  memset(pixels, 0, size * size);
+  while (left <= right && top <= bottom)
+  {
+    for (x = left; x <= right; x++)
+      pixels[top * size + x] = 1;
+    for (x = top; x <= bottom; x++)
+      pixels[x * size + right] = 1;
+    if (bottom - top < 2 || right - left < 2)
+      break;
+    for (x = left; x <= right; x++)
+      pixels[bottom * size + x] = 1;
+    for (x = top + 2; x <= bottom; x++)
+      pixels[x * size + left] = 1;
+    if (left + 2 < size)
+      pixels[(top + 2) * size + left + 1] = 1;
+    left += 2;
+    top += 2;
+    right -= 2;
+    bottom -= 2;
+  }
+}
+
+/// A serpentine corridor (maze-like)
+static void Draw_serpentine(byte * pixels, int size)
+{
+  int y;
+
+  memset(pixels, 0, size * size);
+  for (y = 0; y < size; y += 2)
+  {
+    memset(pixels + y * size, 1, size);
+    if (y + 1 < size)
+      pixels[(y + 1) * size + ((y / 2) & 1 ? 0 : size - 1)] = 1;
+  }
+}
+
+/// Random "dithered" area
+static void Draw_dither(byte * pixels, int size)
+{
+  int i;
+  for (i = 0; i < size * size; i++)
+    pixels[i] = (random() % 100) < 65 ? 1 : 0;
+  pixels[0] = 1;
+}
+
+/**
+ * Tests for Flood_fill() : the result must match the one of the
+ * multi-pass sweep. The time taken by both is logged.
+ */
+int Test_Flood_fill(char * errmsg)
+{
+  static const struct {
+    const char * name;
+    void (*draw)(byte *, int);
+  } shapes[] = {
+    { "spiral", Draw_spiral },
+    { "serpentine", Draw_serpentine },
+    { "dither", Draw_dither },
+  };
+  byte * reference;
+  byte * pixels;
+  unsigned int i;
+  int ok = 1;
+
+  reference = malloc(FILL_TEST_SIZE * FILL_TEST_SIZE);
+  pixels = malloc(FILL_TEST_SIZE * FILL_TEST_SIZE);
+  if (reference == NULL || pixels == NULL)
+  {
+    free(reference);
+    free(pixels);
+    snprintf(errmsg, ERRMSG_LENGTH, "malloc() failed");
+    return 0;
+  }
+  for (i = 0; ok && i < sizeof(shapes) / sizeof(shapes[0]); i++)
+  {
+    clock_t start, sweep_time, span_time;
+    short left, top, right, bottom;
+    int x, y;
+
+    shapes[i].draw(reference, FILL_TEST_SIZE);
+    memcpy(pixels, reference, FILL_TEST_SIZE * FILL_TEST_SIZE);
+
+    start = clock();
+    Sweep_fill(reference, FILL_TEST_SIZE, FILL_TEST_SIZE, 0, 0);
+    sweep_time = clock() - start;
+
+    start = clock();
+    if (Flood_fill(pixels, FILL_TEST_SIZE, 0, 0, FILL_TEST_SIZE - 1, FILL_TEST_SIZE - 1,
+                   0, 0, 1, 2, &left, &top, &right, &bottom) < 0)
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "Flood_fill() failed on %s", shapes[i].name);
+      ok = 0;
+      break;
+    }
+    span_time = clock() - start;
+
+    GFX2_Log(GFX2_INFO, "Flood fill %-10s: sweep %6ldms  scanline %6ldms\n", shapes[i].name,
+             (long)(sweep_time * 1000 / CLOCKS_PER_SEC), (long)(span_time * 1000 / CLOCKS_PER_SEC));
+
+    if (memcmp(pixels, reference, FILL_TEST_SIZE * FILL_TEST_SIZE) != 0)
+    {
+      snprintf(errmsg, ERRMSG_LENGTH, "Flood_fill() differs from the sweep on %s", shapes[i].name);
+      ok = 0;
+      break;
+    }
+    // check the bounding box
+    for (y = 0; ok && y < FILL_TEST_SIZE; y++)
+      for (x = 0; x < FILL_TEST_SIZE; x++)
+        if (pixels[y * FILL_TEST_SIZE + x] == 2 && (x < left || x > right || y < top || y > bottom))
+        {
+          snprintf(errmsg, ERRMSG_LENGTH, "(%d,%d) filled outside of (%d,%d)-(%d,%d) on %s",
+                   x, y, left, top, right, bottom, shapes[i].name);
+          ok = 0;
+          break;
+        }
+  }
+  free(reference);
+  free(pixels);
+  return ok;
+}
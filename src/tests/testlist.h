@@ -8,11 +8,17 @@ TEST(Read_Write_bytes)
 TEST(Realpath)
 TEST(File_exists)
 TEST(Calculate_relative_path)
+TEST(Find_command_line_switch)
 
 TEST(MOTO_MAP_pack)
 TEST(CPC_compare_colors)
 TEST(Packbits)
 TEST(Convert_24b_bitmap_to_256)
+TEST(Convert_24b_bitmap_to_256_Floyd_Steinberg)
+TEST(CT_build_grid)
+TEST(OT_count_box)
+TEST(Quantizers)
+TEST(Flood_fill)
 TEST(Formats)
 TEST(Load)
 TEST(Save)
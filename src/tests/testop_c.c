@@ -27,7 +27,9 @@
 /// Unit tests.
 ///
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include "tests.h"
 #include "../op_c.h"
 #include "../gfx2log.h"
@@ -46,7 +48,7 @@ int Test_Convert_24b_bitmap_to_256(char * msg)
     source[i].G = i;
     source[i].B = i;
   }
-  if (Convert_24b_bitmap_to_256(dest, source, 16, 16, palette) != 0)
+  if (Convert_24b_bitmap_to_256(dest, source, 16, 16, palette, QUANTIZER_MEDIAN_CUT, 0) != 0)
   {
     return 0;
   }
@@ -59,3 +61,346 @@ int Test_Convert_24b_bitmap_to_256(char * msg)
   // TODO: test a real reduction
   return 1;
 }
+
+int Test_Convert_24b_bitmap_to_256_Floyd_Steinberg(char * msg)
+{
+  const int width = 640;
+  const int height = 480;
+  T_Palette palette;
+  T_Components * source;
+  T_Components * copy;
+  byte * dest;
+  byte * dest_threads;
+  CT_Tree * tc;
+  long sum_source[3] = { 0, 0, 0 };
+  long sum_dest[3] = { 0, 0, 0 };
+  long i;
+  int x, y, c;
+  int ok = 0;
+
+  source = (T_Components *)malloc(width * height * sizeof(T_Components));
+  copy = (T_Components *)malloc(width * height * sizeof(T_Components));
+  dest = (byte *)malloc(width * height);
+  dest_threads = (byte *)malloc(width * height);
+  if (source == NULL || copy == NULL || dest == NULL || dest_threads == NULL)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "Failed to allocate memory");
+    goto end;
+  }
+  for (y = 0; y < height; y++)
+  {
+    for (x = 0; x < width; x++)
+    {
+      source[y * width + x].R = x * 255 / (width - 1);
+      source[y * width + x].G = y * 255 / (height - 1);
+      source[y * width + x].B = (x + y) & 255;
+    }
+  }
+  memcpy(copy, source, width * height * sizeof(T_Components));
+  tc = Optimize_palette(source, width * height, palette, 5, 5, 5);
+  if (tc == NULL)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "Optimize_palette() failed");
+    goto end;
+  }
+  Convert_24b_bitmap_to_256_Floyd_Steinberg(dest, source, width, height, palette, tc, 1);
+  Convert_24b_bitmap_to_256_Floyd_Steinberg(dest_threads, source, width, height, palette, tc, 4);
+  CT_delete(tc);
+  if (memcmp(copy, source, width * height * sizeof(T_Components)) != 0)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "Source picture was modified");
+    goto end;
+  }
+  // The result doesn't depend on the number of threads
+  if (memcmp(dest, dest_threads, width * height) != 0)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "The result differs with 1 and 4 threads");
+    goto end;
+  }
+  // The dithering must keep the average color of the picture
+  for (i = 0; i < (long)width * height; i++)
+  {
+    sum_source[0] += source[i].R;
+    sum_source[1] += source[i].G;
+    sum_source[2] += source[i].B;
+    sum_dest[0] += palette[dest[i]].R;
+    sum_dest[1] += palette[dest[i]].G;
+    sum_dest[2] += palette[dest[i]].B;
+  }
+  for (c = 0; c < 3; c++)
+  {
+    long diff = (sum_dest[c] - sum_source[c]) / (width * height);
+    if (diff < -1 || diff > 1)
+    {
+      snprintf(msg, ERRMSG_LENGTH, "Average of component %d is %ld instead of %ld",
+               c, sum_dest[c] / (width * height), sum_source[c] / (width * height));
+      goto end;
+    }
+  }
+  ok = 1;
+end:
+  free(source);
+  free(copy);
+  free(dest);
+  free(dest_threads);
+  return ok;
+}
+
+int Test_CT_build_grid(char * msg)
+{
+  const int size = 256 * 256;
+  T_Palette palette;
+  T_Components * source;
+  CT_Tree * tc;
+  CT_Tree * reference;
+  int bits;
+  int i;
+  int r, g, b;
+  int ok = 0;
+
+  source = (T_Components *)malloc(size * sizeof(T_Components));
+  reference = CT_new();
+  if (source == NULL || reference == NULL)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "Failed to allocate memory");
+    free(source);
+    CT_delete(reference);
+    return 0;
+  }
+  srand(42);
+  for (i = 0; i < size; i++)
+  {
+    source[i].R = rand() & 255;
+    source[i].G = (rand() & 127) + (i >> 9);
+    source[i].B = i & 255;
+  }
+  tc = Optimize_palette(source, size, palette, 5, 5, 5);
+  free(source);
+  if (tc == NULL)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "Optimize_palette() failed");
+    CT_delete(reference);
+    return 0;
+  }
+  // Copy of the tree without grid
+  memcpy(reference, tc, sizeof(CT_Tree));
+  for (bits = 3; bits <= CT_GRID_BITS; bits++)
+  {
+    if (CT_build_grid(tc, bits) != 0)
+    {
+      snprintf(msg, ERRMSG_LENGTH, "CT_build_grid(%d) failed", bits);
+      goto end;
+    }
+    for (r = 0; r < 256; r++)
+      for (g = 0; g < 256; g++)
+        for (b = 0; b < 256; b += 5)
+        {
+          if (CT_get(tc, r, g, b) != CT_get(reference, r, g, b))
+          {
+            snprintf(msg, ERRMSG_LENGTH, "bits=%d (%d,%d,%d) : %d instead of %d",
+                     bits, r, g, b, CT_get(tc, r, g, b), CT_get(reference, r, g, b));
+            goto end;
+          }
+        }
+  }
+  ok = 1;
+end:
+  CT_delete(tc);
+  CT_delete(reference);
+  return ok;
+}
+
+int Test_OT_count_box(char * msg)
+{
+  const int size = 20000;
+  T_Components * source;
+  T_Occurrence_table * to;
+  int i;
+  int ok = 0;
+
+  source = (T_Components *)malloc(size * sizeof(T_Components));
+  to = OT_new(5, 6, 4);
+  if (source == NULL || to == NULL)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "Failed to allocate memory");
+    goto end;
+  }
+  srand(1234);
+  for (i = 0; i < size; i++)
+  {
+    source[i].R = rand() & 255;
+    source[i].G = rand() & 255;
+    source[i].B = rand() % 100;
+  }
+  OT_count_occurrences(to, source, size);
+  if (OT_count_box(to, 0, to->rng_r - 1, 0, to->rng_g - 1, 0, to->rng_b - 1) != size)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "Total count is %d instead of %d",
+             OT_count_box(to, 0, to->rng_r - 1, 0, to->rng_g - 1, 0, to->rng_b - 1), size);
+    goto end;
+  }
+  // Compare random boxes with the sum of the occurrences
+  for (i = 0; i < 1000; i++)
+  {
+    int box[6];
+    int count = 0;
+    int r, g, b;
+
+    box[0] = rand() % to->rng_r;
+    box[1] = box[0] + rand() % (to->rng_r - box[0]);
+    box[2] = rand() % to->rng_g;
+    box[3] = box[2] + rand() % (to->rng_g - box[2]);
+    box[4] = rand() % to->rng_b;
+    box[5] = box[4] + rand() % (to->rng_b - box[4]);
+    for (r = box[0]; r <= box[1]; r++)
+      for (g = box[2]; g <= box[3]; g++)
+        for (b = box[4]; b <= box[5]; b++)
+          count += OT_get(to, r, g, b);
+    if (OT_count_box(to, box[0], box[1], box[2], box[3], box[4], box[5]) != count)
+    {
+      snprintf(msg, ERRMSG_LENGTH, "Box (%d-%d,%d-%d,%d-%d) : %d instead of %d",
+               box[0], box[1], box[2], box[3], box[4], box[5],
+               OT_count_box(to, box[0], box[1], box[2], box[3], box[4], box[5]), count);
+      goto end;
+    }
+  }
+  ok = 1;
+end:
+  free(source);
+  if (to != NULL)
+    OT_delete(to);
+  return ok;
+}
+
+/// Triangle wave, from 0 to 255, with a period of 512
+static int Triangle(int x)
+{
+  x &= 511;
+  return (x < 256) ? x : 511 - x;
+}
+
+/// Draw one of the reference pictures of Test_Quantizers()
+static void Draw_quantizer_picture(T_Components * pixels, int width, int height, int picture)
+{
+  T_Components centers[12];
+  int x, y, i;
+
+  srand(42 + picture);
+  for (i = 0; i < 12; i++)
+  {
+    centers[i].R = rand() & 255;
+    centers[i].G = rand() & 255;
+    centers[i].B = rand() & 255;
+  }
+  for (y = 0; y < height; y++)
+  {
+    for (x = 0; x < width; x++)
+    {
+      T_Components * p = pixels + y * width + x;
+      int r, g, b;
+
+      switch (picture)
+      {
+        case 0: // smooth gradients
+          r = x * 255 / (width - 1);
+          g = y * 255 / (height - 1);
+          b = (x + y) * 255 / (width + height - 2);
+          break;
+        case 1: // "plasma"
+          r = Triangle(x * 3 + Triangle(y * 2));
+          g = Triangle(y * 5 + Triangle(x + y) / 2);
+          b = Triangle((x + 2 * y) * 2 + Triangle(x * 4) / 4);
+          break;
+        case 2: // a few clusters of noisy colors
+          i = ((x / 64) + (y / 48) * 3) % 12;
+          r = centers[i].R + (rand() % 25) - 12;
+          g = centers[i].G + (rand() % 25) - 12;
+          b = centers[i].B + (rand() % 25) - 12;
+          break;
+        default: // "photo": large soft areas with some grain
+          i = ((x / 128) + (y / 96) * 4) % 12;
+          r = centers[i].R * 3 / 4 + x / 16 + (rand() % 17) - 8;
+          g = centers[i].G * 3 / 4 + y / 12 + (rand() % 17) - 8;
+          b = centers[i].B * 3 / 4 + Triangle(x + y) / 8 + (rand() % 17) - 8;
+          break;
+      }
+      p->R = (r < 0) ? 0 : (r > 255) ? 255 : r;
+      p->G = (g < 0) ? 0 : (g > 255) ? 255 : g;
+      p->B = (b < 0) ? 0 : (b > 255) ? 255 : b;
+    }
+  }
+}
+
+/**
+ * Compare the color reductions : time and mean squared error for a few
+ * reference pictures.
+ */
+int Test_Quantizers(char * msg)
+{
+  static const char * const pictures[] = { "gradient", "plasma", "clusters", "photo" };
+  static const char * const names[QUANTIZER_COUNT] = { "median cut", "Wu", "k-means" };
+  const int width = 512;
+  const int height = 384;
+  T_Components * source;
+  byte * dest;
+  int picture;
+  int ok = 0;
+
+  source = (T_Components *)malloc(width * height * sizeof(T_Components));
+  dest = (byte *)malloc(width * height);
+  if (source == NULL || dest == NULL)
+  {
+    snprintf(msg, ERRMSG_LENGTH, "Failed to allocate memory");
+    goto end;
+  }
+  for (picture = 0; picture < (int)(sizeof(pictures) / sizeof(pictures[0])); picture++)
+  {
+    double error[QUANTIZER_COUNT];
+    int quantizer;
+
+    Draw_quantizer_picture(source, width, height, picture);
+    for (quantizer = 0; quantizer < QUANTIZER_COUNT; quantizer++)
+    {
+      T_Palette palette;
+      struct timeval start, end;
+      long duration;
+      double sum = 0;
+      long i;
+
+      gettimeofday(&start, NULL);
+      if (Convert_24b_bitmap_to_256(dest, source, width, height, palette, (enum QUANTIZER)quantizer, 0) != 0)
+      {
+        snprintf(msg, ERRMSG_LENGTH, "%s failed on %s", names[quantizer], pictures[picture]);
+        goto end;
+      }
+      gettimeofday(&end, NULL);
+      // wall clock time, the quantizers may use several threads
+      duration = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+      for (i = 0; i < (long)width * height; i++)
+      {
+        int dr = source[i].R - palette[dest[i]].R;
+        int dg = source[i].G - palette[dest[i]].G;
+        int db = source[i].B - palette[dest[i]].B;
+
+        sum += dr * dr + dg * dg + db * db;
+      }
+      error[quantizer] = sum / ((long)width * height);
+      GFX2_Log(GFX2_INFO, "Quantizer %-10s %-8s: %6ldms  mean squared error %8.2f\n",
+               names[quantizer], pictures[picture],
+               duration, error[quantizer]);
+    }
+    // The refinement never makes the median cut worse, except for the
+    // precision of the lookup grid
+    if (error[QUANTIZER_KMEANS] > error[QUANTIZER_MEDIAN_CUT] * 1.05)
+    {
+      snprintf(msg, ERRMSG_LENGTH, "k-means error %.2f is bigger than median cut error %.2f on %s",
+               error[QUANTIZER_KMEANS], error[QUANTIZER_MEDIAN_CUT], pictures[picture]);
+      goto end;
+    }
+  }
+  ok = 1;
+end:
+  free(source);
+  free(dest);
+  return ok;
+}
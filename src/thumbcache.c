@@ -0,0 +1,436 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file thumbcache.c
+/// Thumbnail cache and background decoding of the file selector previews.
+///
+/// The loaders report their errors through the global File_error and the
+/// preview layout depends on global settings, so they cannot run in a
+/// thread. The background worker is a forked process which decodes the
+/// preview and writes it to the cache, where the file selector picks it up.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(__unix__) || defined(__macosx__) || defined(__HAIKU__)
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#define THUMBNAIL_USE_FORK
+#endif
+
+#include "struct.h"
+#include "global.h"
+#include "io.h"
+#include "loadsave.h"
+#include "thumbcache.h"
+
+#define THUMBNAIL_DIRECTORY "thumbnails"
+#define THUMBNAIL_MAGIC     "GFX2THB"
+#define THUMBNAIL_VERSION   1
+
+/// What identifies a version of a file
+typedef struct
+{
+  dword Size_low;
+  dword Size_high;
+  dword Time_low;
+  dword Time_high;
+} T_File_stamp;
+
+static int Get_file_stamp(const char * full_path, T_File_stamp * stamp)
+{
+  struct stat infos;
+  unsigned long long value;
+
+  if (stat(full_path, &infos) != 0)
+    return -1;
+  value = (unsigned long long)infos.st_size;
+  stamp->Size_low = (dword)value;
+  stamp->Size_high = (dword)(value >> 32);
+  value = (unsigned long long)infos.st_mtime;
+  stamp->Time_low = (dword)value;
+  stamp->Time_high = (dword)(value >> 32);
+  return 0;
+}
+
+/// Name of the cache file for a picture: a FNV-1a hash of its full path.
+static char * Thumbnail_filename(const char * full_path, const char * extension)
+{
+  dword hash = 2166136261u;
+  const byte * p;
+  char name[16];
+  char * directory;
+  char * filename;
+
+  for (p = (const byte *)full_path; *p != '\0'; p++)
+    hash = (hash ^ *p) * 16777619u;
+  snprintf(name, sizeof(name), "%08lx.%s", (unsigned long)hash, extension);
+
+  directory = Filepath_append_to_dir(Config_directory, THUMBNAIL_DIRECTORY);
+  if (directory == NULL)
+    return NULL;
+  filename = Filepath_append_to_dir(directory, name);
+  free(directory);
+  return filename;
+}
+
+/// Write the part of the header which must match for an entry to be valid.
+static int Write_thumbnail_header(FILE * f, const char * full_path, const T_File_stamp * stamp)
+{
+  word length = (word)strlen(full_path);
+
+  return Write_bytes(f, THUMBNAIL_MAGIC, 7)
+      && Write_byte(f, THUMBNAIL_VERSION)
+      && Write_word_le(f, length)
+      && Write_bytes(f, full_path, length)
+      && Write_dword_le(f, stamp->Size_low)
+      && Write_dword_le(f, stamp->Size_high)
+      && Write_dword_le(f, stamp->Time_low)
+      && Write_dword_le(f, stamp->Time_high)
+      && Write_byte(f, Menu_factor_X)
+      && Write_byte(f, Menu_factor_Y)
+      && Write_byte(f, Config.Maximize_preview)
+      && Write_byte(f, (byte)Pixel_ratio);
+}
+
+/// Check that an entry was written for this version of the file and the
+/// current preview settings.
+static int Check_thumbnail_header(FILE * f, const char * full_path, const T_File_stamp * stamp)
+{
+  byte magic[8];
+  word length;
+  dword values[4];
+  byte settings[4];
+  char * path;
+  int i;
+  int ok;
+
+  if (!Read_bytes(f, magic, 8)
+      || memcmp(magic, THUMBNAIL_MAGIC, 7) != 0 || magic[7] != THUMBNAIL_VERSION)
+    return 0;
+  if (!Read_word_le(f, &length) || length != strlen(full_path))
+    return 0;
+  path = malloc(length);
+  if (path == NULL)
+    return 0;
+  ok = Read_bytes(f, path, length) && memcmp(path, full_path, length) == 0;
+  free(path);
+  if (!ok)
+    return 0;
+  for (i = 0; i < 4; i++)
+    if (!Read_dword_le(f, values + i))
+      return 0;
+  if (values[0] != stamp->Size_low || values[1] != stamp->Size_high
+      || values[2] != stamp->Time_low || values[3] != stamp->Time_high)
+    return 0;
+  if (!Read_bytes(f, settings, 4))
+    return 0;
+  return settings[0] == Menu_factor_X
+      && settings[1] == Menu_factor_Y
+      && settings[2] == Config.Maximize_preview
+      && settings[3] == (byte)Pixel_ratio;
+}
+
+/// Read the preview data of an entry into a context.
+static int Read_thumbnail_data(FILE * f, T_IO_Context * context)
+{
+  byte values[6];
+  word sizes[6];
+  dword file_size;
+  byte length;
+  byte has_bitmap;
+  int i;
+
+  if (!Read_bytes(f, values, 6))
+    return 0;
+  context->Format = values[0];
+  context->bpp = values[1];
+  context->Ratio = (enum PIXEL_RATIO)values[2];
+  context->Background_transparent = values[3];
+  context->Transparent_color = values[4];
+  has_bitmap = values[5];
+  for (i = 0; i < 6; i++)
+    if (!Read_word_le(f, sizes + i))
+      return 0;
+  context->Width = (short)sizes[0];
+  context->Height = (short)sizes[1];
+  context->Original_width = (short)sizes[2];
+  context->Original_height = (short)sizes[3];
+  context->Preview_factor_X = (short)sizes[4];
+  context->Preview_factor_Y = (short)sizes[5];
+  if (context->Preview_factor_X < 1 || context->Preview_factor_Y < 1)
+    return 0;
+  if (!Read_dword_le(f, &file_size))
+    return 0;
+  context->File_size = (long)file_size;
+  if (!Read_bytes(f, context->Palette, sizeof(T_Palette))
+      || !Read_bytes(f, context->Preview_usage, sizeof(context->Preview_usage))
+      || !Read_byte(f, &length) || length > COMMENT_SIZE
+      || !Read_bytes(f, context->Comment, length))
+    return 0;
+  context->Comment[length] = '\0';
+
+  if (has_bitmap)
+  {
+    int width, height;
+    int y;
+
+    context->Preview_bitmap = calloc(1, PREVIEW_WIDTH*PREVIEW_HEIGHT*Menu_factor_X*Menu_factor_Y);
+    if (context->Preview_bitmap == NULL)
+      return 0;
+    Get_preview_size(context, &width, &height);
+    if (width > PREVIEW_WIDTH*Menu_factor_X || height > PREVIEW_HEIGHT*Menu_factor_Y)
+      return 0;
+    for (y = 0; y < height; y++)
+      if (!Read_bytes(f, context->Preview_bitmap + y*PREVIEW_WIDTH*Menu_factor_X, width))
+        return 0;
+  }
+  return 1;
+}
+
+/// Open the cache entry of a file, if it is valid.
+/// @return the entry, positioned just after the header, or NULL
+static FILE * Open_thumbnail(const char * file_name, const char * file_directory)
+{
+  T_File_stamp stamp;
+  char * full_path;
+  char * filename;
+  FILE * f = NULL;
+
+  if (Config_directory == NULL || file_name == NULL)
+    return NULL;
+  full_path = Filepath_append_to_dir(file_directory, file_name);
+  if (full_path == NULL)
+    return NULL;
+  if (Get_file_stamp(full_path, &stamp) == 0)
+  {
+    filename = Thumbnail_filename(full_path, "thb");
+    if (filename != NULL)
+    {
+      f = fopen(filename, "rb");
+      if (f != NULL && !Check_thumbnail_header(f, full_path, &stamp))
+      {
+        fclose(f);
+        f = NULL;
+      }
+      free(filename);
+    }
+  }
+  free(full_path);
+  return f;
+}
+
+int Thumbnail_is_cached(const char * file_name, const char * file_directory)
+{
+  FILE * f = Open_thumbnail(file_name, file_directory);
+
+  if (f == NULL)
+    return 0;
+  fclose(f);
+  return 1;
+}
+
+int Thumbnail_cache_load(T_IO_Context * context)
+{
+  T_IO_Context entry;
+  FILE * f;
+  int ok;
+
+  f = Open_thumbnail(context->File_name, context->File_directory);
+  if (f == NULL)
+    return -1;
+  // Work on a copy, so a bad entry leaves the context untouched
+  memcpy(&entry, context, sizeof(T_IO_Context));
+  entry.Preview_bitmap = NULL;
+  ok = Read_thumbnail_data(f, &entry);
+  fclose(f);
+  if (!ok)
+  {
+    free(entry.Preview_bitmap);
+    return -1;
+  }
+  free(context->Preview_bitmap);
+  memcpy(context, &entry, sizeof(T_IO_Context));
+  context->Preview_pos_X = Window_pos_X + 183*Menu_factor_X;
+  context->Preview_pos_Y = Window_pos_Y +  95*Menu_factor_Y;
+  return 0;
+}
+
+void Thumbnail_cache_save(const T_IO_Context * context)
+{
+  T_File_stamp stamp;
+  char * full_path;
+  char * directory;
+  char * filename;
+  char * temp_filename;
+  FILE * f;
+  byte length;
+  int ok;
+
+  if (Config_directory == NULL)
+    return;
+  full_path = Filepath_append_to_dir(context->File_directory, context->File_name);
+  if (full_path == NULL)
+    return;
+  if (strlen(full_path) > 65535 || Get_file_stamp(full_path, &stamp) != 0)
+  {
+    free(full_path);
+    return;
+  }
+  directory = Filepath_append_to_dir(Config_directory, THUMBNAIL_DIRECTORY);
+  if (directory != NULL && !Directory_exists(directory))
+    Directory_create(directory);
+  free(directory);
+
+  filename = Thumbnail_filename(full_path, "thb");
+  temp_filename = Thumbnail_filename(full_path, "tmp");
+  if (filename == NULL || temp_filename == NULL)
+  {
+    free(filename);
+    free(temp_filename);
+    free(full_path);
+    return;
+  }
+
+  // Write to a temporary file first, so an interrupted worker never
+  // leaves a truncated entry behind.
+  f = fopen(temp_filename, "wb");
+  if (f != NULL)
+  {
+    length = (byte)strlen(context->Comment);
+    ok = Write_thumbnail_header(f, full_path, &stamp)
+      && Write_byte(f, context->Format)
+      && Write_byte(f, context->bpp)
+      && Write_byte(f, (byte)context->Ratio)
+      && Write_byte(f, context->Background_transparent)
+      && Write_byte(f, context->Transparent_color)
+      && Write_byte(f, context->Preview_bitmap != NULL)
+      && Write_word_le(f, (word)context->Width)
+      && Write_word_le(f, (word)context->Height)
+      && Write_word_le(f, (word)context->Original_width)
+      && Write_word_le(f, (word)context->Original_height)
+      && Write_word_le(f, (word)context->Preview_factor_X)
+      && Write_word_le(f, (word)context->Preview_factor_Y)
+      && Write_dword_le(f, (dword)context->File_size)
+      && Write_bytes(f, context->Palette, sizeof(T_Palette))
+      && Write_bytes(f, context->Preview_usage, sizeof(context->Preview_usage))
+      && Write_byte(f, length)
+      && Write_bytes(f, context->Comment, length);
+    if (ok && context->Preview_bitmap != NULL)
+    {
+      int width, height;
+      int y;
+
+      Get_preview_size(context, &width, &height);
+      if (width > PREVIEW_WIDTH*Menu_factor_X || height > PREVIEW_HEIGHT*Menu_factor_Y)
+        ok = 0;
+      for (y = 0; ok && y < height; y++)
+        ok = Write_bytes(f, context->Preview_bitmap + y*PREVIEW_WIDTH*Menu_factor_X, width);
+    }
+    if (fclose(f) != 0)
+      ok = 0;
+    remove(filename);
+    if (!ok || rename(temp_filename, filename) != 0)
+      remove(temp_filename);
+  }
+  free(filename);
+  free(temp_filename);
+  free(full_path);
+}
+
+#ifdef THUMBNAIL_USE_FORK
+/// Process id of the background preview worker, 0 if there is none
+static pid_t Worker_pid = 0;
+#endif
+
+int Start_preview_worker(const char * file_name, const char * file_directory, byte format)
+{
+#ifdef THUMBNAIL_USE_FORK
+  pid_t pid;
+
+  Cancel_preview_worker();
+  if (Config_directory == NULL)
+    return -1;
+  fflush(stdout);
+  fflush(stderr);
+  pid = fork();
+  if (pid == 0)
+  {
+    T_IO_Context context;
+
+    // The handlers of the parent would try to save its image
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGABRT, SIG_DFL);
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGFPE, SIG_DFL);
+
+    Init_context_preview(&context, file_name, file_directory);
+    context.Format = format;
+    context.Preview_headless = 1;
+    Load_image(&context);
+    // _exit() : the child must not run the atexit() handlers of the parent
+    _exit(File_error == 0 ? 0 : 1);
+  }
+  if (pid < 0)
+    return -1;
+  Worker_pid = pid;
+  return 0;
+#else
+  (void)file_name;
+  (void)file_directory;
+  (void)format;
+  return -1;
+#endif
+}
+
+int Check_preview_worker(void)
+{
+#ifdef THUMBNAIL_USE_FORK
+  int status;
+  pid_t pid;
+
+  if (Worker_pid == 0)
+    return -1;
+  pid = waitpid(Worker_pid, &status, WNOHANG);
+  if (pid == 0)
+    return 1;
+  Worker_pid = 0;
+  if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    return -1;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+void Cancel_preview_worker(void)
+{
+#ifdef THUMBNAIL_USE_FORK
+  if (Worker_pid != 0)
+  {
+    kill(Worker_pid, SIGKILL);
+    waitpid(Worker_pid, NULL, 0);
+    Worker_pid = 0;
+  }
+#endif
+}
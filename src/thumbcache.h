@@ -0,0 +1,80 @@
+/* vim:expandtab:ts=2 sw=2:
+*/
+/*  Grafx2 - The Ultimate 256-color bitmap paint program
+
+	Copyright owned by various GrafX2 authors, see COPYRIGHT.txt for details.
+
+    Grafx2 is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; version 2
+    of the License.
+
+    Grafx2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Grafx2; if not, see <http://www.gnu.org/licenses/>
+*/
+///@file thumbcache.h
+/// Thumbnail cache and background decoding of the file selector previews.
+
+#ifndef THUMBCACHE_H_INCLUDED
+#define THUMBCACHE_H_INCLUDED
+
+#include "loadsave.h"
+
+/**
+ * Fill a preview context from the thumbnail cache.
+ *
+ * The cache lives in the "thumbnails" sub-directory of the configuration
+ * directory. An entry is only used if the path, the modification time and
+ * the size of the file, as well as the preview layout settings, are the
+ * same as when it was written.
+ *
+ * @param context a CONTEXT_PREVIEW context with File_name and File_directory set
+ * @return 0 if the preview was found in the cache, -1 otherwise
+ */
+int Thumbnail_cache_load(T_IO_Context * context);
+
+/**
+ * Check if the thumbnail cache has a valid entry for a file.
+ * @param file_name, file_directory the file to preview
+ * @return 1 if the preview is in the cache, 0 otherwise
+ */
+int Thumbnail_is_cached(const char * file_name, const char * file_directory);
+
+/**
+ * Store a successfully loaded preview in the thumbnail cache.
+ *
+ * Errors are silently ignored, the cache is only an optimization.
+ * @param context a CONTEXT_PREVIEW context, just after Load_image()
+ */
+void Thumbnail_cache_save(const T_IO_Context * context);
+
+/**
+ * Start decoding a preview in the background.
+ *
+ * The worker loads the file without any display and stores the result
+ * in the thumbnail cache. A worker which is already running is cancelled.
+ *
+ * @param file_name, file_directory the file to preview
+ * @param format the format filter of the file selector
+ * @return 0 if the worker is started
+ * @return -1 if the preview has to be loaded synchronously
+ */
+int Start_preview_worker(const char * file_name, const char * file_directory, byte format);
+
+/**
+ * Check the state of the background worker.
+ * @return 1 while the worker is running
+ * @return 0 when it has finished and the preview is in the cache
+ * @return -1 if it has failed, or if there is no worker
+ */
+int Check_preview_worker(void);
+
+/// Stop the background worker, if there is one running.
+void Cancel_preview_worker(void);
+
+#endif
@@ -171,14 +171,65 @@ int Tile_is_same_flipped_xy(int t1, int t2)
   return 1;
 }
 
+/// Hash of the pixels of a tile, read in the given orientation.
+///
+/// Tile_hash(t1, TILE_FLIPPED_X) == Tile_hash(t2, TILE_FLIPPED_NONE)
+/// when Tile_is_same_flipped_x(t1, t2) (with a FNV-1a hash).
+static dword Tile_hash(int t, enum TILE_FLIPPED flipped)
+{
+  const byte * row;
+  int x_step = 1;
+  long y_step = Main.image_width;
+  dword hash = 2166136261U;
+  int x, y;
+
+  row = Main.backups->Pages->Image[Main.current_layer].Pixels+(TILE_Y(t))*Main.image_width+(TILE_X(t));
+  if (flipped & TILE_FLIPPED_X)
+  {
+    row += Snap_width - 1;
+    x_step = -1;
+  }
+  if (flipped & TILE_FLIPPED_Y)
+  {
+    row += (Snap_height - 1) * y_step;
+    y_step = -y_step;
+  }
+  for (y=0; y < Snap_height; y++, row += y_step)
+  {
+    const byte * pixel = row;
+    for (x=0; x < Snap_width; x++, pixel += x_step)
+      hash = (hash ^ *pixel) * 16777619U;
+  }
+  return hash;
+}
+
+/// Insert a tile in the circular list of a known tile.
+static void Link_tile(int tile, int ref_tile, byte flipped)
+{
+  // Insert at the end. classic doubly-linked-list.
+  int last_tile=Main.tilemap[ref_tile].Previous;
+  Main.tilemap[tile].Previous=last_tile;
+  Main.tilemap[tile].Next=ref_tile;
+  Main.tilemap[tile].Flipped=Main.tilemap[ref_tile].Flipped ^ flipped;
+  Main.tilemap[ref_tile].Previous=tile;
+  Main.tilemap[last_tile].Next=tile;
+}
+
 /// Create or update a tilemap based on current screen (layer)'s pixels.
+///
+/// The unique tiles are kept in a hash table (open addressing) of their
+/// pixels' hash, so each tile is compared only with the tiles
+/// which have the same hash, in each allowed orientation.
 void Tilemap_update(void)
 {
   int width;
   int height;
   int tile;
-  int count=1;
+  int count=0;
   T_Tile * tile_ptr;
+  dword * tile_hash;  // hash of each unique tile
+  int * hash_table;   // index+1 of unique tiles, 0 for free slots
+  dword hash_mask;
   
   int wait_window=0;
   byte old_cursor=0;
@@ -189,17 +240,30 @@ void Tilemap_update(void)
   width=(Main.image_width-Snap_offset_X)/Snap_width;
   height=(Main.image_height-Snap_offset_Y)/Snap_height;
   
-  if (width<1 || height<1 || width*height>1000000l
+  if (width<1 || height<1 || (long)width*height>4000000l
    || (tile_ptr=(T_Tile *)malloc(width*height*sizeof(T_Tile))) == NULL)
   {
     // Cannot enable tilemap because either the image is too small
     // for the grid settings (and I don't want to implement partial tiles)
-    // Or the number of tiles seems unreasonable (one million) : This can
+    // Or the number of tiles seems unreasonable (four million) : This can
     // happen if you set grid 1x1 for example.
   
     Disable_tilemap(&Main);
     return;
   }
+  // the hash table is kept at most half full
+  for (hash_mask=1023; hash_mask < (dword)width*height*2; hash_mask = hash_mask*2+1)
+    ;
+  tile_hash = (dword *)malloc(width*height*sizeof(dword));
+  hash_table = (int *)calloc(hash_mask+1, sizeof(int));
+  if (tile_hash == NULL || hash_table == NULL)
+  {
+    free(tile_hash);
+    free(hash_table);
+    free(tile_ptr);
+    Disable_tilemap(&Main);
+    return;
+  }
   
   if (Main.tilemap)
   {
@@ -212,7 +276,7 @@ void Tilemap_update(void)
   Main.tilemap_width=width;
   Main.tilemap_height=height;
 
-  if (width*height > 1000 || Config.Tilemap_show_count)
+  if (width*height > 100000 || Config.Tilemap_show_count)
   {
     wait_window=1;
     old_cursor=Cursor_shape;
@@ -234,109 +298,71 @@ void Tilemap_update(void)
   
   // Now find similar tiles and link them in circular linked list
   //It will be used to modify all tiles whenever you draw on one.
-  for (tile=1; tile<width*height; tile++)
+  for (tile=0; tile<width*height; tile++)
   {
-    int ref_tile;
-    
-    // Try normal comparison
-    
-    for (ref_tile=0; ref_tile<tile; ref_tile++)
-    {
-      if (Main.tilemap[ref_tile].Previous<=ref_tile && Tile_is_same(ref_tile, tile))
-      {
-        break; // stop loop on ref_tile
-      }
-    }
-    if (ref_tile<tile)
-    {
-      // New occurrence of a known tile
-      // Insert at the end. classic doubly-linked-list.
-      int last_tile=Main.tilemap[ref_tile].Previous;
-      Main.tilemap[tile].Previous=last_tile;
-      Main.tilemap[tile].Next=ref_tile;
-      Main.tilemap[tile].Flipped=Main.tilemap[ref_tile].Flipped;
-      Main.tilemap[ref_tile].Previous=tile;
-      Main.tilemap[last_tile].Next=tile;
-      continue; // next tile
-    }
-    
-    // Try flipped-y comparison
-    if (Config.Tilemap_allow_flipped_y)
-    {
-      for (ref_tile=0; ref_tile<tile; ref_tile++)
-      {
-        if (Main.tilemap[ref_tile].Previous<=ref_tile && Tile_is_same_flipped_y(ref_tile, tile))
-        {
-          break; // stop loop on ref_tile
-        }
-      }
-      if (ref_tile<tile)
-      {
-        // New occurrence of a known tile
-        // Insert at the end. classic doubly-linked-list.
-        int last_tile=Main.tilemap[ref_tile].Previous;
-        Main.tilemap[tile].Previous=last_tile;
-        Main.tilemap[tile].Next=ref_tile;
-        Main.tilemap[tile].Flipped=Main.tilemap[ref_tile].Flipped ^ TILE_FLIPPED_Y;
-        Main.tilemap[ref_tile].Previous=tile;
-        Main.tilemap[last_tile].Next=tile;
-        continue; // next tile
-      }
-    }
+    static const enum TILE_FLIPPED orientations[4] =
+      { TILE_FLIPPED_NONE, TILE_FLIPPED_Y, TILE_FLIPPED_X, TILE_FLIPPED_XY };
+    int i;
+    int ref_tile = -1;
+    dword hash = 0;
+    dword slot;
     
-    // Try flipped-x comparison
-    if (Config.Tilemap_allow_flipped_x)
+    // Try normal comparison, then flipped-y, flipped-x, flipped-xy
+    for (i = 0; i < 4 && ref_tile < 0; i++)
     {
-      for (ref_tile=0; ref_tile<tile; ref_tile++)
+      dword flipped_hash;
+
+      if ((orientations[i] & TILE_FLIPPED_X) && !Config.Tilemap_allow_flipped_x)
+        continue;
+      if ((orientations[i] & TILE_FLIPPED_Y) && !Config.Tilemap_allow_flipped_y)
+        continue;
+      flipped_hash = Tile_hash(tile, orientations[i]);
+      if (i == 0)
+        hash = flipped_hash;
+      for (slot = flipped_hash & hash_mask; hash_table[slot] != 0; slot = (slot + 1) & hash_mask)
       {
-        if (Main.tilemap[ref_tile].Previous<=ref_tile && Tile_is_same_flipped_x(ref_tile, tile))
+        int candidate = hash_table[slot] - 1;
+        int same;
+
+        if (tile_hash[candidate] != flipped_hash)
+          continue;
+        switch (orientations[i])
         {
-          break; // stop loop on ref_tile
+          case TILE_FLIPPED_Y:
+            same = Tile_is_same_flipped_y(candidate, tile);
+            break;
+          case TILE_FLIPPED_X:
+            same = Tile_is_same_flipped_x(candidate, tile);
+            break;
+          case TILE_FLIPPED_XY:
+            same = Tile_is_same_flipped_xy(candidate, tile);
+            break;
+          default:
+            same = Tile_is_same(candidate, tile);
         }
-      }
-      if (ref_tile<tile)
-      {
-        // New occurrence of a known tile
-        // Insert at the end. classic doubly-linked-list.
-        int last_tile=Main.tilemap[ref_tile].Previous;
-        Main.tilemap[tile].Previous=last_tile;
-        Main.tilemap[tile].Next=ref_tile;
-        Main.tilemap[tile].Flipped=Main.tilemap[ref_tile].Flipped ^ TILE_FLIPPED_X;
-        Main.tilemap[ref_tile].Previous=tile;
-        Main.tilemap[last_tile].Next=tile;
-        continue; // next tile
-      }
-    }
-    
-    // Try flipped-xy comparison
-    if (Config.Tilemap_allow_flipped_x && Config.Tilemap_allow_flipped_y)
-    {
-      for (ref_tile=0; ref_tile<tile; ref_tile++)
-      {
-        if (Main.tilemap[ref_tile].Previous<=ref_tile && Tile_is_same_flipped_xy(ref_tile, tile))
+        if (same)
         {
-          break; // stop loop on ref_tile
+          // New occurrence of a known tile
+          Link_tile(tile, candidate, orientations[i]);
+          ref_tile = candidate;
+          break;
         }
       }
-      if (ref_tile<tile)
-      {
-        // New occurrence of a known tile
-        // Insert at the end. classic doubly-linked-list.
-        int last_tile=Main.tilemap[ref_tile].Previous;
-        Main.tilemap[tile].Previous=last_tile;
-        Main.tilemap[tile].Next=ref_tile;
-        Main.tilemap[tile].Flipped=Main.tilemap[ref_tile].Flipped ^ TILE_FLIPPED_XY;
-        Main.tilemap[ref_tile].Previous=tile;
-        Main.tilemap[last_tile].Next=tile;
-        continue; // next tile
-      }
     }
+    if (ref_tile >= 0)
+      continue; // next tile
     
     // This tile is really unique.
-    // Nothing to do at this time: the initialization
-    // has already set the right data for Main.tilemap[tile].
+    // the initialization has already set the right data
+    // for Main.tilemap[tile], just register it in the hash table.
+    for (slot = hash & hash_mask; hash_table[slot] != 0; slot = (slot + 1) & hash_mask)
+      ;
+    hash_table[slot] = tile + 1;
+    tile_hash[tile] = hash;
     count++;
   }
+  free(tile_hash);
+  free(hash_table);
   
   if (wait_window)
   {
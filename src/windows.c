@@ -3099,43 +3099,38 @@ void Display_all_screen(void)
 
 
 
-byte Best_color(byte r,byte g,byte b)
-{
-  int col;
-  int   delta_r,delta_g,delta_b;
-  int   dist;
-  int   best_dist=0x7FFFFFFF;
-  int   rmean;
-  byte  best_color=0;
+/// Number of entries in each cache of nearest color results
+#define BEST_COLOR_CACHE_SIZE 4096
 
-  for (col=0; col<256; col++)
-  {
-    if (!Exclude_color[col])
-    {
-      delta_r=(int)Main.palette[col].R-r;
-      delta_g=(int)Main.palette[col].G-g;
-      delta_b=(int)Main.palette[col].B-b;
-
-      rmean = ( Main.palette[col].R + r ) / 2;
-
-      if (!(dist= ( ( (512+rmean) *delta_r*delta_r) >>8) + 4*delta_g*delta_g + (((767-rmean)*delta_b*delta_b)>>8)))
-      //if (!(dist=(delta_r*delta_r*30)+(delta_g*delta_g*59)+(delta_b*delta_b*11)))
-        return col;
+/// Cache of the results of Best_color() or Best_color_nonexcluded().
+///
+/// It is a direct-mapped table indexed by a hash of the RGB value.
+/// It is flushed when its version differs from Best_color_version,
+/// see Invalidate_best_color_cache().
+typedef struct
+{
+  dword version;      ///< Best_color_version the results were computed for
+  dword key[BEST_COLOR_CACHE_SIZE]; ///< 0x01RRGGBB, 0 for an empty entry
+  byte color[BEST_COLOR_CACHE_SIZE];///< nearest color of the key
+} T_Best_color_cache;
 
-      if (dist<best_dist)
-      {
-        best_dist=dist;
-        best_color=col;
-      }
-    }
-  }
+static T_Best_color_cache Best_color_cache;
+static T_Best_color_cache Best_color_nonexcluded_cache;
+/// Incremented each time Main.palette or ::Exclude_color changes
+static dword Best_color_version = 1;
 
-  return best_color;
+void Invalidate_best_color_cache(void)
+{
+  Best_color_version++;
+  if (Best_color_version == 0)
+    Best_color_version = 1; // 0 is the version of the empty caches
 }
 
-byte Best_color_nonexcluded(byte red,byte green,byte blue)
+/// Linear search of the nearest color of Main.palette,
+/// skipping the colors flagged in excluded (if not NULL).
+static byte Search_best_color(byte r, byte g, byte b, const byte * excluded)
 {
-  int   col;
+  int col;
   int   delta_r,delta_g,delta_b;
   int   dist;
   int   best_dist=0x7FFFFFFF;
@@ -3144,16 +3139,18 @@ byte Best_color_nonexcluded(byte red,byte green,byte blue)
 
   for (col=0; col<256; col++)
   {
-    delta_r=(int)Main.palette[col].R-red;
-    delta_g=(int)Main.palette[col].G-green;
-    delta_b=(int)Main.palette[col].B-blue;
+    if (excluded != NULL && excluded[col])
+      continue;
 
-    if(delta_r == 0 && delta_g == 0 && delta_b == 0) return col;
+    delta_r=(int)Main.palette[col].R-r;
+    delta_g=(int)Main.palette[col].G-g;
+    delta_b=(int)Main.palette[col].B-b;
 
-    rmean = ( Main.palette[col].R + red ) / 2;
+    rmean = ( Main.palette[col].R + r ) / 2;
 
-    dist= ( ( (512+rmean) *delta_r*delta_r) >>8) + 4*delta_g*delta_g + (((767-rmean)*delta_b*delta_b)>>8);
-    //dist=(delta_r*delta_r*30)+(delta_g*delta_g*59)+(delta_b*delta_b*11)
+    if (!(dist= ( ( (512+rmean) *delta_r*delta_r) >>8) + 4*delta_g*delta_g + (((767-rmean)*delta_b*delta_b)>>8)))
+    //if (!(dist=(delta_r*delta_r*30)+(delta_g*delta_g*59)+(delta_b*delta_b*11)))
+      return col;
 
     if (dist<best_dist)
     {
@@ -3161,9 +3158,39 @@ byte Best_color_nonexcluded(byte red,byte green,byte blue)
       best_color=col;
     }
   }
+
   return best_color;
 }
 
+/// Look up the cache, and fill it with Search_best_color() if needed.
+static byte Cached_best_color(T_Best_color_cache * cache, byte r, byte g, byte b, const byte * excluded)
+{
+  dword key = 0x01000000 | ((dword)r << 16) | ((dword)g << 8) | b;
+  dword index = (dword)(key * 2654435761U) >> 20; // 12 bits hash
+
+  if (cache->version != Best_color_version)
+  {
+    cache->version = Best_color_version;
+    memset(cache->key, 0, sizeof(cache->key));
+  }
+  if (cache->key[index] != key)
+  {
+    cache->key[index] = key;
+    cache->color[index] = Search_best_color(r, g, b, excluded);
+  }
+  return cache->color[index];
+}
+
+byte Best_color(byte r,byte g,byte b)
+{
+  return Cached_best_color(&Best_color_cache, r, g, b, Exclude_color);
+}
+
+byte Best_color_nonexcluded(byte red,byte green,byte blue)
+{
+  return Cached_best_color(&Best_color_nonexcluded_cache, red, green, blue, NULL);
+}
+
 byte Best_color_range(byte r, byte g, byte b, byte max)
 {
 
@@ -115,6 +115,10 @@ byte Best_color_nonexcluded(byte red,byte green,byte blue);
 byte Best_color_range(byte red,byte green,byte blue,byte max);
 byte Best_color_perceptual(byte r,byte g,byte b);
 byte Best_color_perceptual_except(byte r,byte g,byte b, byte except);
+/// Forget the results cached by Best_color() and Best_color_nonexcluded().
+/// It has to be called after each modification of Main.palette or
+/// ::Exclude_color.
+void Invalidate_best_color_cache(void);
 
 void Horizontal_XOR_line_zoom(short x_pos, short y_pos, short width);
 void Vertical_XOR_line_zoom(short x_pos, short y_pos, short height);